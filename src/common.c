@@ -21,3 +21,9 @@
 #include "common.h"
 
 enum ProgFlags flags;
+enum Durability durability = DurabilityFull;
+unsigned int hashJobs = 1;
+enum HashRead hashRead = HashReadStream;
+enum HashIo hashIo = HashIoRead;
+int hashCacheCreate = 0;
+unsigned int hashBufferSize = 0; // 0 means the default size of the hashing buffer
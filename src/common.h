@@ -31,11 +31,47 @@ enum ProgFlags
 	PropFlag = 16,
 	RecurFlag = 32,
 	VersionFlag = 64,
-	MoveFileFlag = 128
+	MoveFileFlag = 128,
+	FormatFlag = 256,
+	OffsetIndexFlag = 512,
+	JournalFlag = 1024,
+	CompactFlag = 2048,
+	InvertedIndexFlag = 4096,
+	ExplainFlag = 8192,
+	HashFlag = 16384
+};
+
+enum Durability
+{
+	DurabilityNone = 0, // the changes are left to the page cache
+	DurabilityFile = 1, // the data of the new index file is synced before it is published
+	DurabilityFull = 2  // the directory is synced after the rename as well
+};
+
+enum HashRead
+{
+	HashReadStream = 0, // the files are read into an aligned buffer
+	HashReadMmap   = 1  // the files are mapped and hashed in place
+};
+
+enum HashIo
+{
+	HashIoRead  = 0, // every worker reads its file by blocking calls
+	HashIoUring = 1  // every worker keeps the reads of several files in flight through io_uring
 };
 
 extern enum ProgFlags flags;
+extern enum Durability durability;
+extern unsigned int hashJobs;
+extern enum HashRead hashRead;
+extern enum HashIo hashIo;
+extern int hashCacheCreate;
+extern unsigned int hashBufferSize;
 
-#define FILE_HASH_LEN 40
+#define FILE_HASH_LEN 64   // the hex form of the longest hash
+#define FILE_HASH_SIZE 32  // the longest hash, a shorter one is padded by zeros
+#define HASH_JOBS_MAX  256
+#define HASH_BUFFER_MIN 4096
+#define HASH_BUFFER_MAX (256 * 1024 * 1024)
 
 #endif // COMMON_H
@@ -0,0 +1,274 @@
+/*
+ * digest.c
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include "sha1x86.h"
+#endif
+
+#include "digest.h"
+
+static uint64_t loadBE64(const unsigned char *p);
+static int  hexValue(char ch);
+static void encodeScalar(const unsigned char *src, size_t len, char *dst);
+static int  decodeScalar(const char *src, size_t len, unsigned char *dst);
+static int  hasAvx2(void);
+#ifdef __SSE2__
+static void encode16(const unsigned char *src, char *dst);
+static int  decode16(const char *src, unsigned char *dst);
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+static void encode16Avx2(const unsigned char *src, char *dst);
+static int  decode16Avx2(const char *src, unsigned char *dst);
+#endif
+
+int _digestAvx2 = -1;  // the AVX2 kernels are used, -1 until the processor is asked
+
+int digestCompare(const unsigned char *digest1, const unsigned char *digest2)
+{
+	// Compares as memcmp does, by big-endian words
+	int i;
+	for (i = 0; i < FILE_HASH_SIZE; i += 8)
+	{
+		uint64_t w1 = loadBE64(digest1 + i);
+		uint64_t w2 = loadBE64(digest2 + i);
+		if (w1 != w2)
+			return (w1 < w2) ? -1 : 1;
+	}
+	return 0;
+}
+
+int digestIsEqual(const unsigned char *digest1, const unsigned char *digest2)
+{
+	uint64_t diff = 0;
+	int i;
+	for (i = 0; i < FILE_HASH_SIZE; i += 8)
+	{
+		uint64_t w1, w2;
+		memcpy(&w1, digest1 + i, 8);
+		memcpy(&w2, digest2 + i, 8);
+		diff |= w1 ^ w2;
+	}
+	return diff == 0;
+}
+
+void digestToHex(const unsigned char *digest, unsigned int size, char *hex)
+{
+	// Writes size * 2 lowercase characters and the terminating zero
+	unsigned int pos = 0;
+#if defined(__x86_64__) || defined(__i386__)
+	if (hasAvx2())
+		for ( ; pos + 16 <= size; pos += 16)
+			encode16Avx2(digest + pos, hex + pos * 2);
+#endif
+#ifdef __SSE2__
+	for ( ; pos + 16 <= size; pos += 16)
+		encode16(digest + pos, hex + pos * 2);
+#endif
+	encodeScalar(digest + pos, size - pos, hex + pos * 2);
+	hex[size * 2] = '\0';
+}
+
+int digestFromHex(const char *hex, unsigned int size, unsigned char *digest)
+{
+	// Reads exactly size * 2 characters of either case, the rest of FILE_HASH_SIZE bytes is zeroed
+	unsigned int pos = 0;
+#if defined(__x86_64__) || defined(__i386__)
+	if (hasAvx2())
+		for ( ; pos + 16 <= size; pos += 16)
+			if (decode16Avx2(hex + pos * 2, digest + pos) != EXIT_SUCCESS)
+				return EXIT_FAILURE;
+#endif
+#ifdef __SSE2__
+	for ( ; pos + 16 <= size; pos += 16)
+		if (decode16(hex + pos * 2, digest + pos) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+#endif
+	if (decodeScalar(hex + pos * 2, size - pos, digest + pos) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	memset(digest + size, 0, FILE_HASH_SIZE - size);
+	return EXIT_SUCCESS;
+}
+
+/**************************** Private ********************************/
+
+static uint64_t loadBE64(const unsigned char *p)
+{
+	uint64_t w;
+	memcpy(&w, p, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	w = __builtin_bswap64(w);
+#endif
+	return w;
+}
+
+static int hexValue(char ch)
+{
+	if (ch >= '0' && ch <= '9')
+		return ch - '0';
+	ch |= 0x20;
+	if (ch >= 'a' && ch <= 'f')
+		return ch - 'a' + 10;
+	return -1;
+}
+
+static void encodeScalar(const unsigned char *src, size_t len, char *dst)
+{
+	static const char digits[] = "0123456789abcdef";
+	while (len-- != 0)
+	{
+		*dst++ = digits[*src >> 4];
+		*dst++ = digits[*src & 15];
+		++src;
+	}
+}
+
+static int decodeScalar(const char *src, size_t len, unsigned char *dst)
+{
+	while (len-- != 0)
+	{
+		int hi = hexValue(src[0]);
+		int lo = hexValue(src[1]);
+		if (hi < 0 || lo < 0)
+			return EXIT_FAILURE;
+		*dst++ = (hi << 4) | lo;
+		src += 2;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int hasAvx2(void)
+{
+	// Asked once, the tests set _digestAvx2 to take either kernel
+	int has = __atomic_load_n(&_digestAvx2, __ATOMIC_RELAXED);
+	if (has < 0)
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		has = sha1x86Supported(SHA1BackendAvx2);
+#else
+		has = 0;
+#endif
+		__atomic_store_n(&_digestAvx2, has, __ATOMIC_RELAXED);
+	}
+	return has;
+}
+
+#ifdef __SSE2__
+
+static __m128i nibblesToHex(__m128i nib)
+{
+	// '0' + n, plus the distance to 'a' for n > 9
+	__m128i alpha = _mm_cmpgt_epi8(nib, _mm_set1_epi8(9));
+	nib = _mm_add_epi8(nib, _mm_set1_epi8('0'));
+	return _mm_add_epi8(nib, _mm_and_si128(alpha, _mm_set1_epi8('a' - '0' - 10)));
+}
+
+static __m128i hexToNibbles(__m128i chr, int *valid)
+{
+	// Both ranges are checked by unsigned saturation: x <= n when x -sat n is zero
+	__m128i zero  = _mm_setzero_si128();
+	__m128i dig   = _mm_sub_epi8(chr, _mm_set1_epi8('0'));
+	__m128i alp   = _mm_sub_epi8(_mm_or_si128(chr, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+	__m128i isDig = _mm_cmpeq_epi8(_mm_subs_epu8(dig, _mm_set1_epi8(9)), zero);
+	__m128i isAlp = _mm_cmpeq_epi8(_mm_subs_epu8(alp, _mm_set1_epi8(5)), zero);
+	*valid = _mm_movemask_epi8(_mm_or_si128(isDig, isAlp)) == 0xffff;
+	alp = _mm_add_epi8(alp, _mm_set1_epi8(10));
+	return _mm_or_si128(_mm_and_si128(isDig, dig), _mm_and_si128(isAlp, alp));
+}
+
+static void encode16(const unsigned char *src, char *dst)
+{
+	__m128i v  = _mm_loadu_si128((const __m128i *)src);
+	__m128i mk = _mm_set1_epi8(0x0f);
+	__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mk);
+	__m128i lo = _mm_and_si128(v, mk);
+	_mm_storeu_si128((__m128i *)dst, nibblesToHex(_mm_unpacklo_epi8(hi, lo)));
+	_mm_storeu_si128((__m128i *)(dst + 16), nibblesToHex(_mm_unpackhi_epi8(hi, lo)));
+}
+
+static int decode16(const char *src, unsigned char *dst)
+{
+	// A pair of nibbles is a word with the high nibble in its low byte
+	int valid1, valid2;
+	__m128i n1 = hexToNibbles(_mm_loadu_si128((const __m128i *)src), &valid1);
+	__m128i n2 = hexToNibbles(_mm_loadu_si128((const __m128i *)(src + 16)), &valid2);
+	if (!valid1 || !valid2)
+		return EXIT_FAILURE;
+	__m128i mk = _mm_set1_epi16(0xff);
+	n1 = _mm_and_si128(_mm_or_si128(_mm_slli_epi16(n1, 4), _mm_srli_epi16(n1, 8)), mk);
+	n2 = _mm_and_si128(_mm_or_si128(_mm_slli_epi16(n2, 4), _mm_srli_epi16(n2, 8)), mk);
+	_mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(n1, n2));
+	return EXIT_SUCCESS;
+}
+
+#endif // __SSE2__
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("avx2")))
+static __m256i nibblesToHexAvx2(__m256i nib)
+{
+	// '0' + n, plus the distance to 'a' for n > 9
+	__m256i alpha = _mm256_cmpgt_epi8(nib, _mm256_set1_epi8(9));
+	nib = _mm256_add_epi8(nib, _mm256_set1_epi8('0'));
+	return _mm256_add_epi8(nib, _mm256_and_si256(alpha, _mm256_set1_epi8('a' - '0' - 10)));
+}
+
+__attribute__((target("avx2")))
+static __m256i hexToNibblesAvx2(__m256i chr, int *valid)
+{
+	// Both ranges are checked by unsigned saturation: x <= n when x -sat n is zero
+	__m256i zero  = _mm256_setzero_si256();
+	__m256i dig   = _mm256_sub_epi8(chr, _mm256_set1_epi8('0'));
+	__m256i alp   = _mm256_sub_epi8(_mm256_or_si256(chr, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+	__m256i isDig = _mm256_cmpeq_epi8(_mm256_subs_epu8(dig, _mm256_set1_epi8(9)), zero);
+	__m256i isAlp = _mm256_cmpeq_epi8(_mm256_subs_epu8(alp, _mm256_set1_epi8(5)), zero);
+	*valid = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(isDig, isAlp)) == 0xffffffffu;
+	alp = _mm256_add_epi8(alp, _mm256_set1_epi8(10));
+	return _mm256_or_si256(_mm256_and_si256(isDig, dig), _mm256_and_si256(isAlp, alp));
+}
+
+__attribute__((target("avx2")))
+static void encode16Avx2(const unsigned char *src, char *dst)
+{
+	// Every byte is widened to a word holding the high nibble in the low byte and the low nibble in the high byte
+	__m256i w = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)src));
+	__m256i n = _mm256_or_si256(_mm256_srli_epi16(w, 4), _mm256_slli_epi16(_mm256_and_si256(w, _mm256_set1_epi16(0x0f)), 8));
+	_mm256_storeu_si256((__m256i *)dst, nibblesToHexAvx2(n));
+}
+
+__attribute__((target("avx2")))
+static int decode16Avx2(const char *src, unsigned char *dst)
+{
+	int valid;
+	__m256i n = hexToNibblesAvx2(_mm256_loadu_si256((const __m256i *)src), &valid);
+	if (!valid)
+		return EXIT_FAILURE;
+	__m256i b = _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi16(n, 4), _mm256_srli_epi16(n, 8)), _mm256_set1_epi16(0xff));
+	b = _mm256_permute4x64_epi64(_mm256_packus_epi16(b, b), 0x08);
+	_mm_storeu_si128((__m128i *)dst, _mm256_castsi256_si128(b));
+	return EXIT_SUCCESS;
+}
+
+#endif // __x86_64__ || __i386__
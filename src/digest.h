@@ -0,0 +1,38 @@
+/*
+ * digest.h
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include "common.h"
+
+/*
+ * Content digests are kept as FILE_HASH_SIZE raw bytes, the hex form (two lowercase characters
+ * for every byte of the hash) appears only at the text boundary: the headers of the simple format
+ * and the messages. The order of digests is the order of memcmp, the comparison loads four
+ * 64-bit words. A hash shorter than FILE_HASH_SIZE is padded by zeros, so it compares by its bytes.
+ */
+
+int  digestCompare(const unsigned char *digest1, const unsigned char *digest2);
+int  digestIsEqual(const unsigned char *digest1, const unsigned char *digest2);
+void digestToHex(const unsigned char *digest, unsigned int size, char *hex);
+int  digestFromHex(const char *hex, unsigned int size, unsigned char *digest);
+
+#endif // DIGEST_H
@@ -154,12 +154,12 @@ int fieldsPrintRow(const struct FieldListStruct *fields, const struct ItemStruct
 		{
 			if (i == cnt)
 			{
-				if (fputwc(L'\n', fd) != WEOF)
+				if (fputc('\n', fd) != EOF)
 					res = EXIT_SUCCESS;
 				break;
 			}
 
-			if (i != 0 && fputwc(L'\t', fd) == WEOF)
+			if (i != 0 && fputc('\t', fd) == EOF)
 				break;
 
 			struct FieldStruct *fld = fields->columns[i];
@@ -170,12 +170,12 @@ int fieldsPrintRow(const struct FieldListStruct *fields, const struct ItemStruct
 					return EXIT_FAILURE;
 				if (wcslen(pVal) == 0)
 					pVal = L"-";
-				if (fld->type == FileName && baseDir[0] != L'\0' && fputws(baseDir, fd) == EOF)
+				if (fld->type == FileName && baseDir[0] != L'\0' && utf8Fputs(baseDir, fd) == EOF)
 					break;
-				if (fputws(pVal, fd) == EOF)
+				if (utf8Fputs(pVal, fd) == EOF)
 					break;
 			}
-			else if (fputwc(L'-', fd) == WEOF)
+			else if (fputc('-', fd) == EOF)
 				break;
 		}
 		if (res != EXIT_SUCCESS)
@@ -23,27 +23,109 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <fnmatch.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
 
 #include "file.h"
-#include "sha1.h"
+#include "digest.h"
+#include "hashcache.h"
+#include "hashalg.h"
+#include "sha1mb.h"
+#include "uring.h"
+#include "utils.h"
 
-#define FILES_INCREASE    10
+#define FILES_INCREASE    16
+#define FILE_SMALL_SIZE   65536  // the files up to it are read whole and hashed together
+#define FILE_BATCH_COUNT  (SHA1MB_LANES * 2)
+#define FILE_READ_BUFFER  (1024 * 1024)  // the default size of the hashing buffer
+#define FILE_DROP_WINDOW  (8 * 1024 * 1024)  // the hashed pages are dropped from the page cache by these parts
+#define FILE_URING_DEPTH  16   // the files read at once by an io_uring worker
+#define FILE_URING_CHUNK  (128 * 1024)
+#define FILE_TREE_WINDOW  1024  // the chunks of a tree hash whose leaves are kept at once
+
+enum FileHashState { HashPending, HashCached, HashDone };
+
+struct FileHashResult
+{
+	enum ErrorId    res;
+	int             err;  // errno of the failure
+	enum FileHashState state;
+	int             keyed;  // key holds the identity of the file, taken before it is read
+	struct HashCacheKey key;
+};
+
+struct FileHashJob
+{
+	enum HashAlg    alg;
+	struct FileItem **list;
+	unsigned int    count;    // positions in the list up to the last item
+	unsigned int    next;     // the next position to take
+	unsigned int    failPos;  // the lowest failed position, count if there is none
+	struct FileHashResult *results;
+};
+
+struct FileUringSlot
+{
+	struct FileItem *fi;   // NULL if the slot is free
+	unsigned int    pos;
+	int             fd;
+	off64_t         offset;  // of the read in flight
+	unsigned int    buffer;  // the half of the slot buffer it reads into
+	struct HashAlgCtx ctx;
+};
+
+struct FileTreeJob
+{
+	int             fd;
+	enum HashAlg    alg;
+	off64_t         start;  // of the first chunk
+	uint64_t        first;  // the first chunk of the window
+	uint64_t        next;   // the next chunk to take
+	uint64_t        end;    // the chunk after the window
+	int             err;    // errno of a failure, 0 if there is none
+	unsigned char   (*leaves)[FILE_HASH_SIZE];  // of the window
+};
+
+struct FileHashBatch
+{
+	unsigned int    count;
+	struct Sha1mbJob jobs[FILE_BATCH_COUNT];
+	unsigned char   *buffer;  // FILE_SMALL_SIZE bytes for every job
+};
 
 int fileFilter(const struct dirent64 *ent);
 int cmpsizefi(const void *fi1, const void *fi2);
 int cmpsizehashfi(const void *fi1, const void *fi2);
 int cmpfilepath(const void *fi1, const void *fi2);
 
-void fileitemsFreeList(struct FileItem **list, unsigned int cnt);
 int  fileitemsInsertItem(struct FileItemList *fil, struct FileItem *fi, enum FileItemMask mask);
 void fileitemsPackItems(struct FileItemList *fil);
 void fileitemsPackList(struct FileItem **list, unsigned int cnt);
 void fileitemsRemoveDuplicates(struct FileItemList *fil);
+enum ErrorId fileitemsHashItem(struct FileItem *fi, enum HashAlg alg, int *err);
+enum ErrorId fileitemsReadSmall(struct FileItem *fi, struct FileHashBatch *batch, int *err);
+void *fileitemsHashWorker(void *arg);
+void *fileitemsUringWorker(void *arg);
+int  fileitemsNextPosition(struct FileHashJob *job, unsigned int *pos);
+unsigned int fileitemsLookupHashes(struct FileHashJob *job, struct HashCache *cache);
+void fileitemsHashFailed(struct FileHashJob *job, unsigned int pos, enum ErrorId res, int err);
+size_t fileReadBufferSize(const struct stat64 *st, off64_t start);
+int  fileHashMapped(int fd, const struct stat64 *st, off64_t start, size_t chunk, struct HashAlgCtx *ctx);
+void fileDropCache(int fd, off64_t start, off64_t end);
+int  fileHashFd(int fd, enum HashAlg alg, unsigned char hash[FILE_HASH_SIZE], int counted);
+int  fileHashChunks(int fd, const struct stat64 *st, off64_t *start, struct HashAlgCtx *ctx, int counted);
+void *fileTreeWorker(void *arg);
+unsigned int fileTakeTreeThreads(uint64_t helpers, int counted);
 
 const char *_pattern;
+unsigned int _hashThreads = 0;  // the file workers and the helpers hashing the chunks, the helpers keep it to hashJobs
 
-enum ErrorId fileInfo(const char *fileName, size_t *size, wchar_t *hash, int sizeHash)
+enum ErrorId fileInfo(const char *fileName, size_t *size)
 {
 	struct stat64 fstat;
 	if (stat64(fileName, &fstat) == -1)
@@ -59,31 +141,9 @@ enum ErrorId fileInfo(const char *fileName, size_t *size, wchar_t *hash, int siz
 	if (fstat.st_size == 0)
 		return ErrorFileIsEmpty;
 
-	enum ErrorId res = ErrorNone;
 	if (size != NULL)
 		*size = fstat.st_size;
-	if (hash != NULL)
-	{
-		FILE *fd = fopen64(fileName, "r");
-		if (fd != NULL)
-		{
-			if (sizeHash > FILE_HASH_LEN)
-			{
-				char sHash[FILE_HASH_LEN + 1];
-				if (sha1file(fd, sHash) != EXIT_SUCCESS)
-					res = ErrorOther;
-				mbstowcs(hash, sHash, FILE_HASH_LEN);
-				hash[FILE_HASH_LEN] = L'\0';
-			}
-			else
-				res = ErrorInternal;
-			fclose(fd);
-		}
-		else
-			res = ErrorOther;
-	}
-
-	return res;
+	return ErrorNone;
 }
 
 void fileInfoError(const char *fileName, enum ErrorId err)
@@ -174,12 +234,13 @@ struct FileItemList *fileitemsInitFromList(char **filesArray, unsigned int files
 		fil->dirsCount = 0;
 		fil->dirItems  = NULL;
 		fil->packed = PackedYes;
+		tagarenaInit(&fil->arena);
 
 		unsigned int i;
 		for (i = 0; i < filesCount; ++i)
 		{
 			size_t fsz;
-			enum ErrorId res = fileInfo(filesArray[i], &fsz, NULL, 0);
+			enum ErrorId res = fileInfo(filesArray[i], &fsz);
 			if (res == ErrorNone || res == ErrorFileIsDir)
 			{
 				if ((res == ErrorNone && (mask & MaskFile)) || (res == ErrorFileIsDir && (mask & MaskDir)))
@@ -190,26 +251,27 @@ struct FileItemList *fileitemsInitFromList(char **filesArray, unsigned int files
 						fputs("Error: path too long\n", stderr);
 						break;
 					}
-					struct FileItem *fi = malloc(sizeof(struct FileItem));
-					if (fi == NULL)
+					// The path takes no more characters than bytes, the unused tail is given back at once
+					struct FileItem *fi = tagarenaAlloc(&fil->arena, sizeof(struct FileItem));
+					wchar_t *path = (fi != NULL) ? tagarenaAlloc(&fil->arena, (len + 1) * sizeof(wchar_t)) : NULL;
+					if (path == NULL)
 					{
 						fputs("Error: fileitemsInitFromList failed\n", stderr);
 						break;
 					}
-					fi->size = fsz;
-					size_t sz = mbstowcs(fi->path, filesArray[i], PATH_MAX);
-					if (sz == (size_t) -1 || sz == PATH_MAX)
+					size_t sz = utf8ToWcs(path, filesArray[i], len + 1);
+					if (sz == (size_t) -1 || sz == len + 1)
 					{
-						free(fi);
 						fputs("Error: fileitemsInsertItem failed\n",stderr);
 						break;
 					}
+					fi->size = fsz;
+					fi->path = tagarenaRealloc(&fil->arena, path, (len + 1) * sizeof(wchar_t), (sz + 1) * sizeof(wchar_t));
 					fi->name = fileBaseNameOffsetW(fi->path);
-					fi->hash[0] = L'\0';
+					memset(fi->hash, 0, sizeof(fi->hash));
 					fi->userData = 0;
 					if (fileitemsInsertItem(fil, fi, mask) != EXIT_SUCCESS)
 					{
-						free(fi);
 						fputs("Error: fileitemsInsertItem failed\n",stderr);
 						break;
 					}
@@ -234,38 +296,72 @@ struct FileItemList *fileitemsInitFromList(char **filesArray, unsigned int files
 
 void fileitemsFree(struct FileItemList *fil)
 {
-	struct FileItem **list = fil->fileItems;
-	if (list != NULL)
-		fileitemsFreeList(list, fil->filesCount);
-
-	list = fil->dirItems;
-	if (list != NULL)
-		fileitemsFreeList(list, fil->dirsCount);
-
+	free(fil->fileItems);
+	free(fil->dirItems);
+	tagarenaFree(&fil->arena);
 	free(fil);
 }
 
-int fileitemsCalculateHashes(struct FileItemList *fil)
+int fileitemsCalculateHashes(struct FileItemList *fil, enum HashAlg alg, unsigned int jobs, struct HashCache *cache)
 {
-	struct FileItem **list = fil->fileItems;
+	// The files are hashed by jobs threads, the calling one included. The positions are taken
+	// in the list order, so the first failed file in that order is the one reported.
+	// The files found in the cache are not read, the hashed ones are stored even if another failed
+	struct FileHashJob job;
+	job.alg   = alg;
+	job.list  = fil->fileItems;
+	job.count = 0;
 	unsigned int cnt = fil->filesCount;
-	for ( ; cnt != 0; ++list)
-	{
-		struct FileItem *fi = *list;
-		if (fi != NULL)
-		{
-			char sPath[PATH_MAX];
-			wcstombs(sPath, fi->name, PATH_MAX);
-			enum ErrorId res = fileInfo(sPath, NULL, fi->hash, sizeof(fi->hash));
-			if (res != ErrorNone)
-			{
-				fileInfoError(sPath, res);
-				return EXIT_FAILURE;
-			}
+	while (cnt != 0)
+		if (job.list[job.count++] != NULL)
 			--cnt;
-		}
+	if (job.count == 0)
+		return EXIT_SUCCESS;
+	job.next    = 0;
+	job.failPos = job.count;
+	job.results = malloc(sizeof(struct FileHashResult) * job.count);
+	if (job.results == NULL)
+	{
+		fputs("Error: fileitemsCalculateHashes failed\n", stderr);
+		return EXIT_FAILURE;
 	}
-	return EXIT_SUCCESS;
+	unsigned int toHash = fileitemsLookupHashes(&job, cache);
+	if (jobs > toHash)
+		jobs = (toHash != 0) ? toHash : 1;
+	void *(*worker)(void *) = (hashIo == HashIoUring) ? fileitemsUringWorker : fileitemsHashWorker;
+	pthread_t *threads = NULL;
+	unsigned int started = 0;
+	// The workers are counted before they start, so the tree hashes take their helpers
+	// only from the rest of hashJobs. Every worker leaves the count when it ends
+	__atomic_add_fetch(&_hashThreads, jobs, __ATOMIC_RELAXED);
+	if (jobs > 1 && (threads = malloc(sizeof(pthread_t) * (jobs - 1))) != NULL)
+		for ( ; started < jobs - 1; ++started)
+			if (pthread_create(&threads[started], NULL, worker, &job) != 0)
+				break;
+	__atomic_sub_fetch(&_hashThreads, jobs - 1 - started, __ATOMIC_RELAXED);
+	worker(&job);
+	while (started != 0)
+		pthread_join(threads[--started], NULL);
+	free(threads);
+	if (cache != NULL)
+	{
+		unsigned int i;
+		for (i = 0; i < job.count; ++i)
+			if (job.results[i].state == HashDone && job.results[i].keyed)
+				hashcacheStore(cache, &job.results[i].key, job.list[i]->hash);
+	}
+
+	int res = EXIT_SUCCESS;
+	if (job.failPos != job.count)
+	{
+		char sPath[PATH_MAX];
+		wcsToUtf8(sPath, job.list[job.failPos]->name, PATH_MAX);
+		errno = job.results[job.failPos].err;
+		fileInfoError(sPath, job.results[job.failPos].res);
+		res = EXIT_FAILURE;
+	}
+	free(job.results);
+	return res;
 }
 
 void fileitemsSort(struct FileItemList *fil, enum SortMethod method)
@@ -291,7 +387,7 @@ void fileitemsSort(struct FileItemList *fil, enum SortMethod method)
 
 void fileitemsRemoveItem(struct FileItemList *fil, struct FileItem **pfi, enum FileItemMask mask)
 {
-	free(*pfi);
+	tagarenaRelease(&fil->arena, *pfi);
 	*pfi = NULL;
 	unsigned int cnt;
 	unsigned int offset;
@@ -340,9 +436,9 @@ int cmpsizehashfi(const void* fi1, const void* fi2)
 	int res = cmpsizefi(fi1, fi2);
 	if (res == 0)
 	{
-		const wchar_t *hash1 = (*(const struct FileItem **)fi1)->hash;
-		const wchar_t *hash2 = (*(const struct FileItem **)fi2)->hash;
-		res = wcscmp(hash1, hash2);
+		const unsigned char *hash1 = (*(const struct FileItem **)fi1)->hash;
+		const unsigned char *hash2 = (*(const struct FileItem **)fi2)->hash;
+		res = digestCompare(hash1, hash2);
 	}
 	return res;
 }
@@ -359,21 +455,6 @@ int cmpfilepath(const void *fi1, const void *fi2)
 	return res;
 }
 
-void fileitemsFreeList(struct FileItem **list, unsigned int cnt)
-{
-	unsigned int i;
-	for (i = 0; cnt != 0; ++i)
-	{
-		struct FileItem *fi = list[i];
-		if (fi != NULL)
-		{
-			free(fi);
-			--cnt;
-		}
-	}
-	free(list);
-}
-
 int fileitemsInsertItem(struct FileItemList *fil, struct FileItem *fi, enum FileItemMask mask)
 {
 	unsigned int    *pMax;
@@ -395,18 +476,16 @@ int fileitemsInsertItem(struct FileItemList *fil, struct FileItem *fi, enum File
 	unsigned int max = *pMax;
 	if (*pCnt == max)
 	{
-		struct FileItem **pNew;
-		if (*pCnt == 0)
-			pNew = malloc(sizeof(struct FileItem *) * FILES_INCREASE);
-		else
-			pNew = realloc(*pList, sizeof(struct FileItem *) * (max + FILES_INCREASE));
+		// The list doubles, so a long list of files is not copied for every few ones
+		unsigned int newMax = (max == 0) ? FILES_INCREASE : max * 2;
+		struct FileItem **pNew = realloc(*pList, sizeof(struct FileItem *) * newMax);
 		if (pNew == NULL)
 			return EXIT_FAILURE;
 
-		bzero(&pNew[max], sizeof(struct FileItem *) * FILES_INCREASE);
+		bzero(&pNew[max], sizeof(struct FileItem *) * (newMax - max));
 		pNew[max] = fi;
 		*pList    = pNew;
-		*pMax     += FILES_INCREASE;
+		*pMax     = newMax;
 		++*pCnt;
 		return EXIT_SUCCESS;
 	}
@@ -457,52 +536,75 @@ void fileitemsPackList(struct FileItem **list, unsigned int cnt)
 	} while (cnt != 0);
 }
 
-int sha1file (FILE *fd, char sha1_str[41])
+int fileHash(int fd, enum HashAlg alg, unsigned char hash[FILE_HASH_SIZE])
 {
-	SHA1_CTX ctx;
-	SHA1Init(&ctx);
-	unsigned char buff[4096];
-	do
+	return fileHashFd(fd, alg, hash, 0);
+}
+
+int fileHashFd(int fd, enum HashAlg alg, unsigned char hash[FILE_HASH_SIZE], int counted)
+{
+	// Hashes the file from the current offset to its end. The file is read ahead sequentially,
+	// and the hashed pages are dropped from the page cache, so a large archive does not evict the others.
+	// The chunks of a tree hash are read by several threads, the last one is hashed here
+	struct stat64 st;
+	off64_t start = lseek64(fd, 0, SEEK_CUR);
+	if (start == -1 || fstat64(fd, &st) == -1)
+		return EXIT_FAILURE;
+	posix_fadvise64(fd, start, 0, POSIX_FADV_SEQUENTIAL);
+	posix_fadvise64(fd, start, 0, POSIX_FADV_NOREUSE);
+	struct HashAlgCtx ctx;
+	hashalgInit(&ctx, alg);
+	if (hashalgIsTree(alg) && hashJobs > 1 && S_ISREG(st.st_mode) && st.st_size - start > HASHALG_CHUNK_SIZE
+		&& (fileHashChunks(fd, &st, &start, &ctx, counted) != EXIT_SUCCESS || lseek64(fd, start, SEEK_SET) == -1))
+		return EXIT_FAILURE;
+	size_t bufSize = fileReadBufferSize(&st, start);
+	if (hashRead == HashReadMmap && S_ISREG(st.st_mode) && st.st_size > start
+		&& fileHashMapped(fd, &st, start, bufSize, &ctx) == EXIT_SUCCESS)
 	{
-		size_t cnt = fread(buff, 1, sizeof(buff), fd);
-		if (cnt != sizeof(buff) && ferror(fd) != 0)
+		hashalgFinal(&ctx, hash);
+		return EXIT_SUCCESS;
+	}
+
+	unsigned char *buff;
+	if ((errno = posix_memalign((void **)&buff, sysconf(_SC_PAGESIZE), bufSize)) != 0)
+		return EXIT_FAILURE;
+	int res = EXIT_SUCCESS;
+	off64_t pos     = start;
+	off64_t dropped = start;
+	while (1)
+	{
+		ssize_t cnt = read(fd, buff, bufSize);
+		if (cnt == 0)
+			break;
+		if (cnt == -1)
 		{
-			perror("read");
-			return EXIT_FAILURE;
-		}
-		SHA1Update(&ctx, buff, cnt);
-	} while (feof(fd) == 0);
-	unsigned char hash[20];
-	SHA1Final(hash, &ctx);
-	char *j = sha1_str;
-	unsigned int i;
-	for (i = 0; i < 20; i++) {
-		unsigned char chr1 = hash[i];
-		unsigned char chr2 = chr1 & 15;
-		chr1 >>= 4;
-		if (chr1 <= 9) {
-			chr1 += 48;
-		} else {
-			chr1 += 87;
+			if (errno == EINTR)
+				continue;
+			res = EXIT_FAILURE;
+			break;
 		}
-		*j = chr1;
-		++j;
-		if (chr2 <= 9) {
-			chr2 += 48;
-		} else {
-			chr2 += 87;
+		hashalgUpdate(&ctx, buff, cnt);
+		pos += cnt;
+		if (pos - dropped >= FILE_DROP_WINDOW)
+		{
+			fileDropCache(fd, dropped, pos);
+			dropped = pos;
 		}
-		*j = chr2;
-		++j;
 	}
-	*j = '\0';
+	free(buff);
+	if (res != EXIT_SUCCESS)
+		return res;
+	fileDropCache(fd, dropped, pos);
+	hashalgFinal(&ctx, hash);
 	return EXIT_SUCCESS;
 }
 
 void fileitemsRemoveDuplicates(struct FileItemList *fil)
 {
-	fileitemsSort(fil, SortByPath);
 	unsigned int cnt = fil->filesCount;
+	if (cnt == 0)
+		return;
+	fileitemsSort(fil, SortByPath);
 	struct FileItem *fi_1 = fil->fileItems[0];
 	unsigned int i;
 	for (i = 1; i < cnt; ++i)
@@ -516,3 +618,444 @@ void fileitemsRemoveDuplicates(struct FileItemList *fil)
 	if (fil->packed == PackedNo)
 		fileitemsPackItems(fil);
 }
+
+enum ErrorId fileitemsHashItem(struct FileItem *fi, enum HashAlg alg, int *err)
+{
+	char sPath[PATH_MAX];
+	wcsToUtf8(sPath, fi->name, PATH_MAX);
+	enum ErrorId res = ErrorOther;
+	int fd = open(sPath, O_RDONLY | O_LARGEFILE);
+	if (fd != -1)
+	{
+		if (fileHashFd(fd, alg, fi->hash, 1) == EXIT_SUCCESS)
+			res = ErrorNone;
+		else
+			*err = errno;
+		close(fd);
+	}
+	else
+		*err = errno;
+	return res;
+}
+
+enum ErrorId fileitemsReadSmall(struct FileItem *fi, struct FileHashBatch *batch, int *err)
+{
+	// The file is added to the batch, a file grown past FILE_SMALL_SIZE since the scan is hashed at once
+	char sPath[PATH_MAX];
+	wcsToUtf8(sPath, fi->name, PATH_MAX);
+	int fd = open(sPath, O_RDONLY | O_LARGEFILE);
+	if (fd == -1)
+	{
+		*err = errno;
+		return ErrorOther;
+	}
+	enum ErrorId res = ErrorNone;
+	unsigned char *data = batch->buffer + batch->count * FILE_SMALL_SIZE;
+	size_t len = 0;
+	unsigned char extra;
+	ssize_t cnt = 0;
+	while (len < FILE_SMALL_SIZE && (cnt = read(fd, data + len, FILE_SMALL_SIZE - len)) != 0)
+	{
+		if (cnt == -1 && errno != EINTR)
+			break;
+		if (cnt > 0)
+			len += cnt;
+	}
+	if (len < FILE_SMALL_SIZE && cnt == -1)
+		res = ErrorOther;
+	else if (len == FILE_SMALL_SIZE && read(fd, &extra, 1) == 1)
+	{
+		if (lseek64(fd, 0, SEEK_SET) == -1 || fileHash(fd, HashAlgSha1, fi->hash) != EXIT_SUCCESS)
+			res = ErrorOther;
+	}
+	else
+	{
+		struct Sha1mbJob *job = &batch->jobs[batch->count++];
+		job->data   = data;
+		job->len    = len;
+		job->digest = fi->hash;
+		memset(fi->hash, 0, FILE_HASH_SIZE);
+		fileDropCache(fd, 0, len);
+	}
+	if (res != ErrorNone)
+		*err = errno;
+	close(fd);
+	return res;
+}
+
+void *fileitemsHashWorker(void *arg)
+{
+	// Takes the positions until the list ends or a position after a failed one comes.
+	// The small files of SHA-1 are collected into a batch and hashed in the lanes of sha1mbHash
+	struct FileHashJob *job = arg;
+	struct FileHashBatch batch;
+	batch.count  = 0;
+	batch.buffer = (job->alg == HashAlgSha1) ? malloc(FILE_BATCH_COUNT * FILE_SMALL_SIZE) : NULL;
+	unsigned int pos;
+	while (fileitemsNextPosition(job, &pos) == EXIT_SUCCESS)
+	{
+		struct FileItem *fi = job->list[pos];
+		int err = 0;
+		enum ErrorId res;
+		if (batch.buffer != NULL && fi->size <= FILE_SMALL_SIZE)
+		{
+			res = fileitemsReadSmall(fi, &batch, &err);
+			if (batch.count == FILE_BATCH_COUNT)
+			{
+				sha1mbHash(batch.jobs, batch.count);
+				batch.count = 0;
+			}
+		}
+		else
+			res = fileitemsHashItem(fi, job->alg, &err);
+		if (res != ErrorNone)
+			fileitemsHashFailed(job, pos, res, err);
+		else
+			job->results[pos].state = HashDone;
+	}
+	sha1mbHash(batch.jobs, batch.count);
+	free(batch.buffer);
+	__atomic_sub_fetch(&_hashThreads, 1, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+void *fileitemsUringWorker(void *arg)
+{
+	// Keeps up to FILE_URING_DEPTH files read through the ring at once, one read in flight for each.
+	// A slot reads the next chunk into one half of its buffer while the other half is hashed.
+	// Without io_uring the files are read by fileitemsHashWorker
+	struct FileHashJob *job = arg;
+	struct Uring ring;
+	if (uringInit(&ring, FILE_URING_DEPTH) != EXIT_SUCCESS)
+		return fileitemsHashWorker(arg);
+	struct FileUringSlot slots[FILE_URING_DEPTH];
+	unsigned char *buffer;
+	if (posix_memalign((void **)&buffer, sysconf(_SC_PAGESIZE), FILE_URING_DEPTH * 2 * FILE_URING_CHUNK) != 0)
+	{
+		uringFree(&ring);
+		return fileitemsHashWorker(arg);
+	}
+	unsigned int i;
+	for (i = 0; i < FILE_URING_DEPTH; ++i)
+		slots[i].fi = NULL;
+	unsigned int inFlight = 0;
+	int more = 1;
+	while (1)
+	{
+		for (i = 0; more && i < FILE_URING_DEPTH; ++i)
+		{
+			struct FileUringSlot *slot = &slots[i];
+			if (slot->fi != NULL)
+				continue;
+			unsigned int pos;
+			if (fileitemsNextPosition(job, &pos) != EXIT_SUCCESS)
+			{
+				more = 0;
+				break;
+			}
+			if (hashalgIsTree(job->alg) && hashJobs > 1 && job->list[pos]->size > HASHALG_CHUNK_SIZE)
+			{
+				// The chunks are read by the threads of fileHash meanwhile
+				int err = 0;
+				enum ErrorId res = fileitemsHashItem(job->list[pos], job->alg, &err);
+				if (res != ErrorNone)
+					fileitemsHashFailed(job, pos, res, err);
+				else
+					job->results[pos].state = HashDone;
+				continue;
+			}
+			char sPath[PATH_MAX];
+			wcsToUtf8(sPath, job->list[pos]->name, PATH_MAX);
+			slot->fd = open(sPath, O_RDONLY | O_LARGEFILE);
+			if (slot->fd == -1)
+			{
+				fileitemsHashFailed(job, pos, ErrorOther, errno);
+				continue;
+			}
+			posix_fadvise64(slot->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+			slot->fi     = job->list[pos];
+			slot->pos    = pos;
+			slot->offset = 0;
+			slot->buffer = 0;
+			hashalgInit(&slot->ctx, job->alg);
+			uringPrepRead(&ring, slot->fd, buffer + i * 2 * FILE_URING_CHUNK, FILE_URING_CHUNK, 0, i);
+			++inFlight;
+		}
+		if (inFlight == 0)
+		{
+			if (!more)
+				break;
+			continue;
+		}
+		if (uringSubmit(&ring, 1) != EXIT_SUCCESS)
+		{
+			// The reads sent earlier may still write to the buffer, so they are waited for.
+			// The files of the slots are read again by the blocking reads, the rest by fileitemsHashWorker
+			uint64_t userData;
+			int readRes;
+			while (ring.inKernel != 0)
+				if (!uringNextCompletion(&ring, &userData, &readRes) && uringWait(&ring) != EXIT_SUCCESS)
+					sched_yield();
+			free(buffer);
+			uringFree(&ring);
+			for (i = 0; i < FILE_URING_DEPTH; ++i)
+			{
+				if (slots[i].fi == NULL)
+					continue;
+				close(slots[i].fd);
+				int err = 0;
+				enum ErrorId res = fileitemsHashItem(slots[i].fi, job->alg, &err);
+				if (res != ErrorNone)
+					fileitemsHashFailed(job, slots[i].pos, res, err);
+				else
+					job->results[slots[i].pos].state = HashDone;
+			}
+			return fileitemsHashWorker(arg);
+		}
+
+		uint64_t userData;
+		int res;
+		while (uringNextCompletion(&ring, &userData, &res))
+		{
+			struct FileUringSlot *slot = &slots[userData];
+			unsigned char *data = buffer + (userData * 2 + slot->buffer) * FILE_URING_CHUNK;
+			if (res == -EINTR || res == -EAGAIN)
+			{
+				uringPrepRead(&ring, slot->fd, data, FILE_URING_CHUNK, slot->offset, userData);
+				continue;
+			}
+			if (res > 0)
+			{
+				slot->offset += res;
+				slot->buffer ^= 1;
+				uringPrepRead(&ring, slot->fd, buffer + (userData * 2 + slot->buffer) * FILE_URING_CHUNK,
+					FILE_URING_CHUNK, slot->offset, userData);
+				hashalgUpdate(&slot->ctx, data, res);
+				continue;
+			}
+			if (res == 0)
+			{
+				hashalgFinal(&slot->ctx, slot->fi->hash);
+				job->results[slot->pos].state = HashDone;
+			}
+			else
+				fileitemsHashFailed(job, slot->pos, ErrorOther, -res);
+			fileDropCache(slot->fd, 0, slot->offset);
+			close(slot->fd);
+			slot->fi = NULL;
+			--inFlight;
+		}
+	}
+	free(buffer);
+	uringFree(&ring);
+	__atomic_sub_fetch(&_hashThreads, 1, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+int fileitemsNextPosition(struct FileHashJob *job, unsigned int *pos)
+{
+	// Skips the empty and the cached positions, fails at the end of the list or after a failed position
+	while (1)
+	{
+		unsigned int p = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+		if (p >= job->count || p > __atomic_load_n(&job->failPos, __ATOMIC_RELAXED))
+			return EXIT_FAILURE;
+		if (job->list[p] != NULL && job->results[p].state != HashCached)
+		{
+			*pos = p;
+			return EXIT_SUCCESS;
+		}
+	}
+}
+
+unsigned int fileitemsLookupHashes(struct FileHashJob *job, struct HashCache *cache)
+{
+	// Takes the identities of the files and their hashes found in the cache, returns the count of the rest
+	unsigned int toHash = 0;
+	unsigned int i;
+	for (i = 0; i < job->count; ++i)
+	{
+		struct FileHashResult *result = &job->results[i];
+		result->state = HashPending;
+		result->keyed = 0;
+		struct FileItem *fi = job->list[i];
+		if (fi == NULL)
+			continue;
+		if (cache != NULL)
+		{
+			char sPath[PATH_MAX];
+			struct stat64 st;
+			wcsToUtf8(sPath, fi->name, PATH_MAX);
+			if (stat64(sPath, &st) == 0)
+			{
+				hashcacheMakeKey(&result->key, &st);
+				result->keyed = 1;
+				if (hashcacheLookup(cache, &result->key, fi->hash))
+				{
+					result->state = HashCached;
+					continue;
+				}
+			}
+		}
+		++toHash;
+	}
+	return toHash;
+}
+
+void fileitemsHashFailed(struct FileHashJob *job, unsigned int pos, enum ErrorId res, int err)
+{
+	job->results[pos].res = res;
+	job->results[pos].err = err;
+	unsigned int fail = __atomic_load_n(&job->failPos, __ATOMIC_RELAXED);
+	while (pos < fail && !__atomic_compare_exchange_n(&job->failPos, &fail, pos, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+size_t fileReadBufferSize(const struct stat64 *st, off64_t start)
+{
+	// The size set by the user or the default one, in whole blocks of the file system
+	// and no larger than the rest of a regular file
+	size_t block = sysconf(_SC_PAGESIZE);
+	if (st->st_blksize > 0 && (size_t)st->st_blksize > block)
+		block = st->st_blksize;
+	size_t size = (hashBufferSize != 0) ? hashBufferSize : FILE_READ_BUFFER;
+	if (S_ISREG(st->st_mode) && st->st_size >= start && (off64_t)size > st->st_size - start)
+		size = (st->st_size > start) ? st->st_size - start : 1;
+	return (size + block - 1) / block * block;
+}
+
+int fileHashMapped(int fd, const struct stat64 *st, off64_t start, size_t chunk, struct HashAlgCtx *ctx)
+{
+	// The file is mapped from the page holding start and hashed in place by chunks,
+	// the hashed part is dropped while the rest is read ahead. The file must not shrink meanwhile
+	off64_t base = start & ~((off64_t)sysconf(_SC_PAGESIZE) - 1);
+	size_t mapLen = st->st_size - base;
+	unsigned char *map = mmap64(NULL, mapLen, PROT_READ, MAP_SHARED, fd, base);
+	if (map == MAP_FAILED)
+		return EXIT_FAILURE;
+	madvise(map, mapLen, MADV_SEQUENTIAL);
+	size_t pos = start - base;
+	size_t dropped = 0;
+	while (pos < mapLen)
+	{
+		size_t len = (mapLen - pos < chunk) ? mapLen - pos : chunk;
+		hashalgUpdate(ctx, map + pos, len);
+		pos += len;
+		if (pos - dropped >= FILE_DROP_WINDOW || pos == mapLen)
+		{
+			madvise(map + dropped, pos - dropped, MADV_DONTNEED);
+			fileDropCache(fd, base + dropped, base + pos);
+			dropped = pos;
+		}
+	}
+	munmap(map, mapLen);
+	lseek64(fd, st->st_size, SEEK_SET);
+	return EXIT_SUCCESS;
+}
+
+void fileDropCache(int fd, off64_t start, off64_t end)
+{
+	// The pages of the hashed range leave the page cache, the partial ones at its edges stay
+	if (end > start)
+		posix_fadvise64(fd, start, end - start, POSIX_FADV_DONTNEED);
+}
+
+int fileHashChunks(int fd, const struct stat64 *st, off64_t *start, struct HashAlgCtx *ctx, int counted)
+{
+	// The chunks of a tree hash but the last one are hashed by windows of FILE_TREE_WINDOW chunks.
+	// A window is shared by the calling thread and the helpers it can take, and its leaves are added
+	// in order, so the digest does not depend on the threads. start is moved past the hashed chunks.
+	// counted tells the calling thread is a file worker already counted in _hashThreads
+	struct FileTreeJob job;
+	uint64_t count = (st->st_size - *start - 1) / HASHALG_CHUNK_SIZE;
+	job.fd     = fd;
+	job.alg    = ctx->alg;
+	job.start  = *start;
+	job.err    = 0;
+	job.leaves = malloc(sizeof(*job.leaves) * FILE_TREE_WINDOW);
+	if (job.leaves == NULL)
+		return EXIT_FAILURE;
+	pthread_t threads[HASH_JOBS_MAX];
+	uint64_t i;
+	for (job.first = 0; job.first < count && job.err == 0; job.first = job.end)
+	{
+		job.next = job.first;
+		job.end  = (count - job.first > FILE_TREE_WINDOW) ? job.first + FILE_TREE_WINDOW : count;
+		unsigned int helpers = fileTakeTreeThreads(job.end - job.first - 1, counted);
+		unsigned int started = 0;
+		for ( ; started < helpers; ++started)
+			if (pthread_create(&threads[started], NULL, fileTreeWorker, &job) != 0)
+				break;
+		fileTreeWorker(&job);
+		while (started != 0)
+			pthread_join(threads[--started], NULL);
+		__atomic_sub_fetch(&_hashThreads, helpers + !counted, __ATOMIC_RELAXED);
+		if (job.err == 0)
+			for (i = job.first; i < job.end; ++i)
+				hashalgAddLeaf(ctx, job.leaves[i - job.first]);
+	}
+	free(job.leaves);
+	if (job.err != 0)
+	{
+		errno = job.err;
+		return EXIT_FAILURE;
+	}
+	*start += count * HASHALG_CHUNK_SIZE;
+	return EXIT_SUCCESS;
+}
+
+void *fileTreeWorker(void *arg)
+{
+	// Takes the chunks of the window until it ends or a chunk fails. A file shrunk meanwhile fails
+	struct FileTreeJob *job = arg;
+	unsigned char *buff;
+	int err = posix_memalign((void **)&buff, sysconf(_SC_PAGESIZE), HASHALG_CHUNK_SIZE);
+	if (err != 0)
+		buff = NULL;
+	while (err == 0 && __atomic_load_n(&job->err, __ATOMIC_RELAXED) == 0)
+	{
+		uint64_t chunk = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+		if (chunk >= job->end)
+			break;
+		off64_t offset = job->start + (off64_t)chunk * HASHALG_CHUNK_SIZE;
+		size_t len = 0;
+		while (len < HASHALG_CHUNK_SIZE)
+		{
+			ssize_t cnt = pread64(job->fd, buff + len, HASHALG_CHUNK_SIZE - len, offset + len);
+			if (cnt > 0)
+				len += cnt;
+			else if (cnt == 0 || errno != EINTR)
+			{
+				err = (cnt == 0) ? EIO : errno;
+				break;
+			}
+		}
+		if (err != 0)
+			break;
+		hashalgLeaf(job->alg, buff, len, job->leaves[chunk - job->first]);
+		fileDropCache(job->fd, offset, offset + len);
+	}
+	free(buff);
+	if (err != 0)
+	{
+		int none = 0;
+		__atomic_compare_exchange_n(&job->err, &none, err, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+unsigned int fileTakeTreeThreads(uint64_t helpers, int counted)
+{
+	// Counts the calling thread unless it is counted and takes up to helpers threads more
+	// while fewer than hashJobs threads hash, returns the count of the taken helpers
+	unsigned int self = !counted;
+	unsigned int cur = __atomic_load_n(&_hashThreads, __ATOMIC_RELAXED);
+	unsigned int take;
+	do
+	{
+		take = (cur + self < hashJobs) ? hashJobs - cur - self : 0;
+		if (take > helpers)
+			take = helpers;
+	} while (!__atomic_compare_exchange_n(&_hashThreads, &cur, cur + take + self, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	return take;
+}
@@ -21,7 +21,9 @@
 #ifndef FILE_H
 #define FILE_H
 
+#ifndef __USE_GNU
 #define __USE_GNU
+#endif
 
 #include <stdio.h>
 #include <sys/stat.h>
@@ -31,6 +33,9 @@
 
 #include "errors.h"
 #include "common.h"
+#include "tagarena.h"
+#include "hashcache.h"
+#include "hashalg.h"
 
 
 enum PackStatus { PackedNo, PackedYes };
@@ -45,14 +50,15 @@ struct FileItemList
 	unsigned int    dirsMax;
 	struct FileItem **dirItems;
 	enum PackStatus packed;
+	struct TagArena arena;  // the items and their paths
 };
 
 struct FileItem
 {
 	size_t         size;
-	wchar_t        path[PATH_MAX];
+	wchar_t        *path;
 	wchar_t        *name;
-	wchar_t        hash[FILE_HASH_LEN + 1];
+	unsigned char  hash[FILE_HASH_SIZE];  // raw digest, valid after fileitemsCalculateHashes
 	unsigned int   userData;
 };
 
@@ -61,16 +67,16 @@ enum SortMethod { SortBySize, SortBySizeHash, SortByPath };
 
 typedef struct dirent64 ** DirEntry;
 
-enum ErrorId fileInfo(const char *fileName, size_t *size, wchar_t *hash, int sizeHash);
+enum ErrorId fileInfo(const char *fileName, size_t *size);
 void fileInfoError(const char *fileName, enum ErrorId err);
 int dirList(const char *path, const char *pattern, DirEntry *dir);
 int fileBaseNameOffset(char **filesArray, unsigned int filesCount);
 wchar_t *fileBaseNameOffsetW(wchar_t *path);
-int sha1file(FILE *fd, char[41]);
+int fileHash(int fd, enum HashAlg alg, unsigned char hash[FILE_HASH_SIZE]);
 
 struct FileItemList *fileitemsInitFromList(char **filesArray, unsigned int filesCount, unsigned int dirLen, enum FileItemMask mask);
 void fileitemsFree(struct FileItemList *fil);
-int  fileitemsCalculateHashes(struct FileItemList *fil);
+int  fileitemsCalculateHashes(struct FileItemList *fil, enum HashAlg alg, unsigned int jobs, struct HashCache *cache);
 void fileitemsSort(struct FileItemList *fil, enum SortMethod method);
 void fileitemsRemoveItem(struct FileItemList *fil, struct FileItem **pfi, enum FileItemMask mask);
 
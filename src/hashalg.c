@@ -0,0 +1,232 @@
+/*
+ * hashalg.c
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashalg.h"
+
+struct HashAlgInfo
+{
+	const char   *name;
+	unsigned int size;
+	enum HashAlg base;  // the same hash if it is not a tree one
+};
+
+static const struct HashAlgInfo hashalgInfo[HashAlgCount] = {
+	{ "sha1",        20,          HashAlgSha1 },
+	{ "xxh128",      XXH128_SIZE, HashAlgXxh128 },
+	{ "sha256",      SHA256_SIZE, HashAlgSha256 },
+	{ "sha1-tree",   20,          HashAlgSha1 },
+	{ "xxh128-tree", XXH128_SIZE, HashAlgXxh128 },
+	{ "sha256-tree", SHA256_SIZE, HashAlgSha256 }
+};
+
+static const unsigned char hashalgLeafTag = 0x00;
+static const unsigned char hashalgNodeTag = 0x01;
+
+static void hashalgBaseInit(struct HashAlgCtx *ctx);
+static void hashalgBaseUpdate(struct HashAlgCtx *ctx, const unsigned char *data, size_t len);
+static void hashalgBaseFinal(struct HashAlgCtx *ctx, unsigned char digest[FILE_HASH_SIZE]);
+static void hashalgNode(enum HashAlg base, const unsigned char *left, const unsigned char *right, unsigned char digest[FILE_HASH_SIZE]);
+
+const char *hashalgName(enum HashAlg alg)
+{
+	return hashalgInfo[alg].name;
+}
+
+unsigned int hashalgSize(enum HashAlg alg)
+{
+	return hashalgInfo[alg].size;
+}
+
+int hashalgIsTree(enum HashAlg alg)
+{
+	return hashalgInfo[alg].base != alg;
+}
+
+int hashalgFind(const char *name, size_t len, enum HashAlg *alg)
+{
+	unsigned int i;
+	for (i = 0; i < HashAlgCount; ++i)
+		if (strlen(hashalgInfo[i].name) == len && memcmp(hashalgInfo[i].name, name, len) == 0)
+		{
+			*alg = i;
+			return EXIT_SUCCESS;
+		}
+	return EXIT_FAILURE;
+}
+
+void hashalgInit(struct HashAlgCtx *ctx, enum HashAlg alg)
+{
+	ctx->alg      = alg;
+	ctx->base     = hashalgInfo[alg].base;
+	ctx->chunkLen = 0;
+	ctx->chunks   = 0;
+	ctx->levels   = 0;
+	hashalgBaseInit(ctx);
+	if (alg != ctx->base)
+		hashalgBaseUpdate(ctx, &hashalgLeafTag, 1);
+}
+
+void hashalgUpdate(struct HashAlgCtx *ctx, const unsigned char *data, size_t len)
+{
+	if (ctx->alg == ctx->base)
+	{
+		hashalgBaseUpdate(ctx, data, len);
+		return;
+	}
+	// A full chunk is closed when more data comes, so the last chunk is closed by hashalgFinal
+	while (len != 0)
+	{
+		if (ctx->chunkLen == HASHALG_CHUNK_SIZE)
+		{
+			unsigned char leaf[FILE_HASH_SIZE];
+			hashalgBaseFinal(ctx, leaf);
+			hashalgAddLeaf(ctx, leaf);
+			hashalgBaseInit(ctx);
+			hashalgBaseUpdate(ctx, &hashalgLeafTag, 1);
+			ctx->chunkLen = 0;
+		}
+		size_t part = HASHALG_CHUNK_SIZE - ctx->chunkLen;
+		if (part > len)
+			part = len;
+		hashalgBaseUpdate(ctx, data, part);
+		ctx->chunkLen += part;
+		data += part;
+		len  -= part;
+	}
+}
+
+void hashalgFinal(struct HashAlgCtx *ctx, unsigned char digest[FILE_HASH_SIZE])
+{
+	// The digest is padded by zeros to FILE_HASH_SIZE
+	unsigned int size = hashalgInfo[ctx->alg].size;
+	hashalgBaseFinal(ctx, digest);
+	if (ctx->alg != ctx->base)
+	{
+		// The subtrees are joined from the smallest one
+		hashalgAddLeaf(ctx, digest);
+		memcpy(digest, ctx->nodes[--ctx->levels], size);
+		while (ctx->levels != 0)
+		{
+			--ctx->levels;
+			hashalgNode(ctx->base, ctx->nodes[ctx->levels], digest, digest);
+		}
+	}
+	memset(digest + size, 0, FILE_HASH_SIZE - size);
+}
+
+void hashalgLeaf(enum HashAlg alg, const unsigned char *data, size_t len, unsigned char digest[FILE_HASH_SIZE])
+{
+	// The leaf of a chunk of the tree hash alg
+	struct HashAlgCtx ctx;
+	ctx.base = hashalgInfo[alg].base;
+	hashalgBaseInit(&ctx);
+	hashalgBaseUpdate(&ctx, &hashalgLeafTag, 1);
+	hashalgBaseUpdate(&ctx, data, len);
+	hashalgBaseFinal(&ctx, digest);
+}
+
+void hashalgAddLeaf(struct HashAlgCtx *ctx, const unsigned char digest[FILE_HASH_SIZE])
+{
+	// Adds the leaf of the next chunk, the current chunk must be empty. Every even count of the chunks
+	// joins the two last subtrees of the same size, so a complete subtree is left for every set bit of the count
+	unsigned int size = hashalgInfo[ctx->alg].size;
+	uint64_t count = ++ctx->chunks;
+	memcpy(ctx->nodes[ctx->levels], digest, size);
+	while ((count & 1) == 0)
+	{
+		--ctx->levels;
+		hashalgNode(ctx->base, ctx->nodes[ctx->levels], ctx->nodes[ctx->levels + 1], ctx->nodes[ctx->levels]);
+		count >>= 1;
+	}
+	++ctx->levels;
+}
+
+/**************************** Private ********************************/
+
+static void hashalgBaseInit(struct HashAlgCtx *ctx)
+{
+	switch (ctx->base)
+	{
+		case HashAlgXxh128:
+			xxh128Init(&ctx->u.xxh128);
+			break;
+		case HashAlgSha256:
+			sha256Init(&ctx->u.sha256);
+			break;
+		default:
+			SHA1Init(&ctx->u.sha1);
+			break;
+	}
+}
+
+static void hashalgBaseUpdate(struct HashAlgCtx *ctx, const unsigned char *data, size_t len)
+{
+	switch (ctx->base)
+	{
+		case HashAlgXxh128:
+			xxh128Update(&ctx->u.xxh128, data, len);
+			break;
+		case HashAlgSha256:
+			sha256Update(&ctx->u.sha256, data, len);
+			break;
+		default:
+			// SHA1Update takes the length in 32 bits
+			while (len != 0)
+			{
+				uint32_t part = (len > 0x40000000) ? 0x40000000 : len;
+				SHA1Update(&ctx->u.sha1, data, part);
+				data += part;
+				len  -= part;
+			}
+			break;
+	}
+}
+
+static void hashalgBaseFinal(struct HashAlgCtx *ctx, unsigned char digest[FILE_HASH_SIZE])
+{
+	switch (ctx->base)
+	{
+		case HashAlgXxh128:
+			xxh128Final(&ctx->u.xxh128, digest);
+			break;
+		case HashAlgSha256:
+			sha256Final(&ctx->u.sha256, digest);
+			break;
+		default:
+			SHA1Final(digest, &ctx->u.sha1);
+			break;
+	}
+}
+
+static void hashalgNode(enum HashAlg base, const unsigned char *left, const unsigned char *right, unsigned char digest[FILE_HASH_SIZE])
+{
+	// digest may be one of the children
+	unsigned int size = hashalgInfo[base].size;
+	struct HashAlgCtx ctx;
+	ctx.base = base;
+	hashalgBaseInit(&ctx);
+	hashalgBaseUpdate(&ctx, &hashalgNodeTag, 1);
+	hashalgBaseUpdate(&ctx, left, size);
+	hashalgBaseUpdate(&ctx, right, size);
+	hashalgBaseFinal(&ctx, digest);
+}
@@ -0,0 +1,86 @@
+/*
+ * hashalg.h
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef HASHALG_H
+#define HASHALG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "sha1.h"
+#include "sha256.h"
+#include "xxh128.h"
+
+/*
+ * The content hashes an index can identify its files by. The index names its hash in the
+ * !hash= line of the header, an index without the line uses SHA-1.
+ * A digest is kept in FILE_HASH_SIZE bytes, the bytes after the size of the hash are zero.
+ * The index records the size of its hash in the !hash-size= line, the binary items, the offset
+ * index and the journal store the hashes in that many bytes.
+ *
+ * A tree hash splits the data into chunks of HASHALG_CHUNK_SIZE bytes, the last one may be
+ * shorter or empty. Its base hash hashes every chunk into a leaf, 0x00 || chunk, and every pair
+ * of subtrees into a node, 0x01 || left || right. The left subtree of a node holds the largest
+ * power of two of the chunks that is less than their count, as in RFC 6962. The chunks can be
+ * hashed independently and added to the tree by hashalgAddLeaf, the digest is the same.
+ */
+
+#define HASHALG_CHUNK_SIZE  (1024 * 1024)
+#define HASHALG_TREE_LEVELS 48  // the roots of the complete subtrees, up to 2^48 chunks
+
+enum HashAlg
+{
+	HashAlgSha1       = 0,
+	HashAlgXxh128     = 1,  // XXH3-128, not cryptographic, for the trusted files
+	HashAlgSha256     = 2,
+	HashAlgSha1Tree   = 3,
+	HashAlgXxh128Tree = 4,
+	HashAlgSha256Tree = 5,
+	HashAlgCount
+};
+
+struct HashAlgCtx
+{
+	enum HashAlg  alg;
+	enum HashAlg  base;  // the hash of the data, of the chunks and the nodes for a tree hash
+	union
+	{
+		SHA1_CTX  sha1;
+		struct Xxh128State xxh128;
+		struct Sha256Ctx sha256;
+	} u;                 // the base hash, of the current chunk for a tree hash
+	size_t        chunkLen;
+	uint64_t      chunks;  // the chunks added to the tree
+	unsigned int  levels;
+	unsigned char nodes[HASHALG_TREE_LEVELS][FILE_HASH_SIZE];  // the roots of the complete subtrees, the larger first
+};
+
+const char  *hashalgName(enum HashAlg alg);
+unsigned int hashalgSize(enum HashAlg alg);
+int  hashalgIsTree(enum HashAlg alg);
+int  hashalgFind(const char *name, size_t len, enum HashAlg *alg);
+void hashalgInit(struct HashAlgCtx *ctx, enum HashAlg alg);
+void hashalgUpdate(struct HashAlgCtx *ctx, const unsigned char *data, size_t len);
+void hashalgFinal(struct HashAlgCtx *ctx, unsigned char digest[FILE_HASH_SIZE]);
+void hashalgLeaf(enum HashAlg alg, const unsigned char *data, size_t len, unsigned char digest[FILE_HASH_SIZE]);
+void hashalgAddLeaf(struct HashAlgCtx *ctx, const unsigned char digest[FILE_HASH_SIZE]);
+
+#endif // HASHALG_H
@@ -0,0 +1,257 @@
+/*
+ * hashcache.c
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#define _LARGEFILE64_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "hashcache.h"
+
+#define CACHE_INCREASE  1024
+
+static int  loadEntries(struct HashCache *cache);
+static int  growEntries(struct HashCache *cache, uint32_t count);
+static int  buildTable(struct HashCache *cache);
+static uint32_t *findSlot(const struct HashCache *cache, const struct HashCacheKey *key);
+static int  cmpUsed(const void *e1, const void *e2);
+
+struct HashCache *hashcacheOpen(const char *path, enum HashAlg alg, int create)
+{
+	// Returns NULL if there is no cache and create is not set. A damaged cache or one of another algorithm starts empty
+	if (!create && access(path, F_OK) != 0)
+		return NULL;
+	struct HashCache *cache = malloc(sizeof(struct HashCache));
+	if (cache == NULL)
+		return NULL;
+	memset(cache, 0, sizeof(struct HashCache));
+	cache->path = strdup(path);
+	cache->hashAlg = alg;
+	cache->racyTime = time(NULL) - HASHCACHE_RACY_SEC;
+	if (cache->path == NULL || (loadEntries(cache) != EXIT_SUCCESS && growEntries(cache, CACHE_INCREASE) != EXIT_SUCCESS) ||
+		buildTable(cache) != EXIT_SUCCESS)
+	{
+		hashcacheFree(cache);
+		return NULL;
+	}
+	++cache->generation;
+	return cache;
+}
+
+int hashcacheSave(struct HashCache *cache)
+{
+	// Writes the cache if it has changed, over a temporary file renamed to its name
+	if (!cache->changed)
+		return EXIT_SUCCESS;
+	if (cache->count > HASHCACHE_MAX)
+	{
+		qsort(cache->entries, cache->count, sizeof(struct HashCacheEntry), cmpUsed);
+		cache->count = HASHCACHE_MAX;
+		if (buildTable(cache) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+	}
+
+	char tmpName[PATH_MAX];
+	if (strlen(cache->path) + 4 + 1 > PATH_MAX)
+		return EXIT_FAILURE;
+	strcpy(tmpName, cache->path);
+	strcat(tmpName, ".tmp");
+
+	FILE *fd = fopen(tmpName, "w");
+	if (fd == NULL)
+		return EXIT_FAILURE;
+
+	int res = EXIT_FAILURE;
+	struct HashCacheHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, HASHCACHE_MAGIC, HASHCACHE_MAGIC_LEN);
+	hdr.generation = cache->generation;
+	hdr.count      = cache->count;
+	hdr.hashAlg    = cache->hashAlg;
+	if (fwrite(&hdr, sizeof(hdr), 1, fd) == 1 &&
+		(cache->count == 0 || fwrite(cache->entries, sizeof(struct HashCacheEntry), cache->count, fd) == cache->count))
+		res = EXIT_SUCCESS;
+	if (fclose(fd) == EOF)
+		res = EXIT_FAILURE;
+	if (res == EXIT_SUCCESS && rename(tmpName, cache->path) != 0)
+		res = EXIT_FAILURE;
+	if (res != EXIT_SUCCESS)
+		unlink(tmpName);
+	else
+		cache->changed = 0;
+	return res;
+}
+
+void hashcacheFree(struct HashCache *cache)
+{
+	free(cache->path);
+	free(cache->entries);
+	free(cache->table);
+	free(cache);
+}
+
+void hashcacheMakeKey(struct HashCacheKey *key, const struct stat64 *st)
+{
+	memset(key, 0, sizeof(struct HashCacheKey));
+	key->dev       = st->st_dev;
+	key->ino       = st->st_ino;
+	key->size      = st->st_size;
+	key->mtimeSec  = st->st_mtim.tv_sec;
+	key->mtimeNsec = st->st_mtim.tv_nsec;
+	key->ctimeSec  = st->st_ctim.tv_sec;
+	key->ctimeNsec = st->st_ctim.tv_nsec;
+}
+
+int hashcacheLookup(struct HashCache *cache, const struct HashCacheKey *key, unsigned char *hash)
+{
+	// Returns 1 and the hash if all the identity of the file matches
+	uint32_t *slot = findSlot(cache, key);
+	if (*slot == 0)
+		return 0;
+	struct HashCacheEntry *entry = &cache->entries[*slot - 1];
+	if (memcmp(&entry->key, key, sizeof(struct HashCacheKey)) != 0)
+		return 0;
+	memcpy(hash, entry->hash, FILE_HASH_SIZE);
+	if (entry->used != cache->generation)
+	{
+		entry->used = cache->generation;
+		cache->changed = 1;
+	}
+	return 1;
+}
+
+int hashcacheStore(struct HashCache *cache, const struct HashCacheKey *key, const unsigned char *hash)
+{
+	// The entry of the inode is replaced. A recently changed file is skipped, EXIT_SUCCESS all the same
+	if (key->mtimeSec >= cache->racyTime || key->ctimeSec >= cache->racyTime)
+		return EXIT_SUCCESS;
+	uint32_t *slot = findSlot(cache, key);
+	uint32_t idx = *slot - 1;
+	if (*slot == 0)
+	{
+		if (cache->count == cache->max && growEntries(cache, cache->max + CACHE_INCREASE) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+		idx = cache->count;
+	}
+	struct HashCacheEntry *entry = &cache->entries[idx];
+	entry->key = *key;
+	memcpy(entry->hash, hash, FILE_HASH_SIZE);
+	entry->used = cache->generation;
+	if (*slot == 0)
+	{
+		*slot = ++cache->count;
+		if (cache->count * 2 > cache->tableSize && buildTable(cache) != EXIT_SUCCESS)
+		{
+			*slot = 0;
+			--cache->count;
+			return EXIT_FAILURE;
+		}
+	}
+	cache->changed = 1;
+	return EXIT_SUCCESS;
+}
+
+/**************************** Private ********************************/
+
+static int loadEntries(struct HashCache *cache)
+{
+	FILE *fd = fopen(cache->path, "r");
+	if (fd == NULL)
+		return EXIT_FAILURE;
+	int res = EXIT_FAILURE;
+	struct HashCacheHeader hdr;
+	struct stat64 st;
+	if (fstat64(fileno(fd), &st) == 0 && fread(&hdr, sizeof(hdr), 1, fd) == 1 &&
+		memcmp(hdr.magic, HASHCACHE_MAGIC, HASHCACHE_MAGIC_LEN) == 0 && hdr.hashAlg == cache->hashAlg &&
+		(uint64_t)st.st_size == sizeof(hdr) + (uint64_t)hdr.count * sizeof(struct HashCacheEntry) &&
+		growEntries(cache, hdr.count + CACHE_INCREASE) == EXIT_SUCCESS &&
+		(hdr.count == 0 || fread(cache->entries, sizeof(struct HashCacheEntry), hdr.count, fd) == hdr.count))
+	{
+		cache->count      = hdr.count;
+		cache->generation = hdr.generation;
+		res = EXIT_SUCCESS;
+	}
+	fclose(fd);
+	return res;
+}
+
+static int growEntries(struct HashCache *cache, uint32_t count)
+{
+	struct HashCacheEntry *entries = realloc(cache->entries, count * sizeof(struct HashCacheEntry));
+	if (entries == NULL)
+		return EXIT_FAILURE;
+	cache->entries = entries;
+	cache->max     = count;
+	return EXIT_SUCCESS;
+}
+
+static int buildTable(struct HashCache *cache)
+{
+	// The table is kept at most half full
+	uint32_t size = 64;
+	while (size < cache->count * 2 + 2)
+		size *= 2;
+	uint32_t *table = calloc(size, sizeof(uint32_t));
+	if (table == NULL)
+		return EXIT_FAILURE;
+	free(cache->table);
+	cache->table     = table;
+	cache->tableSize = size;
+	uint32_t i;
+	for (i = 0; i < cache->count; ++i)
+	{
+		// A damaged cache may hold an inode twice, the later entry wins
+		uint32_t *slot = findSlot(cache, &cache->entries[i].key);
+		*slot = i + 1;
+	}
+	return EXIT_SUCCESS;
+}
+
+static uint32_t *findSlot(const struct HashCache *cache, const struct HashCacheKey *key)
+{
+	// The slot of the inode on the device, or the empty slot where it goes
+	uint64_t h = (key->ino ^ (key->dev << 32) ^ (key->dev >> 32)) * 0x9e3779b97f4a7c15ull;
+	uint32_t mask = cache->tableSize - 1;
+	uint32_t pos = (h >> 32) & mask;
+	while (1)
+	{
+		uint32_t *slot = &cache->table[pos];
+		if (*slot == 0)
+			return slot;
+		const struct HashCacheKey *k = &cache->entries[*slot - 1].key;
+		if (k->ino == key->ino && k->dev == key->dev)
+			return slot;
+		pos = (pos + 1) & mask;
+	}
+}
+
+static int cmpUsed(const void *e1, const void *e2)
+{
+	// The entries used last go first
+	uint32_t u1 = ((const struct HashCacheEntry *)e1)->used;
+	uint32_t u2 = ((const struct HashCacheEntry *)e2)->used;
+	if (u1 != u2)
+		return (u1 > u2) ? -1 : 1;
+	return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * hashcache.h
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef HASHCACHE_H
+#define HASHCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "hashalg.h"
+
+/*
+ * Cache of the file hashes (tags.info.hash) next to the index file. A file is known by its
+ * identity: the device, the inode, the size and the modification and the change times.
+ * Any write, truncation, rename over or attribute change of a file moves its change time,
+ * so a changed file is never found. A file changed less than HASHCACHE_RACY_SEC before the
+ * cache was opened is not stored: it could still change within the same timestamp.
+ * All integers are little-endian:
+ *   struct HashCacheHeader
+ *   count times struct HashCacheEntry in no particular order
+ * The cache holds up to HASHCACHE_MAX entries, the ones used last are kept. The hashes are
+ * those of the algorithm in the header, a cache of another algorithm starts empty.
+ */
+
+#define HASHCACHE_MAGIC      "TAGSHC02"
+#define HASHCACHE_MAGIC_LEN  8
+#define HASHCACHE_SUFFIX     ".hash"
+#define HASHCACHE_MAX        65536
+#define HASHCACHE_RACY_SEC   2
+
+struct HashCacheHeader
+{
+	char          magic[HASHCACHE_MAGIC_LEN];
+	uint32_t      generation;  // incremented by every save
+	uint32_t      count;
+	uint32_t      hashAlg;  // enum HashAlg
+};
+
+struct HashCacheKey
+{
+	uint64_t      dev;
+	uint64_t      ino;
+	uint64_t      size;
+	int64_t       mtimeSec;
+	int64_t       ctimeSec;
+	uint32_t      mtimeNsec;
+	uint32_t      ctimeNsec;
+};
+
+struct HashCacheEntry
+{
+	struct HashCacheKey key;
+	unsigned char hash[FILE_HASH_SIZE];
+	uint32_t      used;  // the generation of the last lookup or store
+};
+
+struct HashCache
+{
+	char          *path;
+	struct HashCacheEntry *entries;
+	uint32_t      count;
+	uint32_t      max;
+	uint32_t      *table;  // open addressing by the inode, indexes of the entries plus one
+	uint32_t      tableSize;
+	uint32_t      generation;
+	enum HashAlg  hashAlg;
+	time_t        racyTime;  // the files changed since it are not stored
+	int           changed;
+};
+
+struct stat64;
+
+struct HashCache *hashcacheOpen(const char *path, enum HashAlg alg, int create);
+int  hashcacheSave(struct HashCache *cache);
+void hashcacheFree(struct HashCache *cache);
+void hashcacheMakeKey(struct HashCacheKey *key, const struct stat64 *st);
+int  hashcacheLookup(struct HashCache *cache, const struct HashCacheKey *key, unsigned char *hash);
+int  hashcacheStore(struct HashCache *cache, const struct HashCacheKey *key, const unsigned char *hash);
+
+#endif // HASHCACHE_H
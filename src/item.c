@@ -20,8 +20,11 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #include "item.h"
+#include "digest.h"
+#include "utils.h"
 
 #define NAMES_INCREASE    10
 #define PROPS_INCREASE    10
@@ -29,15 +32,27 @@
 
 int itemSetProperty_(struct ItemStruct *item, struct PropertyStruct *prop);
 int itemInsertProperty(struct ItemStruct *item, struct PropertyStruct *prop);
+void itemRemoveProperty(struct ItemStruct *item, struct PropertyStruct **ptr);
+int itemIndexBuild(struct ItemStruct *item);
+void itemIndexInsert(struct ItemStruct *item, uint32_t hash, unsigned int pos);
+void itemIndexRemove(struct ItemStruct *item, unsigned int pos);
 int itemAddFileName_(struct ItemStruct *item, wchar_t *allocName);
 wchar_t **itemGetFileNameArrayAddrByNum(const struct ItemStruct *item, unsigned int pos);
 wchar_t **itemGetFileNameArrayAddrByName(const struct ItemStruct *item, const wchar_t *fileName);
 
-struct ItemStruct* itemInit(size_t fileSize, const wchar_t *fileHash)
+struct ItemStruct* itemInit(size_t fileSize, const unsigned char *fileHash)
 {
-	struct ItemStruct *item = malloc(sizeof(struct ItemStruct));
+	return itemInitArena(NULL, fileSize, fileHash);
+}
+
+struct ItemStruct *itemInitArena(struct TagArena *arena, size_t fileSize, const unsigned char *fileHash)
+{
+	// The item, its names and its properties are taken from the arena, NULL means the heap
+	// The hash is FILE_HASH_SIZE raw bytes, NULL gives a zero hash
+	struct ItemStruct *item = tagarenaAlloc(arena, sizeof(struct ItemStruct));
 	if (item != NULL)
 	{
+		item->arena         = arena;
 		item->fileNameMax   = 0;
 		item->fileNameCount = 0;
 		item->fileNames     = NULL;
@@ -45,13 +60,17 @@ struct ItemStruct* itemInit(size_t fileSize, const wchar_t *fileHash)
 		item->propsMax      = 0;
 		item->propsCount    = 0;
 		item->props         = NULL;
-		wcsncpy(item->hash, fileHash, FILE_HASH_LEN);
-		item->hash[FILE_HASH_LEN] = L'\0';
+		item->propsIndexMax = 0;
+		item->propsIndex    = NULL;
+		if (fileHash != NULL)
+			memcpy(item->hash, fileHash, FILE_HASH_SIZE);
+		else
+			memset(item->hash, 0, FILE_HASH_SIZE);
 	}
 	return item;
 }
 
-struct ItemStruct *itemInitFromRawData(size_t fSize, const wchar_t *fHash, const wchar_t *fName, const wchar_t *addPropStr, const wchar_t *setPropStr)
+struct ItemStruct *itemInitFromRawData(size_t fSize, const unsigned char *fHash, const wchar_t *fName, const wchar_t *addPropStr, const wchar_t *setPropStr)
 {
 	struct ItemStruct *item = itemInit(fSize, fHash);
 	if (item != NULL)
@@ -92,9 +111,10 @@ void itemFree(struct ItemStruct *item)
 				--cnt;
 			}
 		}
-		free(item->props);
+		tagarenaRelease(item->arena, item->props);
 	}
-	free(item);
+	tagarenaRelease(item->arena, item->propsIndex);
+	tagarenaRelease(item->arena, item);
 }
 
 int itemIsFileName(struct ItemStruct *item, const wchar_t *fileName)
@@ -109,7 +129,7 @@ int itemAddFileName(struct ItemStruct *item, const wchar_t *fileName)
 	if (itemIsFileName(item, fileName) != 0)
 		return EXIT_SUCCESS;
 
-	wchar_t *pName = malloc((wcslen(fileName) + 1) * sizeof(wchar_t));
+	wchar_t *pName = tagarenaAlloc(item->arena, (wcslen(fileName) + 1) * sizeof(wchar_t));
 	if (pName == NULL)
 		return EXIT_FAILURE;
 	wcscpy(pName, fileName);
@@ -117,7 +137,7 @@ int itemAddFileName(struct ItemStruct *item, const wchar_t *fileName)
 	if (itemAddFileName_(item, pName) == EXIT_SUCCESS)
 		return EXIT_SUCCESS;
 
-	free(pName);
+	tagarenaRelease(item->arena, pName);
 	return EXIT_FAILURE;
 }
 
@@ -127,12 +147,12 @@ void itemRemoveFileName(struct ItemStruct *item, const wchar_t *fileName)
 	if (pName != NULL)
 	{
 		--item->fileNameCount;
-		free(*pName);
+		tagarenaRelease(item->arena, *pName);
 		*pName = NULL;
 		if (item->fileNameCount == 0)
 		{
 			item->fileNameMax = 0;
-			free(item->fileNames);
+			tagarenaRelease(item->arena, item->fileNames);
 			item->fileNames = NULL;
 		}
 	}
@@ -158,11 +178,11 @@ void itemClearFileNames(struct ItemStruct *item)
 			if (nm != NULL)
 			{
 				*names = NULL;
-				free(nm);
+				tagarenaRelease(item->arena, nm);
 				--cnt;
 			}
 		}
-		free(item->fileNames);
+		tagarenaRelease(item->arena, item->fileNames);
 		item->fileNames = NULL;
 		item->fileNameCount = 0;
 		item->fileNameMax = 0;
@@ -171,7 +191,7 @@ void itemClearFileNames(struct ItemStruct *item)
 
 int itemIsEqual(const struct ItemStruct *item1, const struct ItemStruct *item2)
 {
-	if (item1->fileSize != item2->fileSize || item1->propsCount != item2->propsCount || wcscmp(item1->hash, item2->hash) != 0)
+	if (item1->fileSize != item2->fileSize || item1->propsCount != item2->propsCount || !digestIsEqual(item1->hash, item2->hash))
 		return 0;
 
 	const unsigned int propCnt = item1->propsCount;
@@ -190,16 +210,24 @@ int itemIsEqual(const struct ItemStruct *item1, const struct ItemStruct *item2)
 
 int itemMerge(struct ItemStruct *itemTo, struct ItemStruct *itemFrom)
 {
+	// The names and the properties are moved if both items share the allocator and copied otherwise
+	const int move = (itemTo->arena == itemFrom->arena);
 	while (itemFrom->fileNameCount != 0)
 	{
 		wchar_t **pName = itemGetFileNameArrayAddrByNum(itemFrom, 0);
-		if (!itemIsFileName(itemTo, *pName))
+		if (!move)
+		{
+			if (itemAddFileName(itemTo, *pName) != EXIT_SUCCESS)
+				return EXIT_FAILURE;
+			tagarenaRelease(itemFrom->arena, *pName);
+		}
+		else if (!itemIsFileName(itemTo, *pName))
 		{
 			if (itemAddFileName_(itemTo, *pName) != EXIT_SUCCESS)
 				return EXIT_FAILURE;
 		}
 		else
-			free(*pName);
+			tagarenaRelease(itemFrom->arena, *pName);
 
 		--itemFrom->fileNameCount;
 		*pName = NULL;
@@ -211,8 +239,20 @@ int itemMerge(struct ItemStruct *itemTo, struct ItemStruct *itemFrom)
 		struct PropertyStruct **ppT = itemGetPropertyPosByName(itemTo, propGetName(*ppF));
 		if (ppT == NULL)
 		{
-			if (itemInsertProperty(itemTo, *ppF) != EXIT_SUCCESS)
+			struct PropertyStruct *prop = *ppF;
+			if (!move)
+			{
+				prop = propCopy(itemTo->arena, prop);
+				if (prop == NULL)
+					return EXIT_FAILURE;
+				propFree(*ppF);
+			}
+			if (itemInsertProperty(itemTo, prop) != EXIT_SUCCESS)
+			{
+				if (!move)
+					propFree(prop);
 				return EXIT_FAILURE;
+			}
 		}
 		else
 		{
@@ -234,10 +274,9 @@ int itemMerge(struct ItemStruct *itemTo, struct ItemStruct *itemFrom)
 					*ppT = propT;
 				}
 			}
-			free(*ppF);
+			propFree(*ppF);
 		}
-		*ppF = NULL;
-		--itemFrom->propsCount;
+		itemRemoveProperty(itemFrom, ppF);
 	}
 
 	itemFree(itemFrom);
@@ -246,7 +285,7 @@ int itemMerge(struct ItemStruct *itemTo, struct ItemStruct *itemFrom)
 
 int itemSetProperty(struct ItemStruct *item, const wchar_t *name, const wchar_t *value)
 {
-	struct PropertyStruct *newProp = propInit(name, value);
+	struct PropertyStruct *newProp = propInitArena(item->arena, name, value);
 	if (newProp == NULL)
 		return EXIT_FAILURE;
 
@@ -290,7 +329,7 @@ int itemAddPropertiesRaw(struct ItemStruct *item, const wchar_t *rawVal)
 		struct PropertyStruct **pp = itemGetPropertyPosByName(item, name);
 		if (pp == NULL)
 		{
-			struct PropertyStruct *prop = propInit(name, valPos);
+			struct PropertyStruct *prop = propInitArena(item->arena, name, valPos);
 			if (prop == NULL)
 				return EXIT_FAILURE;
 			if (itemInsertProperty(item, prop) != EXIT_SUCCESS)
@@ -374,8 +413,7 @@ int itemDelPropertiesRaw(struct ItemStruct *item, const wchar_t *rawVal)
 			if (pp != NULL)
 			{
 				propFree(*pp);
-				*pp = NULL;
-				--item->propsCount;
+				itemRemoveProperty(item, pp);
 			}
 		}
 
@@ -429,39 +467,47 @@ int itemPropertyValueToString(const struct ItemStruct *item, unsigned int propNu
 	if (ptr == NULL)
 		return EXIT_FAILURE;
 
+	if (bufLen < 1)
+		return EXIT_FAILURE;
+
+	// The value is cut to bufLen - 1 characters if it is longer
 	struct PropertyStruct *prop = *ptr;
-	unsigned int cnt = prop->valCount;
-	int buffRem = bufLen - 1;
 	wchar_t *buffPos = strBuf;
-	unsigned int subvalNum = 0;
-	while (cnt != 0 && buffRem != 0)
+	const wchar_t *buffEnd = strBuf + bufLen - 1;
+	unsigned int i;
+	for (i = 0; i < prop->valCount && buffPos != buffEnd; ++i)
 	{
-		if (buffPos != strBuf)
-		{
-			--buffPos;
-			if (buffRem <= 1)
-				break;
+		if (i != 0)
 			*buffPos++ = L',';
-			--buffRem;
-		}
-		const wchar_t *subvalPos = propGetSubval(prop, subvalNum++, ByValue);
+		const wchar_t *subvalPos = propGetSubval(prop, i, ByValue);
 		if (subvalPos == NULL)
 			return EXIT_FAILURE;
-		wchar_t ch;
-		do
-		{
-			ch = *subvalPos++;
-			*buffPos = ch;
-			if (--buffRem == 0)
-				break;
-			++buffPos;
-		} while (ch != L'\0');
-		--cnt;
+		while (*subvalPos != L'\0' && buffPos != buffEnd)
+			*buffPos++ = *subvalPos++;
 	}
 	*buffPos = L'\0';
 	return EXIT_SUCCESS;
 }
 
+int itemPropertyValueLength(const struct ItemStruct *item, unsigned int propNum)
+{
+	// The characters itemPropertyValueToString needs without the terminator, -1 on error
+	struct PropertyStruct **ptr = itemGetPropArrayAddrByNum(item, propNum);
+	if (ptr == NULL)
+		return -1;
+	struct PropertyStruct *prop = *ptr;
+	size_t len = (prop->valCount != 0) ? prop->valCount - 1 : 0;
+	unsigned int i;
+	for (i = 0; i < prop->valCount; ++i)
+	{
+		const wchar_t *subval = propGetSubval(prop, i, ByValue);
+		if (subval == NULL)
+			return -1;
+		len += wcslen(subval);
+	}
+	return (len < INT_MAX) ? (int)len : -1;
+}
+
 struct PropertyStruct **itemGetPropArrayAddrByNum(const struct ItemStruct* item, unsigned int num)
 {
 	if (num < item->propsCount)
@@ -482,6 +528,9 @@ struct PropertyStruct **itemGetPropArrayAddrByNum(const struct ItemStruct* item,
 
 struct PropertyStruct **itemGetPropertyPosByName(const struct ItemStruct *item, const wchar_t *propName)
 {
+	if (item->propsIndex != NULL)
+		return itemGetPropertyPosByHash(item, propName, wcsFoldHash(propName));
+
 	unsigned int cnt = item->propsCount;
 	if (cnt > 0)
 	{
@@ -501,6 +550,25 @@ struct PropertyStruct **itemGetPropertyPosByName(const struct ItemStruct *item,
 	return NULL;
 }
 
+struct PropertyStruct **itemGetPropertyPosByHash(const struct ItemStruct *item, const wchar_t *propName, uint32_t hash)
+{
+	// The hash is wcsFoldHash of the name, known to the caller
+	if (item->propsIndex == NULL)
+		return itemGetPropertyPosByName(item, propName);
+
+	unsigned int mask = item->propsIndexMax - 1;
+	unsigned int i = hash & mask;
+	const struct ItemPropSlot *slot;
+	while ((slot = &item->propsIndex[i])->pos != 0)
+	{
+		struct PropertyStruct **ptr = &item->props[slot->pos - 1];
+		if (slot->hash == hash && wcscasecmp(propName, propGetName(*ptr)) == 0)
+			return ptr;
+		i = (i + 1) & mask;
+	}
+	return NULL;
+}
+
 /**************************** Private ********************************/
 
 int itemSetProperty_(struct ItemStruct *item, struct PropertyStruct *prop)
@@ -524,9 +592,9 @@ int itemInsertProperty(struct ItemStruct *item, struct PropertyStruct *prop)
 	{
 		struct PropertyStruct **newPtr;
 		if (max == 0)
-			newPtr = malloc(sizeof(struct PropertyStruct *) * PROPS_INCREASE);
+			newPtr = tagarenaAlloc(item->arena, sizeof(struct PropertyStruct *) * PROPS_INCREASE);
 		else
-			newPtr = realloc(item->props, sizeof(struct PropertyStruct *) * (max + PROPS_INCREASE));
+			newPtr = tagarenaRealloc(item->arena, item->props, sizeof(struct PropertyStruct *) * max, sizeof(struct PropertyStruct *) * (max + PROPS_INCREASE));
 		if (newPtr == NULL)
 			return EXIT_FAILURE;
 
@@ -535,6 +603,7 @@ int itemInsertProperty(struct ItemStruct *item, struct PropertyStruct *prop)
 		item->props[max] = prop;
 		item->propsMax   += PROPS_INCREASE;
 		++item->propsCount;
+		itemIndexInsert(item, wcsFoldHash(propGetName(prop)), max);
 		return EXIT_SUCCESS;
 	}
 
@@ -544,10 +613,97 @@ int itemInsertProperty(struct ItemStruct *item, struct PropertyStruct *prop)
 			break;
 	*ptr = prop;
 	++item->propsCount;
+	itemIndexInsert(item, wcsFoldHash(propGetName(prop)), ptr - item->props);
+
+	return EXIT_SUCCESS;
+}
 
+void itemRemoveProperty(struct ItemStruct *item, struct PropertyStruct **ptr)
+{
+	// The property itself is already freed or moved by the caller
+	*ptr = NULL;
+	--item->propsCount;
+	itemIndexRemove(item, ptr - item->props);
+}
+
+int itemIndexBuild(struct ItemStruct *item)
+{
+	// The index is kept at most half full
+	unsigned int max = 16;
+	while (max < item->propsCount * 2)
+		max *= 2;
+	struct ItemPropSlot *index = tagarenaCalloc(item->arena, max * sizeof(struct ItemPropSlot));
+	if (index == NULL)
+		return EXIT_FAILURE;
+	tagarenaRelease(item->arena, item->propsIndex);
+	item->propsIndex    = index;
+	item->propsIndexMax = max;
+	unsigned int pos;
+	for (pos = 0; pos < item->propsMax; ++pos)
+	{
+		struct PropertyStruct *prop = item->props[pos];
+		if (prop == NULL)
+			continue;
+		uint32_t hash = wcsFoldHash(propGetName(prop));
+		unsigned int i = hash & (max - 1);
+		while (index[i].pos != 0)
+			i = (i + 1) & (max - 1);
+		index[i].hash = hash;
+		index[i].pos  = pos + 1;
+	}
 	return EXIT_SUCCESS;
 }
 
+void itemIndexInsert(struct ItemStruct *item, uint32_t hash, unsigned int pos)
+{
+	// Without the memory for the index the names are still found by the linear search
+	if (item->propsIndex == NULL || item->propsCount * 2 > item->propsIndexMax)
+	{
+		if (item->propsCount > ITEM_PROPS_INDEX_MIN && itemIndexBuild(item) != EXIT_SUCCESS)
+		{
+			tagarenaRelease(item->arena, item->propsIndex);
+			item->propsIndex    = NULL;
+			item->propsIndexMax = 0;
+		}
+		return;
+	}
+	unsigned int mask = item->propsIndexMax - 1;
+	unsigned int i = hash & mask;
+	while (item->propsIndex[i].pos != 0)
+		i = (i + 1) & mask;
+	item->propsIndex[i].hash = hash;
+	item->propsIndex[i].pos  = pos + 1;
+}
+
+void itemIndexRemove(struct ItemStruct *item, unsigned int pos)
+{
+	if (item->propsIndex == NULL)
+		return;
+	unsigned int mask = item->propsIndexMax - 1;
+	struct ItemPropSlot *index = item->propsIndex;
+	unsigned int i;
+	for (i = 0; index[i].pos != pos + 1; ++i)
+		if (i == mask)
+			return;
+
+	// The following slots of the probe chain are moved back, so no tombstones are needed
+	unsigned int j = i;
+	for ( ; ; )
+	{
+		index[i].pos = 0;
+		unsigned int home;
+		do
+		{
+			j = (j + 1) & mask;
+			if (index[j].pos == 0)
+				return;
+			home = index[j].hash & mask;
+		} while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+		index[i] = index[j];
+		i = j;
+	}
+}
+
 int itemAddFileName_(struct ItemStruct *item, wchar_t *allocName)
 {
 	unsigned int max = item->fileNameMax;
@@ -556,9 +712,9 @@ int itemAddFileName_(struct ItemStruct *item, wchar_t *allocName)
 	{
 		wchar_t **newPtr;
 		if (max == 0)
-			newPtr = malloc(sizeof(wchar_t *) * NAMES_INCREASE);
+			newPtr = tagarenaAlloc(item->arena, sizeof(wchar_t *) * NAMES_INCREASE);
 		else
-			newPtr = realloc(item->fileNames, sizeof(wchar_t *) * (max + NAMES_INCREASE));
+			newPtr = tagarenaRealloc(item->arena, item->fileNames, sizeof(wchar_t *) * max, sizeof(wchar_t *) * (max + NAMES_INCREASE));
 		if (newPtr == NULL)
 			return EXIT_FAILURE;
 
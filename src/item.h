@@ -23,24 +23,42 @@
 
 #include <stddef.h>
 #include <wchar.h>
+#include <stdint.h>
 
 #include "property.h"
 #include "common.h"
 
+/*
+ * The properties of an item with more than ITEM_PROPS_INDEX_MIN of them are also found through
+ * an open-addressing hash index keyed by the case-folded name. A slot holds the hash and
+ * the position in the props array plus one, 0 marks a free slot.
+ */
+#define ITEM_PROPS_INDEX_MIN  8
+
+struct ItemPropSlot
+{
+	uint32_t              hash;
+	uint32_t              pos;
+};
+
 struct ItemStruct
 {
 	size_t                fileSize;
-	wchar_t               hash[FILE_HASH_LEN + 1];
+	unsigned char         hash[FILE_HASH_SIZE];
 	unsigned int          fileNameMax;
 	unsigned int          fileNameCount;
 	wchar_t               **fileNames;
 	unsigned int          propsMax;
 	unsigned int          propsCount;
 	struct PropertyStruct **props;
+	unsigned int          propsIndexMax;
+	struct ItemPropSlot   *propsIndex;
+	struct TagArena       *arena;
 };
 
-struct ItemStruct *itemInit(size_t fileSize, const wchar_t *fileHash);
-struct ItemStruct *itemInitFromRawData(size_t fSize, const wchar_t *fHash, const wchar_t *fName, const wchar_t *addPropStr, const wchar_t *setPropStr);
+struct ItemStruct *itemInit(size_t fileSize, const unsigned char *fileHash);
+struct ItemStruct *itemInitArena(struct TagArena *arena, size_t fileSize, const unsigned char *fileHash);
+struct ItemStruct *itemInitFromRawData(size_t fSize, const unsigned char *fHash, const wchar_t *fName, const wchar_t *addPropStr, const wchar_t *setPropStr);
 void itemFree(struct ItemStruct *item);
 int itemIsFileName(struct ItemStruct *item, const wchar_t *fileName);
 int itemAddFileName(struct ItemStruct *item, const wchar_t *fileName);
@@ -56,7 +74,9 @@ int itemSetPropertiesRaw(struct ItemStruct *item, const wchar_t *rawVal);
 int itemDelPropertiesRaw(struct ItemStruct *item, const wchar_t *rawVal);
 const wchar_t *itemPropertyGetName(const struct ItemStruct *item, unsigned int propNum);
 int itemPropertyValueToString(const struct ItemStruct *item, unsigned int propNum, wchar_t *strBuf, int bufLen);
+int itemPropertyValueLength(const struct ItemStruct *item, unsigned int propNum);
 struct PropertyStruct **itemGetPropArrayAddrByNum(const struct ItemStruct *item, unsigned int num);
 struct PropertyStruct **itemGetPropertyPosByName(const struct ItemStruct *item, const wchar_t *propName);
+struct PropertyStruct **itemGetPropertyPosByHash(const struct ItemStruct *item, const wchar_t *propName, uint32_t hash);
 
 #endif // ITEM_H
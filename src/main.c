@@ -25,6 +25,7 @@
 #include <limits.h>
 #include <locale.h>
 #include <wchar.h>
+#include <unistd.h>
 
 #include "common.h"
 #include "tags.h"
@@ -35,7 +36,20 @@
 enum WarnMode { WarnNone, WarnOptions, WarnFiles, WarnOther };
 
 enum {
-	MoveFileOption = CHAR_MAX + 1
+	MoveFileOption = CHAR_MAX + 1,
+	FormatOption,
+	OffsetIndexOption,
+	JournalOption,
+	CompactOption,
+	DurabilityOption,
+	InvertedIndexOption,
+	ExplainOption,
+	JobsOption,
+	ReadBufferOption,
+	MmapOption,
+	IoUringOption,
+	HashCacheOption,
+	HashOption
 };
 
 struct option long_options[] = {
@@ -52,6 +66,19 @@ struct option long_options[] = {
 	{ "version",      no_argument,       NULL, 'v' },
 	{ "where",        required_argument, NULL, 'w' },
 	{ "move-file",    no_argument,       NULL, MoveFileOption },
+	{ "format",       required_argument, NULL, FormatOption },
+	{ "offset-index", no_argument,       NULL, OffsetIndexOption },
+	{ "journal",      no_argument,       NULL, JournalOption },
+	{ "compact",      no_argument,       NULL, CompactOption },
+	{ "durability",   required_argument, NULL, DurabilityOption },
+	{ "inverted-index", no_argument,     NULL, InvertedIndexOption },
+	{ "explain",      no_argument,       NULL, ExplainOption },
+	{ "jobs",         required_argument, NULL, JobsOption },
+	{ "read-buffer",  required_argument, NULL, ReadBufferOption },
+	{ "mmap",         no_argument,       NULL, MmapOption },
+	{ "io-uring",     no_argument,       NULL, IoUringOption },
+	{ "hash-cache",   no_argument,       NULL, HashCacheOption },
+	{ "hash",         required_argument, NULL, HashOption },
 	{ NULL,           0,                 NULL, 0   }
 };
 
@@ -65,6 +92,8 @@ wchar_t *delOptArg  = NULL;
 wchar_t *setOptArg  = NULL;
 wchar_t *whrOptArg  = NULL;
 wchar_t *fieldsList = NULL;
+char    *formatArg  = NULL;
+char    *hashArg    = NULL;
 
 int main(int argc, char *argv[])
 {
@@ -121,6 +150,90 @@ int main(int argc, char *argv[])
 			case MoveFileOption:
 				flags |= MoveFileFlag;
 				break;
+			case FormatOption:
+				flags |= FormatFlag;
+				formatArg = optarg;
+				break;
+			case HashOption:
+				flags |= HashFlag;
+				hashArg = optarg;
+				break;
+			case OffsetIndexOption:
+				flags |= OffsetIndexFlag;
+				break;
+			case JournalOption:
+				flags |= JournalFlag;
+				break;
+			case CompactOption:
+				flags |= CompactFlag;
+				break;
+			case InvertedIndexOption:
+				flags |= InvertedIndexFlag;
+				break;
+			case ExplainOption:
+				flags |= ExplainFlag;
+				break;
+			case DurabilityOption:
+				if (strcmp(optarg, "none") == 0)
+					durability = DurabilityNone;
+				else if (strcmp(optarg, "file") == 0)
+					durability = DurabilityFile;
+				else if (strcmp(optarg, "full") == 0)
+					durability = DurabilityFull;
+				else
+				{
+					fprintf(stderr, "Error: unknown durability mode %s\n", optarg);
+					res = EXIT_FAILURE;
+				}
+				break;
+			case JobsOption:
+				{
+					// 0 means one job for every online processor
+					char *end;
+					unsigned long n = strtoul(optarg, &end, 10);
+					if (optarg[0] == '\0' || *end != '\0' || optarg[0] == '-' || n > HASH_JOBS_MAX)
+					{
+						fprintf(stderr, "Error: invalid number of jobs %s\n", optarg);
+						res = EXIT_FAILURE;
+						break;
+					}
+					if (n == 0)
+					{
+						long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+						n = (cpus < 1) ? 1 : (cpus > HASH_JOBS_MAX) ? HASH_JOBS_MAX : cpus;
+					}
+					hashJobs = n;
+				}
+				break;
+			case ReadBufferOption:
+				{
+					// The size in bytes, K and M suffixes multiply it by 1024 and 1048576
+					char *end;
+					unsigned long n = strtoul(optarg, &end, 10);
+					if (*end == 'K' || *end == 'k')
+						n = (n > HASH_BUFFER_MAX / 1024) ? HASH_BUFFER_MAX + 1UL : n * 1024;
+					else if (*end == 'M' || *end == 'm')
+						n = (n > HASH_BUFFER_MAX / 1048576) ? HASH_BUFFER_MAX + 1UL : n * 1048576;
+					else
+						--end;
+					if (optarg[0] == '\0' || optarg[0] == '-' || end[1] != '\0' || n < HASH_BUFFER_MIN || n > HASH_BUFFER_MAX)
+					{
+						fprintf(stderr, "Error: invalid size of the read buffer %s\n", optarg);
+						res = EXIT_FAILURE;
+						break;
+					}
+					hashBufferSize = n;
+				}
+				break;
+			case MmapOption:
+				hashRead = HashReadMmap;
+				break;
+			case IoUringOption:
+				hashIo = HashIoUring;
+				break;
+			case HashCacheOption:
+				hashCacheCreate = 1;
+				break;
 			default:
 				showWarning(WarnOther);
 				res = EXIT_FAILURE;
@@ -135,11 +248,49 @@ int main(int argc, char *argv[])
 	if (addOptArg == NULL && delOptArg == NULL && setOptArg == NULL)
 	{
 		int filesCnt = argc - optind;
-		if (flags == InitFlag) // -c option
+		if ((flags & ~(FormatFlag | HashFlag | OffsetIndexFlag | InvertedIndexFlag | JournalFlag)) == InitFlag) // -c option
+		{
+			if (filesCnt == 0 && whrOptArg == NULL && fieldsList == NULL)
+			{
+				res = tagsCreateIndex(formatArg, hashArg);
+				if (res == EXIT_SUCCESS && (flags & OffsetIndexFlag) != 0)
+					res = tagsBuildOffsetIndex();
+				if (res == EXIT_SUCCESS && (flags & InvertedIndexFlag) != 0)
+					res = tagsBuildInvertedIndex();
+				if (res == EXIT_SUCCESS && (flags & JournalFlag) != 0)
+					res = tagsEnableJournal();
+				warn = WarnNone;
+			}
+		}
+		else if (flags == OffsetIndexFlag) // --offset-index option
+		{
+			if (filesCnt == 0 && whrOptArg == NULL && fieldsList == NULL)
+			{
+				res = tagsBuildOffsetIndex();
+				warn = WarnNone;
+			}
+		}
+		else if (flags == InvertedIndexFlag) // --inverted-index option
+		{
+			if (filesCnt == 0 && whrOptArg == NULL && fieldsList == NULL)
+			{
+				res = tagsBuildInvertedIndex();
+				warn = WarnNone;
+			}
+		}
+		else if (flags == JournalFlag) // --journal option
+		{
+			if (filesCnt == 0 && whrOptArg == NULL && fieldsList == NULL)
+			{
+				res = tagsEnableJournal();
+				warn = WarnNone;
+			}
+		}
+		else if (flags == CompactFlag) // --compact option
 		{
 			if (filesCnt == 0 && whrOptArg == NULL && fieldsList == NULL)
 			{
-				res = tagsCreateIndex();
+				res = tagsCompactJournal();
 				warn = WarnNone;
 			}
 		}
@@ -158,7 +309,7 @@ int main(int argc, char *argv[])
 		}
 		else if ((flags & ListFlag) != 0) // -l option
 		{
-			if ((flags & ~(ListFlag | RecurFlag)) == 0 && filesCnt == 0)
+			if ((flags & ~(ListFlag | RecurFlag | ExplainFlag)) == 0 && filesCnt == 0)
 			{
 				res = tagsList(fieldsList, whrOptArg);
 				warn = WarnNone;
@@ -221,6 +372,58 @@ void showHelp()
 		"  -c, --create-index\n"
 		"          creates empty index file in the current directory and exit.\n"
 		"          The index file is created only if it is not present\n"
+		"  --format FORMAT\n"
+		"          format of the index file for -c key: simple (default), binary or\n"
+		"          compressed.\n"
+		"          The format of an existing index is detected automatically\n"
+		"  --hash HASH\n"
+		"          the hash the files are identified by, for -c key: sha1 (default), xxh128\n"
+		"          (fast, not cryptographic) or sha256. The hash of an existing index\n"
+		"          and the size of its digest are read from its header.\n"
+		"          sha1-tree, xxh128-tree and sha256-tree hash the chunks of 1 MB of a file\n"
+		"          into a tree, so a large file is hashed by all threads of --jobs key\n"
+		"  --offset-index\n"
+		"          builds the offset index (tags.info.idx) for the index file in the current\n"
+		"          directory, can be used with -c key. Once created, it is kept up to date\n"
+		"          by the commands that modify the index and speeds up a search of files\n"
+		"  --inverted-index\n"
+		"          builds the inverted index (tags.info.inv) of the parameter values for the\n"
+		"          index file in the current directory, can be used with -c key. Once created,\n"
+		"          it is kept up to date and speeds up the -l key with the -w conditions\n"
+		"  --explain\n"
+		"          used with -l key: runs the search without printing the files and shows\n"
+		"          the plan: the order of the conditions, the use of the inverted index and\n"
+		"          the estimated and the actual numbers of the items\n"
+		"  --journal\n"
+		"          creates the change journal (tags.info.journal) for the index file in the\n"
+		"          current directory, can be used with -c key. While the journal exists the\n"
+		"          commands append their changes to it instead of rewriting the index.\n"
+		"          The journal is merged into the index once it is larger than 64 KB and\n"
+		"          than a quarter of the index\n"
+		"  --compact\n"
+		"          merges the change journal into the index file and empties the journal\n"
+		"  --durability MODE\n"
+		"          how the changes of the index are flushed to the disk: none (left to\n"
+		"          the system), file (the new index file is synced before it replaces the\n"
+		"          old one) or full (default, the directory is synced too)\n"
+		"  --jobs N\n"
+		"          used with -a, -d and -s keys: the number of the threads that compute\n"
+		"          the hashes of the files, 1 by default, 0 means one for every processor\n"
+		"  --read-buffer SIZE\n"
+		"          the size of the buffer the files are hashed by, in bytes or with K or M\n"
+		"          suffix, from 4K to 256M. By default it is 1M or the size of a smaller file\n"
+		"  --mmap\n"
+		"          the files are mapped to the memory instead of read while hashed. The files\n"
+		"          must not be truncated by other programs meanwhile\n"
+		"  --io-uring\n"
+		"          used with -a, -d and -s keys: every hashing thread keeps the reads of\n"
+		"          several files in flight through io_uring. Without the kernel support the\n"
+		"          files are read as usual\n"
+		"  --hash-cache\n"
+		"          used with -a and -s keys: creates the cache of the file hashes\n"
+		"          (tags.info.hash) next to the index file if it is not present. Once\n"
+		"          created, the hashes of the files that have not changed since they were\n"
+		"          hashed are taken from it instead of reading the files\n"
 		"  -d, --remove-value DELETE_LIST\n"
 		"          removes information about the specified files, their parameters or\n"
 		"          the individual values of parameters from the index\n"
@@ -19,13 +19,23 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "property.h"
+#include "utils.h"
 
 #define PROP_SUBVAL_AV_LENGTH  5
 #define SUBVAL_SEPARATOR       L','
 
 void propFreeIndexes(struct PropertyStruct *prop);
+void propFreeLookup(struct PropertyStruct *prop);
+void propLookupAdd(struct PropertyStruct *prop, unsigned int offset);
+void propLookupRemove(struct PropertyStruct *prop, unsigned int offset);
+int propHashBuild(struct PropertyStruct *prop);
+void propHashInsert(struct PropertyStruct *prop, uint32_t hash, unsigned int offset);
+int propOrderBuild(struct PropertyStruct *prop, struct SubvalHandle **sorted);
+int propOrderInsert(struct PropertyStruct *prop, unsigned int offset);
+unsigned int propOrderFind(const struct PropertyStruct *prop, const wchar_t *value, unsigned int cnt);
 int subvalCompareByValue(const void *p1, const void *p2);
 int subvalCompareByUser(const void *p1, const void *p2);
 struct SubvalHandle *propIsSubval_(const struct PropertyStruct *prop, const wchar_t *subval, unsigned int len);
@@ -33,6 +43,12 @@ int trimString(const wchar_t **pStartChar, const wchar_t **pEndChar);
 
 struct PropertyStruct *propInit(const wchar_t *name, const wchar_t *value)
 {
+	return propInitArena(NULL, name, value);
+}
+
+struct PropertyStruct *propInitArena(struct TagArena *arena, const wchar_t *name, const wchar_t *value)
+{
+	// The property and everything it allocates later are taken from the arena, NULL means the heap
 	{
 		const wchar_t ch = name[0];
 		if (ch == L'!')
@@ -48,9 +64,10 @@ struct PropertyStruct *propInit(const wchar_t *name, const wchar_t *value)
 	unsigned int size = sizeWithoutValues;
 	size += (sizeof(struct SubvalHandle) + PROP_SUBVAL_AV_LENGTH) * (valLen / PROP_SUBVAL_AV_LENGTH + 1);
 	size  = (size + sizeof(void *) - 1) & (~(sizeof(void *) - 1)); // alignment
-	struct PropertyStruct *prop = malloc(size);
+	struct PropertyStruct *prop = tagarenaAlloc(arena, size);
 	if (prop == NULL)
 		return NULL;
+	prop->arena = arena;
 	prop->maxSize = size;
 	prop->blkCount = 0;
 
@@ -66,6 +83,10 @@ struct PropertyStruct *propInit(const wchar_t *name, const wchar_t *value)
 	prop->arrayByValue = NULL;
 	prop->arrayByUser = NULL;
 	prop->userData = 0;
+	prop->hashMax = 0;
+	prop->hashSet = NULL;
+	prop->orderMax = 0;
+	prop->orderByValue = NULL;
 
 	if (value != NULL)
 	{
@@ -97,7 +118,7 @@ struct PropertyStruct *propInit(const wchar_t *name, const wchar_t *value)
 				unsigned int newCurSize = prop->curSize + subvalSize;
 				if (prop->maxSize < newCurSize)
 				{
-					struct PropertyStruct *newProp = realloc(prop, newCurSize);
+					struct PropertyStruct *newProp = tagarenaRealloc(arena, prop, prop->maxSize, newCurSize);
 					if (newProp == NULL)
 					{
 						propFree(prop);
@@ -116,6 +137,7 @@ struct PropertyStruct *propInit(const wchar_t *name, const wchar_t *value)
 				pCh[len] = L'\0';
 				++prop->blkCount;
 				++prop->valCount;
+				propLookupAdd(prop, curSubvalOffset);
 				curSubvalOffset += subvalSize;
 			}
 
@@ -135,7 +157,27 @@ struct PropertyStruct *propInit(const wchar_t *name, const wchar_t *value)
 void propFree(struct PropertyStruct *prop)
 {
 	propFreeIndexes(prop);
-	free(prop);
+	propFreeLookup(prop);
+	tagarenaRelease(prop->arena, prop);
+}
+
+struct PropertyStruct *propCopy(struct TagArena *arena, const struct PropertyStruct *prop)
+{
+	// The values are copied as they are, the indexes of the copy are made again when needed
+	struct PropertyStruct *newProp = tagarenaAlloc(arena, prop->curSize);
+	if (newProp == NULL)
+		return NULL;
+	memcpy(newProp, prop, prop->curSize);
+	newProp->maxSize = prop->curSize;
+	newProp->arrayDirect = NULL;
+	newProp->arrayByValue = NULL;
+	newProp->arrayByUser = NULL;
+	newProp->hashMax = 0;
+	newProp->hashSet = NULL;
+	newProp->orderMax = 0;
+	newProp->orderByValue = NULL;
+	newProp->arena = arena;
+	return newProp;
 }
 
 const wchar_t *propGetName(const struct PropertyStruct *prop)
@@ -199,11 +241,20 @@ struct SubvalHandle  **propGetValueIndex(struct PropertyStruct *prop, enum PropS
 	if (*ppArray != NULL)
 		return *ppArray;
 
-	struct SubvalHandle  **pArray = malloc(prop->valCount * sizeof(struct SubvalHandle *));
+	struct SubvalHandle  **pArray = tagarenaAlloc(prop->arena, prop->valCount * sizeof(struct SubvalHandle *));
 	*ppArray = pArray;
 	if (pArray == NULL)
 		return NULL;
 
+	if (order == ByValue && prop->orderByValue != NULL)
+	{
+		// The order is kept up to date by the changes, only the pointers are to be made
+		unsigned int i;
+		for (i = 0; i < cnt; ++i)
+			pArray[i] = (void *)prop + prop->orderByValue[i];
+		return pArray;
+	}
+
 	struct SubvalHandle *pSubval = (void *)prop + prop->valuesOffset;
 	while (cnt != 0)
 	{
@@ -216,7 +267,10 @@ struct SubvalHandle  **propGetValueIndex(struct PropertyStruct *prop, enum PropS
 	}
 
 	if (order == ByValue)
+	{
 		qsort(*ppArray, prop->valCount, sizeof(struct SubvalHandle *), subvalCompareByValue);
+		propOrderBuild(prop, *ppArray);
+	}
 	else if (order == ByUser)
 		qsort(*ppArray, prop->valCount, sizeof(struct SubvalHandle *), subvalCompareByUser);
 
@@ -275,7 +329,7 @@ struct PropertyStruct* propAddSubval(struct PropertyStruct *prop, const wchar_t
 			return prop;
 		if (propIsEmpty(prop))
 		{
-			struct PropertyStruct *newProp = propInit(propGetName(prop), value);
+			struct PropertyStruct *newProp = propInitArena(prop->arena, propGetName(prop), value);
 			if (newProp != NULL)
 			{
 				newProp->userData = prop->userData;
@@ -317,10 +371,13 @@ struct PropertyStruct* propAddSubval(struct PropertyStruct *prop, const wchar_t
 		unsigned int newSize = prop->curSize + subvalSize;
 		if (prop->maxSize < newSize)
 		{
-			newProp = realloc(prop, newSize);
+			// The growth is geometric, so a property collecting many values is not copied for every one
+			unsigned int maxSize = newSize + newSize / 2;
+			maxSize = (maxSize + sizeof(void *) - 1) & (~(sizeof(void *) - 1)); // alignment
+			newProp = tagarenaRealloc(prop->arena, prop, prop->maxSize, maxSize);
 			if (newProp == NULL)
 				return NULL;
-			newProp->maxSize = newSize;
+			newProp->maxSize = maxSize;
 		}
 		newProp->curSize = newSize;
 		++newProp->blkCount;
@@ -336,6 +393,7 @@ struct PropertyStruct* propAddSubval(struct PropertyStruct *prop, const wchar_t
 	pCh[valLen] = L'\0';
 
 	propFreeIndexes(newProp);
+	propLookupAdd(newProp, (void *)pSubval - (void *)newProp);
 	return newProp;
 }
 
@@ -359,27 +417,21 @@ int propDelSubvalues(struct PropertyStruct **pp, const wchar_t *value)
 		if (pEnd != NULL)
 			*pEnd = L'\0';
 
-		struct SubvalHandle *pSubval = (void *)prop + prop->valuesOffset;
-		unsigned int cnt = prop->valCount;
-		while (cnt > 0)
+		struct SubvalHandle *pSubval = propIsSubval(prop, pStart);
+		if (pSubval != NULL)
 		{
-			if (pSubval->subvalStatus == Used)
+			if (prop->valCount != 1)
 			{
-				wchar_t *val = (void *)pSubval + sizeof(struct SubvalHandle);
-				if (wcscasecmp(val, pStart) == 0)
-				{
-					if (prop->valCount != 1)
-					{
-						pSubval->subvalStatus = NotUsed;
-						--prop->valCount;
-					}
-					else
-						val[0] = L'\0';
-					break;
-				}
-				--cnt;
+				propLookupRemove(prop, (void *)pSubval - (void *)prop);
+				pSubval->subvalStatus = NotUsed;
+				--prop->valCount;
+			}
+			else
+			{
+				// The value becomes empty, the lookup has nothing left to keep
+				propFreeLookup(prop);
+				((wchar_t *)((void *)pSubval + sizeof(struct SubvalHandle)))[0] = L'\0';
 			}
-			pSubval = (void *)pSubval + pSubval->subvalSize;
 		}
 
 		if (pEnd == NULL)
@@ -403,21 +455,177 @@ void propFreeIndexes(struct PropertyStruct *prop)
 {
 	if (prop->arrayDirect != NULL)
 	{
-		free(prop->arrayDirect);
+		tagarenaRelease(prop->arena, prop->arrayDirect);
 		prop->arrayDirect = NULL;
 	}
 	if (prop->arrayByValue != NULL)
 	{
-		free(prop->arrayByValue);
+		tagarenaRelease(prop->arena, prop->arrayByValue);
 		prop->arrayByValue = NULL;
 	}
 	if (prop->arrayByUser != NULL)
 	{
-		free(prop->arrayByUser);
+		tagarenaRelease(prop->arena, prop->arrayByUser);
 		prop->arrayByUser = NULL;
 	}
 }
 
+void propFreeLookup(struct PropertyStruct *prop)
+{
+	tagarenaRelease(prop->arena, prop->hashSet);
+	prop->hashSet = NULL;
+	prop->hashMax = 0;
+	tagarenaRelease(prop->arena, prop->orderByValue);
+	prop->orderByValue = NULL;
+	prop->orderMax = 0;
+}
+
+void propLookupAdd(struct PropertyStruct *prop, unsigned int offset)
+{
+	// The subvalue at the offset is already counted in valCount, on a memory failure the lookup is dropped
+	const wchar_t *str = subvalString((void *)prop + offset);
+	if (prop->hashSet != NULL && prop->valCount * 2 <= prop->hashMax)
+		propHashInsert(prop, wcsFoldHash(str), offset);
+	else if (prop->valCount > PROP_SUBVAL_INDEX_MIN && propHashBuild(prop) != EXIT_SUCCESS)
+	{
+		tagarenaRelease(prop->arena, prop->hashSet);
+		prop->hashSet = NULL;
+		prop->hashMax = 0;
+	}
+
+	if (prop->orderByValue != NULL && propOrderInsert(prop, offset) != EXIT_SUCCESS)
+	{
+		tagarenaRelease(prop->arena, prop->orderByValue);
+		prop->orderByValue = NULL;
+		prop->orderMax = 0;
+	}
+}
+
+void propLookupRemove(struct PropertyStruct *prop, unsigned int offset)
+{
+	// The subvalue at the offset is still counted in valCount
+	const wchar_t *str = subvalString((void *)prop + offset);
+	if (prop->orderByValue != NULL)
+	{
+		unsigned int cnt = prop->valCount;
+		unsigned int pos = propOrderFind(prop, str, cnt);
+		memmove(&prop->orderByValue[pos], &prop->orderByValue[pos + 1], (cnt - pos - 1) * sizeof(unsigned int));
+	}
+
+	if (prop->hashSet == NULL)
+		return;
+	unsigned int mask = prop->hashMax - 1;
+	struct PropSubvalSlot *set = prop->hashSet;
+	unsigned int i = wcsFoldHash(str) & mask;
+	while (set[i].offset != offset)
+		i = (i + 1) & mask;
+
+	// The following slots of the probe chain are moved back, so no tombstones are needed
+	unsigned int j = i;
+	for ( ; ; )
+	{
+		set[i].offset = 0;
+		unsigned int home;
+		do
+		{
+			j = (j + 1) & mask;
+			if (set[j].offset == 0)
+				return;
+			home = set[j].hash & mask;
+		} while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+		set[i] = set[j];
+		i = j;
+	}
+}
+
+int propHashBuild(struct PropertyStruct *prop)
+{
+	// The set is kept at most half full
+	unsigned int max = 16;
+	while (max < prop->valCount * 2)
+		max *= 2;
+	struct PropSubvalSlot *set = tagarenaCalloc(prop->arena, max * sizeof(struct PropSubvalSlot));
+	if (set == NULL)
+		return EXIT_FAILURE;
+	tagarenaRelease(prop->arena, prop->hashSet);
+	prop->hashSet = set;
+	prop->hashMax = max;
+
+	unsigned int cnt = prop->valCount;
+	struct SubvalHandle *pSubval = (void *)prop + prop->valuesOffset;
+	while (cnt != 0)
+	{
+		if (pSubval->subvalStatus == Used)
+		{
+			propHashInsert(prop, wcsFoldHash(subvalString(pSubval)), (void *)pSubval - (void *)prop);
+			--cnt;
+		}
+		pSubval = (void *)pSubval + pSubval->subvalSize;
+	}
+	return EXIT_SUCCESS;
+}
+
+void propHashInsert(struct PropertyStruct *prop, uint32_t hash, unsigned int offset)
+{
+	unsigned int mask = prop->hashMax - 1;
+	unsigned int i = hash & mask;
+	while (prop->hashSet[i].offset != 0)
+		i = (i + 1) & mask;
+	prop->hashSet[i].hash   = hash;
+	prop->hashSet[i].offset = offset;
+}
+
+int propOrderBuild(struct PropertyStruct *prop, struct SubvalHandle **sorted)
+{
+	// Once asked for, the order by value is kept by the following changes instead of being sorted again
+	unsigned int cnt = prop->valCount;
+	unsigned int *order = tagarenaAlloc(prop->arena, cnt * sizeof(unsigned int));
+	if (order == NULL)
+		return EXIT_FAILURE;
+	unsigned int i;
+	for (i = 0; i < cnt; ++i)
+		order[i] = (void *)sorted[i] - (void *)prop;
+	tagarenaRelease(prop->arena, prop->orderByValue);
+	prop->orderByValue = order;
+	prop->orderMax = cnt;
+	return EXIT_SUCCESS;
+}
+
+int propOrderInsert(struct PropertyStruct *prop, unsigned int offset)
+{
+	// The new subvalue is counted in valCount but is not in the order yet
+	unsigned int cnt = prop->valCount - 1;
+	if (cnt == prop->orderMax)
+	{
+		unsigned int max = prop->orderMax * 2 + 8;
+		unsigned int *order = tagarenaRealloc(prop->arena, prop->orderByValue, prop->orderMax * sizeof(unsigned int), max * sizeof(unsigned int));
+		if (order == NULL)
+			return EXIT_FAILURE;
+		prop->orderByValue = order;
+		prop->orderMax = max;
+	}
+	unsigned int pos = propOrderFind(prop, subvalString((void *)prop + offset), cnt);
+	memmove(&prop->orderByValue[pos + 1], &prop->orderByValue[pos], (cnt - pos) * sizeof(unsigned int));
+	prop->orderByValue[pos] = offset;
+	return EXIT_SUCCESS;
+}
+
+unsigned int propOrderFind(const struct PropertyStruct *prop, const wchar_t *value, unsigned int cnt)
+{
+	// Returns the position of the first of cnt ordered subvalues not less than the value
+	unsigned int lo = 0;
+	unsigned int hi = cnt;
+	while (lo < hi)
+	{
+		unsigned int mid = lo + (hi - lo) / 2;
+		if (wcscmp(subvalString((void *)prop + prop->orderByValue[mid]), value) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
 int subvalCompareByValue(const void *p1, const void *p2)
 {
 	const struct SubvalHandle *subval1 = *(const struct SubvalHandle **)p1;
@@ -434,6 +642,26 @@ int subvalCompareByUser(const void *p1, const void *p2)
 
 struct SubvalHandle *propIsSubval_(const struct PropertyStruct *prop, const wchar_t *subval, unsigned int len)
 {
+	if (prop->hashSet != NULL)
+	{
+		uint32_t hash = wcsnFoldHash(subval, len);
+		unsigned int mask = prop->hashMax - 1;
+		unsigned int i = hash & mask;
+		const struct PropSubvalSlot *slot;
+		while ((slot = &prop->hashSet[i])->offset != 0)
+		{
+			if (slot->hash == hash)
+			{
+				struct SubvalHandle *pSubval = (void *)prop + slot->offset;
+				const wchar_t *pVal = subvalString(pSubval);
+				if (wcsncasecmp(pVal, subval, len) == 0 && pVal[len] == L'\0')
+					return pSubval;
+			}
+			i = (i + 1) & mask;
+		}
+		return NULL;
+	}
+
 	unsigned int cnt = prop->valCount;
 	struct SubvalHandle *pSubval = (void *)prop + prop->valuesOffset;
 	while (cnt != 0)
@@ -22,12 +22,28 @@
 #define PROPERTY_H
 
 #include <wchar.h>
+#include <stdint.h>
+
+#include "tagarena.h"
 
 enum PropSubvalOrder
 {
 	None, ByValue, ByUser
 };
 
+/*
+ * The subvalues of a property with more than PROP_SUBVAL_INDEX_MIN of them are also found through
+ * an open-addressing hash set keyed by the case-folded value. The slots and the order by value
+ * hold offsets from the start of the property, so they stay valid after realloc.
+ */
+#define PROP_SUBVAL_INDEX_MIN  8
+
+struct PropSubvalSlot
+{
+	uint32_t             hash;
+	unsigned int         offset;
+};
+
 struct PropertyStruct
 {
 	unsigned int         maxSize;
@@ -39,6 +55,11 @@ struct PropertyStruct
 	struct SubvalHandle  **arrayByValue;
 	struct SubvalHandle  **arrayByUser;
 	unsigned int         userData;
+	unsigned int         hashMax;
+	struct PropSubvalSlot *hashSet;
+	unsigned int         orderMax;
+	unsigned int         *orderByValue;
+	struct TagArena      *arena;
 };
 
 enum SubvalStatus { NotUsed, Used };
@@ -51,6 +72,8 @@ struct SubvalHandle
 };
 
 struct PropertyStruct *propInit(const wchar_t *name, const wchar_t *value);
+struct PropertyStruct *propInitArena(struct TagArena *arena, const wchar_t *name, const wchar_t *value);
+struct PropertyStruct *propCopy(struct TagArena *arena, const struct PropertyStruct *prop);
 void propFree(struct PropertyStruct *prop);
 const wchar_t *propGetName(const struct PropertyStruct *prop);
 int propIsEmpty(struct PropertyStruct *prop);
@@ -18,6 +18,9 @@
 #include "sha1.h"
 
 void SHA1Transform(uint32_t state[5], const unsigned char buffer[64]);
+static void SHA1Blocks(uint32_t state[5], const unsigned char *data, size_t blocks);
+static void SHA1Dispatch(uint32_t state[5], const unsigned char *data, size_t blocks);
+static void SHA1SelectBackend(void);
 
 # define SHA1_Transform SHA1Transform
 # define SHA1_Init SHA1Init
@@ -35,6 +38,15 @@ void SHA1Transform(uint32_t state[5], const unsigned char buffer[64]);
 #include <string.h>
 
 #include "sha1.h"
+#if defined(__x86_64__) || defined(__i386__)
+# include "sha1x86.h"
+#endif
+
+typedef void (*SHA1BlocksFunc)(uint32_t state[5], const unsigned char *data, size_t blocks);
+
+/* Resolved on the first call, the threads hashing at once store the same value */
+static SHA1BlocksFunc blocksFunc = SHA1Dispatch;
+static enum SHA1Backend blocksBackend = SHA1BackendGeneric;
 
 #define rol(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
 
@@ -118,6 +130,67 @@ CHAR64LONG16* block = (const CHAR64LONG16*)buffer;
 }
 
 
+/* Hash whole blocks with the portable code */
+
+static void SHA1Blocks(uint32_t state[5], const unsigned char *data, size_t blocks)
+{
+    for ( ; blocks != 0; --blocks, data += 64)
+        SHA1Transform(state, data);
+}
+
+
+/* Pick the fastest backend of the CPU */
+
+static void SHA1SelectBackend(void)
+{
+    /* The SSSE3 kernel is not faster than the portable code, AVX2 uses it for an odd last block */
+    if (SHA1SetBackend(SHA1BackendShaNi) == 0 && SHA1SetBackend(SHA1BackendAvx2) == 0)
+        SHA1SetBackend(SHA1BackendGeneric);
+}
+
+
+/* The first call selects the backend and hashes with it */
+
+static void SHA1Dispatch(uint32_t state[5], const unsigned char *data, size_t blocks)
+{
+    SHA1SelectBackend();
+    __atomic_load_n(&blocksFunc, __ATOMIC_RELAXED)(state, data, blocks);
+}
+
+
+/* Use the given backend, returns 0 if the CPU does not support it */
+
+int SHA1SetBackend(enum SHA1Backend backend)
+{
+SHA1BlocksFunc func = SHA1Blocks;
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (!sha1x86Supported(backend))
+        return 0;
+    switch (backend) {
+        case SHA1BackendShaNi: func = sha1x86BlocksShaNi; break;
+        case SHA1BackendAvx2:  func = sha1x86BlocksAvx2;  break;
+        case SHA1BackendSsse3: func = sha1x86BlocksSsse3; break;
+        case SHA1BackendGeneric: break;
+    }
+#else
+    if (backend != SHA1BackendGeneric)
+        return 0;
+#endif
+    __atomic_store_n(&blocksBackend, backend, __ATOMIC_RELAXED);
+    __atomic_store_n(&blocksFunc, func, __ATOMIC_RELAXED);
+    return 1;
+}
+
+
+enum SHA1Backend SHA1GetBackend(void)
+{
+    if (__atomic_load_n(&blocksFunc, __ATOMIC_RELAXED) == SHA1Dispatch)
+        SHA1SelectBackend();
+    return __atomic_load_n(&blocksBackend, __ATOMIC_RELAXED);
+}
+
+
 /* SHA1Init - Initialize new context */
 
 void SHA1Init(SHA1_CTX* context)
@@ -145,10 +218,12 @@ uint32_t j;
     context->count[1] += (len>>29);
     j = (j >> 3) & 63;
     if ((j + len) > 63) {
+        SHA1BlocksFunc blocks = __atomic_load_n(&blocksFunc, __ATOMIC_RELAXED);
         memcpy(&context->buffer[j], data, (i = 64-j));
-        SHA1Transform(context->state, context->buffer);
-        for ( ; i + 63 < len; i += 64) {
-            SHA1Transform(context->state, &data[i]);
+        blocks(context->state, context->buffer, 1);
+        if (len - i >= 64) {
+            blocks(context->state, &data[i], (len - i) / 64);
+            i += (len - i) & ~63U;
         }
         j = 0;
     }
@@ -18,6 +18,7 @@
 #ifndef SHA1_H
 # define SHA1_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 typedef struct {
@@ -26,8 +27,18 @@ typedef struct {
   unsigned char buffer[64];
 } SHA1_CTX;
 
+/* The implementations of the block function, SHA1Update picks the fastest the CPU has */
+enum SHA1Backend {
+  SHA1BackendGeneric,
+  SHA1BackendSsse3,
+  SHA1BackendAvx2,
+  SHA1BackendShaNi
+};
+
 void SHA1Init(SHA1_CTX* context);
 void SHA1Update(SHA1_CTX* context, const unsigned char* data, uint32_t len);
 void SHA1Final(unsigned char digest[20], SHA1_CTX* context);
+int SHA1SetBackend(enum SHA1Backend backend);
+enum SHA1Backend SHA1GetBackend(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,224 @@
+/*
+ * sha1mb.c
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "sha1mb.h"
+#include "sha1.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include "sha1x86.h"
+
+struct Sha1mbLane
+{
+	const unsigned char *data;
+	unsigned char *digest;
+	size_t        dataBlocks;  // whole blocks of the data
+	size_t        blocks;      // all the blocks, the padding included
+	size_t        next;
+	unsigned char tail[128];   // the blocks after the data: its rest, 0x80, zeros, the length in bits
+};
+
+static const unsigned char zeroBlock[64];
+
+static void laneStart(struct Sha1mbLane *lane, const struct Sha1mbJob *job);
+static const unsigned char *laneBlock(struct Sha1mbLane *lane);
+static void sha1mbHashAvx2(struct Sha1mbJob *jobs, unsigned int count);
+static void sha1mbCompress(uint32_t state[5][SHA1MB_LANES], const unsigned char *blocks[SHA1MB_LANES]);
+#endif
+
+void sha1mbHash(struct Sha1mbJob *jobs, unsigned int count)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	if (sha1mbIsVector())
+	{
+		sha1mbHashAvx2(jobs, count);
+		return;
+	}
+#endif
+	sha1mbHashScalar(jobs, count);
+}
+
+void sha1mbHashScalar(struct Sha1mbJob *jobs, unsigned int count)
+{
+	unsigned int i;
+	for (i = 0; i < count; ++i)
+	{
+		SHA1_CTX ctx;
+		SHA1Init(&ctx);
+		const unsigned char *p = jobs[i].data;
+		size_t len = jobs[i].len;
+		while (len != 0)
+		{
+			// SHA1Update takes 32-bit lengths
+			uint32_t part = (len > 0x40000000) ? 0x40000000 : len;
+			SHA1Update(&ctx, p, part);
+			p   += part;
+			len -= part;
+		}
+		SHA1Final(jobs[i].digest, &ctx);
+	}
+}
+
+int sha1mbIsVector(void)
+{
+	// The lanes pay off when the processor has AVX2 and hashes a single message without the SHA extensions
+#if defined(__x86_64__) || defined(__i386__)
+	static int avx2 = -1;
+	int has = __atomic_load_n(&avx2, __ATOMIC_RELAXED);
+	if (has < 0)
+	{
+		has = sha1x86Supported(SHA1BackendAvx2);
+		__atomic_store_n(&avx2, has, __ATOMIC_RELAXED);
+	}
+	return has && SHA1GetBackend() != SHA1BackendShaNi;
+#else
+	return 0;
+#endif
+}
+
+/**************************** Private ********************************/
+
+#if defined(__x86_64__) || defined(__i386__)
+
+static void laneStart(struct Sha1mbLane *lane, const struct Sha1mbJob *job)
+{
+	size_t rest = job->len & 63;
+	uint64_t bits = (uint64_t)job->len * 8;
+	lane->data       = job->data;
+	lane->digest     = job->digest;
+	lane->dataBlocks = job->len / 64;
+	lane->blocks     = (job->len + 72) / 64;
+	lane->next       = 0;
+	unsigned int tailLen = (lane->blocks - lane->dataBlocks) * 64;
+	memset(lane->tail, 0, tailLen);
+	if (rest != 0)
+		memcpy(lane->tail, job->data + lane->dataBlocks * 64, rest);
+	lane->tail[rest] = 0x80;
+	unsigned int i;
+	for (i = 0; i < 8; ++i)
+		lane->tail[tailLen - 1 - i] = (unsigned char)(bits >> (i * 8));
+}
+
+static const unsigned char *laneBlock(struct Sha1mbLane *lane)
+{
+	size_t n = lane->next++;
+	if (n < lane->dataBlocks)
+		return lane->data + n * 64;
+	return lane->tail + (n - lane->dataBlocks) * 64;
+}
+
+static void sha1mbHashAvx2(struct Sha1mbJob *jobs, unsigned int count)
+{
+	static const uint32_t init[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+	struct Sha1mbLane lanes[SHA1MB_LANES];
+	uint32_t state[5][SHA1MB_LANES];
+	const unsigned char *blocks[SHA1MB_LANES];
+	unsigned int used = 0;  // bit mask of the lanes with a message
+	unsigned int nextJob = 0;
+	unsigned int l, k;
+	while (1)
+	{
+		for (l = 0; l < SHA1MB_LANES; ++l)
+		{
+			if ((used & (1U << l)) == 0 && nextJob < count)
+			{
+				laneStart(&lanes[l], &jobs[nextJob++]);
+				for (k = 0; k < 5; ++k)
+					state[k][l] = init[k];
+				used |= 1U << l;
+			}
+			blocks[l] = (used & (1U << l)) ? laneBlock(&lanes[l]) : zeroBlock;
+		}
+		if (used == 0)
+			break;
+
+		sha1mbCompress(state, blocks);
+
+		for (l = 0; l < SHA1MB_LANES; ++l)
+		{
+			if ((used & (1U << l)) != 0 && lanes[l].next == lanes[l].blocks)
+			{
+				for (k = 0; k < 20; ++k)
+					lanes[l].digest[k] = (unsigned char)(state[k / 4][l] >> ((3 - (k & 3)) * 8));
+				used &= ~(1U << l);
+			}
+		}
+	}
+}
+
+#define MB_ROL(v, n)  _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+#define MB_F0(b, c, d)  _mm256_xor_si256(_mm256_and_si256(_mm256_xor_si256(c, d), b), d)
+#define MB_F1(b, c, d)  _mm256_xor_si256(_mm256_xor_si256(b, c), d)
+#define MB_F2(b, c, d)  _mm256_or_si256(_mm256_and_si256(_mm256_or_si256(b, c), d), _mm256_and_si256(b, c))
+
+/* W[t] for t >= 16 replaces W[t-16] in the ring of 16 words */
+#define MB_W(t) (t < 16 ? w[t] : (w[(t) & 15] = MB_ROL(_mm256_xor_si256(_mm256_xor_si256(w[((t) - 3) & 15], \
+	w[((t) - 8) & 15]), _mm256_xor_si256(w[((t) - 14) & 15], w[(t) & 15])), 1)))
+
+#define MB_ROUND(f, k, v, x, y, z, u, t) \
+	u = _mm256_add_epi32(u, _mm256_add_epi32(_mm256_add_epi32(f(x, y, z), MB_W(t)), _mm256_add_epi32(k, MB_ROL(v, 5)))); \
+	x = MB_ROL(x, 30);
+
+#define MB_ROUND5(f, k, t) \
+	MB_ROUND(f, k, a, b, c, d, e, t)     MB_ROUND(f, k, e, a, b, c, d, t + 1) MB_ROUND(f, k, d, e, a, b, c, t + 2) \
+	MB_ROUND(f, k, c, d, e, a, b, t + 3) MB_ROUND(f, k, b, c, d, e, a, t + 4)
+
+__attribute__((target("avx2")))
+static void sha1mbCompress(uint32_t state[5][SHA1MB_LANES], const unsigned char *blocks[SHA1MB_LANES])
+{
+	// One block of every lane, the word t of the lanes makes the vector w[t]
+	const __m256i bswap = _mm256_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL,
+		0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m256i w[16];
+	unsigned int t;
+	for (t = 0; t < 16; ++t)
+	{
+		uint32_t v[SHA1MB_LANES];
+		unsigned int l;
+		for (l = 0; l < SHA1MB_LANES; ++l)
+			memcpy(&v[l], blocks[l] + t * 4, 4);
+		w[t] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)v), bswap);
+	}
+
+	__m256i a = _mm256_loadu_si256((const __m256i *)state[0]);
+	__m256i b = _mm256_loadu_si256((const __m256i *)state[1]);
+	__m256i c = _mm256_loadu_si256((const __m256i *)state[2]);
+	__m256i d = _mm256_loadu_si256((const __m256i *)state[3]);
+	__m256i e = _mm256_loadu_si256((const __m256i *)state[4]);
+	__m256i k = _mm256_set1_epi32(0x5A827999);
+	MB_ROUND5(MB_F0, k, 0)  MB_ROUND5(MB_F0, k, 5)  MB_ROUND5(MB_F0, k, 10) MB_ROUND5(MB_F0, k, 15)
+	k = _mm256_set1_epi32(0x6ED9EBA1);
+	MB_ROUND5(MB_F1, k, 20) MB_ROUND5(MB_F1, k, 25) MB_ROUND5(MB_F1, k, 30) MB_ROUND5(MB_F1, k, 35)
+	k = _mm256_set1_epi32(0x8F1BBCDC);
+	MB_ROUND5(MB_F2, k, 40) MB_ROUND5(MB_F2, k, 45) MB_ROUND5(MB_F2, k, 50) MB_ROUND5(MB_F2, k, 55)
+	k = _mm256_set1_epi32(0xCA62C1D6);
+	MB_ROUND5(MB_F1, k, 60) MB_ROUND5(MB_F1, k, 65) MB_ROUND5(MB_F1, k, 70) MB_ROUND5(MB_F1, k, 75)
+
+	_mm256_storeu_si256((__m256i *)state[0], _mm256_add_epi32(a, _mm256_loadu_si256((const __m256i *)state[0])));
+	_mm256_storeu_si256((__m256i *)state[1], _mm256_add_epi32(b, _mm256_loadu_si256((const __m256i *)state[1])));
+	_mm256_storeu_si256((__m256i *)state[2], _mm256_add_epi32(c, _mm256_loadu_si256((const __m256i *)state[2])));
+	_mm256_storeu_si256((__m256i *)state[3], _mm256_add_epi32(d, _mm256_loadu_si256((const __m256i *)state[3])));
+	_mm256_storeu_si256((__m256i *)state[4], _mm256_add_epi32(e, _mm256_loadu_si256((const __m256i *)state[4])));
+}
+
+#endif // __x86_64__ || __i386__
@@ -0,0 +1,47 @@
+/*
+ * sha1mb.h
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef SHA1MB_H
+#define SHA1MB_H
+
+#include <stddef.h>
+
+/*
+ * Multi-buffer SHA-1: independent messages are hashed together, each one in a 32-bit lane of
+ * the AVX2 registers, so the dependency chain of one message no longer bounds the speed.
+ * A lane takes the next message as soon as its own is done. Without AVX2, or when the SHA
+ * extensions hash a single message faster, the messages go through SHA1Update one by one.
+ * The digests are those of SHA1Init, SHA1Update and SHA1Final over the same data.
+ */
+
+#define SHA1MB_LANES  8
+
+struct Sha1mbJob
+{
+	const unsigned char *data;
+	size_t        len;
+	unsigned char *digest;  // 20 bytes
+};
+
+void sha1mbHash(struct Sha1mbJob *jobs, unsigned int count);
+void sha1mbHashScalar(struct Sha1mbJob *jobs, unsigned int count);
+int  sha1mbIsVector(void);
+
+#endif // SHA1MB_H
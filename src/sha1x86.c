@@ -0,0 +1,269 @@
+/*
+ * sha1x86.c
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <string.h>
+#include <cpuid.h>
+#include <immintrin.h>
+
+#include "sha1x86.h"
+
+#define ROL(v, n)     (((v) << (n)) | ((v) >> (32 - (n))))
+#define F0(b, c, d)   ((((c) ^ (d)) & (b)) ^ (d))
+#define F1(b, c, d)   ((b) ^ (c) ^ (d))
+#define F2(b, c, d)   ((((b) | (c)) & (d)) | ((b) & (c)))
+
+#define ROUND(f, v, w, x, y, z, i)  z += f(w, x, y) + wk[i] + ROL(v, 5); w = ROL(w, 30);
+#define ROUND5(f, i) \
+	ROUND(f, a, b, c, d, e, i)     ROUND(f, e, a, b, c, d, i + 1) ROUND(f, d, e, a, b, c, i + 2) \
+	ROUND(f, c, d, e, a, b, i + 3) ROUND(f, b, c, d, e, a, i + 4)
+
+static const uint32_t roundConst[4] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+
+static uint64_t xgetbv0(void);
+static inline __attribute__((always_inline)) void sha1Rounds(uint32_t state[5], const uint32_t wk[80]);
+
+int sha1x86Supported(enum SHA1Backend backend)
+{
+	unsigned int a, b, c, d;
+	if (!__get_cpuid(1, &a, &b, &c, &d))
+		return 0;
+	int ssse3 = (c & bit_SSSE3) != 0;
+	int sse41 = (c & bit_SSE4_1) != 0;
+	int ymm   = (c & bit_OSXSAVE) != 0 && (c & bit_AVX) != 0 && (xgetbv0() & 6) == 6;
+	if (!__get_cpuid_count(7, 0, &a, &b, &c, &d))
+		b = 0;
+	switch (backend)
+	{
+		case SHA1BackendShaNi:
+			return ssse3 && sse41 && (b & bit_SHA) != 0;
+		case SHA1BackendAvx2:
+			return ymm && (b & bit_AVX2) != 0;
+		case SHA1BackendSsse3:
+			return ssse3;
+		case SHA1BackendGeneric:
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Four rounds of the SHA extensions for the message words in cur. The state E of these rounds is
+ * ea, eb takes ABCD for the next group. The schedule is advanced for the following groups:
+ * next gets its second step, prev its first step and nn the xor of the middle term
+ */
+#define SHANI_GROUP(ea, eb, cur, next, prev, nn, f) \
+	ea   = _mm_sha1nexte_epu32(ea, cur); \
+	eb   = abcd; \
+	next = _mm_sha1msg2_epu32(next, cur); \
+	abcd = _mm_sha1rnds4_epu32(abcd, ea, f); \
+	prev = _mm_sha1msg1_epu32(prev, cur); \
+	nn   = _mm_xor_si128(nn, cur);
+
+__attribute__((target("sha,sse4.1,ssse3")))
+void sha1x86BlocksShaNi(uint32_t state[5], const unsigned char *data, size_t blocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1B);
+	__m128i e0   = _mm_set_epi32(state[4], 0, 0, 0);
+	__m128i e1, msg0, msg1, msg2, msg3;
+
+	for ( ; blocks != 0; --blocks, data += 64)
+	{
+		__m128i abcdSave = abcd;
+		__m128i e0Save   = e0;
+
+		// Rounds 0-15 load the message
+		msg0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data), mask);
+		e0   = _mm_add_epi32(e0, msg0);
+		e1   = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+		msg1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), mask);
+		e1   = _mm_sha1nexte_epu32(e1, msg1);
+		e0   = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+		msg2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), mask);
+		e0   = _mm_sha1nexte_epu32(e0, msg2);
+		e1   = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+		msg0 = _mm_xor_si128(msg0, msg2);
+
+		msg3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), mask);
+		SHANI_GROUP(e1, e0, msg3, msg0, msg2, msg1, 0)
+
+		// Rounds 16-79, the steps of the schedule after round 67 are not used
+		SHANI_GROUP(e0, e1, msg0, msg1, msg3, msg2, 0)
+		SHANI_GROUP(e1, e0, msg1, msg2, msg0, msg3, 1)
+		SHANI_GROUP(e0, e1, msg2, msg3, msg1, msg0, 1)
+		SHANI_GROUP(e1, e0, msg3, msg0, msg2, msg1, 1)
+		SHANI_GROUP(e0, e1, msg0, msg1, msg3, msg2, 1)
+		SHANI_GROUP(e1, e0, msg1, msg2, msg0, msg3, 1)
+		SHANI_GROUP(e0, e1, msg2, msg3, msg1, msg0, 2)
+		SHANI_GROUP(e1, e0, msg3, msg0, msg2, msg1, 2)
+		SHANI_GROUP(e0, e1, msg0, msg1, msg3, msg2, 2)
+		SHANI_GROUP(e1, e0, msg1, msg2, msg0, msg3, 2)
+		SHANI_GROUP(e0, e1, msg2, msg3, msg1, msg0, 2)
+		SHANI_GROUP(e1, e0, msg3, msg0, msg2, msg1, 3)
+		SHANI_GROUP(e0, e1, msg0, msg1, msg3, msg2, 3)
+		SHANI_GROUP(e1, e0, msg1, msg2, msg0, msg3, 3)
+		SHANI_GROUP(e0, e1, msg2, msg3, msg1, msg0, 3)
+		e1   = _mm_sha1nexte_epu32(e1, msg3);
+		e0   = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+		e0   = _mm_sha1nexte_epu32(e0, e0Save);
+		abcd = _mm_add_epi32(abcd, abcdSave);
+	}
+
+	_mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1B));
+	state[4] = _mm_extract_epi32(e0, 3);
+}
+
+/*
+ * W[t..t+3] from the four previous vectors of words: the lanes 0-2 come straight from the
+ * recurrence, W[t+3] needs W[t] and is fixed from lane 0 after the rotation
+ */
+#define SCHEDULE_STEP(w0, w1, w2, w3) \
+	x  = _mm_xor_si128(_mm_xor_si128(w0, _mm_alignr_epi8(w1, w0, 8)), _mm_xor_si128(w2, _mm_srli_si128(w3, 4))); \
+	x  = _mm_or_si128(_mm_slli_epi32(x, 1), _mm_srli_epi32(x, 31)); \
+	f  = _mm_slli_si128(x, 12); \
+	w0 = _mm_xor_si128(x, _mm_or_si128(_mm_slli_epi32(f, 1), _mm_srli_epi32(f, 31)));
+
+#define STORE_WK(t, w) \
+	_mm_storeu_si128((__m128i *)&wk[t], _mm_add_epi32(w, _mm_set1_epi32(roundConst[(t) / 20])));
+
+#define LOAD_PAIR(offset) _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256( \
+	_mm_loadu_si128((const __m128i *)(data + (offset)))), _mm_loadu_si128((const __m128i *)(data + 64 + (offset))), 1), mask)
+
+#define STORE_WK2(t, w) \
+	k = _mm256_add_epi32(w, _mm256_set1_epi32(roundConst[(t) / 20])); \
+	_mm_storeu_si128((__m128i *)&wk[0][t], _mm256_castsi256_si128(k)); \
+	_mm_storeu_si128((__m128i *)&wk[1][t], _mm256_extracti128_si256(k, 1));
+
+#define SCHEDULE_STEP256(w0, w1, w2, w3) \
+	x  = _mm256_xor_si256(_mm256_xor_si256(w0, _mm256_alignr_epi8(w1, w0, 8)), _mm256_xor_si256(w2, _mm256_srli_si256(w3, 4))); \
+	x  = _mm256_or_si256(_mm256_slli_epi32(x, 1), _mm256_srli_epi32(x, 31)); \
+	f  = _mm256_slli_si256(x, 12); \
+	w0 = _mm256_xor_si256(x, _mm256_or_si256(_mm256_slli_epi32(f, 1), _mm256_srli_epi32(f, 31)));
+
+__attribute__((target("ssse3")))
+void sha1x86BlocksSsse3(uint32_t state[5], const unsigned char *data, size_t blocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	uint32_t wk[80];
+	for ( ; blocks != 0; --blocks, data += 64)
+	{
+		__m128i x, f;
+		__m128i w0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data), mask);
+		__m128i w1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), mask);
+		__m128i w2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), mask);
+		__m128i w3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), mask);
+		STORE_WK(0, w0) STORE_WK(4, w1) STORE_WK(8, w2) STORE_WK(12, w3)
+		SCHEDULE_STEP(w0, w1, w2, w3) STORE_WK(16, w0)
+		SCHEDULE_STEP(w1, w2, w3, w0) STORE_WK(20, w1)
+		SCHEDULE_STEP(w2, w3, w0, w1) STORE_WK(24, w2)
+		SCHEDULE_STEP(w3, w0, w1, w2) STORE_WK(28, w3)
+		SCHEDULE_STEP(w0, w1, w2, w3) STORE_WK(32, w0)
+		SCHEDULE_STEP(w1, w2, w3, w0) STORE_WK(36, w1)
+		SCHEDULE_STEP(w2, w3, w0, w1) STORE_WK(40, w2)
+		SCHEDULE_STEP(w3, w0, w1, w2) STORE_WK(44, w3)
+		SCHEDULE_STEP(w0, w1, w2, w3) STORE_WK(48, w0)
+		SCHEDULE_STEP(w1, w2, w3, w0) STORE_WK(52, w1)
+		SCHEDULE_STEP(w2, w3, w0, w1) STORE_WK(56, w2)
+		SCHEDULE_STEP(w3, w0, w1, w2) STORE_WK(60, w3)
+		SCHEDULE_STEP(w0, w1, w2, w3) STORE_WK(64, w0)
+		SCHEDULE_STEP(w1, w2, w3, w0) STORE_WK(68, w1)
+		SCHEDULE_STEP(w2, w3, w0, w1) STORE_WK(72, w2)
+		SCHEDULE_STEP(w3, w0, w1, w2) STORE_WK(76, w3)
+		sha1Rounds(state, wk);
+	}
+}
+
+__attribute__((target("avx2")))
+void sha1x86BlocksAvx2(uint32_t state[5], const unsigned char *data, size_t blocks)
+{
+	// The low half of the registers holds the words of a block, the high half those of the next one
+	const __m256i mask = _mm256_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL,
+		0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	uint32_t wk[2][80];
+	for ( ; blocks >= 2; blocks -= 2, data += 128)
+	{
+		__m256i x, f, k;
+		__m256i w0 = LOAD_PAIR(0);
+		__m256i w1 = LOAD_PAIR(16);
+		__m256i w2 = LOAD_PAIR(32);
+		__m256i w3 = LOAD_PAIR(48);
+		STORE_WK2(0, w0) STORE_WK2(4, w1) STORE_WK2(8, w2) STORE_WK2(12, w3)
+		SCHEDULE_STEP256(w0, w1, w2, w3) STORE_WK2(16, w0)
+		SCHEDULE_STEP256(w1, w2, w3, w0) STORE_WK2(20, w1)
+		SCHEDULE_STEP256(w2, w3, w0, w1) STORE_WK2(24, w2)
+		SCHEDULE_STEP256(w3, w0, w1, w2) STORE_WK2(28, w3)
+		SCHEDULE_STEP256(w0, w1, w2, w3) STORE_WK2(32, w0)
+		SCHEDULE_STEP256(w1, w2, w3, w0) STORE_WK2(36, w1)
+		SCHEDULE_STEP256(w2, w3, w0, w1) STORE_WK2(40, w2)
+		SCHEDULE_STEP256(w3, w0, w1, w2) STORE_WK2(44, w3)
+		SCHEDULE_STEP256(w0, w1, w2, w3) STORE_WK2(48, w0)
+		SCHEDULE_STEP256(w1, w2, w3, w0) STORE_WK2(52, w1)
+		SCHEDULE_STEP256(w2, w3, w0, w1) STORE_WK2(56, w2)
+		SCHEDULE_STEP256(w3, w0, w1, w2) STORE_WK2(60, w3)
+		SCHEDULE_STEP256(w0, w1, w2, w3) STORE_WK2(64, w0)
+		SCHEDULE_STEP256(w1, w2, w3, w0) STORE_WK2(68, w1)
+		SCHEDULE_STEP256(w2, w3, w0, w1) STORE_WK2(72, w2)
+		SCHEDULE_STEP256(w3, w0, w1, w2) STORE_WK2(76, w3)
+		sha1Rounds(state, wk[0]);
+		sha1Rounds(state, wk[1]);
+	}
+	if (blocks != 0)
+		sha1x86BlocksSsse3(state, data, blocks);
+}
+
+/**************************** Private ********************************/
+
+__attribute__((target("xsave")))
+static uint64_t xgetbv0(void)
+{
+	return _xgetbv(0);
+}
+
+static inline __attribute__((always_inline)) void sha1Rounds(uint32_t state[5], const uint32_t wk[80])
+{
+	// The rounds of one block, wk holds the words of the schedule plus the round constants
+	uint32_t a = state[0];
+	uint32_t b = state[1];
+	uint32_t c = state[2];
+	uint32_t d = state[3];
+	uint32_t e = state[4];
+	ROUND5(F0, 0)  ROUND5(F0, 5)  ROUND5(F0, 10) ROUND5(F0, 15)
+	ROUND5(F1, 20) ROUND5(F1, 25) ROUND5(F1, 30) ROUND5(F1, 35)
+	ROUND5(F2, 40) ROUND5(F2, 45) ROUND5(F2, 50) ROUND5(F2, 55)
+	ROUND5(F1, 60) ROUND5(F1, 65) ROUND5(F1, 70) ROUND5(F1, 75)
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+#endif // __x86_64__ || __i386__
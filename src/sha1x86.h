@@ -0,0 +1,43 @@
+/*
+ * sha1x86.h
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef SHA1X86_H
+#define SHA1X86_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sha1.h"
+
+/*
+ * The x86 kernels of SHA1Update. Every kernel hashes whole 64-byte blocks into the state:
+ *   ShaNi  - the SHA extensions (sha1rnds4, sha1msg1/2, sha1nexte)
+ *   Avx2   - the message schedule of two blocks at once in the halves of a 256-bit register
+ *   Ssse3  - the message schedule four words at a time, the rounds stay scalar
+ * The kernels are compiled for their instruction sets by target attributes and are called
+ * only when sha1x86Supported says the processor has them.
+ */
+
+int  sha1x86Supported(enum SHA1Backend backend);
+void sha1x86BlocksShaNi(uint32_t state[5], const unsigned char *data, size_t blocks);
+void sha1x86BlocksAvx2(uint32_t state[5], const unsigned char *data, size_t blocks);
+void sha1x86BlocksSsse3(uint32_t state[5], const unsigned char *data, size_t blocks);
+
+#endif // SHA1X86_H
@@ -0,0 +1,45 @@
+/*
+ * sha256.h
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * SHA-256 of FIPS 180-4, portable scalar code.
+ * "abc" gives ba7816bf 8f01cfea 414140de 5dae2223 b00361a3 96177a9c b410ff61 f20015ad
+ */
+
+#define SHA256_SIZE  32
+
+struct Sha256Ctx
+{
+	uint32_t      state[8];
+	uint64_t      length;  // in bytes
+	unsigned char buffer[64];
+};
+
+void sha256Init(struct Sha256Ctx *ctx);
+void sha256Update(struct Sha256Ctx *ctx, const unsigned char *data, size_t len);
+void sha256Final(struct Sha256Ctx *ctx, unsigned char digest[SHA256_SIZE]);
+
+#endif // SHA256_H
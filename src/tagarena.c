@@ -0,0 +1,148 @@
+/*
+ * tagarena.c
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tagarena.h"
+
+#define ARENA_ALIGN  16
+
+static size_t alignSize(size_t size);
+static unsigned char *blockData(struct TagArenaBlock *block);
+static struct TagArenaBlock *addBlock(struct TagArena *arena, size_t size);
+
+void tagarenaInit(struct TagArena *arena)
+{
+	arena->head = NULL;
+}
+
+void tagarenaFree(struct TagArena *arena)
+{
+	struct TagArenaBlock *block = arena->head;
+	while (block != NULL)
+	{
+		struct TagArenaBlock *next = block->next;
+		free(block);
+		block = next;
+	}
+	tagarenaInit(arena);
+}
+
+void tagarenaReset(struct TagArena *arena)
+{
+	// The newest block is the largest one, it is kept and the others are freed,
+	// so after the first items the reset is a single store
+	if (arena == NULL || arena->head == NULL)
+		return;
+	struct TagArenaBlock *block = arena->head;
+	if (block->next != NULL)
+	{
+		struct TagArena older = { block->next };
+		tagarenaFree(&older);
+		block->next = NULL;
+	}
+	block->used = 0;
+	block->last = 0;
+}
+
+void *tagarenaAlloc(struct TagArena *arena, size_t size)
+{
+	if (arena == NULL)
+		return malloc(size);
+
+	size = alignSize(size);
+	struct TagArenaBlock *block = arena->head;
+	if (block == NULL || block->size - block->used < size)
+	{
+		block = addBlock(arena, size);
+		if (block == NULL)
+			return NULL;
+	}
+	block->last  = block->used;
+	block->used += size;
+	return blockData(block) + block->last;
+}
+
+void *tagarenaCalloc(struct TagArena *arena, size_t size)
+{
+	void *ptr = tagarenaAlloc(arena, size);
+	if (ptr != NULL)
+		memset(ptr, 0, size);
+	return ptr;
+}
+
+void *tagarenaRealloc(struct TagArena *arena, void *ptr, size_t oldSize, size_t size)
+{
+	// The last allocation of the block grows in place, any other one is copied
+	if (arena == NULL)
+		return realloc(ptr, size);
+	if (ptr == NULL)
+		return tagarenaAlloc(arena, size);
+
+	struct TagArenaBlock *block = arena->head;
+	if (block != NULL && (unsigned char *)ptr == blockData(block) + block->last &&
+		block->size - block->last >= alignSize(size))
+	{
+		block->used = block->last + alignSize(size);
+		return ptr;
+	}
+	void *newPtr = tagarenaAlloc(arena, size);
+	if (newPtr != NULL)
+		memcpy(newPtr, ptr, (oldSize < size) ? oldSize : size);
+	return newPtr;
+}
+
+void tagarenaRelease(struct TagArena *arena, void *ptr)
+{
+	if (arena == NULL)
+		free(ptr);
+}
+
+/**************************** Private ********************************/
+
+static size_t alignSize(size_t size)
+{
+	return (size + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1);
+}
+
+static unsigned char *blockData(struct TagArenaBlock *block)
+{
+	return (unsigned char *)block + alignSize(sizeof(struct TagArenaBlock));
+}
+
+static struct TagArenaBlock *addBlock(struct TagArena *arena, size_t size)
+{
+	// Every new block is at least twice as large as the previous one
+	size_t blockSize = TAGARENA_BLOCK_MIN;
+	if (arena->head != NULL && blockSize < arena->head->size * 2)
+		blockSize = arena->head->size * 2;
+	while (blockSize < size)
+		blockSize *= 2;
+	struct TagArenaBlock *block = malloc(alignSize(sizeof(struct TagArenaBlock)) + blockSize);
+	if (block == NULL)
+		return NULL;
+	block->next = arena->head;
+	block->size = blockSize;
+	block->used = 0;
+	block->last = 0;
+	arena->head = block;
+	return block;
+}
@@ -0,0 +1,56 @@
+/*
+ * tagarena.h
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef TAGARENA_H
+#define TAGARENA_H
+
+#include <stddef.h>
+
+/*
+ * Region allocator for the items of a scan. The memory is taken from blocks by a pointer bump and
+ * is given back all at once by tagarenaReset, the releasing of a single allocation does nothing.
+ * All the functions accept a NULL arena and use malloc, realloc and free then, so the same code
+ * serves the items on the heap and the items in an arena.
+ */
+
+#define TAGARENA_BLOCK_MIN  65536
+
+struct TagArenaBlock
+{
+	struct TagArenaBlock *next;
+	size_t        size;
+	size_t        used;
+	size_t        last;
+};
+
+struct TagArena
+{
+	struct TagArenaBlock *head;
+};
+
+void  tagarenaInit(struct TagArena *arena);
+void  tagarenaFree(struct TagArena *arena);
+void  tagarenaReset(struct TagArena *arena);
+void *tagarenaAlloc(struct TagArena *arena, size_t size);
+void *tagarenaCalloc(struct TagArena *arena, size_t size);
+void *tagarenaRealloc(struct TagArena *arena, void *ptr, size_t oldSize, size_t size);
+void  tagarenaRelease(struct TagArena *arena, void *ptr);
+
+#endif // TAGARENA_H
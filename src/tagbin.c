@@ -0,0 +1,281 @@
+/*
+ * tagbin.c
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tagbin.h"
+#include "utils.h"
+
+#define DICT_INCREASE  16
+#define VALUE_BUFF_LEN 2048
+
+void tagbinDictInit(struct TagBinDict *dict)
+{
+	dict->count = 0;
+	dict->max   = 0;
+	dict->names = NULL;
+}
+
+void tagbinDictFree(struct TagBinDict *dict)
+{
+	unsigned int i;
+	for (i = 0; i < dict->count; ++i)
+		free(dict->names[i]);
+	if (dict->names != NULL)
+		free(dict->names);
+	tagbinDictInit(dict);
+}
+
+int tagbinDictCopy(struct TagBinDict *dictTo, const struct TagBinDict *dictFrom)
+{
+	tagbinDictFree(dictTo);
+	unsigned int i;
+	for (i = 0; i < dictFrom->count; ++i)
+		if (tagbinDictGetId(dictTo, dictFrom->names[i]) < 0)
+			return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+int tagbinDictLoad(struct TagBinDict *dict, const unsigned char *data, size_t size)
+{
+	tagbinDictFree(dict);
+	const unsigned char *end = data + size;
+	uint32_t cnt;
+	if (tagbinReadU32(&data, end, &cnt) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	dict->names = malloc((cnt + 1) * sizeof(wchar_t *));
+	if (dict->names == NULL)
+		return EXIT_FAILURE;
+	dict->max = cnt + 1;
+	for ( ; cnt != 0; --cnt)
+	{
+		uint32_t len;
+		if (tagbinReadU32(&data, end, &len) != EXIT_SUCCESS || (size_t)(end - data) < len)
+			return EXIT_FAILURE;
+		wchar_t *name = malloc((len + 1) * sizeof(wchar_t));
+		if (name == NULL)
+			return EXIT_FAILURE;
+		if (utf8Decode((const char *)data, len, name) == (size_t) -1)
+		{
+			free(name);
+			return EXIT_FAILURE;
+		}
+		dict->names[dict->count++] = name;
+		data += len;
+	}
+	return EXIT_SUCCESS;
+}
+
+int tagbinDictWrite(const struct TagBinDict *dict, FILE *fd)
+{
+	struct TagBinBuffer buf = { 0, 0, NULL };
+	int res = tagbinBufferPutU32(&buf, dict->count);
+	unsigned int i;
+	for (i = 0; i < dict->count && res == EXIT_SUCCESS; ++i)
+		res = tagbinBufferPutString(&buf, dict->names[i]);
+
+	if (res == EXIT_SUCCESS && fwrite(buf.data, 1, buf.length, fd) != buf.length)
+		res = EXIT_FAILURE;
+	tagbinBufferFree(&buf);
+	return res;
+}
+
+int tagbinDictGetId(struct TagBinDict *dict, const wchar_t *name)
+{
+	unsigned int i;
+	for (i = 0; i < dict->count; ++i)
+		if (wcscmp(dict->names[i], name) == 0)
+			return i;
+
+	if (dict->count == dict->max)
+	{
+		wchar_t **newPtr = realloc(dict->names, (dict->max + DICT_INCREASE) * sizeof(wchar_t *));
+		if (newPtr == NULL)
+			return -1;
+		dict->names = newPtr;
+		dict->max  += DICT_INCREASE;
+	}
+	wchar_t *nm = malloc((wcslen(name) + 1) * sizeof(wchar_t));
+	if (nm == NULL)
+		return -1;
+	wcscpy(nm, name);
+	dict->names[dict->count] = nm;
+	return dict->count++;
+}
+
+int tagbinReadItemHeader(const unsigned char *data, size_t size, unsigned int hashSize, struct TagBinItemHeader *hdr)
+{
+	size_t hdrLen = TAGBIN_ITEM_HEADER_SIZE(hashSize);
+	if (hashSize > FILE_HASH_SIZE || size < hdrLen)
+		return EXIT_FAILURE;
+	memcpy(&hdr->fileSize, data, sizeof(hdr->fileSize));
+	memcpy(hdr->hash, data + sizeof(hdr->fileSize), hashSize);
+	memset(hdr->hash + hashSize, 0, FILE_HASH_SIZE - hashSize);
+	memcpy(&hdr->recLength, data + sizeof(hdr->fileSize) + hashSize, sizeof(hdr->recLength));
+	if (hdr->fileSize == 0 || size - hdrLen < hdr->recLength)
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+int tagbinItemLoad(struct ItemStruct *item, const struct TagBinDict *dict, const unsigned char *data, size_t size)
+{
+	const unsigned char *end = data + size;
+	uint32_t namesCnt;
+	uint32_t propsCnt;
+	if (tagbinReadU32(&data, end, &namesCnt) != EXIT_SUCCESS || tagbinReadU32(&data, end, &propsCnt) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+
+	// Every decoded string fits in the record length
+	wchar_t *buff = malloc((size + 1) * sizeof(wchar_t));
+	if (buff == NULL)
+		return EXIT_FAILURE;
+
+	int res = EXIT_SUCCESS;
+	for ( ; namesCnt != 0 && res == EXIT_SUCCESS; --namesCnt)
+	{
+		uint32_t len;
+		res = EXIT_FAILURE;
+		if (tagbinReadU32(&data, end, &len) == EXIT_SUCCESS && (size_t)(end - data) >= len && len != 0)
+			if (utf8Decode((const char *)data, len, buff) != (size_t) -1)
+				res = itemAddFileName(item, buff);
+		data += len;
+	}
+	for ( ; propsCnt != 0 && res == EXIT_SUCCESS; --propsCnt)
+	{
+		uint32_t id;
+		uint32_t len;
+		res = EXIT_FAILURE;
+		if (tagbinReadU32(&data, end, &id) == EXIT_SUCCESS && id < dict->count &&
+			tagbinReadU32(&data, end, &len) == EXIT_SUCCESS && (size_t)(end - data) >= len)
+			if (utf8Decode((const char *)data, len, buff) != (size_t) -1)
+				res = itemSetProperty(item, dict->names[id], buff);
+		data += len;
+	}
+	free(buff);
+	return res;
+}
+
+int tagbinItemWrite(FILE *fd, struct TagBinDict *dict, struct TagBinBuffer *buf, const struct ItemStruct *item, unsigned int hashSize)
+{
+	// The header is filled in when the length of the payload is known
+	size_t hdrLen = TAGBIN_ITEM_HEADER_SIZE(hashSize);
+	buf->length = 0;
+	if (hashSize > FILE_HASH_SIZE || tagbinBufferReserve(buf, hdrLen) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	buf->length = hdrLen;
+	if (tagbinBufferPutU32(buf, item->fileNameCount) != EXIT_SUCCESS || tagbinBufferPutU32(buf, item->propsCount) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+
+	unsigned int i = 0;
+	const wchar_t *fName;
+	while ((fName = itemGetFileName(item, i++)) != NULL)
+		if (tagbinBufferPutString(buf, fName) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+
+	for (i = 0; i < item->propsCount; ++i)
+	{
+		int id = tagbinDictGetId(dict, itemPropertyGetName(item, i));
+		if (id < 0 || tagbinBufferPutU32(buf, id) != EXIT_SUCCESS || tagbinBufferPutValue(buf, item, i) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+	}
+
+	uint64_t fileSize = item->fileSize;
+	uint32_t recLength = buf->length - hdrLen;
+	memcpy(buf->data, &fileSize, sizeof(fileSize));
+	memcpy(buf->data + sizeof(fileSize), item->hash, hashSize);
+	memcpy(buf->data + sizeof(fileSize) + hashSize, &recLength, sizeof(recLength));
+	if (fwrite(buf->data, 1, buf->length, fd) != buf->length)
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+void tagbinBufferFree(struct TagBinBuffer *buf)
+{
+	if (buf->data != NULL)
+		free(buf->data);
+	buf->data   = NULL;
+	buf->length = 0;
+	buf->max    = 0;
+}
+
+int tagbinBufferPutValue(struct TagBinBuffer *buf, const struct ItemStruct *item, unsigned int propNum)
+{
+	// The value is put as a string, a value longer than the buffer on the stack is taken into a heap one
+	wchar_t valStack[VALUE_BUFF_LEN];
+	wchar_t *valBuff = valStack;
+	int len = itemPropertyValueLength(item, propNum);
+	if (len < 0)
+		return EXIT_FAILURE;
+	if (len >= VALUE_BUFF_LEN && (valBuff = malloc((len + 1) * sizeof(wchar_t))) == NULL)
+		return EXIT_FAILURE;
+	int res = EXIT_FAILURE;
+	if (itemPropertyValueToString(item, propNum, valBuff, (len < VALUE_BUFF_LEN) ? VALUE_BUFF_LEN : len + 1) == EXIT_SUCCESS)
+		res = tagbinBufferPutString(buf, valBuff);
+	if (valBuff != valStack)
+		free(valBuff);
+	return res;
+}
+
+int tagbinReadU32(const unsigned char **pData, const unsigned char *end, uint32_t *val)
+{
+	if ((size_t)(end - *pData) < sizeof(uint32_t))
+		return EXIT_FAILURE;
+	memcpy(val, *pData, sizeof(uint32_t));
+	*pData += sizeof(uint32_t);
+	return EXIT_SUCCESS;
+}
+
+int tagbinBufferReserve(struct TagBinBuffer *buf, size_t len)
+{
+	if (buf->length + len <= buf->max)
+		return EXIT_SUCCESS;
+	size_t max = buf->max * 2;
+	if (max < buf->length + len)
+		max = buf->length + len + 256;
+	unsigned char *newPtr = realloc(buf->data, max);
+	if (newPtr == NULL)
+	{
+		tagbinBufferFree(buf);
+		return EXIT_FAILURE;
+	}
+	buf->data = newPtr;
+	buf->max  = max;
+	return EXIT_SUCCESS;
+}
+
+int tagbinBufferPutU32(struct TagBinBuffer *buf, uint32_t val)
+{
+	if (tagbinBufferReserve(buf, sizeof(uint32_t)) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	memcpy(buf->data + buf->length, &val, sizeof(uint32_t));
+	buf->length += sizeof(uint32_t);
+	return EXIT_SUCCESS;
+}
+
+int tagbinBufferPutString(struct TagBinBuffer *buf, const wchar_t *str)
+{
+	size_t sz = utf8EncodedLength(str);
+	if (tagbinBufferPutU32(buf, sz) != EXIT_SUCCESS || tagbinBufferReserve(buf, sz + 1) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	utf8Encode(str, (char *)buf->data + buf->length);
+	buf->length += sz;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,98 @@
+/*
+ * tagbin.h
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef TAGBIN_H
+#define TAGBIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <wchar.h>
+
+#include "item.h"
+#include "hashalg.h"
+
+/*
+ * Binary index layout (!format=binary), all integers are little-endian:
+ *   text header ("!tags-info", "!version=...", "!format=binary", "!hash=...", "!hash-size=...")
+ *   and an empty line
+ *   struct TagBinPreamble
+ *   item records: the item header followed by recLength bytes of payload
+ *   property name dictionary at preamble.dictOffset
+ * Item header:
+ *   uint64 fileSize, hashSize bytes of the hash (the size from the !hash-size= line), uint32 recLength
+ * Item payload:
+ *   uint32 fileNameCount, uint32 propCount
+ *   fileNameCount times: uint32 len, len bytes of UTF-8
+ *   propCount times:     uint32 nameId, uint32 len, len bytes of UTF-8 (comma separated values)
+ * Dictionary:
+ *   uint32 count, count times: uint32 len, len bytes of UTF-8
+ */
+
+#define TAGBIN_MAGIC      "TAGSBIN1"
+#define TAGBIN_MAGIC_LEN  8
+#define TAGBIN_LEGACY_HASH_SIZE  20  // the hash size of an index without the !hash-size= line
+#define TAGBIN_ITEM_HEADER_SIZE(hashSize)  (sizeof(uint64_t) + (hashSize) + sizeof(uint32_t))
+
+struct TagBinPreamble
+{
+	char          magic[TAGBIN_MAGIC_LEN];
+	uint64_t      dictOffset;
+};
+
+struct TagBinItemHeader  // the decoded item header, the hash is padded by zeros
+{
+	uint64_t      fileSize;
+	unsigned char hash[FILE_HASH_SIZE];
+	uint32_t      recLength;
+};
+
+struct TagBinDict
+{
+	unsigned int  count;
+	unsigned int  max;
+	wchar_t       **names;
+};
+
+struct TagBinBuffer
+{
+	size_t        length;
+	size_t        max;
+	unsigned char *data;
+};
+
+void tagbinDictInit(struct TagBinDict *dict);
+void tagbinDictFree(struct TagBinDict *dict);
+int  tagbinDictCopy(struct TagBinDict *dictTo, const struct TagBinDict *dictFrom);
+int  tagbinDictLoad(struct TagBinDict *dict, const unsigned char *data, size_t size);
+int  tagbinDictWrite(const struct TagBinDict *dict, FILE *fd);
+int  tagbinDictGetId(struct TagBinDict *dict, const wchar_t *name);
+
+int  tagbinReadItemHeader(const unsigned char *data, size_t size, unsigned int hashSize, struct TagBinItemHeader *hdr);
+int  tagbinItemLoad(struct ItemStruct *item, const struct TagBinDict *dict, const unsigned char *data, size_t size);
+int  tagbinItemWrite(FILE *fd, struct TagBinDict *dict, struct TagBinBuffer *buf, const struct ItemStruct *item, unsigned int hashSize);
+void tagbinBufferFree(struct TagBinBuffer *buf);
+int  tagbinBufferReserve(struct TagBinBuffer *buf, size_t len);
+int  tagbinBufferPutU32(struct TagBinBuffer *buf, uint32_t val);
+int  tagbinBufferPutString(struct TagBinBuffer *buf, const wchar_t *str);
+int  tagbinBufferPutValue(struct TagBinBuffer *buf, const struct ItemStruct *item, unsigned int propNum);
+int  tagbinReadU32(const unsigned char **pData, const unsigned char *end, uint32_t *val);
+
+#endif // TAGBIN_H
@@ -0,0 +1,661 @@
+/*
+ * tagbitmap.c
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tagbitmap.h"
+
+#define CONTAINERS_INCREASE  16
+#define ARRAY_INCREASE       64
+#define CONTAINER_HEADER     8
+#define CONTAINER_BITS       65536
+
+static struct TagBitmapContainer *findContainer(const struct TagBitmap *bm, uint16_t key, size_t *pos);
+static struct TagBitmapContainer *insertContainer(struct TagBitmap *bm, size_t pos, uint16_t key);
+static int  containerAdd(struct TagBitmapContainer *c, uint16_t low);
+static int  containerContains(const struct TagBitmapContainer *c, uint16_t low);
+static int  containerReserve(struct TagBitmapContainer *c, uint32_t count);
+static int  containerToBits(struct TagBitmapContainer *c);
+static int  containerNormalize(struct TagBitmapContainer *c);
+static int  containerCopy(struct TagBitmapContainer *dst, const struct TagBitmapContainer *src);
+static int  containerOr(struct TagBitmapContainer *c, const struct TagBitmapContainer *other);
+static int  containerAnd(struct TagBitmapContainer *c, const struct TagBitmapContainer *other);
+static void containerFree(struct TagBitmapContainer *c);
+static size_t containerPayload(const struct TagBitmapContainer *c);
+static uint32_t countBits(const uint64_t *bits);
+
+void tagbitmapInit(struct TagBitmap *bm)
+{
+	bm->count      = 0;
+	bm->max        = 0;
+	bm->containers = NULL;
+}
+
+void tagbitmapFree(struct TagBitmap *bm)
+{
+	size_t i;
+	for (i = 0; i < bm->count; ++i)
+		containerFree(&bm->containers[i]);
+	free(bm->containers);
+	tagbitmapInit(bm);
+}
+
+int tagbitmapAdd(struct TagBitmap *bm, uint32_t value)
+{
+	// The ids are mostly added in the ascending order, so the last container is checked first
+	uint16_t key = value >> 16;
+	struct TagBitmapContainer *c;
+	size_t pos;
+	if (bm->count != 0 && bm->containers[bm->count - 1].key == key)
+		c = &bm->containers[bm->count - 1];
+	else if ((c = findContainer(bm, key, &pos)) == NULL && (c = insertContainer(bm, pos, key)) == NULL)
+		return EXIT_FAILURE;
+	return containerAdd(c, value & 0xFFFF);
+}
+
+int tagbitmapContains(const struct TagBitmap *bm, uint32_t value)
+{
+	size_t pos;
+	const struct TagBitmapContainer *c = findContainer(bm, value >> 16, &pos);
+	return (c != NULL && containerContains(c, value & 0xFFFF));
+}
+
+size_t tagbitmapCardinality(const struct TagBitmap *bm)
+{
+	size_t res = 0;
+	size_t i;
+	for (i = 0; i < bm->count; ++i)
+		res += bm->containers[i].count;
+	return res;
+}
+
+int tagbitmapMaximum(const struct TagBitmap *bm, uint32_t *value)
+{
+	// Returns 0 for an empty bitmap
+	if (bm->count == 0)
+		return 0;
+	const struct TagBitmapContainer *c = &bm->containers[bm->count - 1];
+	uint32_t low = 0;
+	if (c->type == TagBitmapArray)
+		low = c->data.array[c->count - 1];
+	else
+	{
+		uint32_t w = TAGBITMAP_WORDS;
+		while (w != 0 && c->data.bits[w - 1] == 0)
+			--w;
+		if (w != 0)
+			low = (w - 1) * 64 + 63 - __builtin_clzll(c->data.bits[w - 1]);
+	}
+	*value = ((uint32_t)c->key << 16) | low;
+	return 1;
+}
+
+int tagbitmapOr(struct TagBitmap *bm, const struct TagBitmap *other)
+{
+	size_t i = 0;
+	size_t j;
+	for (j = 0; j < other->count; ++j)
+	{
+		const struct TagBitmapContainer *o = &other->containers[j];
+		while (i < bm->count && bm->containers[i].key < o->key)
+			++i;
+		if (i < bm->count && bm->containers[i].key == o->key)
+		{
+			if (containerOr(&bm->containers[i], o) != EXIT_SUCCESS)
+				return EXIT_FAILURE;
+		}
+		else
+		{
+			struct TagBitmapContainer copy;
+			if (containerCopy(&copy, o) != EXIT_SUCCESS)
+				return EXIT_FAILURE;
+			struct TagBitmapContainer *c = insertContainer(bm, i, o->key);
+			if (c == NULL)
+			{
+				containerFree(&copy);
+				return EXIT_FAILURE;
+			}
+			*c = copy;
+		}
+		++i;
+	}
+	return EXIT_SUCCESS;
+}
+
+int tagbitmapAnd(struct TagBitmap *bm, const struct TagBitmap *other)
+{
+	// The containers without a pair and the emptied ones are dropped
+	int res = EXIT_SUCCESS;
+	size_t n = 0;
+	size_t j = 0;
+	size_t i;
+	for (i = 0; i < bm->count; ++i)
+	{
+		struct TagBitmapContainer *c = &bm->containers[i];
+		while (j < other->count && other->containers[j].key < c->key)
+			++j;
+		if (j < other->count && other->containers[j].key == c->key)
+		{
+			if (containerAnd(c, &other->containers[j]) != EXIT_SUCCESS)
+				res = EXIT_FAILURE;
+			if (c->count != 0)
+			{
+				bm->containers[n++] = *c;
+				continue;
+			}
+		}
+		containerFree(c);
+	}
+	bm->count = n;
+	return res;
+}
+
+void tagbitmapIterInit(struct TagBitmapIter *it)
+{
+	it->container = 0;
+	it->pos       = 0;
+}
+
+int tagbitmapNext(const struct TagBitmap *bm, struct TagBitmapIter *it, uint32_t *value)
+{
+	while (it->container < bm->count)
+	{
+		const struct TagBitmapContainer *c = &bm->containers[it->container];
+		if (c->type == TagBitmapArray)
+		{
+			if (it->pos < c->count)
+			{
+				*value = ((uint32_t)c->key << 16) | c->data.array[it->pos++];
+				return 1;
+			}
+		}
+		else
+		{
+			while (it->pos < CONTAINER_BITS)
+			{
+				uint64_t word = c->data.bits[it->pos >> 6] >> (it->pos & 63);
+				if (word != 0)
+				{
+					it->pos += __builtin_ctzll(word);
+					*value = ((uint32_t)c->key << 16) | it->pos;
+					++it->pos;
+					return 1;
+				}
+				it->pos = (it->pos | 63) + 1;
+			}
+		}
+		++it->container;
+		it->pos = 0;
+	}
+	return 0;
+}
+
+size_t tagbitmapSerializedSize(const struct TagBitmap *bm)
+{
+	size_t res = sizeof(uint32_t) + bm->count * CONTAINER_HEADER;
+	size_t i;
+	for (i = 0; i < bm->count; ++i)
+		res += containerPayload(&bm->containers[i]);
+	return res;
+}
+
+void tagbitmapSerialize(const struct TagBitmap *bm, unsigned char *buf)
+{
+	uint32_t cnt = bm->count;
+	memcpy(buf, &cnt, sizeof(cnt));
+	unsigned char *hdr = buf + sizeof(cnt);
+	unsigned char *payload = hdr + bm->count * CONTAINER_HEADER;
+	size_t i;
+	for (i = 0; i < bm->count; ++i)
+	{
+		const struct TagBitmapContainer *c = &bm->containers[i];
+		memcpy(hdr, &c->key, sizeof(uint16_t));
+		memcpy(hdr + 2, &c->type, sizeof(uint16_t));
+		memcpy(hdr + 4, &c->count, sizeof(uint32_t));
+		hdr += CONTAINER_HEADER;
+		size_t len = containerPayload(c);
+		memcpy(payload, (c->type == TagBitmapBits) ? (const void *)c->data.bits : (const void *)c->data.array, len);
+		payload += len;
+	}
+}
+
+int tagbitmapDeserialize(struct TagBitmap *bm, const unsigned char *buf, size_t length)
+{
+	// The data comes from a file, so everything is checked before use
+	tagbitmapFree(bm);
+	uint32_t cnt;
+	if (length < sizeof(cnt))
+		return EXIT_FAILURE;
+	memcpy(&cnt, buf, sizeof(cnt));
+	if (cnt > (length - sizeof(cnt)) / CONTAINER_HEADER)
+		return EXIT_FAILURE;
+	if (cnt != 0 && (bm->containers = malloc(cnt * sizeof(struct TagBitmapContainer))) == NULL)
+		return EXIT_FAILURE;
+	bm->max = cnt;
+
+	const unsigned char *hdr = buf + sizeof(cnt);
+	size_t pos = sizeof(cnt) + (size_t)cnt * CONTAINER_HEADER;
+	uint32_t i;
+	for (i = 0; i < cnt; ++i, hdr += CONTAINER_HEADER)
+	{
+		struct TagBitmapContainer c;
+		memcpy(&c.key, hdr, sizeof(uint16_t));
+		memcpy(&c.type, hdr + 2, sizeof(uint16_t));
+		memcpy(&c.count, hdr + 4, sizeof(uint32_t));
+		c.max = 0;
+		if ((i != 0 && c.key <= bm->containers[i - 1].key) ||
+			(c.type == TagBitmapArray && (c.count == 0 || c.count > TAGBITMAP_ARRAY_MAX)) ||
+			(c.type != TagBitmapArray && c.type != TagBitmapBits))
+			break;
+		size_t len = containerPayload(&c);
+		if (len > length - pos)
+			break;
+		if (c.type == TagBitmapBits)
+		{
+			if ((c.data.bits = malloc(len)) == NULL)
+				break;
+			memcpy(c.data.bits, buf + pos, len);
+			c.count = countBits(c.data.bits);
+		}
+		else
+		{
+			if ((c.data.array = malloc(len)) == NULL)
+				break;
+			memcpy(c.data.array, buf + pos, len);
+			c.max = c.count;
+			uint32_t k;
+			for (k = 1; k < c.count; ++k)
+				if (c.data.array[k - 1] >= c.data.array[k])
+					break;
+			if (k < c.count)
+			{
+				containerFree(&c);
+				break;
+			}
+		}
+		pos += len;
+		bm->containers[bm->count++] = c;
+	}
+	if (i != cnt || pos != length)
+	{
+		tagbitmapFree(bm);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+size_t tagbitmapSerializedCardinality(const unsigned char *buf, size_t length)
+{
+	// Only the headers of the containers are read
+	uint32_t cnt;
+	if (length < sizeof(cnt))
+		return 0;
+	memcpy(&cnt, buf, sizeof(cnt));
+	if (cnt > (length - sizeof(cnt)) / CONTAINER_HEADER)
+		return 0;
+	size_t res = 0;
+	uint32_t i;
+	for (i = 0; i < cnt; ++i)
+	{
+		uint32_t count;
+		memcpy(&count, buf + sizeof(cnt) + (size_t)i * CONTAINER_HEADER + 4, sizeof(count));
+		res += (count <= CONTAINER_BITS) ? count : CONTAINER_BITS;
+	}
+	return res;
+}
+
+/**************************** Private ********************************/
+
+static struct TagBitmapContainer *findContainer(const struct TagBitmap *bm, uint16_t key, size_t *pos)
+{
+	size_t lo = 0;
+	size_t hi = bm->count;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		uint16_t k = bm->containers[mid].key;
+		if (k == key)
+			return &bm->containers[mid];
+		if (k < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*pos = lo;
+	return NULL;
+}
+
+static struct TagBitmapContainer *insertContainer(struct TagBitmap *bm, size_t pos, uint16_t key)
+{
+	if (bm->count == bm->max)
+	{
+		struct TagBitmapContainer *newPtr = realloc(bm->containers, (bm->max + CONTAINERS_INCREASE) * sizeof(struct TagBitmapContainer));
+		if (newPtr == NULL)
+			return NULL;
+		bm->containers = newPtr;
+		bm->max += CONTAINERS_INCREASE;
+	}
+	struct TagBitmapContainer *c = &bm->containers[pos];
+	memmove(c + 1, c, (bm->count - pos) * sizeof(struct TagBitmapContainer));
+	++bm->count;
+	c->key        = key;
+	c->type       = TagBitmapArray;
+	c->count      = 0;
+	c->max        = 0;
+	c->data.array = NULL;
+	return c;
+}
+
+static int containerAdd(struct TagBitmapContainer *c, uint16_t low)
+{
+	if (c->type == TagBitmapBits)
+	{
+		uint64_t mask = (uint64_t)1 << (low & 63);
+		if ((c->data.bits[low >> 6] & mask) == 0)
+		{
+			c->data.bits[low >> 6] |= mask;
+			++c->count;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	uint32_t pos = c->count;
+	if (pos != 0 && c->data.array[pos - 1] >= low)
+	{
+		uint32_t lo = 0;
+		uint32_t hi = pos;
+		while (lo < hi)
+		{
+			uint32_t mid = (lo + hi) / 2;
+			if (c->data.array[mid] < low)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (c->data.array[lo] == low)
+			return EXIT_SUCCESS;
+		pos = lo;
+	}
+	if (c->count == TAGBITMAP_ARRAY_MAX)
+	{
+		if (containerToBits(c) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+		return containerAdd(c, low);
+	}
+	if (containerReserve(c, c->count + 1) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	memmove(&c->data.array[pos + 1], &c->data.array[pos], (c->count - pos) * sizeof(uint16_t));
+	c->data.array[pos] = low;
+	++c->count;
+	return EXIT_SUCCESS;
+}
+
+static int containerContains(const struct TagBitmapContainer *c, uint16_t low)
+{
+	if (c->type == TagBitmapBits)
+		return (c->data.bits[low >> 6] >> (low & 63)) & 1;
+	uint32_t lo = 0;
+	uint32_t hi = c->count;
+	while (lo < hi)
+	{
+		uint32_t mid = (lo + hi) / 2;
+		if (c->data.array[mid] == low)
+			return 1;
+		if (c->data.array[mid] < low)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return 0;
+}
+
+static int containerReserve(struct TagBitmapContainer *c, uint32_t count)
+{
+	if (count <= c->max)
+		return EXIT_SUCCESS;
+	uint32_t max = c->max * 2;
+	if (max < c->max + ARRAY_INCREASE)
+		max = c->max + ARRAY_INCREASE;
+	if (max < count)
+		max = count;
+	uint16_t *newPtr = realloc(c->data.array, max * sizeof(uint16_t));
+	if (newPtr == NULL)
+		return EXIT_FAILURE;
+	c->data.array = newPtr;
+	c->max = max;
+	return EXIT_SUCCESS;
+}
+
+static int containerToBits(struct TagBitmapContainer *c)
+{
+	uint64_t *bits = calloc(TAGBITMAP_WORDS, sizeof(uint64_t));
+	if (bits == NULL)
+		return EXIT_FAILURE;
+	uint32_t i;
+	for (i = 0; i < c->count; ++i)
+	{
+		uint16_t low = c->data.array[i];
+		bits[low >> 6] |= (uint64_t)1 << (low & 63);
+	}
+	free(c->data.array);
+	c->type      = TagBitmapBits;
+	c->max       = 0;
+	c->data.bits = bits;
+	return EXIT_SUCCESS;
+}
+
+static int containerNormalize(struct TagBitmapContainer *c)
+{
+	// A sparse bitmap is turned back into an array
+	if (c->type != TagBitmapBits || c->count > TAGBITMAP_ARRAY_MAX)
+		return EXIT_SUCCESS;
+	uint16_t *array = malloc((c->count != 0 ? c->count : 1) * sizeof(uint16_t));
+	if (array == NULL)
+		return EXIT_FAILURE;
+	uint32_t n = 0;
+	uint32_t w;
+	for (w = 0; w < TAGBITMAP_WORDS; ++w)
+	{
+		uint64_t word = c->data.bits[w];
+		while (word != 0)
+		{
+			array[n++] = w * 64 + __builtin_ctzll(word);
+			word &= word - 1;
+		}
+	}
+	free(c->data.bits);
+	c->type       = TagBitmapArray;
+	c->max        = (c->count != 0) ? c->count : 1;
+	c->data.array = array;
+	return EXIT_SUCCESS;
+}
+
+static int containerCopy(struct TagBitmapContainer *dst, const struct TagBitmapContainer *src)
+{
+	*dst = *src;
+	size_t len = containerPayload(src);
+	void *data = malloc(len != 0 ? len : 1);
+	if (data == NULL)
+		return EXIT_FAILURE;
+	memcpy(data, (src->type == TagBitmapBits) ? (const void *)src->data.bits : (const void *)src->data.array, len);
+	if (src->type == TagBitmapBits)
+		dst->data.bits = data;
+	else
+	{
+		dst->data.array = data;
+		dst->max = src->count;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int containerOr(struct TagBitmapContainer *c, const struct TagBitmapContainer *other)
+{
+	uint32_t i;
+	if (c->type == TagBitmapBits)
+	{
+		if (other->type == TagBitmapBits)
+		{
+			for (i = 0; i < TAGBITMAP_WORDS; ++i)
+				c->data.bits[i] |= other->data.bits[i];
+		}
+		else
+		{
+			for (i = 0; i < other->count; ++i)
+			{
+				uint16_t low = other->data.array[i];
+				c->data.bits[low >> 6] |= (uint64_t)1 << (low & 63);
+			}
+		}
+		c->count = countBits(c->data.bits);
+		return EXIT_SUCCESS;
+	}
+	if (other->type == TagBitmapBits)
+	{
+		struct TagBitmapContainer copy;
+		if (containerCopy(&copy, other) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+		copy.key = c->key;
+		if (containerOr(&copy, c) != EXIT_SUCCESS)
+		{
+			containerFree(&copy);
+			return EXIT_FAILURE;
+		}
+		containerFree(c);
+		*c = copy;
+		return EXIT_SUCCESS;
+	}
+	if (c->count + other->count > TAGBITMAP_ARRAY_MAX)
+	{
+		if (containerToBits(c) != EXIT_SUCCESS || containerOr(c, other) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+		return containerNormalize(c);
+	}
+
+	// Both arrays are sorted, so they are merged
+	uint32_t max = c->count + other->count;
+	uint16_t *array = malloc((max != 0 ? max : 1) * sizeof(uint16_t));
+	if (array == NULL)
+		return EXIT_FAILURE;
+	uint32_t j = 0;
+	uint32_t n = 0;
+	i = 0;
+	while (i < c->count && j < other->count)
+	{
+		uint16_t a = c->data.array[i];
+		uint16_t b = other->data.array[j];
+		array[n++] = (a < b) ? a : b;
+		i += (a <= b);
+		j += (b <= a);
+	}
+	while (i < c->count)
+		array[n++] = c->data.array[i++];
+	while (j < other->count)
+		array[n++] = other->data.array[j++];
+	free(c->data.array);
+	c->data.array = array;
+	c->count = n;
+	c->max = (max != 0) ? max : 1;
+	return EXIT_SUCCESS;
+}
+
+static int containerAnd(struct TagBitmapContainer *c, const struct TagBitmapContainer *other)
+{
+	uint32_t i;
+	uint32_t n = 0;
+	if (c->type == TagBitmapArray)
+	{
+		// The result is never larger than the array, so it is built in place
+		if (other->type == TagBitmapBits)
+		{
+			for (i = 0; i < c->count; ++i)
+			{
+				uint16_t low = c->data.array[i];
+				if ((other->data.bits[low >> 6] >> (low & 63)) & 1)
+					c->data.array[n++] = low;
+			}
+		}
+		else
+		{
+			uint32_t j = 0;
+			i = 0;
+			while (i < c->count && j < other->count)
+			{
+				uint16_t a = c->data.array[i];
+				uint16_t b = other->data.array[j];
+				if (a == b)
+					c->data.array[n++] = a;
+				i += (a <= b);
+				j += (b <= a);
+			}
+		}
+		c->count = n;
+		return EXIT_SUCCESS;
+	}
+	if (other->type == TagBitmapArray)
+	{
+		uint16_t *array = malloc((other->count != 0 ? other->count : 1) * sizeof(uint16_t));
+		if (array == NULL)
+			return EXIT_FAILURE;
+		for (i = 0; i < other->count; ++i)
+		{
+			uint16_t low = other->data.array[i];
+			if ((c->data.bits[low >> 6] >> (low & 63)) & 1)
+				array[n++] = low;
+		}
+		free(c->data.bits);
+		c->type       = TagBitmapArray;
+		c->count      = n;
+		c->max        = (other->count != 0) ? other->count : 1;
+		c->data.array = array;
+		return EXIT_SUCCESS;
+	}
+	for (i = 0; i < TAGBITMAP_WORDS; ++i)
+		c->data.bits[i] &= other->data.bits[i];
+	c->count = countBits(c->data.bits);
+	return containerNormalize(c);
+}
+
+static void containerFree(struct TagBitmapContainer *c)
+{
+	if (c->type == TagBitmapBits)
+		free(c->data.bits);
+	else
+		free(c->data.array);
+	c->data.array = NULL;
+	c->count      = 0;
+	c->max        = 0;
+}
+
+static size_t containerPayload(const struct TagBitmapContainer *c)
+{
+	if (c->type == TagBitmapBits)
+		return TAGBITMAP_WORDS * sizeof(uint64_t);
+	return c->count * sizeof(uint16_t);
+}
+
+static uint32_t countBits(const uint64_t *bits)
+{
+	uint32_t res = 0;
+	uint32_t i;
+	for (i = 0; i < TAGBITMAP_WORDS; ++i)
+		res += __builtin_popcountll(bits[i]);
+	return res;
+}
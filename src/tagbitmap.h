@@ -0,0 +1,90 @@
+/*
+ * tagbitmap.h
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef TAGBITMAP_H
+#define TAGBITMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Compressed bitmap of 32-bit item ids. The ids are split by their high 16 bits into containers,
+ * a container holds the low 16 bits either as a sorted array (up to TAGBITMAP_ARRAY_MAX values)
+ * or as a plain bitmap of 65536 bits. The containers are sorted by the high bits.
+ *
+ * Serialized form, all integers are little-endian:
+ *   uint32 count of the containers
+ *   count times { uint16 high bits, uint16 type, uint32 cardinality }
+ *   the payloads of the containers in the same order: cardinality times uint16 for an array,
+ *   TAGBITMAP_WORDS times uint64 for a bitmap
+ */
+
+#define TAGBITMAP_ARRAY_MAX  4096
+#define TAGBITMAP_WORDS      1024
+
+enum TagBitmapType
+{
+	TagBitmapArray,
+	TagBitmapBits
+};
+
+struct TagBitmapContainer
+{
+	uint16_t      key;
+	uint16_t      type;
+	uint32_t      count;
+	uint32_t      max;
+	union
+	{
+		uint16_t  *array;
+		uint64_t  *bits;
+	} data;
+};
+
+struct TagBitmap
+{
+	size_t        count;
+	size_t        max;
+	struct TagBitmapContainer *containers;
+};
+
+struct TagBitmapIter
+{
+	size_t        container;
+	uint32_t      pos;
+};
+
+void   tagbitmapInit(struct TagBitmap *bm);
+void   tagbitmapFree(struct TagBitmap *bm);
+int    tagbitmapAdd(struct TagBitmap *bm, uint32_t value);
+int    tagbitmapContains(const struct TagBitmap *bm, uint32_t value);
+size_t tagbitmapCardinality(const struct TagBitmap *bm);
+int    tagbitmapMaximum(const struct TagBitmap *bm, uint32_t *value);
+int    tagbitmapOr(struct TagBitmap *bm, const struct TagBitmap *other);
+int    tagbitmapAnd(struct TagBitmap *bm, const struct TagBitmap *other);
+void   tagbitmapIterInit(struct TagBitmapIter *it);
+int    tagbitmapNext(const struct TagBitmap *bm, struct TagBitmapIter *it, uint32_t *value);
+
+size_t tagbitmapSerializedSize(const struct TagBitmap *bm);
+void   tagbitmapSerialize(const struct TagBitmap *bm, unsigned char *buf);
+int    tagbitmapDeserialize(struct TagBitmap *bm, const unsigned char *buf, size_t length);
+size_t tagbitmapSerializedCardinality(const unsigned char *buf, size_t length);
+
+#endif // TAGBITMAP_H
@@ -0,0 +1,212 @@
+/*
+ * tagblock.c
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tagblock.h"
+#include "taglz.h"
+
+static int writeBlock(FILE *fd, const unsigned char *data, size_t len, struct TagBlockEntry *entry, struct TagBinBuffer *buf);
+
+void tagblockDirInit(struct TagBlockDir *dir)
+{
+	dir->file       = NULL;
+	dir->fileSize   = 0;
+	dir->count      = 0;
+	dir->entries    = NULL;
+	dir->rawOffsets = NULL;
+	dir->decoded    = NULL;
+	dir->rawSize    = 0;
+}
+
+void tagblockDirFree(struct TagBlockDir *dir)
+{
+	free(dir->entries);
+	free(dir->rawOffsets);
+	free(dir->decoded);
+	tagblockDirInit(dir);
+}
+
+int tagblockDirLoad(struct TagBlockDir *dir, const unsigned char *file, size_t fileSize, size_t dirOffset, size_t *dictOffset)
+{
+	// Checks the directory against the file, so the blocks can be decoded without more checks
+	uint64_t count;
+	if (dirOffset > fileSize || fileSize - dirOffset < sizeof(count))
+		return EXIT_FAILURE;
+	memcpy(&count, file + dirOffset, sizeof(count));
+	size_t pos = dirOffset + sizeof(count);
+	if (count > (fileSize - pos) / sizeof(struct TagBlockEntry))
+		return EXIT_FAILURE;
+
+	tagblockDirFree(dir);
+	if (count != 0)
+	{
+		dir->entries    = malloc(count * sizeof(struct TagBlockEntry));
+		dir->rawOffsets = malloc(count * sizeof(size_t));
+		dir->decoded    = calloc(count, 1);
+		if (dir->entries == NULL || dir->rawOffsets == NULL || dir->decoded == NULL)
+		{
+			tagblockDirFree(dir);
+			return EXIT_FAILURE;
+		}
+		memcpy(dir->entries, file + pos, count * sizeof(struct TagBlockEntry));
+	}
+	dir->count = count;
+
+	size_t i;
+	size_t rawSize = 0;
+	for (i = 0; i < count; ++i)
+	{
+		const struct TagBlockEntry *entry = &dir->entries[i];
+		if (entry->offset > dirOffset || entry->length > dirOffset - entry->offset || entry->minSize > entry->maxSize)
+		{
+			tagblockDirFree(dir);
+			return EXIT_FAILURE;
+		}
+		dir->rawOffsets[i] = rawSize;
+		rawSize += entry->rawLength;
+	}
+	dir->rawSize  = rawSize;
+	dir->file     = file;
+	dir->fileSize = fileSize;
+	*dictOffset = pos + count * sizeof(struct TagBlockEntry);
+	return EXIT_SUCCESS;
+}
+
+size_t tagblockFind(const struct TagBlockDir *dir, size_t pos)
+{
+	// Number of the block that holds the position of the stream, count if it is after the last block
+	size_t lo = 0;
+	size_t hi = dir->count;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if (dir->rawOffsets[mid] + dir->entries[mid].rawLength <= pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+size_t tagblockSeek(const struct TagBlockDir *dir, size_t pos, uint64_t fileSize)
+{
+	// Number of the first block from the position on that can hold items of the file size
+	size_t num = tagblockFind(dir, pos);
+	while (num < dir->count && dir->entries[num].maxSize < fileSize)
+		++num;
+	return num;
+}
+
+int tagblockDecode(struct TagBlockDir *dir, size_t num, unsigned char *stream)
+{
+	if (dir->decoded[num])
+		return EXIT_SUCCESS;
+	const struct TagBlockEntry *entry = &dir->entries[num];
+	if (taglzDecompress(dir->file + entry->offset, entry->length, stream + dir->rawOffsets[num], entry->rawLength) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	dir->decoded[num] = 1;
+	return EXIT_SUCCESS;
+}
+
+int tagblockWrite(FILE *fd, const unsigned char *items, size_t len, unsigned int hashSize, const struct TagBinDict *dict)
+{
+	// Writes everything after the text header, the items are cut into blocks on their boundaries
+	long start = ftell(fd);
+	if (start == -1)
+		return EXIT_FAILURE;
+
+	struct TagBlockPreamble pre;
+	memcpy(pre.magic, TAGBLOCK_MAGIC, TAGBLOCK_MAGIC_LEN);
+	pre.dirOffset = 0;
+	if (fwrite(&pre, sizeof(pre), 1, fd) != 1)
+		return EXIT_FAILURE;
+
+	int res = EXIT_SUCCESS;
+	struct TagBinBuffer buf = { 0, 0, NULL };
+	struct TagBinBuffer dir = { 0, 0, NULL };
+	uint64_t count = 0;
+	size_t blockStart = 0;
+	size_t pos = 0;
+	struct TagBlockEntry entry;
+	memset(&entry, 0, sizeof(entry));
+	while (pos < len)
+	{
+		struct TagBinItemHeader hdr;
+		if (tagbinReadItemHeader(items + pos, len - pos, hashSize, &hdr) != EXIT_SUCCESS)
+		{
+			res = EXIT_FAILURE;
+			break;
+		}
+		if (pos == blockStart)
+			entry.minSize = hdr.fileSize;
+		entry.maxSize = hdr.fileSize;
+		pos += TAGBIN_ITEM_HEADER_SIZE(hashSize) + hdr.recLength;
+		if (pos - blockStart >= TAGBLOCK_SIZE || pos == len)
+		{
+			if (writeBlock(fd, items + blockStart, pos - blockStart, &entry, &buf) != EXIT_SUCCESS ||
+				tagbinBufferReserve(&dir, sizeof(entry)) != EXIT_SUCCESS)
+			{
+				res = EXIT_FAILURE;
+				break;
+			}
+			memcpy(dir.data + dir.length, &entry, sizeof(entry));
+			dir.length += sizeof(entry);
+			++count;
+			blockStart = pos;
+		}
+	}
+
+	long dirOffset = ftell(fd);
+	if (res == EXIT_SUCCESS && dirOffset != -1 &&
+		fwrite(&count, sizeof(count), 1, fd) == 1 &&
+		(dir.length == 0 || fwrite(dir.data, 1, dir.length, fd) == dir.length) &&
+		tagbinDictWrite(dict, fd) == EXIT_SUCCESS)
+	{
+		pre.dirOffset = dirOffset;
+		if (fseek(fd, start + offsetof(struct TagBlockPreamble, dirOffset), SEEK_SET) != 0 ||
+			fwrite(&pre.dirOffset, sizeof(pre.dirOffset), 1, fd) != 1 ||
+			fseek(fd, 0L, SEEK_END) != 0)
+			res = EXIT_FAILURE;
+	}
+	else
+		res = EXIT_FAILURE;
+	tagbinBufferFree(&buf);
+	tagbinBufferFree(&dir);
+	return res;
+}
+
+/**************************** Private ********************************/
+
+static int writeBlock(FILE *fd, const unsigned char *data, size_t len, struct TagBlockEntry *entry, struct TagBinBuffer *buf)
+{
+	long offset = ftell(fd);
+	size_t bound = taglzCompressBound(len);
+	if (offset == -1 || len > UINT32_MAX || tagbinBufferReserve(buf, bound) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	size_t compLen = taglzCompress(data, len, buf->data, bound);
+	if (compLen == 0 || fwrite(buf->data, 1, compLen, fd) != compLen)
+		return EXIT_FAILURE;
+	entry->offset    = offset;
+	entry->length    = compLen;
+	entry->rawLength = len;
+	return EXIT_SUCCESS;
+}
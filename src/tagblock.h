@@ -0,0 +1,79 @@
+/*
+ * tagblock.h
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef TAGBLOCK_H
+#define TAGBLOCK_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tagbin.h"
+
+/*
+ * Compressed variant of the binary index (!format=compressed), all integers are little-endian:
+ *   the text header and the empty line like in the binary index
+ *   struct TagBlockPreamble
+ *   blocks, every one is a sequence of whole binary items (see tagbin.h) compressed by taglz
+ *   at dirOffset: uint64 blockCount, blockCount times struct TagBlockEntry, the dictionary
+ * The blocks follow in the order of the items and keep the range of the file sizes of them,
+ * so a search by the file size decompresses only the blocks that can hold the item.
+ * Every block is decompressed independently into its place of the stream of the binary items.
+ */
+
+#define TAGBLOCK_MAGIC      "TAGSBLK1"
+#define TAGBLOCK_MAGIC_LEN  8
+#define TAGBLOCK_SIZE       65536 // the block is closed by the first item that crosses the size
+
+struct TagBlockPreamble
+{
+	char          magic[TAGBLOCK_MAGIC_LEN];
+	uint64_t      dirOffset;
+};
+
+struct TagBlockEntry
+{
+	uint64_t      offset;
+	uint32_t      length;
+	uint32_t      rawLength;
+	uint64_t      minSize;
+	uint64_t      maxSize;
+};
+
+struct TagBlockDir
+{
+	const unsigned char *file;      // the mapped compressed index
+	size_t        fileSize;
+	size_t        count;
+	struct TagBlockEntry *entries;
+	size_t        *rawOffsets;      // offsets of the blocks in the stream of the items
+	unsigned char *decoded;
+	size_t        rawSize;
+};
+
+void   tagblockDirInit(struct TagBlockDir *dir);
+void   tagblockDirFree(struct TagBlockDir *dir);
+int    tagblockDirLoad(struct TagBlockDir *dir, const unsigned char *file, size_t fileSize, size_t dirOffset, size_t *dictOffset);
+size_t tagblockFind(const struct TagBlockDir *dir, size_t pos);
+size_t tagblockSeek(const struct TagBlockDir *dir, size_t pos, uint64_t fileSize);
+int    tagblockDecode(struct TagBlockDir *dir, size_t num, unsigned char *stream);
+int    tagblockWrite(FILE *fd, const unsigned char *items, size_t len, unsigned int hashSize, const struct TagBinDict *dict);
+
+#endif // TAGBLOCK_H
@@ -19,48 +19,99 @@
  */
 
 #define _LARGEFILE64_SOURCE
+#define _GNU_SOURCE
 
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
 #include <string.h>
 #include <wctype.h>
+#include <wchar.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 #include "tagfile.h"
 #include "sha1.h"
 #include "file.h"
 #include "item.h"
 #include "common.h"
+#include "digest.h"
 #include "utils.h"
 
 #define READ_BUFFER_INCREASE   200
-#define READ_BUFFER_MAX_LENGTH 50000
+#define JOURNAL_COMPACT_MIN    65536  // the journal is merged when it is larger than both of them,
+#define JOURNAL_COMPACT_RATIO  4      // the documented 64 KB and a quarter of the index
+#define COPY_RANGE_MIN         65536
 
 const char tagFileName[] = "tags.info";
 #define tagFileNameLen     9
 
-int tagfileScanItemHeader(const wchar_t *str, size_t *pSz, wchar_t **pHash);
+const char tagFileHeader[] = "!tags-info\n!version=0.1\n!format=%s\n!hash=%s\n!hash-size=%u\n";
+const char *tagFileFormatNames[] = { "simple", "binary", "compressed" };
+
+int tagfileScanItemHeader(const char *str, size_t len, unsigned int hashSize, size_t *pSz, unsigned char *hash);
 enum ErrorId tagfileWritingTail(struct TagFileStruct *tf);
-int tagfileItemOutput(FILE *fd, const struct ItemStruct *item);
-FILE *tagfileGetReadFd(const struct TagFileStruct *tf);
+int tagfileItemOutput(FILE *fd, const struct ItemStruct *item, enum HashAlg alg);
 FILE *tagfileGetWriteFd(const struct TagFileStruct *tf);
 struct TagFileStruct *tagfileInitStruct(enum TagFileMode mode);
 static enum ErrorId initPath(struct TagFileStruct *tf, const wchar_t *dPath, const wchar_t *fName);
 static enum ErrorId updateCharPath(struct TagFileStruct *tf);
-enum ErrorId tagfileAllocateReadBuffer(struct TagFileStruct *tf);
+enum ErrorId tagfileAllocateReadBuffer(struct TagFileStruct *tf, size_t len);
 struct TagFileStruct *tagfileCloneForSubdir(const struct TagFileStruct *tf, const char *subdir);
 enum ErrorId tagfileOpen(struct TagFileStruct *tf);
 enum ErrorId tagfileReadHeader(struct TagFileStruct *tf);
+enum ErrorId tagfileWriteHeader(struct TagFileStruct *tf, FILE *fd);
+enum ErrorId tagfileMap(struct TagFileStruct *tf, FILE *fd);
+enum ErrorId tagfileReadPreamble(struct TagFileStruct *tf);
+enum ErrorId tagfileReadBlocks(struct TagFileStruct *tf);
+enum ErrorId tagfileDecodeBlocks(struct TagFileStruct *tf, size_t from, size_t to);
+size_t tagfileBlockSeek(struct TagFileStruct *tf, size_t sz, size_t curPos);
+enum ErrorId tagfileCompressTempFile(struct TagFileStruct *tf, FILE **pFd, char **pName);
+void tagfileMapRandom(struct TagFileStruct *tf);
+void tagfileUnmap(struct TagFileStruct *tf);
+int tagfileFindNextItemPositionBin(struct TagFileStruct *tf, size_t sz, const unsigned char *hash);
+enum ErrorId tagfileItemBodyLoadBin(struct TagFileStruct *tf, struct ItemStruct *item);
 void tagfileClose(struct TagFileStruct *tf);
 enum ErrorId tagfileReadString(struct TagFileStruct *tf);
-enum ErrorId tagfileWriteString(struct TagFileStruct *tf, const wchar_t *str);
+int tagfileIsLine(const struct TagFileStruct *tf, const char *str, size_t len);
+const wchar_t *tagfileDecodeLine(struct TagFileStruct *tf);
 enum ErrorId tagfileItemBodyLoad(struct TagFileStruct *tf, struct ItemStruct *item);
 struct ItemStruct *tagfileGetNextItem(struct TagFileStruct *tf);
 enum ErrorId tagfileOpenTempWriteFile(struct TagFileStruct *tf);
 void tagfileCloseTemporaryFiles(struct TagFileStruct *tf);
-
-
-int tagfileCreateIndex()
+int tagfileGetSidecarPath(const struct TagFileStruct *tf, char *path);
+int tagfileGetInvertedPath(const struct TagFileStruct *tf, char *path);
+void tagfileOpenInverted(struct TagFileStruct *tf);
+size_t tagfileItemCount(const struct TagFileStruct *tf);
+int tagfileListItem(const struct TagFileStruct *tf, struct FieldListStruct *fields, struct TagPlan *plan, struct ItemStruct *item);
+int tagfileListInverted(struct TagFileStruct *tf, struct FieldListStruct *fields, struct TagPlan *plan);
+struct ItemStruct *tagfileLoadItemAt(struct TagFileStruct *tf, size_t offset);
+void tagfileOpenSidecar(struct TagFileStruct *tf);
+size_t tagfileSidecarSeek(struct TagFileStruct *tf, size_t sz, const unsigned char *hash, size_t curPos);
+enum ErrorId tagfileSkipTo(struct TagFileStruct *tf, size_t to);
+size_t tagfileGetCurrentOffset(const struct TagFileStruct *tf);
+enum ErrorId tagfileCopyPending(struct TagFileStruct *tf);
+int tagfileCollectStart(struct TagFileStruct *tf);
+void tagfileCollectStop(struct TagFileStruct *tf);
+void tagfileCollectRange(struct TagFileStruct *tf, FILE *fdWrite, size_t from, size_t to);
+void tagfileCollectItem(struct TagFileStruct *tf, FILE *fdWrite, const struct ItemStruct *item);
+FILE *tagfileCreateTempFile(struct TagFileStruct *tf, char *path);
+int tagfileLinkTempFile(struct TagFileStruct *tf, FILE *fd, char *path);
+int tagfileSyncDirectory(const struct TagFileStruct *tf);
+int tagfileIsCopying(const struct TagFileStruct *tf);
+int tagfileGetJournalPath(const struct TagFileStruct *tf, char *path);
+enum ErrorId tagfileOpenJournal(struct TagFileStruct *tf);
+void tagfileResetJournalCursor(struct TagFileStruct *tf);
+int tagfileFindNextItemPositionRaw(struct TagFileStruct *tf, size_t sz, const unsigned char *hash);
+int tagfileFindNextItemPositionText(struct TagFileStruct *tf, size_t sz, const unsigned char *hash);
+int tagfileFindNextItemPositionMerged(struct TagFileStruct *tf, size_t sz, const unsigned char *hash);
+struct ItemStruct *tagfileItemLoadRaw(struct TagFileStruct *tf);
+enum ErrorId tagfileSkipItemRaw(struct TagFileStruct *tf);
+
+
+int tagfileCreateIndex(enum TagFileFormat format, enum HashAlg alg)
 {
 	int res = EXIT_FAILURE;
 	if (access(tagFileName, F_OK) == -1 && errno == ENOENT)
@@ -68,12 +119,32 @@ int tagfileCreateIndex()
 		FILE *fd = fopen(tagFileName, "w");
 		if (fd != NULL)
 		{
-			if (fputs("!tags-info", fd) != EOF && fputs("\n!version=0.1\n!format=simple\n\n", fd) != EOF)
+			int len = fprintf(fd, tagFileHeader, tagFileFormatNames[format], hashalgName(alg), hashalgSize(alg));
+			if (len >= 0 && fputc('\n', fd) != EOF)
 			{
-				fputs("Ok\n", stdout);
 				res = EXIT_SUCCESS;
+				if (format == FormatBinary)
+				{
+					// The empty dictionary follows the preamble
+					struct TagBinPreamble pre;
+					memcpy(pre.magic, TAGBIN_MAGIC, TAGBIN_MAGIC_LEN);
+					pre.dictOffset = len + 1 + sizeof(pre);
+					uint32_t dictCnt = 0;
+					if (fwrite(&pre, sizeof(pre), 1, fd) != 1 || fwrite(&dictCnt, sizeof(dictCnt), 1, fd) != 1)
+						res = EXIT_FAILURE;
+				}
+				else if (format == FormatCompressed)
+				{
+					struct TagBinDict dict;
+					tagbinDictInit(&dict);
+					if (tagblockWrite(fd, NULL, 0, hashalgSize(alg), &dict) != EXIT_SUCCESS)
+						res = EXIT_FAILURE;
+				}
 			}
-			fclose(fd);
+			if (fclose(fd) == EOF)
+				res = EXIT_FAILURE;
+			if (res == EXIT_SUCCESS)
+				fputs("Ok\n", stdout);
 		}
 		if (res != EXIT_SUCCESS)
 			perror("tagfile");
@@ -102,9 +173,19 @@ struct TagFileStruct *tagfileInit(const char* dPath, const char* fName, enum Tag
 					res = updateCharPath(tf);
 					if (res == ErrorNone)
 					{
+						// Updates of an index with a journal are appended to the journal
+						char journalName[PATH_MAX];
+						if (mode == ReadWrite && tagfileGetJournalPath(tf, journalName) == EXIT_SUCCESS && access(journalName, F_OK) == 0)
+							tf->journaling = 1;
 						res = tagfileOpen(tf);
 						if (res == ErrorNone)
 							res = tagfileReadHeader(tf);
+						if (res == ErrorNone)
+						{
+							tagfileOpenSidecar(tf);
+							tagfileOpenInverted(tf);
+							res = tagfileOpenJournal(tf);
+						}
 					}
 				}
 				if (_fname != NULL)
@@ -130,20 +211,19 @@ enum ErrorId tagfileReinit(struct TagFileStruct *tf, enum TagFileMode mode)
 	if (tf->mode == ReadWrite)
 		tagfileCloseTemporaryFiles(tf);
 	tf->mode          = mode;
+	tf->journaling    = (mode == ReadWrite && tf->journal.enabled);
 	tf->lastError     = ErrorNone;
-	tf->curLineNum    = 0;
-	tf->readBuffer.pointer[0] = L'\0';
 	tf->curItemSize   = 0;
 	tf->curItemHash   = NULL;
 	tf->findFlag      = 0;
-	if (fseek(tf->fd, 0L, SEEK_SET) != -1)
+	tagfileResetJournalCursor(tf);
+	if (tagfileMap(tf, tf->fd) == ErrorNone)
 	{
-		if (mode == ReadWrite)
+		if (tagfileIsCopying(tf))
 			if (tagfileOpenTempWriteFile(tf) != ErrorNone)
 				return tf->lastError;
+		tagfileReadHeader(tf);
 	}
-	else
-		tf->lastError = ErrorInternal;
 	return tf->lastError;
 }
 
@@ -159,47 +239,101 @@ void tagfileFree(struct TagFileStruct *tf)
 		free(tf->filePath);
 	if (tf->filePathChar != NULL)
 		free(tf->filePathChar);
+	tagidxClose(&tf->sidecar);
+	tagidxListFree(&tf->writeIdx);
+	tagidxListFree(&tf->readIdx);
+	taginvClose(&tf->inverted);
+	tagjournalFree(&tf->journal);
+	tagbinDictFree(&tf->readDict);
+	tagbinDictFree(&tf->writeDict);
+	tagbinBufferFree(&tf->writeBuffer);
 	free(tf);
 }
 
-int tagfileFindNextItemPosition(struct TagFileStruct *tf, size_t sz, const wchar_t *hash)
+int tagfileFindNextItemPosition(struct TagFileStruct *tf, size_t sz, const unsigned char *hash)
+{
+	if (tf->journal.count == 0)
+		return tagfileFindNextItemPositionRaw(tf, sz, hash);
+	return tagfileFindNextItemPositionMerged(tf, sz, hash);
+}
+
+struct ItemStruct *tagfileItemLoad(struct TagFileStruct *tf)
+{
+	struct TagJournal *j = &tf->journal;
+	struct ItemStruct *item;
+	if (j->fromJournal)
+	{
+		item = tagjournalItemLoad(&j->entries[j->pos], tf->arena);
+		if (item == NULL)
+		{
+			fprintf(stderr, "Error: file %S - invalid journal record\n", tf->filePath);
+			tf->lastError = ErrorInvalidIndex;
+			return NULL;
+		}
+		++j->pos;
+		j->fromJournal = 0;
+		j->found = 0;
+		tf->lastError = ErrorNone;
+	}
+	else
+	{
+		item = tagfileItemLoadRaw(tf);
+		if (item == NULL)
+			return NULL;
+		// The end of the index file is not the end while there are journal items ahead
+		if (tf->lastError == ErrorEOF && j->pos < j->count)
+			tf->lastError = ErrorNone;
+	}
+
+	if (tf->journaling && tagjournalSetLoaded(j, item) != EXIT_SUCCESS)
+	{
+		itemFree(item);
+		tf->lastError = ErrorInternal;
+		return NULL;
+	}
+	return item;
+}
+
+int tagfileFindNextItemPositionText(struct TagFileStruct *tf, size_t sz, const unsigned char *hash)
 {
-	if (feof(tagfileGetReadFd(tf)))
+	if (tf->map.eof)
 	{
 		tf->lastError = ErrorEOF;
 		return 0;
 	}
 
-	wchar_t *buff = tf->readBuffer.pointer;
-	short fWrite = 0;
-	if (tf->mode == ReadWrite)
-		++fWrite;
-
 	if (tf->curLineNum == 0 || tf->findFlag)
 	{
-		if (fWrite && tf->curLineNum != 0)
-			if (tagfileWriteString(tf, buff) != ErrorNone)
-				return 0;
 		if (tagfileReadString(tf) != ErrorNone)
 			return 0;
 	}
 
+	size_t lineStart = tf->line.pointer - (const char *)tf->map.base;
+	size_t skipTo = tagfileSidecarSeek(tf, sz, hash, lineStart);
+	if (skipTo != lineStart)
+	{
+		if (tagfileSkipTo(tf, skipTo) != ErrorNone || tagfileReadString(tf) != ErrorNone)
+			return 0;
+	}
+
 	do
 	{
-		if (buff[0] == L'[')
+		if (tf->line.length != 0 && tf->line.pointer[0] == '[')
 		{
-			if (tagfileScanItemHeader(buff, &tf->curItemSize, &tf->curItemHash) != EXIT_SUCCESS)
+			if (tagfileScanItemHeader(tf->line.pointer, tf->line.length, hashalgSize(tf->hashAlg), &tf->curItemSize, tf->curItemHashBuf) != EXIT_SUCCESS)
 			{
+				fprintf(stderr, "Error: file %S, line %i - invalid format\n", tf->filePath, tf->curLineNum);
 				tf->lastError = ErrorInvalidIndex;
 				return 0;
 			}
+			tf->curItemHash = tf->curItemHashBuf;
 			int sizeCmp = 0;
 			int hashCmp = 0;
 			if (sz != 0)
 			{
 				sizeCmp = sz - tf->curItemSize;
 				if (hash != NULL)
-					hashCmp = wcsncmp(hash, tf->curItemHash, FILE_HASH_LEN);
+					hashCmp = digestCompare(hash, tf->curItemHash);
 			}
 			if (sizeCmp == 0)
 			{
@@ -214,17 +348,14 @@ int tagfileFindNextItemPosition(struct TagFileStruct *tf, size_t sz, const wchar
 			else if (sz < tf->curItemSize)
 				return 0;
 		}
-
-		if (fWrite && tagfileWriteString(tf, buff) != ErrorNone)
-			break;
 	} while (tagfileReadString(tf) == ErrorNone);
 
 	return 0;
 }
 
-struct ItemStruct *tagfileItemLoad(struct TagFileStruct *tf)
+struct ItemStruct *tagfileItemLoadRaw(struct TagFileStruct *tf)
 {
-	struct ItemStruct *item = itemInit(tf->curItemSize, tf->curItemHash);
+	struct ItemStruct *item = itemInitArena(tf->arena, tf->curItemSize, tf->curItemHash);
 	if (item == NULL)
 	{
 		tf->lastError = ErrorInvalidIndex;
@@ -232,8 +363,17 @@ struct ItemStruct *tagfileItemLoad(struct TagFileStruct *tf)
 		return NULL;
 	}
 
+	// The loaded item is not copied, it is written again only if it is inserted
+	if (tagfileIsCopying(tf) && tagfileCopyPending(tf) != ErrorNone)
+	{
+		itemFree(item);
+		return NULL;
+	}
 	if (tagfileItemBodyLoad(tf, item) == ErrorNone || tf->lastError == ErrorEOF)
+	{
+		tf->copyPos = tagfileGetCurrentOffset(tf);
 		return item;
+	}
 
 	itemFree(item);
 	return NULL;
@@ -244,23 +384,36 @@ int tagfileList(struct TagFileStruct *tf, struct FieldListStruct *fields, const
 	int res = EXIT_SUCCESS;
 	if (tf->lastError == ErrorNone)
 	{
-		struct ItemStruct *item = NULL;
-		while ((item = tagfileGetNextItem(tf)) != NULL)
+		// The plan orders the conditions and decides whether the inverted index is worth using
+		struct TagPlan plan;
+		tagplanInit(&plan);
+		if (tagplanBuild(&plan, whr, &tf->inverted, tagfileItemCount(tf)) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+		// The listed items are not kept, they are taken from the arena that is reset after each one
+		struct TagArena arena;
+		tagarenaInit(&arena);
+		tf->arena = &arena;
+		if (plan.access == PlanInvertedIndex)
+			res = tagfileListInverted(tf, fields, &plan);
+		else
 		{
-			int fltr = (whr == NULL) ? 0 : whereIsFiltered(whr, item);
-			if (!fltr)
+			struct ItemStruct *item = NULL;
+			while (res == EXIT_SUCCESS && (item = tagfileGetNextItem(tf)) != NULL)
 			{
-				if (fields != NULL)
-					res = fieldsPrintRow(fields, item, tf->dirPath, stdout);
-				else
-					res = tagfileItemOutput(stdout, item);
+				res = tagfileListItem(tf, fields, &plan, item);
+				itemFree(item);
+				tagarenaReset(&arena);
 			}
-			itemFree(item);
-			if (res != EXIT_SUCCESS)
-				return EXIT_FAILURE;
+			if (tf->lastError != ErrorEOF && tf->lastError != ErrorNone)
+				res = EXIT_FAILURE;
 		}
-		if (tf->lastError != ErrorEOF && tf->lastError != ErrorNone)
-			res = EXIT_FAILURE;
+		tf->arena = NULL;
+		tagarenaFree(&arena);
+		if (res == EXIT_SUCCESS && (flags & ExplainFlag) != 0)
+			res = tagplanPrint(&plan, tf->dirPath, stdout);
+		tagplanFree(&plan);
+		if (res != EXIT_SUCCESS)
+			return EXIT_FAILURE;
 	}
 	tagfileClose(tf);
 
@@ -302,6 +455,10 @@ int tagfileShowProps(struct TagFileStruct *tf, struct ItemStruct *item)
 
 	if (tf->lastError == ErrorNone)
 	{
+		// The loaded items are taken from the arena, itemMerge copies what is new to the heap
+		struct TagArena arena;
+		tagarenaInit(&arena);
+		tf->arena = &arena;
 		struct ItemStruct *item2;
 		while ((item2 = tagfileGetNextItem(tf)) != NULL)
 		{
@@ -309,13 +466,17 @@ int tagfileShowProps(struct TagFileStruct *tf, struct ItemStruct *item)
 			if (itemMerge(item, item2) != EXIT_SUCCESS)
 			{
 				itemFree(item2);
+				res = EXIT_FAILURE;
 				fputs("Error: itemMerge failed\n", stderr);
-				return EXIT_FAILURE;
+				break;
 			}
+			tagarenaReset(&arena);
 			if (tf->lastError == ErrorEOF)
 				break;
 		}
-		if (tf->lastError != ErrorEOF && tf->lastError != ErrorNone)
+		tf->arena = NULL;
+		tagarenaFree(&arena);
+		if (res != EXIT_SUCCESS || (tf->lastError != ErrorEOF && tf->lastError != ErrorNone))
 			return EXIT_FAILURE;
 	}
 	tagfileClose(tf);
@@ -352,12 +513,31 @@ int tagfileShowProps(struct TagFileStruct *tf, struct ItemStruct *item)
 
 enum ErrorId tagfileSetAppendMode(struct TagFileStruct *tf)
 {
+	if (tf->journaling)
+	{
+		// The journal keeps all the changes, so the search starts again from the beginning
+		if (tagjournalFlushLoaded(&tf->journal) != EXIT_SUCCESS)
+		{
+			tf->lastError = ErrorInternal;
+			return ErrorInternal;
+		}
+		tagfileResetJournalCursor(tf);
+		if (tagfileMap(tf, tf->fd) == ErrorNone)
+			tagfileReadHeader(tf);
+		return tf->lastError;
+	}
+
 	if (tagfileWritingTail(tf) == ErrorNone)
 	{
-		if (fseek(tf->fdModif, 0L, SEEK_SET) == 0 && (tf->fdInsert = tmpfile()) != NULL)
+		// The entries of the first pass describe the temporary file that is read now
+		tagidxListFree(&tf->readIdx);
+		tf->readIdx = tf->writeIdx;
+		tf->readIdxValid = (tf->writeIdxState != 0);
+		tagidxListInit(&tf->writeIdx, tf->readIdx.hashSize);
+		if ((tf->fdInsert = tagfileCreateTempFile(tf, tf->insertPath)) != NULL)
 		{
-			tf->curLineNum = 0;
-			tf->lastError = ErrorNone;
+			if (tagfileMap(tf, tf->fdModif) == ErrorNone)
+				tagfileReadHeader(tf);
 		}
 		else
 		{
@@ -372,9 +552,30 @@ enum ErrorId tagfileInsertItem(struct TagFileStruct *tf, const struct ItemStruct
 {
 	enum ErrorId res = ErrorOther;
 
+	if (tf->journaling)
+	{
+		if (tagjournalInsertItem(&tf->journal, item) == EXIT_SUCCESS)
+			res = ErrorNone;
+		else
+			fputs("Error: tagjournalInsertItem failed\n", stderr);
+		tf->lastError = res;
+		return res;
+	}
+
+	if (tagfileCopyPending(tf) != ErrorNone)
+		return tf->lastError;
+
 	FILE *fdWrite = tagfileGetWriteFd(tf);
-	if (tagfileItemOutput(fdWrite, item) == EXIT_SUCCESS)
-		if (fputwc(L'\n', fdWrite) != WEOF)
+	tagfileCollectItem(tf, fdWrite, item);
+	if (tf->format == FormatBinary)
+	{
+		if (tagbinItemWrite(fdWrite, &tf->writeDict, &tf->writeBuffer, item, tf->hashSize) == EXIT_SUCCESS)
+			res = ErrorNone;
+		else
+			perror("tmpfile");
+	}
+	else if (tagfileItemOutput(fdWrite, item, tf->hashAlg) == EXIT_SUCCESS)
+		if (fputc('\n', fdWrite) != EOF)
 			res = ErrorNone;
 
 	tf->lastError = res;
@@ -383,77 +584,310 @@ enum ErrorId tagfileInsertItem(struct TagFileStruct *tf, const struct ItemStruct
 
 enum ErrorId tagfileApplyModifications(struct TagFileStruct *tf)
 {
+	if (tf->journaling)
+	{
+		struct TagJournal *j = &tf->journal;
+		char journalName[PATH_MAX];
+		tf->lastError = ErrorNone;
+		if (tagjournalFlushLoaded(j) != EXIT_SUCCESS || tagfileGetJournalPath(tf, journalName) != EXIT_SUCCESS)
+			tf->lastError = ErrorInternal;
+		else if (tagjournalCommit(j, journalName, tf->filePathChar, durability != DurabilityNone) != EXIT_SUCCESS)
+		{
+			perror("journal");
+			tf->lastError = ErrorOther;
+		}
+		else if (j->fileLength > JOURNAL_COMPACT_MIN && j->fileLength > tf->map.size / JOURNAL_COMPACT_RATIO)
+			tagfileCompactJournal(tf);
+		return tf->lastError;
+	}
+
 	if (tagfileWritingTail(tf) != ErrorNone)
 		return tf->lastError;
 
+	// The new index is already written next to the old one, it is published with a single rename
 	enum ErrorId res = ErrorOther;
 	FILE *fd = tagfileGetWriteFd(tf);
-	unsigned int pathLen = strlen(tf->filePathChar);
-	if (pathLen + 4 + 1 <= PATH_MAX)
+	char *tmpName = (fd == tf->fdInsert) ? tf->insertPath : tf->modifPath;
+	if (tf->compressed && tagfileCompressTempFile(tf, &fd, &tmpName) != ErrorNone)
+		perror("tmpfile");
+	else if (fflush(fd) == EOF || (durability != DurabilityNone && fdatasync(fileno(fd)) == -1))
+		perror("tmpfile");
+	else if (tmpName[0] == '\0' && tagfileLinkTempFile(tf, fd, tmpName) != EXIT_SUCCESS)
+		perror("tmpfile");
+	else if (rename(tmpName, tf->filePathChar) == -1)
+		perror("indexfile");
+	else
 	{
-		char tmpName[PATH_MAX];
-		strcpy(tmpName, tf->filePathChar);
-		strcpy(tmpName + pathLen, ".tmp");
-		FILE *fdTmp = fopen(&tmpName[0], "w");
-		if (fdTmp != NULL)
+		tmpName[0] = '\0';
+		if (durability == DurabilityFull && tagfileSyncDirectory(tf) != EXIT_SUCCESS)
+			perror("indexdir");
+		res = ErrorNone;
+		// The existing companion indexes are built again for the new index file,
+		// the offset index is taken from the entries collected while the index was written
+		char idxName[PATH_MAX];
+		char invName[PATH_MAX];
+		int needIdx = (tagfileGetSidecarPath(tf, idxName) == EXIT_SUCCESS && access(idxName, F_OK) == 0);
+		int needInv = (tagfileGetInvertedPath(tf, invName) == EXIT_SUCCESS && access(invName, F_OK) == 0);
+		if (needIdx && tf->writeIdxState == 1)
 		{
-			fseek(fd, 0L, SEEK_SET);
-			char buff[4096];
-			while (1)
+			tagidxClose(&tf->sidecar);
+			if (tf->compressed)
 			{
-				size_t cntRead = fread(buff, 1, sizeof(buff) * sizeof(char), fd);
-				if (ferror(fd))
-					break;
-				if (cntRead != 0)
-				{
-					size_t cntWrite = fwrite(buff, 1, cntRead, fdTmp);
-					if (cntRead != cntWrite || ferror(fdTmp))
-						break;
-				}
-				if (feof(fd))
-				{
-					res = ErrorNone;
-					fflush(fdTmp);
-					break;
-				}
+				// The items of a compressed index are addressed from the start of the blocks
+				size_t itemsOffset = tf->writePreamble + sizeof(struct TagBinPreamble);
+				size_t i;
+				for (i = 0; i < tf->writeIdx.count; ++i)
+					((struct TagIdxEntry *)(tf->writeIdx.entries + i * TAGIDX_ENTRY_SIZE(tf->hashSize)))->offset -= itemsOffset;
 			}
-			if (fclose(fdTmp) == EOF)
-				res = ErrorOther;
+			if (tagidxListWrite(&tf->writeIdx, idxName, fileno(fd)) == EXIT_SUCCESS)
+				needIdx = 0;
+		}
+		tagfileCollectStop(tf);
+		tagidxListFree(&tf->readIdx);
+		tf->readIdxValid = 0;
+		tagfileClose(tf);
+		if (needIdx || needInv)
+		{
+			tf->mode = ReadOnly;
+			if (tagfileOpen(tf) != ErrorNone || tagfileReadHeader(tf) != ErrorNone)
+				needIdx = needInv = -1;
+			if (needIdx && (needIdx == -1 || tagfileBuildSidecar(tf) != ErrorNone))
+				fputs("Warning: the offset index was not updated\n", stderr);
+			if (needInv && (needInv == -1 || tagfileMap(tf, tf->fd) != ErrorNone || tagfileReadHeader(tf) != ErrorNone ||
+				tagfileBuildInverted(tf) != ErrorNone))
+				fputs("Warning: the inverted index was not updated\n", stderr);
+			tagfileClose(tf);
+		}
+	}
+	tf->lastError = res;
+	return res;
+}
+
+enum ErrorId tagfileCompressTempFile(struct TagFileStruct *tf, FILE **pFd, char **pName)
+{
+	// The written binary index is packed into another temporary file
+	FILE *fd = *pFd;
+	FILE **pOutFd = &tf->fdInsert;
+	char *outName = tf->insertPath;
+	if (fd == tf->fdInsert)
+	{
+		pOutFd = &tf->fdModif;
+		outName = tf->modifPath;
+	}
+	if (*pOutFd != NULL)
+	{
+		fclose(*pOutFd);
+		*pOutFd = NULL;
+	}
+	if (outName[0] != '\0')
+	{
+		unlink(outName);
+		outName[0] = '\0';
+	}
+
+	struct stat64 st;
+	if (fflush(fd) == EOF || fstat64(fileno(fd), &st) == -1)
+		return ErrorOther;
+	size_t size = st.st_size;
+	struct TagBinPreamble pre;
+	size_t itemsOffset = tf->writePreamble + sizeof(pre);
+	if (tf->writePreamble <= 0 || itemsOffset > size)
+		return ErrorInternal;
+	unsigned char *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(fd), 0);
+	if (base == MAP_FAILED)
+		return ErrorOther;
+	memcpy(&pre, base + tf->writePreamble, sizeof(pre));
+
+	enum ErrorId res = ErrorOther;
+	if (pre.dictOffset < itemsOffset || pre.dictOffset > size)
+		res = ErrorInternal;
+	else if ((*pOutFd = tagfileCreateTempFile(tf, outName)) != NULL)
+	{
+		if (fprintf(*pOutFd, tagFileHeader, tagFileFormatNames[FormatCompressed], hashalgName(tf->hashAlg), tf->hashSize) >= 0 && fputc('\n', *pOutFd) != EOF &&
+			tagblockWrite(*pOutFd, base + itemsOffset, pre.dictOffset - itemsOffset, tf->hashSize, &tf->writeDict) == EXIT_SUCCESS)
+		{
+			*pFd = *pOutFd;
+			*pName = outName;
+			res = ErrorNone;
+		}
+	}
+	munmap(base, size);
+	return res;
+}
+
+enum ErrorId tagfileBuildSidecar(struct TagFileStruct *tf)
+{
+	char idxName[PATH_MAX];
+	if (tagfileGetSidecarPath(tf, idxName) != EXIT_SUCCESS)
+	{
+		tf->lastError = ErrorInternal;
+		return ErrorInternal;
+	}
+
+	tagidxClose(&tf->sidecar);
+	struct TagIdxList list;
+	tagidxListInit(&list, tf->hashSize);
+	enum ErrorId res = ErrorNone;
+	while (tagfileFindNextItemPositionRaw(tf, 0, NULL))
+	{
+		size_t offset = tagfileGetCurrentOffset(tf);
+		if (tagidxListAppend(&list, tf->curItemSize, tf->curItemHash, offset) != EXIT_SUCCESS)
+		{
+			res = ErrorInternal;
+			break;
+		}
+	}
+	if (res == ErrorNone && tf->lastError != ErrorEOF)
+		res = tf->lastError;
+	if (res == ErrorNone && tagidxListWrite(&list, idxName, fileno(tf->fd)) != EXIT_SUCCESS)
+	{
+		perror("offset index");
+		res = ErrorOther;
+	}
+	tagidxListFree(&list);
+	tf->lastError = res;
+	return res;
+}
+
+enum ErrorId tagfileBuildInverted(struct TagFileStruct *tf)
+{
+	// Only the items of the index file are indexed, the journal is merged at a search
+	char invName[PATH_MAX];
+	if (tagfileGetInvertedPath(tf, invName) != EXIT_SUCCESS)
+	{
+		tf->lastError = ErrorInternal;
+		return ErrorInternal;
+	}
 
-			if (res == ErrorNone)
+	taginvClose(&tf->inverted);
+	struct TagInvList list;
+	memset(&list, 0, sizeof(list));
+	struct TagBinBuffer key = { 0, 0, NULL };
+	struct TagArena arena;
+	tagarenaInit(&arena);
+	tf->arena = &arena;
+	enum ErrorId res = ErrorNone;
+	while (res == ErrorNone && tagfileFindNextItemPositionRaw(tf, 0, NULL))
+	{
+		size_t offset = tagfileGetCurrentOffset(tf);
+		struct ItemStruct *item = tagfileItemLoadRaw(tf);
+		if (item == NULL)
+		{
+			res = tf->lastError;
+			break;
+		}
+		unsigned int i;
+		for (i = 0; res == ErrorNone && i < item->propsCount; ++i)
+		{
+			struct PropertyStruct *prop = item->props[i];
+			if (prop == NULL)
+				continue;
+			const wchar_t *name = propGetName(prop);
+			unsigned int j;
+			for (j = 0; j < prop->valCount; ++j)
 			{
-				tagfileClose(tf);
-				res = ErrorOther;
-				char bakName[PATH_MAX];
-				strcpy(bakName, tf->filePathChar);
-				strcpy(bakName + pathLen, ".bak");
-				if (rename(tf->filePathChar, bakName) == 0)
+				if (taginvMakeKey(&key, name, propGetSubval(prop, j, None)) != EXIT_SUCCESS ||
+					taginvListAppend(&list, (const char *)key.data, key.length, offset) != EXIT_SUCCESS)
 				{
-					sync();
-					if (rename(tmpName, tf->filePathChar) == 0)
-					{
-						sync();
-						unlink(bakName);
-						res = ErrorNone;
-					}
-					else
-						perror("indexfile");
+					res = ErrorInternal;
+					break;
 				}
-				else
-					perror("bakfile");
 			}
-			else
-				perror("tmpfile");
-			if (res != ErrorNone)
-				unlink(tmpName);
 		}
-		else
-			perror("tmpfile");
+		itemFree(item);
+		tagarenaReset(&arena);
+		if (tf->lastError == ErrorEOF)
+			break;
+	}
+	tf->arena = NULL;
+	tagarenaFree(&arena);
+	if (res == ErrorNone && tf->lastError != ErrorEOF && tf->lastError != ErrorNone)
+		res = tf->lastError;
+	if (res == ErrorNone && taginvListWrite(&list, invName, fileno(tf->fd)) != EXIT_SUCCESS)
+	{
+		perror("inverted index");
+		res = ErrorOther;
 	}
+	taginvListFree(&list);
+	tagbinBufferFree(&key);
 	tf->lastError = res;
 	return res;
 }
 
+enum ErrorId tagfileEnableJournal(struct TagFileStruct *tf)
+{
+	// An existing journal is kept unless it belongs to another version of the index file
+	char journalName[PATH_MAX];
+	if (tagfileGetJournalPath(tf, journalName) != EXIT_SUCCESS)
+	{
+		tf->lastError = ErrorInternal;
+		return ErrorInternal;
+	}
+	if (!tf->journal.enabled || tf->journal.stale)
+	{
+		tagjournalFree(&tf->journal);
+		tf->journal.hashSize = tf->hashSize;
+		if (tagjournalCreate(journalName, tf->filePathChar, tf->hashSize) != EXIT_SUCCESS)
+		{
+			perror("journal");
+			tf->lastError = ErrorOther;
+			return ErrorOther;
+		}
+		tf->journal.enabled = 1;
+	}
+	return ErrorNone;
+}
+
+enum ErrorId tagfileCompactJournal(struct TagFileStruct *tf)
+{
+	// All the items are written to a new index file through the merged cursor
+	char journalName[PATH_MAX];
+	if (tagfileGetJournalPath(tf, journalName) != EXIT_SUCCESS || tagjournalFlushLoaded(&tf->journal) != EXIT_SUCCESS)
+	{
+		tf->lastError = ErrorInternal;
+		return ErrorInternal;
+	}
+	if (tagjournalHasPending(&tf->journal) && tagjournalCommit(&tf->journal, journalName, tf->filePathChar, durability != DurabilityNone) != EXIT_SUCCESS)
+	{
+		perror("journal");
+		tf->lastError = ErrorOther;
+		return ErrorOther;
+	}
+
+	tf->journaling = 0;
+	tf->mode       = ReadWrite;
+	tf->findFlag   = 0;
+	tagfileResetJournalCursor(tf);
+	if (tagfileMap(tf, tf->fd) != ErrorNone || tagfileOpenTempWriteFile(tf) != ErrorNone || tagfileReadHeader(tf) != ErrorNone)
+		return tf->lastError;
+
+	struct ItemStruct *item;
+	while ((item = tagfileGetNextItem(tf)) != NULL)
+	{
+		enum ErrorId res = tagfileInsertItem(tf, item);
+		itemFree(item);
+		if (res != ErrorNone)
+			return res;
+	}
+	if (tf->lastError != ErrorEOF && tf->lastError != ErrorNone)
+		return tf->lastError;
+
+	// The old journal does not match the new index file, so a crash here loses nothing
+	if (tagfileApplyModifications(tf) == ErrorNone)
+	{
+		tagjournalFree(&tf->journal);
+		tf->journal.hashSize = tf->hashSize;
+		if (tagjournalCreate(journalName, tf->filePathChar, tf->hashSize) == EXIT_SUCCESS)
+			tf->journal.enabled = 1;
+		else
+		{
+			perror("journal");
+			tf->lastError = ErrorOther;
+		}
+	}
+	return tf->lastError;
+}
+
 struct ItemStruct *tagfileGetItemByFileName(struct TagFileStruct *tf, const wchar_t *fileName)
 {
 	struct ItemStruct *item;
@@ -475,81 +909,89 @@ struct ItemStruct *tagfileGetItemByFileName(struct TagFileStruct *tf, const wcha
 	return NULL;
 }
 
+struct HashCache *tagfileOpenHashCache(const struct TagFileStruct *tf, int create)
+{
+	// The cache of the file hashes lives next to the index, NULL if there is none and create is not set
+	char path[PATH_MAX];
+	size_t len = strlen(tf->filePathChar);
+	if (len + sizeof(HASHCACHE_SUFFIX) > PATH_MAX)
+		return NULL;
+	memcpy(path, tf->filePathChar, len);
+	memcpy(path + len, HASHCACHE_SUFFIX, sizeof(HASHCACHE_SUFFIX));
+	return hashcacheOpen(path, tf->hashAlg, create);
+}
+
 /******************************* Private ******************************/
 
-int tagfileScanItemHeader(const wchar_t *str, size_t *pSz, wchar_t **pHash)
+int tagfileScanItemHeader(const char *str, size_t len, unsigned int hashSize, size_t *pSz, unsigned char *hash)
 {
-	if (str[0] != L'[')
-		return EXIT_FAILURE;
-
-	int len = wcslen(str);
-	if (len < FILE_HASH_LEN + 4 || str[--len] != L']')
+	// [size:hash], the hash has hashSize * 2 hex characters
+	if (len < hashSize * 2 + 4 || str[0] != '[' || str[len - 1] != ']')
 		return EXIT_FAILURE;
 
-	wchar_t *sep = wcschr(str, L':');
+	const char *sep = memchr(str, ':', len);
 	if (sep == NULL || sep - str < 2)
 		return EXIT_FAILURE;
 
 	int c = 0;
-	const wchar_t *p = str + 1;
+	size_t sz = 0;
+	const char *p = str + 1;
 	do
 	{
-		if (!iswdigit(*p))
+		if (*p < '0' || *p > '9')
 			return EXIT_FAILURE;
+		sz = sz * 10 + (*p - '0');
 		++c;
 	} while (++p != sep);
 
 	if (c > 20)
 		return EXIT_FAILURE;
-	if (wcslen(sep + 1) != FILE_HASH_LEN + 1) // + ']'
+	if ((size_t)(str + len - sep) != hashSize * 2 + 2) // ':' + hash + ']'
 		return EXIT_FAILURE;
 
-	wchar_t buff[21];
-	wcsncpy(buff, str + 1, c);
-	buff[c] = L'\0';
-	*pSz = (size_t)wcstoll(buff, NULL, 10);
-
-	*pHash = sep + 1;
-
-	return EXIT_SUCCESS;
+	*pSz = sz;
+	return digestFromHex(p + 1, hashSize, hash);
 }
 
 enum ErrorId tagfileWritingTail(struct TagFileStruct *tf)
 {
-	FILE *fdRead = tagfileGetReadFd(tf);
-	if (!feof(fdRead))
+	if (tf->format == FormatBinary)
 	{
-		const wchar_t *buff = tf->readBuffer.pointer;
-		do
-		{
-			if (tf->curLineNum != 0)
-				tagfileWriteString(tf, buff);
-		} while (tagfileReadString(tf) == ErrorNone);
+		// The rest of the items is copied as is, the dictionary is written again
+		FILE *fdWrite = tagfileGetWriteFd(tf);
+		tf->map.pos = tf->map.end;
+		tf->findFlag = 0;
+		if (tagfileCopyPending(tf) != ErrorNone)
+			return tf->lastError;
+		tf->lastError = ErrorOther;
+		uint64_t dictOffset = ftell(fdWrite);
+		if (tagbinDictWrite(&tf->writeDict, fdWrite) == EXIT_SUCCESS &&
+			fseek(fdWrite, tf->writePreamble + offsetof(struct TagBinPreamble, dictOffset), SEEK_SET) == 0 &&
+			fwrite(&dictOffset, sizeof(dictOffset), 1, fdWrite) == 1 &&
+			fseek(fdWrite, 0L, SEEK_END) == 0 && fflush(fdWrite) == 0)
+			tf->lastError = ErrorNone;
+		if (tf->lastError != ErrorNone)
+			perror("tmpfile");
+		return tf->lastError;
 	}
 
-	if (tf->lastError == ErrorEOF)
-		tf->lastError = ErrorNone;
-	return tf->lastError;
+	// The rest of the index is copied as is
+	tf->map.pos = tf->map.end;
+	tf->map.eof = 1;
+	return tagfileCopyPending(tf);
 }
 
-int tagfileItemOutput(FILE *fd, const struct ItemStruct *item)
+int tagfileItemOutput(FILE *fd, const struct ItemStruct *item, enum HashAlg alg)
 {
-	int res;
-	if (fd != stdout)
-		res = fwprintf(fd, L"[%zu:%S]\n", item->fileSize, item->hash);
-	else
-		res = fprintf(fd, "[%zu:%S]\n", item->fileSize, item->hash);
-	if (res >= 0)
+	char hex[FILE_HASH_LEN + 1];
+	digestToHex(item->hash, hashalgSize(alg), hex);
+	if (fprintf(fd, "[%zu:%s]\n", item->fileSize, hex) >= 0)
 	{
 		unsigned int i = 0;
 		const wchar_t *fName;
 		while ((fName = itemGetFileName(item, i++)) != NULL)
 		{
-			if (fd != stdout)
-				res = fwprintf(fd, L"!FileName=%S\n", fName);
-			else
-				res = fprintf(fd, "!FileName=%S\n", fName);
-			if (res < 0)
+			if (fputs("!FileName=", fd) == EOF || utf8Fputs(fName, fd) == EOF || fputc('\n', fd) == EOF)
 			{
 				perror("tagfile");
 				return EXIT_FAILURE;
@@ -559,19 +1001,26 @@ int tagfileItemOutput(FILE *fd, const struct ItemStruct *item)
 		if (cnt > 0)
 		{
 			unsigned int i;
-			wchar_t tempValueBuff[2048];
+			wchar_t tempValueStack[2048];
 			for (i = 0; i < cnt; ++i)
 			{
-				if (itemPropertyValueToString(item, i, tempValueBuff, sizeof(tempValueBuff) / sizeof(wchar_t)) != EXIT_SUCCESS)
+				// A value longer than the buffer on the stack is taken into a heap one
+				wchar_t *tempValueBuff = tempValueStack;
+				int len = itemPropertyValueLength(item, i);
+				int bufLen = (len < 2048) ? 2048 : len + 1;
+				if (len < 0 || (bufLen > 2048 && (tempValueBuff = malloc(bufLen * sizeof(wchar_t))) == NULL) ||
+					itemPropertyValueToString(item, i, tempValueBuff, bufLen) != EXIT_SUCCESS)
 				{
+					if (tempValueBuff != tempValueStack)
+						free(tempValueBuff);
 					fputs("Error: itemPropertyValueToString failed\n", stderr);
 					return EXIT_FAILURE;
 				}
-				if (fd != stdout)
-					res = fwprintf(fd, L"%S=%S\n", itemPropertyGetName(item, i), tempValueBuff);
-				else
-					res = fprintf(fd, "%S=%S\n", itemPropertyGetName(item, i), tempValueBuff);
-				if (res < 0)
+				int res = (utf8Fputs(itemPropertyGetName(item, i), fd) == EOF || fputc('=', fd) == EOF
+					|| utf8Fputs(tempValueBuff, fd) == EOF || fputc('\n', fd) == EOF) ? EXIT_FAILURE : EXIT_SUCCESS;
+				if (tempValueBuff != tempValueStack)
+					free(tempValueBuff);
+				if (res != EXIT_SUCCESS)
 				{
 					perror("tagfile");
 					return EXIT_FAILURE;
@@ -601,6 +1050,9 @@ struct TagFileStruct *tagfileInitStruct(enum TagFileMode mode)
 		tf->filePath           = NULL;
 		tf->fileName           = NULL;
 		tf->mode               = mode;
+		tf->format             = FormatSimple;
+		tf->hashAlg            = HashAlgSha1;
+		tf->hashSize           = hashalgSize(HashAlgSha1);
 		tf->lastError          = ErrorNone;
 		tf->curLineNum         = 0;
 		tf->readBuffer.length  = 0;
@@ -610,6 +1062,36 @@ struct TagFileStruct *tagfileInitStruct(enum TagFileMode mode)
 		tf->findFlag           = 0;
 		tf->fdModif            = NULL;
 		tf->fdInsert           = NULL;
+		tf->modifPath[0]       = '\0';
+		tf->insertPath[0]      = '\0';
+		tf->map.base           = NULL;
+		tf->map.size           = 0;
+		tf->map.pos            = 0;
+		tf->map.end            = 0;
+		tf->map.eof            = 0;
+		tf->map.fd             = -1;
+		tf->map.random         = 0;
+		tf->copyPos            = 0;
+		tf->sidecarUsable      = 0;
+		tagidxListInit(&tf->writeIdx, 0);
+		tf->writeIdxState      = 0;
+		tagidxListInit(&tf->readIdx, 0);
+		tf->readIdxValid       = 0;
+		tagblockDirInit(&tf->blocks);
+		tf->compressed         = 0;
+		tagidxInit(&tf->sidecar);
+		taginvInit(&tf->inverted);
+		tagjournalInit(&tf->journal);
+		tf->journaling         = 0;
+		tf->arena              = NULL;
+		tf->line.pointer       = NULL;
+		tf->line.length        = 0;
+		tf->writePreamble      = 0;
+		tagbinDictInit(&tf->readDict);
+		tagbinDictInit(&tf->writeDict);
+		tf->writeBuffer.length = 0;
+		tf->writeBuffer.max    = 0;
+		tf->writeBuffer.data   = NULL;
 	}
 	return tf;
 }
@@ -666,7 +1148,7 @@ enum ErrorId initPath(struct TagFileStruct *tf, const wchar_t *dPath, const wcha
 				if (fName != NULL)
 					wcscpy(tf->fileName, fName);
 				else
-					mbstowcs(tf->fileName, tagFileName, PATH_MAX - tf->dirLen);
+					utf8ToWcs(tf->fileName, tagFileName, PATH_MAX - tf->dirLen);
 				res = ErrorNone;
 			}
 		}
@@ -683,10 +1165,10 @@ static enum ErrorId updateCharPath(struct TagFileStruct *tf)
 		if (tf->filePathChar != NULL || (tf->filePathChar = malloc(PATH_MAX * sizeof(char))) != NULL)
 		{
 			res = ErrorOther;
-			size_t sz = wcstombs(tf->dirPathChar, tf->dirPath, PATH_MAX);
+			size_t sz = wcsToUtf8(tf->dirPathChar, tf->dirPath, PATH_MAX);
 			if (sz != (size_t) -1 && sz != PATH_MAX)
 			{
-				sz = wcstombs(tf->filePathChar, tf->filePath, PATH_MAX);
+				sz = wcsToUtf8(tf->filePathChar, tf->filePath, PATH_MAX);
 				if (sz != (size_t) -1 && sz != PATH_MAX)
 					res = ErrorNone;
 			}
@@ -696,31 +1178,23 @@ static enum ErrorId updateCharPath(struct TagFileStruct *tf)
 	return res;
 }
 
-enum ErrorId tagfileAllocateReadBuffer(struct TagFileStruct *tf)
+enum ErrorId tagfileAllocateReadBuffer(struct TagFileStruct *tf, size_t len)
 {
-	size_t len = tf->readBuffer.length + READ_BUFFER_INCREASE;
-	if (len > READ_BUFFER_MAX_LENGTH)
-	{
-		tf->lastError = ErrorInvalidIndex;
-		return ErrorInvalidIndex;
-	}
+	if (len <= tf->readBuffer.length)
+		return ErrorNone;
+	len = (len / READ_BUFFER_INCREASE + 1) * READ_BUFFER_INCREASE;
+	if (len < tf->readBuffer.length * 2)
+		len = tf->readBuffer.length * 2;
 
-	wchar_t *newBuff;
-	if (tf->readBuffer.pointer == NULL)
-		newBuff = malloc(len * sizeof(wchar_t));
-	else
-		newBuff = realloc(tf->readBuffer.pointer, len * sizeof(wchar_t));
+	wchar_t *newBuff = realloc(tf->readBuffer.pointer, len * sizeof(wchar_t));
 	if (newBuff == NULL)
 	{
 		tf->lastError = ErrorInternal;
 		return ErrorInternal;
 	}
 
-	tf->readBuffer.length = len;
-	if (tf->readBuffer.pointer == NULL)
-		newBuff[0] = L'\0';
+	tf->readBuffer.length  = len;
 	tf->readBuffer.pointer = newBuff;
-	tf->lastError = ErrorNone;
 	return ErrorNone;
 }
 
@@ -748,7 +1222,7 @@ struct TagFileStruct *tagfileCloneForSubdir(const struct TagFileStruct *tf, cons
 		}
 
 		size_t buf_sz = PATH_MAX - dirLen;
-		subLen = mbstowcs(tfRes->dirPath + dirLen, subdir, buf_sz);
+		subLen = utf8ToWcs(tfRes->dirPath + dirLen, subdir, buf_sz);
 		if (subLen == (size_t) -1 || subLen == buf_sz)
 		{
 			tagfileFree(tfRes);
@@ -772,8 +1246,14 @@ struct TagFileStruct *tagfileCloneForSubdir(const struct TagFileStruct *tf, cons
 			return NULL;
 		}
 
-		if (tagfileOpen(tfRes) == ErrorNone)
-			tagfileReadHeader(tfRes);
+		char journalName[PATH_MAX];
+		if (tfRes->mode == ReadWrite && tagfileGetJournalPath(tfRes, journalName) == EXIT_SUCCESS && access(journalName, F_OK) == 0)
+			tfRes->journaling = 1;
+		if (tagfileOpen(tfRes) == ErrorNone && tagfileReadHeader(tfRes) == ErrorNone)
+		{
+			tagfileOpenInverted(tfRes);
+			tagfileOpenJournal(tfRes);
+		}
 	}
 	return tfRes;
 }
@@ -796,14 +1276,14 @@ enum ErrorId tagfileOpen(struct TagFileStruct *tf)
 		return ErrorOther;
 	}
 
-	if (tf->readBuffer.pointer == NULL && tagfileAllocateReadBuffer(tf) != ErrorNone)
+	if (tagfileMap(tf, tf->fd) != ErrorNone)
 	{
 		fclose(tf->fd);
 		tf->fd = NULL;
 		return tf->lastError;
 	}
 
-	if (tf->mode == ReadWrite)
+	if (tagfileIsCopying(tf))
 	{
 		if (tagfileOpenTempWriteFile(tf) != ErrorNone)
 			return tf->lastError;
@@ -816,17 +1296,371 @@ enum ErrorId tagfileReadHeader(struct TagFileStruct *tf)
 {
 	if (tagfileReadString(tf) == ErrorNone)
 	{
-		if (wcscmp(tf->readBuffer.pointer, L"!tags-info") != 0)
+		if (!tagfileIsLine(tf, "!tags-info", 10))
 		{
 			fprintf(stderr, "Error: file %S, line %i - invalid format\n", tf->filePath, tf->curLineNum);
 			tf->lastError = ErrorInvalidIndex;
+			return ErrorInvalidIndex;
 		}
-	}
-	return tf->lastError;
-}
 
-void tagfileClose(struct TagFileStruct *tf)
+		tf->format  = FormatSimple;
+		tf->hashAlg = HashAlgSha1;
+		unsigned int hashSize = 0;
+		int compressed = 0;
+		while (tagfileReadString(tf) == ErrorNone && tf->line.length != 0 && tf->line.pointer[0] == '!')
+		{
+			if (tf->line.length >= 8 && memcmp(tf->line.pointer, "!format=", 8) == 0)
+			{
+				if (tagfileIsLine(tf, "!format=binary", 14))
+					tf->format = FormatBinary;
+				else if (tagfileIsLine(tf, "!format=compressed", 18))
+				{
+					tf->format = FormatBinary;
+					compressed = 1;
+				}
+				else if (!tagfileIsLine(tf, "!format=simple", 14))
+				{
+					fprintf(stderr, "Error: file %S, line %i - unknown format\n", tf->filePath, tf->curLineNum);
+					tf->lastError = ErrorInvalidIndex;
+					return ErrorInvalidIndex;
+				}
+			}
+			else if (tf->line.length >= 6 && memcmp(tf->line.pointer, "!hash=", 6) == 0)
+			{
+				if (hashalgFind(tf->line.pointer + 6, tf->line.length - 6, &tf->hashAlg) != EXIT_SUCCESS)
+				{
+					fprintf(stderr, "Error: file %S, line %i - unknown hash\n", tf->filePath, tf->curLineNum);
+					tf->lastError = ErrorInvalidIndex;
+					return ErrorInvalidIndex;
+				}
+			}
+			else if (tf->line.length >= 11 && memcmp(tf->line.pointer, "!hash-size=", 11) == 0)
+			{
+				size_t i;
+				hashSize = 0;
+				for (i = 11; i < tf->line.length && hashSize <= FILE_HASH_SIZE; ++i)
+				{
+					char c = tf->line.pointer[i];
+					if (c < '0' || c > '9')
+						break;
+					hashSize = hashSize * 10 + (c - '0');
+				}
+				if (i == 11 || i != tf->line.length || hashSize == 0)
+					hashSize = FILE_HASH_SIZE + 1;
+			}
+		}
+		if (tf->lastError == ErrorEOF)
+		{
+			tf->line.length = 0;
+			tf->lastError = ErrorNone;
+		}
+		// The binary items of an index without the size of the hash keep 20 bytes of it
+		if (hashSize == 0)
+			hashSize = (tf->format == FormatBinary) ? TAGBIN_LEGACY_HASH_SIZE : hashalgSize(tf->hashAlg);
+		if (tf->lastError == ErrorNone && (hashSize < hashalgSize(tf->hashAlg) || hashSize > FILE_HASH_SIZE))
+		{
+			fprintf(stderr, "Error: file %S - invalid size of the %s hash\n", tf->filePath, hashalgName(tf->hashAlg));
+			tf->lastError = ErrorInvalidIndex;
+			return ErrorInvalidIndex;
+		}
+		tf->hashSize = hashSize;
+		// The temporary files of an update are not compressed, the index keeps its own format
+		if (tf->map.fd == fileno(tf->fd))
+			tf->compressed = compressed;
+		if (tf->lastError == ErrorNone && tf->format == FormatBinary)
+		{
+			if (compressed)
+				tagfileReadBlocks(tf);
+			else
+				tagfileReadPreamble(tf);
+		}
+		if (tf->lastError == ErrorNone && tagfileIsCopying(tf))
+		{
+			tagfileWriteHeader(tf, tagfileGetWriteFd(tf));
+			tf->copyPos = tagfileGetCurrentOffset(tf);
+			tagidxListFree(&tf->writeIdx);
+			tagidxListInit(&tf->writeIdx, tf->hashSize);
+			tf->writeIdxState = -1;
+		}
+	}
+	return tf->lastError;
+}
+
+enum ErrorId tagfileWriteHeader(struct TagFileStruct *tf, FILE *fd)
 {
+	tf->lastError = ErrorOther;
+	if (tf->format == FormatSimple)
+	{
+		if (fprintf(fd, tagFileHeader, tagFileFormatNames[tf->format], hashalgName(tf->hashAlg), tf->hashSize) >= 0)
+			tf->lastError = ErrorNone;
+	}
+	else if (fprintf(fd, tagFileHeader, tagFileFormatNames[tf->format], hashalgName(tf->hashAlg), tf->hashSize) >= 0 && fputc('\n', fd) != EOF)
+	{
+		struct TagBinPreamble pre;
+		memcpy(pre.magic, TAGBIN_MAGIC, TAGBIN_MAGIC_LEN);
+		pre.dictOffset = 0;
+		tf->writePreamble = ftell(fd);
+		if (tf->writePreamble != -1 && fwrite(&pre, sizeof(pre), 1, fd) == 1)
+		{
+			if (tagbinDictCopy(&tf->writeDict, &tf->readDict) == EXIT_SUCCESS)
+				tf->lastError = ErrorNone;
+			else
+				tf->lastError = ErrorInternal;
+		}
+	}
+	if (tf->lastError != ErrorNone)
+		perror("tmpfile");
+	return tf->lastError;
+}
+
+enum ErrorId tagfileMap(struct TagFileStruct *tf, FILE *fd)
+{
+	tagfileUnmap(tf);
+	// Offsets of the sidecar are valid only for the index file itself
+	tf->sidecarUsable = (fd == tf->fd);
+	tf->curLineNum   = 0;
+	tf->line.pointer = NULL;
+	tf->line.length  = 0;
+
+	struct stat64 st;
+	if (fflush(fd) != 0 || fstat64(fileno(fd), &st) == -1)
+	{
+		tf->lastError = ErrorOther;
+		perror("index file");
+		return ErrorOther;
+	}
+	if (st.st_size != 0)
+	{
+		void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fd), 0);
+		if (base == MAP_FAILED)
+		{
+			tf->lastError = ErrorOther;
+			perror("mmap");
+			return ErrorOther;
+		}
+		// A scan is assumed until the first seek
+		madvise(base, st.st_size, MADV_SEQUENTIAL);
+		tf->map.base = base;
+		tf->map.size = st.st_size;
+		tf->map.end  = st.st_size;
+	}
+	tf->map.fd     = fileno(fd);
+	tf->map.random = 0;
+	tf->copyPos    = 0;
+	tf->lastError = ErrorNone;
+	return ErrorNone;
+}
+
+enum ErrorId tagfileReadPreamble(struct TagFileStruct *tf)
+{
+	// The preamble follows the empty line that closes the text header
+	tf->lastError = ErrorInvalidIndex;
+	size_t offset = tf->map.pos;
+	size_t size   = tf->map.size;
+	struct TagBinPreamble pre;
+	if (!tf->map.eof && tf->line.length == 0 && size - offset >= sizeof(pre))
+	{
+		memcpy(&pre, tf->map.base + offset, sizeof(pre));
+		offset += sizeof(pre);
+		if (memcmp(pre.magic, TAGBIN_MAGIC, TAGBIN_MAGIC_LEN) == 0 && pre.dictOffset >= offset && pre.dictOffset <= size)
+		{
+			if (tagbinDictLoad(&tf->readDict, tf->map.base + pre.dictOffset, size - pre.dictOffset) == EXIT_SUCCESS)
+			{
+				tf->map.pos = offset;
+				tf->map.end = pre.dictOffset;
+				tf->lastError = ErrorNone;
+			}
+		}
+	}
+	if (tf->lastError != ErrorNone)
+		fprintf(stderr, "Error: file %S - invalid binary index\n", tf->filePath);
+	return tf->lastError;
+}
+
+enum ErrorId tagfileReadBlocks(struct TagFileStruct *tf)
+{
+	// The items of the blocks are decompressed on demand into an anonymous mapping,
+	// so the map looks like the items of the binary index
+	tf->lastError = ErrorInvalidIndex;
+	size_t offset = tf->map.pos;
+	size_t size   = tf->map.size;
+	size_t dictOffset;
+	struct TagBlockPreamble pre;
+	if (!tf->map.eof && tf->line.length == 0 && size - offset >= sizeof(pre))
+	{
+		memcpy(&pre, tf->map.base + offset, sizeof(pre));
+		if (memcmp(pre.magic, TAGBLOCK_MAGIC, TAGBLOCK_MAGIC_LEN) == 0 && pre.dirOffset >= offset + sizeof(pre) &&
+			tagblockDirLoad(&tf->blocks, tf->map.base, size, pre.dirOffset, &dictOffset) == EXIT_SUCCESS &&
+			tagbinDictLoad(&tf->readDict, tf->map.base + dictOffset, size - dictOffset) == EXIT_SUCCESS)
+			tf->lastError = ErrorNone;
+	}
+	if (tf->lastError != ErrorNone)
+	{
+		tagblockDirFree(&tf->blocks);
+		fprintf(stderr, "Error: file %S - invalid compressed index\n", tf->filePath);
+		return tf->lastError;
+	}
+
+	void *stream = NULL;
+	if (tf->blocks.rawSize != 0)
+	{
+		stream = mmap(NULL, tf->blocks.rawSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (stream == MAP_FAILED)
+		{
+			tagblockDirFree(&tf->blocks);
+			tf->lastError = ErrorOther;
+			perror("mmap");
+			return ErrorOther;
+		}
+	}
+	tf->blocks.file = tf->map.base;
+	tf->map.base = stream;
+	tf->map.size = tf->blocks.rawSize;
+	tf->map.pos  = 0;
+	tf->map.end  = tf->blocks.rawSize;
+	tf->map.fd   = -1;
+	return ErrorNone;
+}
+
+enum ErrorId tagfileDecodeBlocks(struct TagFileStruct *tf, size_t from, size_t to)
+{
+	// Makes the range of the items readable
+	struct TagBlockDir *dir = &tf->blocks;
+	size_t num;
+	for (num = tagblockFind(dir, from); num < dir->count && dir->rawOffsets[num] < to; ++num)
+	{
+		if (tagblockDecode(dir, num, tf->map.base) != EXIT_SUCCESS)
+		{
+			fprintf(stderr, "Error: file %S, block %zu - invalid compressed data\n", tf->filePath, num);
+			tf->lastError = ErrorInvalidIndex;
+			return ErrorInvalidIndex;
+		}
+	}
+	return ErrorNone;
+}
+
+size_t tagfileBlockSeek(struct TagFileStruct *tf, size_t sz, size_t curPos)
+{
+	// Passes the blocks whose items are all smaller than the file size
+	if (tf->blocks.count == 0 || sz == 0)
+		return curPos;
+	size_t num = tagblockSeek(&tf->blocks, curPos, sz);
+	size_t offset = (num < tf->blocks.count) ? tf->blocks.rawOffsets[num] : tf->map.end;
+	return (offset > curPos) ? offset : curPos;
+}
+
+void tagfileMapRandom(struct TagFileStruct *tf)
+{
+	// The lookups through the offset and the inverted index read single items, the mapping of the file is advised once
+	if (tf->map.random)
+		return;
+	tf->map.random = 1;
+	if (tf->blocks.file != NULL)
+		madvise((void *)tf->blocks.file, tf->blocks.fileSize, MADV_RANDOM);
+	else if (tf->map.base != NULL)
+		madvise(tf->map.base, tf->map.size, MADV_RANDOM);
+}
+
+void tagfileUnmap(struct TagFileStruct *tf)
+{
+	if (tf->map.base != NULL)
+	{
+		munmap(tf->map.base, tf->map.size);
+		tf->map.base = NULL;
+	}
+	if (tf->blocks.file != NULL)
+		munmap((void *)tf->blocks.file, tf->blocks.fileSize);
+	tagblockDirFree(&tf->blocks);
+	tf->map.size = 0;
+	tf->map.pos  = 0;
+	tf->map.end  = 0;
+	tf->map.eof  = 0;
+	tf->map.fd   = -1;
+}
+
+int tagfileFindNextItemPositionBin(struct TagFileStruct *tf, size_t sz, const unsigned char *hash)
+{
+	if (!tf->findFlag)
+	{
+		size_t skipTo = tagfileSidecarSeek(tf, sz, hash, tf->map.pos);
+		skipTo = tagfileBlockSeek(tf, sz, skipTo);
+		if (skipTo != tf->map.pos && tagfileSkipTo(tf, skipTo) != ErrorNone)
+			return 0;
+	}
+
+	struct TagBinItemHeader hdr;
+	while (tf->map.pos < tf->map.end)
+	{
+		if (tagfileDecodeBlocks(tf, tf->map.pos, tf->map.pos + 1) != ErrorNone)
+			return 0;
+		const unsigned char *rec = tf->map.base + tf->map.pos;
+		if (tagbinReadItemHeader(rec, tf->map.end - tf->map.pos, tf->hashSize, &hdr) != EXIT_SUCCESS)
+		{
+			fprintf(stderr, "Error: file %S, offset %zu - invalid format\n", tf->filePath, tf->map.pos);
+			tf->lastError = ErrorInvalidIndex;
+			return 0;
+		}
+		size_t recLen = TAGBIN_ITEM_HEADER_SIZE(tf->hashSize) + hdr.recLength;
+
+		if (!tf->findFlag)
+		{
+			tf->curItemSize = hdr.fileSize;
+			memcpy(tf->curItemHashBuf, hdr.hash, FILE_HASH_SIZE);
+			tf->curItemHash = tf->curItemHashBuf;
+			tf->lastError = ErrorNone;
+
+			int sizeCmp = 0;
+			int hashCmp = 0;
+			if (sz != 0)
+			{
+				sizeCmp = (sz != tf->curItemSize);
+				if (hash != NULL)
+					hashCmp = digestCompare(hash, tf->curItemHash);
+			}
+			if (sizeCmp == 0)
+			{
+				if (hashCmp == 0)
+				{
+					tf->findFlag = 1;
+					return 1;
+				}
+				if (hashCmp < 0)
+					return 0;
+			}
+			else if (sz < tf->curItemSize)
+				return 0;
+		}
+
+		tf->map.pos += recLen;
+		tf->findFlag = 0;
+	}
+	tf->curItemSize = 0;
+	tf->curItemHash = NULL;
+	tf->lastError = ErrorEOF;
+	return 0;
+}
+
+enum ErrorId tagfileItemBodyLoadBin(struct TagFileStruct *tf, struct ItemStruct *item)
+{
+	struct TagBinItemHeader hdr;
+	const unsigned char *rec = tf->map.base + tf->map.pos;
+	size_t hdrLen = TAGBIN_ITEM_HEADER_SIZE(tf->hashSize);
+	if (tagbinReadItemHeader(rec, tf->map.end - tf->map.pos, tf->hashSize, &hdr) != EXIT_SUCCESS ||
+		tagbinItemLoad(item, &tf->readDict, rec + hdrLen, hdr.recLength) != EXIT_SUCCESS)
+	{
+		fprintf(stderr, "Error: file %S, offset %zu - invalid format\n", tf->filePath, tf->map.pos);
+		tf->lastError = ErrorInvalidIndex;
+		return ErrorInvalidIndex;
+	}
+	tf->map.pos += hdrLen + hdr.recLength;
+	tf->findFlag = 0;
+	tf->lastError = (tf->map.pos < tf->map.end) ? ErrorNone : ErrorEOF;
+	return tf->lastError;
+}
+
+void tagfileClose(struct TagFileStruct *tf)
+{
+	tagfileUnmap(tf);
 	if (tf->fd != NULL)
 	{
 		fclose(tf->fd);
@@ -842,72 +1676,68 @@ void tagfileClose(struct TagFileStruct *tf)
 
 enum ErrorId tagfileReadString(struct TagFileStruct *tf)
 {
-	FILE *fdRead = tagfileGetReadFd(tf);
 	++tf->curLineNum;
 	tf->curItemSize = 0;
 	tf->curItemHash = NULL;
 	tf->findFlag    = 0;
-	wchar_t *buff   = tf->readBuffer.pointer;
-	size_t bufLen   = tf->readBuffer.length;
-	size_t i = 0;
-	while (fgetws(&buff[i], bufLen - i, fdRead) != NULL)
+	size_t pos = tf->map.pos;
+	size_t rem = tf->map.end - pos;
+	if (pos >= tf->map.end)
 	{
-		size_t strLen = wcslen(&buff[i]);
-		if (strLen != 0)
-		{
-			i += strLen;
-			if (buff[i-1] != L'\n')
-			{
-				if (bufLen - i <= 1)
-				{
-					if (tagfileAllocateReadBuffer(tf) != ErrorNone)
-						return tf->lastError;
-					bufLen = tf->readBuffer.length;
-				}
-				continue;
-			}
-			buff[i-1] = L'\0';
-		}
-		tf->lastError = ErrorNone;
-		return ErrorNone;
+		tf->map.eof = 1;
+		tf->lastError = ErrorEOF;
+		return ErrorEOF;
 	}
 
-	enum ErrorId res = ErrorOther;
-	if (feof(fdRead) != 0)
-		res = ErrorEOF;
-	else
-		perror("tagfile");
-	tf->lastError = res;
-	return res;
+	const char *str = (const char *)tf->map.base + pos;
+	const char *eol = memchr(str, '\n', rem);
+	size_t len = (eol != NULL) ? (size_t)(eol - str) : rem;
+	tf->line.pointer = str;
+	tf->line.length  = len;
+	tf->map.pos = pos + len + ((eol != NULL) ? 1 : 0);
+	tf->lastError = ErrorNone;
+	return ErrorNone;
 }
 
-enum ErrorId tagfileWriteString(struct TagFileStruct *tf, const wchar_t *str)
+int tagfileIsLine(const struct TagFileStruct *tf, const char *str, size_t len)
 {
-	enum ErrorId res = ErrorNone;
-	FILE *fdWrite = tagfileGetWriteFd(tf);
-	if (fputws(str, fdWrite) == -1 || fputwc(L'\n', fdWrite) == WEOF)
-	{
-		res = ErrorOther;
-		perror("tmpfile");
-	}
-	tf->lastError = res;
-	return res;
+	return (tf->line.length == len && memcmp(tf->line.pointer, str, len) == 0) ? 1 : 0;
+}
+
+const wchar_t *tagfileDecodeLine(struct TagFileStruct *tf)
+{
+	size_t len = tf->line.length;
+	if (tagfileAllocateReadBuffer(tf, len + 1) != ErrorNone)
+		return NULL;
+
+	if (utf8Decode(tf->line.pointer, len, tf->readBuffer.pointer) == (size_t) -1)
+		return NULL;
+	return tf->readBuffer.pointer;
 }
 
 enum ErrorId tagfileItemBodyLoad(struct TagFileStruct *tf, struct ItemStruct *item)
 {
-	wchar_t *buff = tf->readBuffer.pointer;
+	if (tf->format == FormatBinary)
+		return tagfileItemBodyLoadBin(tf, item);
+
 	while (tagfileReadString(tf) == ErrorNone)
 	{
-		if (buff[0] == L'[')
+		const char ch = (tf->line.length != 0) ? tf->line.pointer[0] : '\0';
+		if (ch == '[')
 		{
 			tf->lastError = ErrorNone;
 			return ErrorNone;
 		}
 
-		if (buff[0] != L'\0' && buff[0] != L'#')
+		if (ch != '\0' && ch != '#')
 		{
-
+			wchar_t *buff = (wchar_t *)tagfileDecodeLine(tf);
+			if (buff == NULL)
+			{
+				fprintf(stderr, "Error: file %S, line %i - invalid character\n", tf->filePath, tf->curLineNum);
+				tf->lastError = ErrorInvalidIndex;
+				return ErrorInvalidIndex;
+			}
 			wchar_t *valPos = wcschr(buff, L'=');
 			if (valPos == NULL || valPos == buff)
 			{
@@ -959,14 +1789,6 @@ struct ItemStruct *tagfileGetNextItem(struct TagFileStruct *tf)
 	return tagfileItemLoad(tf);
 }
 
-FILE *tagfileGetReadFd(const struct TagFileStruct *tf)
-{
-	FILE *fd = tf->fd;
-	if (tf->fdInsert != NULL)
-		fd = tf->fdModif;
-	return fd;
-}
-
 FILE *tagfileGetWriteFd(const struct TagFileStruct *tf)
 {
 	FILE *fd = tf->fdInsert;
@@ -987,11 +1809,22 @@ void tagfileCloseTemporaryFiles(struct TagFileStruct *tf)
 		fclose(tf->fdInsert);
 		tf->fdInsert = NULL;
 	}
+	// The named temporary files that were not published are removed
+	if (tf->modifPath[0] != '\0')
+	{
+		unlink(tf->modifPath);
+		tf->modifPath[0] = '\0';
+	}
+	if (tf->insertPath[0] != '\0')
+	{
+		unlink(tf->insertPath);
+		tf->insertPath[0] = '\0';
+	}
 }
 
 enum ErrorId tagfileOpenTempWriteFile(struct TagFileStruct *tf)
 {
-	tf->fdModif = tmpfile();
+	tf->fdModif = tagfileCreateTempFile(tf, tf->modifPath);
 	if (tf->fdModif == NULL)
 	{
 		tf->lastError = ErrorOther;
@@ -1001,3 +1834,521 @@ enum ErrorId tagfileOpenTempWriteFile(struct TagFileStruct *tf)
 		tf->lastError = ErrorNone;
 	return tf->lastError;
 }
+
+int tagfileGetSidecarPath(const struct TagFileStruct *tf, char *path)
+{
+	size_t len = strlen(tf->filePathChar);
+	if (len + sizeof(TAGIDX_SUFFIX) > PATH_MAX)
+		return EXIT_FAILURE;
+	memcpy(path, tf->filePathChar, len);
+	memcpy(path + len, TAGIDX_SUFFIX, sizeof(TAGIDX_SUFFIX));
+	return EXIT_SUCCESS;
+}
+
+void tagfileOpenSidecar(struct TagFileStruct *tf)
+{
+	char idxName[PATH_MAX];
+	if (tagfileGetSidecarPath(tf, idxName) == EXIT_SUCCESS)
+		tagidxOpen(&tf->sidecar, idxName, fileno(tf->fd), tf->hashSize);
+}
+
+size_t tagfileSidecarSeek(struct TagFileStruct *tf, size_t sz, const unsigned char *hash, size_t curPos)
+{
+	// Returns the offset of the first item not less than (sz, hash) if it is ahead of curPos
+	if (!tf->sidecarUsable || tf->sidecar.base == NULL || sz == 0)
+		return curPos;
+
+	static const unsigned char zeroHash[FILE_HASH_SIZE];
+	const struct TagIdxEntry *entry = tagidxLowerBound(&tf->sidecar, sz, (hash != NULL) ? hash : zeroHash);
+	size_t offset = (entry != NULL) ? entry->offset : tf->map.end;
+	if (offset <= curPos || offset > tf->map.end)
+		return curPos;
+	return offset;
+}
+
+enum ErrorId tagfileSkipTo(struct TagFileStruct *tf, size_t to)
+{
+	// Everything before the position stays pending for the modified index
+	tagfileMapRandom(tf);
+	tf->map.pos = to;
+	tf->findFlag = 0;
+	tf->lastError = ErrorNone;
+	return ErrorNone;
+}
+
+size_t tagfileGetCurrentOffset(const struct TagFileStruct *tf)
+{
+	// Offset of the item or the line the cursor stands on
+	if (tf->format == FormatSimple)
+	{
+		if (tf->map.eof)
+			return tf->map.end;
+		if (tf->curLineNum != 0 && tf->line.pointer != NULL)
+			return tf->line.pointer - (const char *)tf->map.base;
+	}
+	return tf->map.pos;
+}
+
+enum ErrorId tagfileCopyPending(struct TagFileStruct *tf)
+{
+	// The untouched part of the index up to the cursor is passed to the modified index as raw bytes
+	size_t from = tf->copyPos;
+	size_t to   = tagfileGetCurrentOffset(tf);
+	tf->lastError = ErrorNone;
+	if (to <= from)
+		return ErrorNone;
+
+	if (tagfileDecodeBlocks(tf, from, to) != ErrorNone)
+		return tf->lastError;
+	FILE *fdWrite = tagfileGetWriteFd(tf);
+	tagfileCollectRange(tf, fdWrite, from, to);
+	size_t len = to - from;
+	if (len >= COPY_RANGE_MIN && tf->map.fd != -1 && fflush(fdWrite) == 0)
+	{
+		// The kernel copies large ranges without passing them through the user space
+		loff_t off = from;
+		while (len != 0)
+		{
+			ssize_t cnt = copy_file_range(tf->map.fd, &off, fileno(fdWrite), NULL, len, 0);
+			if (cnt <= 0)
+				break;
+			len -= cnt;
+		}
+		from = off;
+		if (fseek(fdWrite, 0L, SEEK_END) != 0)
+			tf->lastError = ErrorOther;
+	}
+	const unsigned char *data = tf->map.base + from;
+	if (tf->lastError != ErrorNone || (len != 0 && fwrite(data, 1, len, fdWrite) != len) ||
+		(tf->format == FormatSimple && to == tf->map.end && tf->map.base[to - 1] != '\n' && fputc('\n', fdWrite) == EOF))
+	{
+		perror("tmpfile");
+		tf->lastError = ErrorOther;
+		return ErrorOther;
+	}
+	tf->copyPos = to;
+	return ErrorNone;
+}
+
+int tagfileCollectStart(struct TagFileStruct *tf)
+{
+	// The entries are collected only if the entries of the read map are known
+	if (tf->writeIdxState == -1)
+	{
+		if (tf->sidecarUsable)
+			tf->writeIdxState = (tf->sidecar.base != NULL);
+		else
+			tf->writeIdxState = tf->readIdxValid;
+	}
+	return tf->writeIdxState;
+}
+
+void tagfileCollectStop(struct TagFileStruct *tf)
+{
+	tagidxListFree(&tf->writeIdx);
+	tf->writeIdxState = 0;
+}
+
+void tagfileCollectRange(struct TagFileStruct *tf, FILE *fdWrite, size_t from, size_t to)
+{
+	// The entries of the copied items are moved to the offsets of the modified index
+	if (tagfileCollectStart(tf) != 1)
+		return;
+	long newOffset = ftell(fdWrite);
+	const unsigned char *entries = tf->readIdx.entries;
+	size_t count = tf->readIdx.count;
+	if (tf->sidecarUsable)
+	{
+		entries = tf->sidecar.entries;
+		count   = tf->sidecar.count;
+	}
+	if (newOffset == -1 || tagidxListAppendRange(&tf->writeIdx, entries, count, from, to, newOffset) != EXIT_SUCCESS)
+		tagfileCollectStop(tf);
+}
+
+void tagfileCollectItem(struct TagFileStruct *tf, FILE *fdWrite, const struct ItemStruct *item)
+{
+	if (tagfileCollectStart(tf) != 1)
+		return;
+	long offset = ftell(fdWrite);
+	if (offset == -1 || tagidxListAppend(&tf->writeIdx, item->fileSize, item->hash, offset) != EXIT_SUCCESS)
+		tagfileCollectStop(tf);
+}
+
+int tagfileIsCopying(const struct TagFileStruct *tf)
+{
+	// In the update mode the index file is copied unless the changes go to the journal
+	return (tf->mode == ReadWrite && !tf->journaling) ? 1 : 0;
+}
+
+int tagfileGetJournalPath(const struct TagFileStruct *tf, char *path)
+{
+	size_t len = strlen(tf->filePathChar);
+	if (len + sizeof(TAGJOURNAL_SUFFIX) > PATH_MAX)
+		return EXIT_FAILURE;
+	memcpy(path, tf->filePathChar, len);
+	memcpy(path + len, TAGJOURNAL_SUFFIX, sizeof(TAGJOURNAL_SUFFIX));
+	return EXIT_SUCCESS;
+}
+
+enum ErrorId tagfileOpenJournal(struct TagFileStruct *tf)
+{
+	char journalName[PATH_MAX];
+	if (tagfileGetJournalPath(tf, journalName) != EXIT_SUCCESS)
+		tf->lastError = ErrorInternal;
+	else if (tagjournalLoad(&tf->journal, journalName, fileno(tf->fd), tf->hashSize) != EXIT_SUCCESS)
+		tf->lastError = ErrorOther;
+	return tf->lastError;
+}
+
+void tagfileResetJournalCursor(struct TagFileStruct *tf)
+{
+	tf->journal.pos         = 0;
+	tf->journal.fromJournal = 0;
+	tf->journal.found       = 0;
+}
+
+int tagfileFindNextItemPositionRaw(struct TagFileStruct *tf, size_t sz, const unsigned char *hash)
+{
+	if (tf->format == FormatBinary)
+		return tagfileFindNextItemPositionBin(tf, sz, hash);
+	return tagfileFindNextItemPositionText(tf, sz, hash);
+}
+
+int tagfileFindNextItemPositionMerged(struct TagFileStruct *tf, size_t sz, const unsigned char *hash)
+{
+	// The journal items replace the items of the index file with the same size and hash
+	struct TagJournal *j = &tf->journal;
+	if (j->found)
+		++j->pos;
+	j->found = 0;
+	j->fromJournal = 0;
+
+	static const unsigned char zeroHash[FILE_HASH_SIZE];
+	const unsigned char *target = (hash != NULL) ? hash : zeroHash;
+
+	while (1)
+	{
+		int fnd = tagfileFindNextItemPositionRaw(tf, sz, hash);
+		if (!fnd && tf->lastError != ErrorNone && tf->lastError != ErrorEOF)
+			return 0;
+		int mainEof = (!fnd && tf->lastError == ErrorEOF);
+
+		if (sz != 0)
+			while (j->pos < j->count && tagjournalCompare(&j->entries[j->pos], sz, target) < 0)
+				++j->pos;
+		if (j->pos == j->count)
+			return fnd;
+
+		const struct TagJournalEntry *entry = &j->entries[j->pos];
+		int cmp = -1;
+		if (!mainEof)
+			cmp = tagjournalCompare(entry, tf->curItemSize, tf->curItemHash);
+		if (cmp > 0)
+			return fnd;
+		if (cmp == 0)
+		{
+			if (tagfileSkipItemRaw(tf) != ErrorNone)
+				return 0;
+		}
+		else
+			tf->findFlag = 0; // the item of the index file stays current
+		if (entry->deleted)
+		{
+			++j->pos;
+			continue;
+		}
+
+		tf->curItemSize = entry->fileSize;
+		memcpy(tf->curItemHashBuf, entry->hash, FILE_HASH_SIZE);
+		tf->curItemHash = tf->curItemHashBuf;
+		tf->lastError = ErrorNone;
+		j->fromJournal = 1;
+		if (sz == 0 || (entry->fileSize == sz && (hash == NULL || memcmp(entry->hash, target, FILE_HASH_SIZE) == 0)))
+		{
+			j->found = 1;
+			return 1;
+		}
+		return 0;
+	}
+}
+
+enum ErrorId tagfileSkipItemRaw(struct TagFileStruct *tf)
+{
+	// Passes over the current item of the index file without copying it
+	if (tagfileIsCopying(tf) && tagfileCopyPending(tf) != ErrorNone)
+		return tf->lastError;
+	if (tf->format == FormatBinary)
+	{
+		struct TagBinItemHeader hdr;
+		if (tagbinReadItemHeader(tf->map.base + tf->map.pos, tf->map.end - tf->map.pos, tf->hashSize, &hdr) != EXIT_SUCCESS)
+		{
+			tf->lastError = ErrorInvalidIndex;
+			return ErrorInvalidIndex;
+		}
+		tf->map.pos += TAGBIN_ITEM_HEADER_SIZE(tf->hashSize) + hdr.recLength;
+		tf->findFlag = 0;
+		tf->copyPos = tf->map.pos;
+		tf->lastError = ErrorNone;
+		return ErrorNone;
+	}
+
+	while (tagfileReadString(tf) == ErrorNone)
+		if (tf->line.length != 0 && tf->line.pointer[0] == '[')
+			break;
+	if (tf->lastError == ErrorEOF)
+		tf->lastError = ErrorNone;
+	tf->copyPos = tagfileGetCurrentOffset(tf);
+	return tf->lastError;
+}
+
+FILE *tagfileCreateTempFile(struct TagFileStruct *tf, char *path)
+{
+	// The file is created in the directory of the index file, so it can be renamed over the index.
+	// An anonymous file is preferred, it does not remain on the disk after a crash.
+	const char *dirName = (tf->dirPathChar[0] != '\0') ? tf->dirPathChar : ".";
+	path[0] = '\0';
+	int fd = -1;
+#ifdef O_TMPFILE
+	fd = open(dirName, O_TMPFILE | O_RDWR, 0666);
+#endif
+	if (fd == -1)
+	{
+		size_t len = strlen(tf->filePathChar);
+		if (len + sizeof(".XXXXXX") > PATH_MAX)
+		{
+			errno = ENAMETOOLONG;
+			return NULL;
+		}
+		memcpy(path, tf->filePathChar, len);
+		memcpy(path + len, ".XXXXXX", sizeof(".XXXXXX"));
+		fd = mkstemp(path);
+		if (fd == -1)
+		{
+			path[0] = '\0';
+			return NULL;
+		}
+	}
+
+	// The new index keeps the permissions of the old one
+	struct stat st;
+	if (tf->fd != NULL && fstat(fileno(tf->fd), &st) == 0)
+		fchmod(fd, st.st_mode & 07777);
+
+	FILE *res = fdopen(fd, "w+");
+	if (res == NULL)
+	{
+		close(fd);
+		if (path[0] != '\0')
+		{
+			unlink(path);
+			path[0] = '\0';
+		}
+	}
+	return res;
+}
+
+int tagfileLinkTempFile(struct TagFileStruct *tf, FILE *fd, char *path)
+{
+	// Gives a name to the anonymous temporary file
+	size_t len = strlen(tf->filePathChar);
+	if (len + sizeof(".tmp") > PATH_MAX)
+	{
+		errno = ENAMETOOLONG;
+		return EXIT_FAILURE;
+	}
+	memcpy(path, tf->filePathChar, len);
+	memcpy(path + len, ".tmp", sizeof(".tmp"));
+
+	char procName[64];
+	snprintf(procName, sizeof(procName), "/proc/self/fd/%d", fileno(fd));
+	unlink(path); // left by an interrupted run
+	if (linkat(AT_FDCWD, procName, AT_FDCWD, path, AT_SYMLINK_FOLLOW) == -1)
+	{
+		path[0] = '\0';
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+int tagfileSyncDirectory(const struct TagFileStruct *tf)
+{
+	const char *dirName = (tf->dirPathChar[0] != '\0') ? tf->dirPathChar : ".";
+	int fd = open(dirName, O_RDONLY | O_DIRECTORY);
+	if (fd == -1)
+		return EXIT_FAILURE;
+	int res = (fsync(fd) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (close(fd) == -1)
+		res = EXIT_FAILURE;
+	return res;
+}
+
+int tagfileGetInvertedPath(const struct TagFileStruct *tf, char *path)
+{
+	size_t len = strlen(tf->filePathChar);
+	if (len + sizeof(TAGINV_SUFFIX) > PATH_MAX)
+		return EXIT_FAILURE;
+	memcpy(path, tf->filePathChar, len);
+	memcpy(path + len, TAGINV_SUFFIX, sizeof(TAGINV_SUFFIX));
+	return EXIT_SUCCESS;
+}
+
+void tagfileOpenInverted(struct TagFileStruct *tf)
+{
+	char invName[PATH_MAX];
+	if (tagfileGetInvertedPath(tf, invName) == EXIT_SUCCESS)
+		taginvOpen(&tf->inverted, invName, fileno(tf->fd));
+}
+
+size_t tagfileItemCount(const struct TagFileStruct *tf)
+{
+	// The number of the items of the index file if an index knows it, otherwise 0
+	if (tf->sidecarUsable && tf->sidecar.base != NULL)
+		return tf->sidecar.count;
+	if (tf->inverted.base != NULL)
+		return tf->inverted.itemCount;
+	return 0;
+}
+
+int tagfileListItem(const struct TagFileStruct *tf, struct FieldListStruct *fields, struct TagPlan *plan, struct ItemStruct *item)
+{
+	++plan->read;
+	if (tagplanIsFiltered(plan, item))
+		return EXIT_SUCCESS;
+	++plan->rows;
+	if ((flags & ExplainFlag) != 0)
+		return EXIT_SUCCESS;
+	if (fields != NULL)
+		return fieldsPrintRow(fields, item, tf->dirPath, stdout);
+	return tagfileItemOutput(stdout, item, tf->hashAlg);
+}
+
+int tagfileListInverted(struct TagFileStruct *tf, struct FieldListStruct *fields, struct TagPlan *plan)
+{
+	// Every condition with values limits the items to the union of the bitmaps of the values,
+	// the conditions are intersected in the order of the plan until nothing is left
+	struct TagBitmap found;
+	struct TagBitmap cur;
+	struct TagBitmap val;
+	tagbitmapInit(&found);
+	tagbitmapInit(&cur);
+	tagbitmapInit(&val);
+	struct TagBinBuffer key = { 0, 0, NULL };
+	int used = 0;
+	int res = EXIT_SUCCESS;
+	unsigned int i;
+	for (i = 0; res == EXIT_SUCCESS && i < plan->stepCount && (!used || found.count != 0); ++i)
+	{
+		struct PropertyStruct *cond = plan->steps[i].cond;
+		if (plan->steps[i].kind != PlanCondValues)
+			continue;
+		tagbitmapFree(&cur);
+		unsigned int j;
+		for (j = 0; j < cond->valCount; ++j)
+		{
+			if (taginvMakeKey(&key, propGetName(cond), propGetSubval(cond, j, None)) != EXIT_SUCCESS ||
+				taginvLookup(&tf->inverted, (const char *)key.data, key.length, &val) != EXIT_SUCCESS ||
+				tagbitmapOr(&cur, &val) != EXIT_SUCCESS)
+			{
+				res = EXIT_FAILURE;
+				break;
+			}
+		}
+		if (!used)
+		{
+			struct TagBitmap tmp = found;
+			found = cur;
+			cur = tmp;
+			used = 1;
+		}
+		else if (tagbitmapAnd(&found, &cur) != EXIT_SUCCESS)
+			res = EXIT_FAILURE;
+	}
+	tagbinBufferFree(&key);
+	tagbitmapFree(&cur);
+	tagbitmapFree(&val);
+	if (res != EXIT_SUCCESS)
+	{
+		tagbitmapFree(&found);
+		return EXIT_FAILURE;
+	}
+
+	// The items of the journal replace the found items with the same size and hash
+	struct TagJournal *j = &tf->journal;
+	size_t jPos = 0;
+	struct TagBitmapIter it;
+	tagbitmapIterInit(&it);
+	int more = 1;
+	while (res == EXIT_SUCCESS && more)
+	{
+		struct ItemStruct *item = NULL;
+		uint32_t id;
+		if ((more = tagbitmapNext(&found, &it, &id)) != 0)
+		{
+			item = tagfileLoadItemAt(tf, tf->inverted.items[id]);
+			if (item == NULL)
+			{
+				res = EXIT_FAILURE;
+				break;
+			}
+		}
+		for ( ; res == EXIT_SUCCESS && jPos < j->count; ++jPos)
+		{
+			const struct TagJournalEntry *entry = &j->entries[jPos];
+			int cmp = (item != NULL) ? tagjournalCompare(entry, item->fileSize, item->hash) : -1;
+			if (cmp > 0)
+				break;
+			if (cmp == 0)
+			{
+				itemFree(item);
+				item = NULL;
+			}
+			if (entry->deleted)
+				continue;
+			struct ItemStruct *jItem = tagjournalItemLoad(entry, tf->arena);
+			if (jItem == NULL)
+				res = EXIT_FAILURE;
+			else
+			{
+				res = tagfileListItem(tf, fields, plan, jItem);
+				itemFree(jItem);
+			}
+			if (cmp == 0)
+			{
+				++jPos;
+				break;
+			}
+		}
+		if (item != NULL)
+		{
+			if (res == EXIT_SUCCESS)
+				res = tagfileListItem(tf, fields, plan, item);
+			itemFree(item);
+		}
+		tagarenaReset(tf->arena);
+	}
+	tagbitmapFree(&found);
+	return res;
+}
+
+struct ItemStruct *tagfileLoadItemAt(struct TagFileStruct *tf, size_t offset)
+{
+	// Loads the item of the index file that starts at the offset
+	if (offset >= tf->map.end)
+	{
+		tf->lastError = ErrorInvalidIndex;
+		return NULL;
+	}
+	tagfileMapRandom(tf);
+	tf->map.pos    = offset;
+	tf->map.eof    = 0;
+	tf->findFlag   = 0;
+	tf->curLineNum = 0;
+	if (!tagfileFindNextItemPositionRaw(tf, 0, NULL) || tagfileGetCurrentOffset(tf) != offset)
+	{
+		fprintf(stderr, "Error: file %S - invalid inverted index\n", tf->filePath);
+		tf->lastError = ErrorInvalidIndex;
+		return NULL;
+	}
+	return tagfileItemLoadRaw(tf);
+}
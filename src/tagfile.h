@@ -29,8 +29,17 @@
 #include "errors.h"
 #include "where.h"
 #include "fields.h"
+#include "tagbin.h"
+#include "tagidx.h"
+#include "tagjournal.h"
+#include "tagblock.h"
+#include "taginv.h"
+#include "tagplan.h"
+#include "tagarena.h"
+#include "hashalg.h"
 
 enum TagFileMode {ReadOnly, ReadWrite};
+enum TagFileFormat {FormatSimple, FormatBinary, FormatCompressed};
 
 struct TagFileStruct
 {
@@ -42,31 +51,74 @@ struct TagFileStruct
 	char             *filePathChar;
 	wchar_t          *fileName;
 	enum TagFileMode mode;
+	enum TagFileFormat format;
 	enum ErrorId     lastError;
 	unsigned int     curLineNum;
 	struct
+	{
+		unsigned char *base;
+		size_t       size;
+		size_t       pos;
+		size_t       end;
+		int          eof;
+		int          fd;
+		int          random;  // the items are read by seeks, the read-ahead of the scans is off
+	} map;
+	struct
+	{
+		const char   *pointer;
+		size_t       length;
+	} line;
+	struct
 	{
 		size_t       length;
 		wchar_t      *pointer;
 	} readBuffer;
+	struct TagBlockDir blocks;
+	int              compressed; // the index is compressed, its items are read like the binary ones
+	struct TagIdx    sidecar;
+	int              sidecarUsable;
+	struct TagIdxList writeIdx;  // the sidecar entries of the modified index, collected while it is written
+	int              writeIdxState;  // -1 not known yet, 0 the entries are not collected, 1 they are
+	struct TagIdxList readIdx;  // the entries of the first temporary file in the append mode
+	int              readIdxValid;
+	struct TagInv    inverted;
+	struct TagJournal journal;
+	int              journaling;
+	struct TagArena  *arena;  // the loaded items are taken from it if it is set
+	struct TagBinDict readDict;
+	struct TagBinDict writeDict;
+	struct TagBinBuffer writeBuffer;
+	long             writePreamble;
 	size_t           curItemSize;
-	wchar_t          *curItemHash;
+	const unsigned char *curItemHash;
+	unsigned char    curItemHashBuf[FILE_HASH_SIZE];
 	int              findFlag;
+	enum HashAlg     hashAlg;  // the content hash of the items, from the !hash= line of the header
+	unsigned int     hashSize; // the bytes of the hash in the binary items, the offset index and the journal
 	FILE             *fdModif;
 	FILE             *fdInsert;
+	size_t           copyPos;  // the part of the map before it is already passed to the modified index
+	char             modifPath[PATH_MAX];  // names of the temporary files, empty if they are anonymous
+	char             insertPath[PATH_MAX];
 };
 
-int tagfileCreateIndex();
+int tagfileCreateIndex(enum TagFileFormat format, enum HashAlg alg);
 struct TagFileStruct *tagfileInit(const char *dPath, const char *fName, enum TagFileMode mode);
 enum ErrorId tagfileReinit(struct TagFileStruct *tf, enum TagFileMode mode);
 void tagfileFree(struct TagFileStruct *tf);
-int tagfileFindNextItemPosition(struct TagFileStruct *tf, size_t sz, const wchar_t *hash);
+int tagfileFindNextItemPosition(struct TagFileStruct *tf, size_t sz, const unsigned char *hash);
 struct ItemStruct *tagfileItemLoad(struct TagFileStruct *tf);
 int tagfileList(struct TagFileStruct *tf, struct FieldListStruct *fields, const struct WhereStruct *whr);
 int tagfileShowProps(struct TagFileStruct *tf, struct ItemStruct *item);
 enum ErrorId tagfileSetAppendMode(struct TagFileStruct *tf);
 enum ErrorId tagfileInsertItem(struct TagFileStruct *tf, const struct ItemStruct *item);
 enum ErrorId tagfileApplyModifications(struct TagFileStruct *tf);
+enum ErrorId tagfileBuildSidecar(struct TagFileStruct *tf);
+enum ErrorId tagfileBuildInverted(struct TagFileStruct *tf);
+enum ErrorId tagfileEnableJournal(struct TagFileStruct *tf);
+enum ErrorId tagfileCompactJournal(struct TagFileStruct *tf);
 struct ItemStruct *tagfileGetItemByFileName(struct TagFileStruct *tf, const wchar_t *fileName);
+struct HashCache *tagfileOpenHashCache(const struct TagFileStruct *tf, int create);
 
 #endif // TAGFILE_H
@@ -0,0 +1,232 @@
+/*
+ * tagidx.c
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#define _LARGEFILE64_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "tagidx.h"
+
+#define LIST_INCREASE  256
+
+static void makeStamp(struct TagIdxHeader *hdr, const struct stat64 *st, unsigned int hashSize);
+static int  cmpEntry(const struct TagIdxEntry *entry, unsigned int hashSize, uint64_t fileSize, const unsigned char *hash);
+
+void tagidxInit(struct TagIdx *idx)
+{
+	idx->base     = NULL;
+	idx->size     = 0;
+	idx->entries  = NULL;
+	idx->count    = 0;
+	idx->hashSize = 0;
+}
+
+int tagidxOpen(struct TagIdx *idx, const char *path, int indexFd, unsigned int hashSize)
+{
+	tagidxClose(idx);
+
+	struct stat64 st;
+	if (fstat64(indexFd, &st) == -1)
+		return EXIT_FAILURE;
+
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return EXIT_FAILURE;
+
+	int res = EXIT_FAILURE;
+	struct stat64 stIdx;
+	if (fstat64(fd, &stIdx) != -1 && (size_t)stIdx.st_size >= sizeof(struct TagIdxHeader))
+	{
+		void *base = mmap(NULL, stIdx.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (base != MAP_FAILED)
+		{
+			struct TagIdxHeader hdr;
+			struct TagIdxHeader stamp;
+			memcpy(&hdr, base, sizeof(hdr));
+			makeStamp(&stamp, &st, hashSize);
+			size_t cnt = (stIdx.st_size - sizeof(hdr)) / TAGIDX_ENTRY_SIZE(hashSize);
+			if (memcmp(hdr.magic, TAGIDX_MAGIC, TAGIDX_MAGIC_LEN) == 0 && hdr.indexSize == stamp.indexSize &&
+				hdr.mtimeSec == stamp.mtimeSec && hdr.mtimeNsec == stamp.mtimeNsec && hdr.inode == stamp.inode &&
+				hdr.hashSize == hashSize && hdr.count == cnt)
+			{
+				idx->base     = base;
+				idx->size     = stIdx.st_size;
+				idx->entries  = (const unsigned char *)base + sizeof(hdr);
+				idx->count    = cnt;
+				idx->hashSize = hashSize;
+				res = EXIT_SUCCESS;
+			}
+			else
+				munmap(base, stIdx.st_size);
+		}
+	}
+	close(fd);
+	return res;
+}
+
+void tagidxClose(struct TagIdx *idx)
+{
+	if (idx->base != NULL)
+		munmap(idx->base, idx->size);
+	tagidxInit(idx);
+}
+
+const struct TagIdxEntry *tagidxEntry(const unsigned char *entries, unsigned int hashSize, size_t num)
+{
+	return (const struct TagIdxEntry *)(entries + num * TAGIDX_ENTRY_SIZE(hashSize));
+}
+
+const struct TagIdxEntry *tagidxLowerBound(const struct TagIdx *idx, uint64_t fileSize, const unsigned char *hash)
+{
+	size_t lo = 0;
+	size_t hi = idx->count;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if (cmpEntry(tagidxEntry(idx->entries, idx->hashSize, mid), idx->hashSize, fileSize, hash) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo < idx->count) ? tagidxEntry(idx->entries, idx->hashSize, lo) : NULL;
+}
+
+void tagidxListInit(struct TagIdxList *list, unsigned int hashSize)
+{
+	list->count    = 0;
+	list->max      = 0;
+	list->entries  = NULL;
+	list->hashSize = hashSize;
+}
+
+int tagidxListAppend(struct TagIdxList *list, uint64_t fileSize, const unsigned char *hash, uint64_t offset)
+{
+	size_t entrySize = TAGIDX_ENTRY_SIZE(list->hashSize);
+	if (list->count == list->max)
+	{
+		unsigned char *entries = realloc(list->entries, (list->max + LIST_INCREASE) * entrySize);
+		if (entries == NULL)
+			return EXIT_FAILURE;
+		list->entries = entries;
+		list->max += LIST_INCREASE;
+	}
+	unsigned char *data = list->entries + list->count++ * entrySize;
+	struct TagIdxEntry entry;
+	entry.fileSize = fileSize;
+	entry.offset   = offset;
+	memcpy(data, &entry, sizeof(entry));
+	memcpy(data + sizeof(entry), hash, list->hashSize);
+	memset(data + sizeof(entry) + list->hashSize, 0, entrySize - sizeof(entry) - list->hashSize);
+	return EXIT_SUCCESS;
+}
+
+int tagidxListAppendRange(struct TagIdxList *list, const unsigned char *entries, size_t count, uint64_t from, uint64_t to, uint64_t newOffset)
+{
+	// The entries have the hash size of the list and are sorted by the offset too,
+	// the ones of the items in [from, to) are moved to newOffset
+	unsigned int hashSize = list->hashSize;
+	size_t lo = 0;
+	size_t hi = count;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if (tagidxEntry(entries, hashSize, mid)->offset < from)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo < count; ++lo)
+	{
+		const struct TagIdxEntry *entry = tagidxEntry(entries, hashSize, lo);
+		if (entry->offset >= to)
+			break;
+		if (tagidxListAppend(list, entry->fileSize, (const unsigned char *)(entry + 1), entry->offset - from + newOffset) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+int tagidxListWrite(const struct TagIdxList *list, const char *path, int indexFd)
+{
+	struct stat64 st;
+	if (fstat64(indexFd, &st) == -1)
+		return EXIT_FAILURE;
+
+	char tmpName[PATH_MAX];
+	if (strlen(path) + 4 + 1 > PATH_MAX)
+		return EXIT_FAILURE;
+	strcpy(tmpName, path);
+	strcat(tmpName, ".tmp");
+
+	FILE *fd = fopen(tmpName, "w");
+	if (fd == NULL)
+		return EXIT_FAILURE;
+
+	int res = EXIT_FAILURE;
+	struct TagIdxHeader hdr;
+	makeStamp(&hdr, &st, list->hashSize);
+	hdr.count = list->count;
+	if (fwrite(&hdr, sizeof(hdr), 1, fd) == 1 &&
+		(list->count == 0 || fwrite(list->entries, TAGIDX_ENTRY_SIZE(list->hashSize), list->count, fd) == list->count))
+		res = EXIT_SUCCESS;
+	if (fclose(fd) == EOF)
+		res = EXIT_FAILURE;
+	if (res == EXIT_SUCCESS && rename(tmpName, path) != 0)
+		res = EXIT_FAILURE;
+	if (res != EXIT_SUCCESS)
+		unlink(tmpName);
+	return res;
+}
+
+void tagidxListFree(struct TagIdxList *list)
+{
+	if (list->entries != NULL)
+		free(list->entries);
+	list->entries = NULL;
+	list->count   = 0;
+	list->max     = 0;
+}
+
+/**************************** Private ********************************/
+
+static void makeStamp(struct TagIdxHeader *hdr, const struct stat64 *st, unsigned int hashSize)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, TAGIDX_MAGIC, TAGIDX_MAGIC_LEN);
+	hdr->indexSize = st->st_size;
+	hdr->mtimeSec  = st->st_mtim.tv_sec;
+	hdr->mtimeNsec = st->st_mtim.tv_nsec;
+	hdr->inode     = st->st_ino;
+	hdr->hashSize  = hashSize;
+}
+
+static int cmpEntry(const struct TagIdxEntry *entry, unsigned int hashSize, uint64_t fileSize, const unsigned char *hash)
+{
+	if (entry->fileSize != fileSize)
+		return (entry->fileSize < fileSize) ? -1 : 1;
+	return memcmp(entry + 1, hash, hashSize);
+}
@@ -0,0 +1,89 @@
+/*
+ * tagidx.h
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef TAGIDX_H
+#define TAGIDX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Offset sidecar of the index file (tags.info.idx), all integers are little-endian:
+ *   struct TagIdxHeader
+ *   count entries, sorted by file size and hash like the index itself
+ * An entry is struct TagIdxEntry followed by hashSize bytes of the hash, padded by zeros to
+ * a multiple of 8 bytes. The header stamps the size, the modification time and the inode of
+ * the index file the sidecar was built for. A sidecar with a different stamp or hash size
+ * is ignored.
+ */
+
+#define TAGIDX_MAGIC      "TAGSIDX2"
+#define TAGIDX_MAGIC_LEN  8
+#define TAGIDX_SUFFIX     ".idx"
+#define TAGIDX_ENTRY_SIZE(hashSize)  (sizeof(struct TagIdxEntry) + (((hashSize) + 7) & ~(size_t)7))
+
+struct TagIdxHeader
+{
+	char          magic[TAGIDX_MAGIC_LEN];
+	uint64_t      indexSize;
+	int64_t       mtimeSec;
+	int64_t       mtimeNsec;
+	uint64_t      inode;
+	uint64_t      count;
+	uint32_t      hashSize;
+	uint32_t      reserved;
+};
+
+struct TagIdxEntry
+{
+	uint64_t      fileSize;
+	uint64_t      offset;
+};
+
+struct TagIdx
+{
+	void          *base;
+	size_t        size;
+	const unsigned char *entries;
+	size_t        count;
+	unsigned int  hashSize;
+};
+
+struct TagIdxList
+{
+	size_t        count;
+	size_t        max;
+	unsigned char *entries;
+	unsigned int  hashSize;
+};
+
+void tagidxInit(struct TagIdx *idx);
+int  tagidxOpen(struct TagIdx *idx, const char *path, int indexFd, unsigned int hashSize);
+void tagidxClose(struct TagIdx *idx);
+const struct TagIdxEntry *tagidxEntry(const unsigned char *entries, unsigned int hashSize, size_t num);
+const struct TagIdxEntry *tagidxLowerBound(const struct TagIdx *idx, uint64_t fileSize, const unsigned char *hash);
+
+void tagidxListInit(struct TagIdxList *list, unsigned int hashSize);
+int  tagidxListAppend(struct TagIdxList *list, uint64_t fileSize, const unsigned char *hash, uint64_t offset);
+int  tagidxListAppendRange(struct TagIdxList *list, const unsigned char *entries, size_t count, uint64_t from, uint64_t to, uint64_t newOffset);
+int  tagidxListWrite(const struct TagIdxList *list, const char *path, int indexFd);
+void tagidxListFree(struct TagIdxList *list);
+
+#endif // TAGIDX_H
@@ -0,0 +1,440 @@
+/*
+ * taginv.c
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#define _LARGEFILE64_SOURCE
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <wctype.h>
+#include <linux/limits.h>
+
+#include "taginv.h"
+#include "utils.h"
+
+#define LIST_INCREASE     1024
+#define STRINGS_INCREASE  16384
+
+static void makeStamp(struct TagInvHeader *hdr, const struct stat64 *st);
+static int  cmpKey(const char *key1, size_t len1, const char *key2, size_t len2);
+static int  cmpPair(const void *p1, const void *p2, void *strings);
+static const struct TagInvKey *findKey(const struct TagInv *inv, const char *key, size_t keyLength);
+static int  cmpOffset(const void *p1, const void *p2);
+static size_t findItem(const uint64_t *items, size_t count, uint64_t offset);
+
+void taginvInit(struct TagInv *inv)
+{
+	inv->base      = NULL;
+	inv->size      = 0;
+	inv->keys      = NULL;
+	inv->keyCount  = 0;
+	inv->items     = NULL;
+	inv->itemCount = 0;
+	inv->bitmaps   = NULL;
+	inv->strings   = NULL;
+}
+
+int taginvOpen(struct TagInv *inv, const char *path, int indexFd)
+{
+	taginvClose(inv);
+
+	struct stat64 st;
+	if (fstat64(indexFd, &st) == -1)
+		return EXIT_FAILURE;
+
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return EXIT_FAILURE;
+
+	int res = EXIT_FAILURE;
+	struct stat64 stInv;
+	if (fstat64(fd, &stInv) != -1 && (size_t)stInv.st_size >= sizeof(struct TagInvHeader))
+	{
+		void *base = mmap(NULL, stInv.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (base != MAP_FAILED)
+		{
+			struct TagInvHeader hdr;
+			struct TagInvHeader stamp;
+			memcpy(&hdr, base, sizeof(hdr));
+			makeStamp(&stamp, &st);
+			size_t rest = stInv.st_size - sizeof(hdr);
+			if (memcmp(hdr.magic, TAGINV_MAGIC, TAGINV_MAGIC_LEN) == 0 && hdr.indexSize == stamp.indexSize &&
+				hdr.mtimeSec == stamp.mtimeSec && hdr.mtimeNsec == stamp.mtimeNsec && hdr.inode == stamp.inode &&
+				hdr.keyCount <= rest / sizeof(struct TagInvKey) && hdr.itemCount <= rest / sizeof(uint64_t) &&
+				hdr.bitmapsSize <= rest && hdr.stringsSize <= rest &&
+				hdr.keyCount * sizeof(struct TagInvKey) + hdr.itemCount * sizeof(uint64_t) + hdr.bitmapsSize + hdr.stringsSize == rest)
+			{
+				const unsigned char *data = (const unsigned char *)base + sizeof(hdr);
+				const struct TagInvKey *keys = (const struct TagInvKey *)data;
+				size_t i;
+				for (i = 0; i < hdr.keyCount; ++i)
+					if (keys[i].bitmapOffset > hdr.bitmapsSize || keys[i].bitmapLength > hdr.bitmapsSize - keys[i].bitmapOffset ||
+						keys[i].keyOffset > hdr.stringsSize || keys[i].keyLength > hdr.stringsSize - keys[i].keyOffset)
+						break;
+				if (i == hdr.keyCount)
+				{
+					inv->base      = base;
+					inv->size      = stInv.st_size;
+					inv->keys      = keys;
+					inv->keyCount  = hdr.keyCount;
+					inv->items     = (const uint64_t *)(data + hdr.keyCount * sizeof(struct TagInvKey));
+					inv->itemCount = hdr.itemCount;
+					inv->bitmaps   = (const unsigned char *)(inv->items + hdr.itemCount);
+					inv->strings   = (const char *)(inv->bitmaps + hdr.bitmapsSize);
+					res = EXIT_SUCCESS;
+				}
+			}
+			if (res != EXIT_SUCCESS)
+				munmap(base, stInv.st_size);
+		}
+	}
+	close(fd);
+	return res;
+}
+
+void taginvClose(struct TagInv *inv)
+{
+	if (inv->base != NULL)
+		munmap(inv->base, inv->size);
+	taginvInit(inv);
+}
+
+int taginvLookup(const struct TagInv *inv, const char *key, size_t keyLength, struct TagBitmap *items)
+{
+	// An absent key has no items, it is not an error
+	const struct TagInvKey *k = findKey(inv, key, keyLength);
+	if (k == NULL)
+	{
+		tagbitmapFree(items);
+		return EXIT_SUCCESS;
+	}
+	if (tagbitmapDeserialize(items, inv->bitmaps + k->bitmapOffset, k->bitmapLength) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	// The ids index the item table
+	uint32_t last;
+	if (tagbitmapMaximum(items, &last) && last >= inv->itemCount)
+	{
+		tagbitmapFree(items);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+size_t taginvCount(const struct TagInv *inv, const char *key, size_t keyLength)
+{
+	const struct TagInvKey *k = findKey(inv, key, keyLength);
+	if (k == NULL)
+		return 0;
+	return tagbitmapSerializedCardinality(inv->bitmaps + k->bitmapOffset, k->bitmapLength);
+}
+
+size_t taginvCountPrefix(const struct TagInv *inv, const char *prefix, size_t prefixLength)
+{
+	// The keys with the same prefix are adjacent, an item can be counted more than once
+	size_t lo = 0;
+	size_t hi = inv->keyCount;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		const struct TagInvKey *k = &inv->keys[mid];
+		if (cmpKey(inv->strings + k->keyOffset, k->keyLength, prefix, prefixLength) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	size_t res = 0;
+	for ( ; lo < inv->keyCount; ++lo)
+	{
+		const struct TagInvKey *k = &inv->keys[lo];
+		if (k->keyLength < prefixLength || memcmp(inv->strings + k->keyOffset, prefix, prefixLength) != 0)
+			break;
+		res += tagbitmapSerializedCardinality(inv->bitmaps + k->bitmapOffset, k->bitmapLength);
+	}
+	return res;
+}
+
+int taginvMakeKey(struct TagBinBuffer *buf, const wchar_t *name, const wchar_t *value)
+{
+	// The names and the values are compared case insensitively, so the key is in lower case
+	size_t nameLen = wcslen(name);
+	size_t valLen  = wcslen(value);
+	wchar_t *lower = malloc((nameLen + valLen + 2) * sizeof(wchar_t));
+	if (lower == NULL)
+		return EXIT_FAILURE;
+	size_t i;
+	for (i = 0; i < nameLen; ++i)
+		lower[i] = towlower(name[i]);
+	lower[nameLen] = L'\0';
+	for (i = 0; i < valLen; ++i)
+		lower[nameLen + 1 + i] = towlower(value[i]);
+	lower[nameLen + 1 + valLen] = L'\0';
+
+	int res = EXIT_FAILURE;
+	buf->length = 0;
+	size_t len = utf8EncodedLength(lower) + 1 + utf8EncodedLength(lower + nameLen + 1) + 1;
+	if (tagbinBufferReserve(buf, len) == EXIT_SUCCESS)
+	{
+		size_t n = utf8Encode(lower, (char *)buf->data) + 1;
+		buf->length = n + utf8Encode(lower + nameLen + 1, (char *)buf->data + n);
+		res = EXIT_SUCCESS;
+	}
+	free(lower);
+	return res;
+}
+
+int taginvListAppend(struct TagInvList *list, const char *key, size_t keyLength, uint64_t offset)
+{
+	if (list->count == list->max)
+	{
+		struct TagInvPair *pairs = realloc(list->pairs, (list->max + LIST_INCREASE) * sizeof(struct TagInvPair));
+		if (pairs == NULL)
+			return EXIT_FAILURE;
+		list->pairs = pairs;
+		list->max += LIST_INCREASE;
+	}
+	if (list->stringsLength + keyLength > list->stringsMax)
+	{
+		size_t max = list->stringsMax + keyLength + STRINGS_INCREASE;
+		char *strings = realloc(list->strings, max);
+		if (strings == NULL)
+			return EXIT_FAILURE;
+		list->strings = strings;
+		list->stringsMax = max;
+	}
+	struct TagInvPair *pair = &list->pairs[list->count++];
+	pair->keyPos    = list->stringsLength;
+	pair->keyLength = keyLength;
+	pair->offset    = offset;
+	memcpy(list->strings + list->stringsLength, key, keyLength);
+	list->stringsLength += keyLength;
+	return EXIT_SUCCESS;
+}
+
+int taginvListWrite(struct TagInvList *list, const char *path, int indexFd)
+{
+	struct stat64 st;
+	if (fstat64(indexFd, &st) == -1)
+		return EXIT_FAILURE;
+
+	char tmpName[PATH_MAX];
+	if (strlen(path) + 4 + 1 > PATH_MAX)
+		return EXIT_FAILURE;
+	strcpy(tmpName, path);
+	strcat(tmpName, ".tmp");
+
+	// The pairs are grouped by the keys, the repeated pairs are dropped
+	size_t cnt = 0;
+	size_t i;
+	if (list->count != 0)
+	{
+		qsort_r(list->pairs, list->count, sizeof(struct TagInvPair), cmpPair, list->strings);
+		for (i = 0; i < list->count; ++i)
+			if (cnt == 0 || cmpPair(&list->pairs[cnt - 1], &list->pairs[i], list->strings) != 0)
+				list->pairs[cnt++] = list->pairs[i];
+	}
+	list->count = cnt;
+
+	// The items are numbered in the order of their offsets
+	struct TagInvHeader hdr;
+	makeStamp(&hdr, &st);
+	uint64_t *items = malloc((cnt != 0 ? cnt : 1) * sizeof(uint64_t));
+	struct TagInvKey *keys = malloc((cnt != 0 ? cnt : 1) * sizeof(struct TagInvKey));
+	unsigned char *bitmaps = NULL;
+	size_t bitmapsMax = 0;
+	int res = EXIT_FAILURE;
+	if (items == NULL || keys == NULL)
+		goto done;
+	for (i = 0; i < cnt; ++i)
+		items[i] = list->pairs[i].offset;
+	qsort(items, cnt, sizeof(uint64_t), cmpOffset);
+	for (i = 0; i < cnt; ++i)
+		if (hdr.itemCount == 0 || items[hdr.itemCount - 1] != items[i])
+			items[hdr.itemCount++] = items[i];
+
+	size_t start = 0;
+	for (i = 0; i <= cnt; ++i)
+	{
+		const struct TagInvPair *pair = &list->pairs[i];
+		if (i != 0 && (i == cnt || cmpKey(list->strings + pair[-1].keyPos, pair[-1].keyLength, list->strings + pair->keyPos, pair->keyLength) != 0))
+		{
+			// The ids of a key are added in the ascending order
+			struct TagBitmap bm;
+			tagbitmapInit(&bm);
+			size_t k;
+			for (k = start; k < i; ++k)
+				if (tagbitmapAdd(&bm, findItem(items, hdr.itemCount, list->pairs[k].offset)) != EXIT_SUCCESS)
+					break;
+			size_t len = tagbitmapSerializedSize(&bm);
+			if (k == i && hdr.bitmapsSize + len > bitmapsMax)
+			{
+				size_t max = (hdr.bitmapsSize + len) * 2;
+				unsigned char *newPtr = realloc(bitmaps, max);
+				if (newPtr == NULL)
+					k = 0;
+				else
+				{
+					bitmaps = newPtr;
+					bitmapsMax = max;
+				}
+			}
+			if (k != i)
+			{
+				tagbitmapFree(&bm);
+				goto done;
+			}
+			tagbitmapSerialize(&bm, bitmaps + hdr.bitmapsSize);
+			tagbitmapFree(&bm);
+
+			struct TagInvKey *key = &keys[hdr.keyCount++];
+			key->bitmapOffset = hdr.bitmapsSize;
+			key->bitmapLength = len;
+			key->keyOffset    = hdr.stringsSize;
+			key->keyLength    = pair[-1].keyLength;
+			hdr.bitmapsSize += len;
+			hdr.stringsSize += pair[-1].keyLength;
+			start = i;
+		}
+	}
+
+	FILE *fd = fopen(tmpName, "w");
+	if (fd != NULL)
+	{
+		if (fwrite(&hdr, sizeof(hdr), 1, fd) == 1 &&
+			(hdr.keyCount == 0 || fwrite(keys, sizeof(struct TagInvKey), hdr.keyCount, fd) == hdr.keyCount) &&
+			(hdr.itemCount == 0 || fwrite(items, sizeof(uint64_t), hdr.itemCount, fd) == hdr.itemCount) &&
+			(hdr.bitmapsSize == 0 || fwrite(bitmaps, 1, hdr.bitmapsSize, fd) == hdr.bitmapsSize))
+		{
+			// The strings of the keys follow in the order of the keys
+			size_t k;
+			size_t n = 0;
+			for (k = 0; k < cnt; ++k)
+			{
+				const struct TagInvPair *pair = &list->pairs[k];
+				if (k != 0 && cmpKey(list->strings + pair[-1].keyPos, pair[-1].keyLength, list->strings + pair->keyPos, pair->keyLength) == 0)
+					continue;
+				if (fwrite(list->strings + pair->keyPos, 1, pair->keyLength, fd) != pair->keyLength)
+					break;
+				++n;
+			}
+			if (k == cnt && n == hdr.keyCount)
+				res = EXIT_SUCCESS;
+		}
+		if (fclose(fd) == EOF)
+			res = EXIT_FAILURE;
+		if (res == EXIT_SUCCESS && rename(tmpName, path) != 0)
+			res = EXIT_FAILURE;
+		if (res != EXIT_SUCCESS)
+			unlink(tmpName);
+	}
+
+done:
+	free(items);
+	free(keys);
+	free(bitmaps);
+	return res;
+}
+
+void taginvListFree(struct TagInvList *list)
+{
+	free(list->pairs);
+	free(list->strings);
+	list->pairs         = NULL;
+	list->count         = 0;
+	list->max           = 0;
+	list->strings       = NULL;
+	list->stringsLength = 0;
+	list->stringsMax    = 0;
+}
+
+/**************************** Private ********************************/
+
+static void makeStamp(struct TagInvHeader *hdr, const struct stat64 *st)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, TAGINV_MAGIC, TAGINV_MAGIC_LEN);
+	hdr->indexSize = st->st_size;
+	hdr->mtimeSec  = st->st_mtim.tv_sec;
+	hdr->mtimeNsec = st->st_mtim.tv_nsec;
+	hdr->inode     = st->st_ino;
+}
+
+static int cmpKey(const char *key1, size_t len1, const char *key2, size_t len2)
+{
+	int cmp = memcmp(key1, key2, (len1 < len2) ? len1 : len2);
+	if (cmp != 0)
+		return cmp;
+	return (len1 < len2) ? -1 : (len1 > len2) ? 1 : 0;
+}
+
+static int cmpPair(const void *p1, const void *p2, void *strings)
+{
+	const struct TagInvPair *pair1 = p1;
+	const struct TagInvPair *pair2 = p2;
+	int cmp = cmpKey((const char *)strings + pair1->keyPos, pair1->keyLength, (const char *)strings + pair2->keyPos, pair2->keyLength);
+	if (cmp != 0)
+		return cmp;
+	return (pair1->offset < pair2->offset) ? -1 : (pair1->offset > pair2->offset) ? 1 : 0;
+}
+
+static const struct TagInvKey *findKey(const struct TagInv *inv, const char *key, size_t keyLength)
+{
+	size_t lo = 0;
+	size_t hi = inv->keyCount;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		const struct TagInvKey *k = &inv->keys[mid];
+		int cmp = cmpKey(inv->strings + k->keyOffset, k->keyLength, key, keyLength);
+		if (cmp == 0)
+			return k;
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+static int cmpOffset(const void *p1, const void *p2)
+{
+	uint64_t off1 = *(const uint64_t *)p1;
+	uint64_t off2 = *(const uint64_t *)p2;
+	return (off1 < off2) ? -1 : (off1 > off2) ? 1 : 0;
+}
+
+static size_t findItem(const uint64_t *items, size_t count, uint64_t offset)
+{
+	size_t lo = 0;
+	size_t hi = count;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if (items[mid] < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
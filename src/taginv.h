@@ -0,0 +1,108 @@
+/*
+ * taginv.h
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef TAGINV_H
+#define TAGINV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <wchar.h>
+
+#include "tagbitmap.h"
+#include "tagbin.h"
+
+/*
+ * Inverted index of the property values (tags.info.inv), all integers are little-endian:
+ *   struct TagInvHeader, stamped like the offset index with the index file it belongs to
+ *   keyCount times struct TagInvKey, sorted by the bytes of the keys
+ *   itemCount times uint64 offset of an item in the index file, ascending; the position in this
+ *   table is the id of the item
+ *   bitmapsSize bytes of the serialized bitmaps (tagbitmap.h) of the item ids, one per key
+ *   stringsSize bytes of the keys
+ * The key is the UTF-8 name of a property, the zero byte and the UTF-8 value, both lower case,
+ * the bitmap of the key holds the items that have the value of the property.
+ */
+
+#define TAGINV_MAGIC      "TAGSINV2"
+#define TAGINV_MAGIC_LEN  8
+#define TAGINV_SUFFIX     ".inv"
+
+struct TagInvHeader
+{
+	char          magic[TAGINV_MAGIC_LEN];
+	uint64_t      indexSize;
+	int64_t       mtimeSec;
+	int64_t       mtimeNsec;
+	uint64_t      inode;
+	uint64_t      keyCount;
+	uint64_t      itemCount;
+	uint64_t      bitmapsSize;
+	uint64_t      stringsSize;
+};
+
+struct TagInvKey
+{
+	uint64_t      bitmapOffset;
+	uint64_t      bitmapLength;
+	uint64_t      keyOffset;
+	uint64_t      keyLength;
+};
+
+struct TagInv
+{
+	void          *base;
+	size_t        size;
+	const struct TagInvKey *keys;
+	size_t        keyCount;
+	const uint64_t *items;
+	size_t        itemCount;
+	const unsigned char *bitmaps;
+	const char    *strings;
+};
+
+struct TagInvList
+{
+	size_t        count;
+	size_t        max;
+	struct TagInvPair
+	{
+		size_t    keyPos;
+		size_t    keyLength;
+		uint64_t  offset;
+	} *pairs;
+	size_t        stringsLength;
+	size_t        stringsMax;
+	char          *strings;
+};
+
+void taginvInit(struct TagInv *inv);
+int  taginvOpen(struct TagInv *inv, const char *path, int indexFd);
+void taginvClose(struct TagInv *inv);
+int  taginvLookup(const struct TagInv *inv, const char *key, size_t keyLength, struct TagBitmap *items);
+size_t taginvCount(const struct TagInv *inv, const char *key, size_t keyLength);
+size_t taginvCountPrefix(const struct TagInv *inv, const char *prefix, size_t prefixLength);
+int  taginvMakeKey(struct TagBinBuffer *buf, const wchar_t *name, const wchar_t *value);
+
+int  taginvListAppend(struct TagInvList *list, const char *key, size_t keyLength, uint64_t offset);
+int  taginvListWrite(struct TagInvList *list, const char *path, int indexFd);
+void taginvListFree(struct TagInvList *list);
+
+#endif // TAGINV_H
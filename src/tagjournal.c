@@ -0,0 +1,490 @@
+/*
+ * tagjournal.c
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#define _LARGEFILE64_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "tagjournal.h"
+#include "common.h"
+#include "utils.h"
+
+#define ENTRIES_INCREASE  64
+#define FNV_OFFSET_BASIS  2166136261U
+#define FNV_PRIME         16777619U
+
+static void makeStamp(struct TagJournalHeader *hdr, const struct stat64 *st, unsigned int hashSize);
+static void readRecord(const unsigned char *data, unsigned int hashSize, struct TagJournalRecord *rec);
+static void writeRecord(unsigned char *data, unsigned int hashSize, const struct TagJournalRecord *rec);
+static uint32_t checksum(uint32_t hash, const void *data, size_t len);
+static int  encodeItem(struct TagBinBuffer *buf, const struct ItemStruct *item);
+static int  putEntry(struct TagJournal *j, uint64_t fileSize, const unsigned char *hash, const unsigned char *data, size_t length, int pending);
+static int  applyRecords(struct TagJournal *j, const unsigned char *data, const unsigned char *end);
+static int  readString(const unsigned char **pData, const unsigned char *end, wchar_t *buff);
+
+void tagjournalInit(struct TagJournal *j)
+{
+	memset(j, 0, sizeof(*j));
+}
+
+void tagjournalFree(struct TagJournal *j)
+{
+	size_t i;
+	for (i = 0; i < j->count; ++i)
+		if (j->entries[i].data != NULL)
+			free(j->entries[i].data);
+	if (j->entries != NULL)
+		free(j->entries);
+	tagbinBufferFree(&j->loaded.data);
+	tagbinBufferFree(&j->buffer);
+	tagjournalInit(j);
+}
+
+int tagjournalLoad(struct TagJournal *j, const char *path, int indexFd, unsigned int hashSize)
+{
+	tagjournalFree(j);
+	j->hashSize = hashSize;
+
+	FILE *fd = fopen(path, "r");
+	if (fd == NULL)
+		return (errno == ENOENT) ? EXIT_SUCCESS : EXIT_FAILURE;
+	j->enabled = 1;
+
+	struct stat64 st;
+	struct stat64 stIdx;
+	unsigned char *base = NULL;
+	int res = EXIT_FAILURE;
+	if (fstat64(fileno(fd), &st) != -1 && fstat64(indexFd, &stIdx) != -1)
+	{
+		size_t size = st.st_size;
+		if (size == 0 || (base = malloc(size)) != NULL)
+		{
+			if (size == 0 || fread(base, 1, size, fd) == size)
+				res = EXIT_SUCCESS;
+		}
+		if (res == EXIT_SUCCESS)
+		{
+			struct TagJournalHeader hdr;
+			struct TagJournalHeader stamp;
+			makeStamp(&stamp, &stIdx, hashSize);
+			if (size < sizeof(hdr) || (memcpy(&hdr, base, sizeof(hdr)), memcmp(&hdr, &stamp, sizeof(hdr)) != 0))
+			{
+				j->stale = 1;
+				fputs("Warning: the journal does not belong to the index file and is ignored\n", stderr);
+			}
+			else
+			{
+				j->fileLength = sizeof(hdr);
+				const unsigned char *end = base + size;
+				const unsigned char *txn = base + sizeof(hdr);
+				const unsigned char *p   = txn;
+				size_t recSize = TAGJOURNAL_RECORD_SIZE(hashSize);
+				uint32_t cnt  = 0;
+				uint32_t hash = FNV_OFFSET_BASIS;
+				struct TagJournalRecord rec;
+				while ((size_t)(end - p) >= recSize)
+				{
+					readRecord(p, hashSize, &rec);
+					if (rec.type == JournalCommit)
+					{
+						if (rec.fileSize != cnt || rec.checksum != hash)
+							break;
+						if (applyRecords(j, txn, p) != EXIT_SUCCESS)
+						{
+							res = EXIT_FAILURE;
+							break;
+						}
+						p += recSize;
+						txn = p;
+						j->fileLength = p - base;
+						cnt  = 0;
+						hash = FNV_OFFSET_BASIS;
+						continue;
+					}
+					if ((rec.type != JournalPut && rec.type != JournalDelete) || (size_t)(end - p) - recSize < rec.length)
+						break;
+					hash = checksum(hash, p, recSize + rec.length);
+					p += recSize + rec.length;
+					++cnt;
+				}
+			}
+		}
+	}
+	if (base != NULL)
+		free(base);
+	fclose(fd);
+	j->pos = 0;
+	if (res != EXIT_SUCCESS)
+		perror("journal");
+	return res;
+}
+
+int tagjournalCreate(const char *path, const char *indexPath, unsigned int hashSize)
+{
+	struct stat64 st;
+	char tmpName[PATH_MAX];
+	// A journal without the size of the hashes could not be read back
+	if (hashSize == 0 || hashSize > FILE_HASH_SIZE || stat64(indexPath, &st) == -1 || strlen(path) + 4 + 1 > PATH_MAX)
+		return EXIT_FAILURE;
+	strcpy(tmpName, path);
+	strcat(tmpName, ".tmp");
+
+	FILE *fd = fopen(tmpName, "w");
+	if (fd == NULL)
+		return EXIT_FAILURE;
+	struct TagJournalHeader hdr;
+	makeStamp(&hdr, &st, hashSize);
+	int res = EXIT_FAILURE;
+	if (fwrite(&hdr, sizeof(hdr), 1, fd) == 1 && fflush(fd) == 0 && fsync(fileno(fd)) == 0)
+		res = EXIT_SUCCESS;
+	if (fclose(fd) == EOF)
+		res = EXIT_FAILURE;
+	if (res == EXIT_SUCCESS && rename(tmpName, path) != 0)
+		res = EXIT_FAILURE;
+	if (res != EXIT_SUCCESS)
+		unlink(tmpName);
+	return res;
+}
+
+int tagjournalCommit(struct TagJournal *j, const char *path, const char *indexPath, int syncData)
+{
+	if (!tagjournalHasPending(j))
+		return EXIT_SUCCESS;
+
+	if (!j->enabled || j->stale)
+	{
+		if (tagjournalCreate(path, indexPath, j->hashSize) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+		j->enabled    = 1;
+		j->stale      = 0;
+		j->fileLength = sizeof(struct TagJournalHeader);
+	}
+
+	struct TagBinBuffer *buf = &j->buffer;
+	struct TagJournalRecord rec;
+	size_t recSize = TAGJOURNAL_RECORD_SIZE(j->hashSize);
+	uint32_t cnt  = 0;
+	uint32_t hash = FNV_OFFSET_BASIS;
+	size_t i;
+	buf->length = 0;
+	for (i = 0; i < j->count; ++i)
+	{
+		const struct TagJournalEntry *entry = &j->entries[i];
+		if (!entry->pending)
+			continue;
+		memset(&rec, 0, sizeof(rec));
+		rec.type     = (entry->deleted) ? JournalDelete : JournalPut;
+		rec.length   = entry->length;
+		rec.fileSize = entry->fileSize;
+		memcpy(rec.hash, entry->hash, FILE_HASH_SIZE);
+		size_t start = buf->length;
+		if (tagbinBufferReserve(buf, recSize + entry->length) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+		writeRecord(buf->data + buf->length, j->hashSize, &rec);
+		if (entry->length != 0)
+			memcpy(buf->data + buf->length + recSize, entry->data, entry->length);
+		buf->length += recSize + entry->length;
+		hash = checksum(hash, buf->data + start, buf->length - start);
+		++cnt;
+	}
+	memset(&rec, 0, sizeof(rec));
+	rec.type     = JournalCommit;
+	rec.fileSize = cnt;
+	rec.checksum = hash;
+	if (tagbinBufferReserve(buf, recSize) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	writeRecord(buf->data + buf->length, j->hashSize, &rec);
+	buf->length += recSize;
+
+	// A torn tail of an interrupted commit is overwritten
+	int fd = open(path, O_WRONLY);
+	if (fd == -1)
+		return EXIT_FAILURE;
+	int res = EXIT_FAILURE;
+	if (ftruncate(fd, j->fileLength) == 0 && pwrite(fd, buf->data, buf->length, j->fileLength) == (ssize_t)buf->length &&
+		(!syncData || fdatasync(fd) == 0))
+		res = EXIT_SUCCESS;
+	if (close(fd) == -1)
+		res = EXIT_FAILURE;
+	if (res == EXIT_SUCCESS)
+	{
+		j->fileLength += buf->length;
+		for (i = 0; i < j->count; ++i)
+			j->entries[i].pending = 0;
+	}
+	return res;
+}
+
+int tagjournalHasPending(const struct TagJournal *j)
+{
+	size_t i;
+	for (i = 0; i < j->count; ++i)
+		if (j->entries[i].pending)
+			return 1;
+	return 0;
+}
+
+int tagjournalCompare(const struct TagJournalEntry *entry, uint64_t fileSize, const unsigned char *hash)
+{
+	if (entry->fileSize != fileSize)
+		return (entry->fileSize < fileSize) ? -1 : 1;
+	return memcmp(entry->hash, hash, FILE_HASH_SIZE);
+}
+
+struct ItemStruct *tagjournalItemLoad(const struct TagJournalEntry *entry, struct TagArena *arena)
+{
+	struct ItemStruct *item = itemInitArena(arena, entry->fileSize, entry->hash);
+	if (item == NULL)
+		return NULL;
+
+	const unsigned char *data = entry->data;
+	const unsigned char *end  = data + entry->length;
+	uint32_t namesCnt;
+	uint32_t propsCnt;
+	int res = EXIT_FAILURE;
+	wchar_t *buff = tagarenaAlloc(arena, (entry->length + 1) * sizeof(wchar_t));
+	wchar_t *buff2 = tagarenaAlloc(arena, (entry->length + 1) * sizeof(wchar_t));
+	if (buff != NULL && buff2 != NULL &&
+		tagbinReadU32(&data, end, &namesCnt) == EXIT_SUCCESS && tagbinReadU32(&data, end, &propsCnt) == EXIT_SUCCESS)
+	{
+		res = EXIT_SUCCESS;
+		for ( ; namesCnt != 0 && res == EXIT_SUCCESS; --namesCnt)
+		{
+			res = readString(&data, end, buff);
+			if (res == EXIT_SUCCESS)
+				res = itemAddFileName(item, buff);
+		}
+		for ( ; propsCnt != 0 && res == EXIT_SUCCESS; --propsCnt)
+		{
+			res = readString(&data, end, buff);
+			if (res == EXIT_SUCCESS)
+				res = readString(&data, end, buff2);
+			if (res == EXIT_SUCCESS)
+				res = itemSetProperty(item, buff, buff2);
+		}
+	}
+	if (buff != NULL)
+		tagarenaRelease(arena, buff);
+	if (buff2 != NULL)
+		tagarenaRelease(arena, buff2);
+	if (res != EXIT_SUCCESS)
+	{
+		itemFree(item);
+		item = NULL;
+	}
+	return item;
+}
+
+int tagjournalSetLoaded(struct TagJournal *j, const struct ItemStruct *item)
+{
+	if (tagjournalFlushLoaded(j) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (encodeItem(&j->loaded.data, item) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	memcpy(j->loaded.hash, item->hash, FILE_HASH_SIZE);
+	j->loaded.fileSize = item->fileSize;
+	j->loaded.used = 1;
+	return EXIT_SUCCESS;
+}
+
+int tagjournalFlushLoaded(struct TagJournal *j)
+{
+	// The item given to the caller was not written back, so it is removed
+	if (!j->loaded.used)
+		return EXIT_SUCCESS;
+	j->loaded.used = 0;
+	return putEntry(j, j->loaded.fileSize, j->loaded.hash, NULL, 0, 1);
+}
+
+int tagjournalInsertItem(struct TagJournal *j, const struct ItemStruct *item)
+{
+	if (encodeItem(&j->buffer, item) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+
+	if (j->loaded.used)
+	{
+		if (j->loaded.fileSize == item->fileSize && memcmp(j->loaded.hash, item->hash, FILE_HASH_SIZE) == 0)
+		{
+			j->loaded.used = 0;
+			if (j->loaded.data.length == j->buffer.length && memcmp(j->loaded.data.data, j->buffer.data, j->buffer.length) == 0)
+				return EXIT_SUCCESS; // unchanged
+		}
+		else if (tagjournalFlushLoaded(j) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+	}
+	return putEntry(j, item->fileSize, item->hash, j->buffer.data, j->buffer.length, 1);
+}
+
+/**************************** Private ********************************/
+
+static void makeStamp(struct TagJournalHeader *hdr, const struct stat64 *st, unsigned int hashSize)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, TAGJOURNAL_MAGIC, TAGJOURNAL_MAGIC_LEN);
+	hdr->indexSize = st->st_size;
+	hdr->mtimeSec  = st->st_mtim.tv_sec;
+	hdr->mtimeNsec = st->st_mtim.tv_nsec;
+	hdr->inode     = st->st_ino;
+	hdr->hashSize  = hashSize;
+}
+
+static void readRecord(const unsigned char *data, unsigned int hashSize, struct TagJournalRecord *rec)
+{
+	memcpy(&rec->type, data, sizeof(rec->type));
+	data += sizeof(rec->type);
+	memcpy(&rec->length, data, sizeof(rec->length));
+	data += sizeof(rec->length);
+	memcpy(&rec->fileSize, data, sizeof(rec->fileSize));
+	data += sizeof(rec->fileSize);
+	memcpy(rec->hash, data, hashSize);
+	memset(rec->hash + hashSize, 0, FILE_HASH_SIZE - hashSize);
+	data += hashSize;
+	memcpy(&rec->checksum, data, sizeof(rec->checksum));
+}
+
+static void writeRecord(unsigned char *data, unsigned int hashSize, const struct TagJournalRecord *rec)
+{
+	memcpy(data, &rec->type, sizeof(rec->type));
+	data += sizeof(rec->type);
+	memcpy(data, &rec->length, sizeof(rec->length));
+	data += sizeof(rec->length);
+	memcpy(data, &rec->fileSize, sizeof(rec->fileSize));
+	data += sizeof(rec->fileSize);
+	memcpy(data, rec->hash, hashSize);
+	data += hashSize;
+	memcpy(data, &rec->checksum, sizeof(rec->checksum));
+}
+
+static uint32_t checksum(uint32_t hash, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	for ( ; len != 0; --len)
+		hash = (hash ^ *p++) * FNV_PRIME;
+	return hash;
+}
+
+static int encodeItem(struct TagBinBuffer *buf, const struct ItemStruct *item)
+{
+	buf->length = 0;
+	if (tagbinBufferPutU32(buf, item->fileNameCount) != EXIT_SUCCESS || tagbinBufferPutU32(buf, item->propsCount) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+
+	unsigned int i = 0;
+	const wchar_t *fName;
+	while ((fName = itemGetFileName(item, i++)) != NULL)
+		if (tagbinBufferPutString(buf, fName) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+
+	for (i = 0; i < item->propsCount; ++i)
+		if (tagbinBufferPutString(buf, itemPropertyGetName(item, i)) != EXIT_SUCCESS || tagbinBufferPutValue(buf, item, i) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+static int putEntry(struct TagJournal *j, uint64_t fileSize, const unsigned char *hash, const unsigned char *data, size_t length, int pending)
+{
+	size_t lo = 0;
+	size_t hi = j->count;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if (tagjournalCompare(&j->entries[mid], fileSize, hash) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	unsigned char *copy = NULL;
+	if (data != NULL)
+	{
+		copy = malloc(length + 1);
+		if (copy == NULL)
+			return EXIT_FAILURE;
+		memcpy(copy, data, length);
+	}
+
+	struct TagJournalEntry *entry;
+	if (lo < j->count && tagjournalCompare(&j->entries[lo], fileSize, hash) == 0)
+	{
+		entry = &j->entries[lo];
+		if (entry->data != NULL)
+			free(entry->data);
+	}
+	else
+	{
+		if (j->count == j->max)
+		{
+			struct TagJournalEntry *entries = realloc(j->entries, (j->max + ENTRIES_INCREASE) * sizeof(struct TagJournalEntry));
+			if (entries == NULL)
+			{
+				if (copy != NULL)
+					free(copy);
+				return EXIT_FAILURE;
+			}
+			j->entries = entries;
+			j->max += ENTRIES_INCREASE;
+		}
+		memmove(&j->entries[lo + 1], &j->entries[lo], (j->count - lo) * sizeof(struct TagJournalEntry));
+		++j->count;
+		// The cursor stays on the same entry
+		if (lo <= j->pos)
+			++j->pos;
+		entry = &j->entries[lo];
+		entry->fileSize = fileSize;
+		memcpy(entry->hash, hash, FILE_HASH_SIZE);
+	}
+	entry->deleted = (data == NULL);
+	entry->pending = pending;
+	entry->data    = copy;
+	entry->length  = (data != NULL) ? length : 0;
+	return EXIT_SUCCESS;
+}
+
+static int applyRecords(struct TagJournal *j, const unsigned char *data, const unsigned char *end)
+{
+	struct TagJournalRecord rec;
+	while (data != end)
+	{
+		readRecord(data, j->hashSize, &rec);
+		data += TAGJOURNAL_RECORD_SIZE(j->hashSize);
+		if (putEntry(j, rec.fileSize, rec.hash, (rec.type == JournalPut) ? data : NULL, rec.length, 0) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+		data += rec.length;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int readString(const unsigned char **pData, const unsigned char *end, wchar_t *buff)
+{
+	uint32_t len;
+	if (tagbinReadU32(pData, end, &len) != EXIT_SUCCESS || (size_t)(end - *pData) < len)
+		return EXIT_FAILURE;
+	if (utf8Decode((const char *)*pData, len, buff) == (size_t) -1)
+		return EXIT_FAILURE;
+	*pData += len;
+	return EXIT_SUCCESS;
+}
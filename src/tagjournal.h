@@ -0,0 +1,117 @@
+/*
+ * tagjournal.h
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef TAGJOURNAL_H
+#define TAGJOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "item.h"
+#include "tagbin.h"
+
+/*
+ * Change journal of the index file (tags.info.journal), all integers are little-endian:
+ *   struct TagJournalHeader, stamped like the offset index with the index file it belongs to
+ *   transactions: any number of Put/Delete records followed by a Commit record
+ * Every record is uint32 type, uint32 length, uint64 fileSize, hashSize bytes of the hash
+ * (the size from the header), uint32 checksum, followed by length bytes of payload.
+ * The payload of a Put record is the whole new state of the item:
+ *   uint32 fileNameCount, uint32 propCount
+ *   fileNameCount times: uint32 len, len bytes of UTF-8
+ *   propCount times:     uint32 len, len bytes of UTF-8 (name), uint32 len, len bytes of UTF-8 (values)
+ * A Delete record has no payload. The Commit record keeps the number of records of the
+ * transaction in fileSize and the FNV-1a checksum of them in checksum. A transaction
+ * that is not terminated by a valid Commit record is ignored.
+ */
+
+#define TAGJOURNAL_MAGIC      "TAGSJRN2"
+#define TAGJOURNAL_MAGIC_LEN  8
+#define TAGJOURNAL_SUFFIX     ".journal"
+#define TAGJOURNAL_RECORD_SIZE(hashSize)  (2 * sizeof(uint32_t) + sizeof(uint64_t) + (hashSize) + sizeof(uint32_t))
+
+enum TagJournalRecordType {JournalPut = 1, JournalDelete = 2, JournalCommit = 3};
+
+struct TagJournalHeader
+{
+	char          magic[TAGJOURNAL_MAGIC_LEN];
+	uint64_t      indexSize;
+	int64_t       mtimeSec;
+	int64_t       mtimeNsec;
+	uint64_t      inode;
+	uint32_t      hashSize;
+	uint32_t      reserved;
+};
+
+struct TagJournalRecord  // the decoded record, the hash is padded by zeros
+{
+	uint32_t      type;
+	uint32_t      length;
+	uint64_t      fileSize;
+	unsigned char hash[FILE_HASH_SIZE];
+	uint32_t      checksum;
+};
+
+struct TagJournalEntry
+{
+	uint64_t      fileSize;
+	unsigned char hash[FILE_HASH_SIZE];
+	int           deleted;
+	int           pending;
+	size_t        length;
+	unsigned char *data;
+};
+
+struct TagJournal
+{
+	int           enabled;    // the journal file exists
+	int           stale;      // the journal file belongs to another version of the index
+	unsigned int  hashSize;   // the hash size of the records, the one of the index
+	size_t        fileLength; // length of the committed part of the journal file
+	size_t        count;
+	size_t        max;
+	struct TagJournalEntry *entries;
+	size_t        pos;        // read position of the index cursor
+	int           fromJournal;
+	int           found;
+	struct
+	{
+		int       used;
+		uint64_t  fileSize;
+		unsigned char hash[FILE_HASH_SIZE];
+		struct TagBinBuffer data;
+	} loaded;                 // the last item given to the caller in the update mode
+	struct TagBinBuffer buffer;
+};
+
+void tagjournalInit(struct TagJournal *j);
+void tagjournalFree(struct TagJournal *j);
+int  tagjournalLoad(struct TagJournal *j, const char *path, int indexFd, unsigned int hashSize);
+int  tagjournalCreate(const char *path, const char *indexPath, unsigned int hashSize);
+int  tagjournalCommit(struct TagJournal *j, const char *path, const char *indexPath, int syncData);
+int  tagjournalHasPending(const struct TagJournal *j);
+
+int  tagjournalCompare(const struct TagJournalEntry *entry, uint64_t fileSize, const unsigned char *hash);
+struct ItemStruct *tagjournalItemLoad(const struct TagJournalEntry *entry, struct TagArena *arena);
+int  tagjournalSetLoaded(struct TagJournal *j, const struct ItemStruct *item);
+int  tagjournalFlushLoaded(struct TagJournal *j);
+int  tagjournalInsertItem(struct TagJournal *j, const struct ItemStruct *item);
+
+#endif // TAGJOURNAL_H
@@ -0,0 +1,201 @@
+/*
+ * taglz.c
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "taglz.h"
+
+#define TAGLZ_MIN_MATCH      4
+#define TAGLZ_HASH_BITS      13
+#define TAGLZ_MAX_OFFSET     65535
+#define TAGLZ_LAST_LITERALS  5   // the data always ends with literals
+#define TAGLZ_MATCH_LIMIT    12  // no match starts closer to the end of the data
+
+static uint32_t read32(const unsigned char *p);
+static unsigned int hash4(const unsigned char *p);
+static unsigned char *putLength(unsigned char *op, const unsigned char *opEnd, size_t len);
+static unsigned char *putSequence(unsigned char *op, const unsigned char *opEnd, const unsigned char *lit, size_t litLen, size_t offset, size_t matchLen);
+static int getLength(const unsigned char **pIp, const unsigned char *ipEnd, size_t *len);
+
+size_t taglzCompressBound(size_t len)
+{
+	return len + len / 255 + 16;
+}
+
+size_t taglzCompress(const unsigned char *src, size_t len, unsigned char *dst, size_t cap)
+{
+	// Returns the length of the compressed data or 0 if it does not fit into cap bytes
+	uint32_t table[1 << TAGLZ_HASH_BITS];
+	memset(table, 0, sizeof(table));
+
+	unsigned char *op = dst;
+	unsigned char *opEnd = dst + cap;
+	size_t anchor = 0;
+	size_t ip = 0;
+	if (len > TAGLZ_MATCH_LIMIT)
+	{
+		size_t limit = len - TAGLZ_MATCH_LIMIT;
+		size_t matchEnd = len - TAGLZ_LAST_LITERALS;
+		while (ip < limit)
+		{
+			unsigned int h = hash4(src + ip);
+			size_t cand = table[h];
+			table[h] = ip;
+			if (cand >= ip || ip - cand > TAGLZ_MAX_OFFSET || read32(src + cand) != read32(src + ip))
+			{
+				++ip;
+				continue;
+			}
+
+			size_t matchLen = TAGLZ_MIN_MATCH;
+			while (ip + matchLen < matchEnd && src[cand + matchLen] == src[ip + matchLen])
+				++matchLen;
+			op = putSequence(op, opEnd, src + anchor, ip - anchor, ip - cand, matchLen);
+			if (op == NULL)
+				return 0;
+			ip += matchLen;
+			anchor = ip;
+			if (ip - 2 < limit)
+				table[hash4(src + ip - 2)] = ip - 2;
+		}
+	}
+
+	op = putSequence(op, opEnd, src + anchor, len - anchor, 0, 0);
+	return (op != NULL) ? (size_t)(op - dst) : 0;
+}
+
+int taglzDecompress(const unsigned char *src, size_t len, unsigned char *dst, size_t dstLen)
+{
+	// Succeeds only if the data is decoded to exactly dstLen bytes
+	const unsigned char *ip = src;
+	const unsigned char *ipEnd = src + len;
+	size_t op = 0;
+	while (ip < ipEnd)
+	{
+		unsigned int token = *ip++;
+		size_t litLen = token >> 4;
+		if (litLen == 15 && getLength(&ip, ipEnd, &litLen) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+		if (litLen > (size_t)(ipEnd - ip) || litLen > dstLen - op)
+			return EXIT_FAILURE;
+		memcpy(dst + op, ip, litLen);
+		ip += litLen;
+		op += litLen;
+		if (ip == ipEnd)
+			break;
+
+		if (ipEnd - ip < 2)
+			return EXIT_FAILURE;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		size_t matchLen = token & 15;
+		if (matchLen == 15 && getLength(&ip, ipEnd, &matchLen) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+		matchLen += TAGLZ_MIN_MATCH;
+		if (offset == 0 || offset > op || matchLen > dstLen - op)
+			return EXIT_FAILURE;
+
+		const unsigned char *match = dst + op - offset;
+		if (offset >= matchLen)
+			memcpy(dst + op, match, matchLen);
+		else
+		{
+			// The match overlaps the output, it repeats the last offset bytes
+			size_t i;
+			for (i = 0; i < matchLen; ++i)
+				dst[op + i] = match[i];
+		}
+		op += matchLen;
+	}
+	return (op == dstLen) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**************************** Private ********************************/
+
+static uint32_t read32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static unsigned int hash4(const unsigned char *p)
+{
+	return (read32(p) * 2654435761u) >> (32 - TAGLZ_HASH_BITS);
+}
+
+static unsigned char *putLength(unsigned char *op, const unsigned char *opEnd, size_t len)
+{
+	// The rest of a length that does not fit into the nibble of the token
+	for (; len >= 255; len -= 255)
+	{
+		if (op == opEnd)
+			return NULL;
+		*op++ = 255;
+	}
+	if (op == opEnd)
+		return NULL;
+	*op++ = len;
+	return op;
+}
+
+static unsigned char *putSequence(unsigned char *op, const unsigned char *opEnd, const unsigned char *lit, size_t litLen, size_t offset, size_t matchLen)
+{
+	// A sequence without the match (matchLen == 0) is the last one
+	if (op == opEnd)
+		return NULL;
+	size_t matchCode = (matchLen != 0) ? matchLen - TAGLZ_MIN_MATCH : 0;
+	unsigned char *token = op++;
+	*token = ((litLen < 15) ? litLen : 15) << 4;
+	if (litLen >= 15 && (op = putLength(op, opEnd, litLen - 15)) == NULL)
+		return NULL;
+	if ((size_t)(opEnd - op) < litLen)
+		return NULL;
+	memcpy(op, lit, litLen);
+	op += litLen;
+	if (matchLen == 0)
+		return op;
+
+	if (opEnd - op < 2)
+		return NULL;
+	*op++ = offset & 0xff;
+	*op++ = offset >> 8;
+	*token |= (matchCode < 15) ? matchCode : 15;
+	if (matchCode >= 15 && (op = putLength(op, opEnd, matchCode - 15)) == NULL)
+		return NULL;
+	return op;
+}
+
+static int getLength(const unsigned char **pIp, const unsigned char *ipEnd, size_t *len)
+{
+	const unsigned char *ip = *pIp;
+	unsigned int b;
+	do
+	{
+		if (ip == ipEnd)
+			return EXIT_FAILURE;
+		b = *ip++;
+		*len += b;
+	} while (b == 255);
+	*pIp = ip;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,40 @@
+/*
+ * taglz.h
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef TAGLZ_H
+#define TAGLZ_H
+
+#include <stddef.h>
+
+/*
+ * Byte oriented LZ77 codec of the compressed index blocks.
+ * The compressed data is a sequence of the sequences:
+ *   token: the high nibble is the number of literals, the low nibble is the match length - 4,
+ *          the value 15 of a nibble is continued by bytes added to it while they are 255
+ *   literals
+ *   uint16 offset of the match back from the current position (little-endian)
+ * The last sequence has only literals and ends the data.
+ */
+
+size_t taglzCompressBound(size_t len);
+size_t taglzCompress(const unsigned char *src, size_t len, unsigned char *dst, size_t cap);
+int    taglzDecompress(const unsigned char *src, size_t len, unsigned char *dst, size_t dstLen);
+
+#endif // TAGLZ_H
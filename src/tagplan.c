@@ -0,0 +1,232 @@
+/*
+ * tagplan.c
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdlib.h>
+
+#include "tagplan.h"
+#include "utils.h"
+
+// A candidate read through the inverted index costs about as much as this many items of a scan
+#define PLAN_RANDOM_COST     4.0
+#define PLAN_GUESS_VALUE     0.1
+#define PLAN_GUESS_PRESENCE  0.5
+
+static double stepSelectivity(const struct TagPlanStep *step, const struct TagInv *inv, size_t itemCount, struct TagBinBuffer *key);
+static int  printCondition(struct PropertyStruct *cond, enum TagPlanCondKind kind, FILE *fd);
+static int  printEstimate(const struct TagPlan *plan, double selectivity, FILE *fd);
+
+void tagplanInit(struct TagPlan *plan)
+{
+	plan->whr         = NULL;
+	plan->access      = PlanFullScan;
+	plan->hasStats    = 0;
+	plan->itemCount   = 0;
+	plan->selectivity = 1.0;
+	plan->read        = 0;
+	plan->rows        = 0;
+	plan->stepCount   = 0;
+	plan->steps       = NULL;
+}
+
+int tagplanBuild(struct TagPlan *plan, const struct WhereStruct *whr, const struct TagInv *inv, size_t itemCount)
+{
+	tagplanFree(plan);
+	plan->itemCount = itemCount;
+	int useInv = (inv != NULL && inv->base != NULL);
+	plan->hasStats = (useInv && itemCount != 0);
+	if (whr == NULL || whr->condCount == 0)
+		return EXIT_SUCCESS;
+
+	plan->whr   = whr;
+	plan->steps = malloc(whr->condCount * sizeof(struct TagPlanStep));
+	if (plan->steps == NULL)
+		return EXIT_FAILURE;
+
+	struct TagBinBuffer key = { 0, 0, NULL };
+	unsigned int i;
+	for (i = 0; i < whr->condCount; ++i)
+	{
+		struct TagPlanStep step;
+		step.cond    = whr->conditions[i];
+		step.index   = i;
+		step.checked = 0;
+		step.passed  = 0;
+		if (step.cond->userData)
+			step.kind = PlanCondPresent;
+		else if (propIsEmpty(step.cond))
+			step.kind = PlanCondAbsent;
+		else
+			step.kind = PlanCondValues;
+		step.selectivity = stepSelectivity(&step, plan->hasStats ? inv : NULL, itemCount, &key);
+		if (step.selectivity < 0.0)
+		{
+			tagbinBufferFree(&key);
+			tagplanFree(plan);
+			return EXIT_FAILURE;
+		}
+
+		// Insertion keeps the order of the command line for the equal estimates
+		unsigned int pos = plan->stepCount;
+		while (pos != 0 && plan->steps[pos - 1].selectivity > step.selectivity)
+		{
+			plan->steps[pos] = plan->steps[pos - 1];
+			--pos;
+		}
+		plan->steps[pos] = step;
+		++plan->stepCount;
+		plan->selectivity *= step.selectivity;
+	}
+	tagbinBufferFree(&key);
+
+	// The inverted index pays off when the candidates are few enough to be read one by one
+	if (useInv)
+	{
+		double candidates = 1.0;
+		int indexed = 0;
+		for (i = 0; i < plan->stepCount; ++i)
+		{
+			if (plan->steps[i].kind == PlanCondValues)
+			{
+				candidates *= plan->steps[i].selectivity;
+				indexed = 1;
+			}
+		}
+		if (indexed && (!plan->hasStats || candidates * PLAN_RANDOM_COST < 1.0))
+			plan->access = PlanInvertedIndex;
+	}
+	return EXIT_SUCCESS;
+}
+
+int tagplanIsFiltered(struct TagPlan *plan, struct ItemStruct *item)
+{
+	if (plan->stepCount == 0)
+		return 0;
+	struct PropertyStruct *bound[plan->stepCount];
+	whereBind(plan->whr, item, bound);
+	unsigned int i;
+	for (i = 0; i < plan->stepCount; ++i)
+	{
+		struct TagPlanStep *step = &plan->steps[i];
+		++step->checked;
+		if (whereIsCondFiltered(plan->whr, step->index, bound[step->index]))
+			return 1;
+		++step->passed;
+	}
+	return 0;
+}
+
+int tagplanPrint(const struct TagPlan *plan, const wchar_t *dirPath, FILE *fd)
+{
+	if (fputs("index: ", fd) == EOF || utf8Fputs(dirPath, fd) == EOF || fputs("tags.info\n", fd) == EOF)
+		return EXIT_FAILURE;
+	if (fprintf(fd, "access: %s\n", (plan->access == PlanInvertedIndex) ? "inverted index" : "full scan") < 0)
+		return EXIT_FAILURE;
+	if (plan->itemCount != 0 && fprintf(fd, "items: %zu\n", plan->itemCount) < 0)
+		return EXIT_FAILURE;
+	if (fprintf(fd, "statistics: %s\n", plan->hasStats ? "inverted index" : "none") < 0)
+		return EXIT_FAILURE;
+	unsigned int i;
+	for (i = 0; i < plan->stepCount; ++i)
+	{
+		const struct TagPlanStep *step = &plan->steps[i];
+		if (fprintf(fd, "condition %u: ", i + 1) < 0 || printCondition(step->cond, step->kind, fd) != EXIT_SUCCESS ||
+			fputs("\testimated ", fd) == EOF || printEstimate(plan, step->selectivity, fd) != EXIT_SUCCESS ||
+			fprintf(fd, "\tchecked %zu\tpassed %zu\n", step->checked, step->passed) < 0)
+			return EXIT_FAILURE;
+	}
+	if (fputs("rows: estimated ", fd) == EOF || printEstimate(plan, plan->selectivity, fd) != EXIT_SUCCESS ||
+		fprintf(fd, "\tactual %zu\tread %zu\n", plan->rows, plan->read) < 0)
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+void tagplanFree(struct TagPlan *plan)
+{
+	free(plan->steps);
+	tagplanInit(plan);
+}
+
+/**************************** Private ********************************/
+
+static double stepSelectivity(const struct TagPlanStep *step, const struct TagInv *inv, size_t itemCount, struct TagBinBuffer *key)
+{
+	// Returns a negative value on an error
+	struct PropertyStruct *cond = step->cond;
+	double res;
+	if (step->kind == PlanCondValues)
+	{
+		if (inv == NULL)
+			res = PLAN_GUESS_VALUE * cond->valCount;
+		else
+		{
+			size_t cnt = 0;
+			unsigned int i;
+			for (i = 0; i < cond->valCount; ++i)
+			{
+				if (taginvMakeKey(key, propGetName(cond), propGetSubval(cond, i, None)) != EXIT_SUCCESS)
+					return -1.0;
+				cnt += taginvCount(inv, (const char *)key->data, key->length);
+			}
+			res = (double)cnt / itemCount;
+		}
+	}
+	else
+	{
+		if (inv == NULL)
+			res = PLAN_GUESS_PRESENCE;
+		else
+		{
+			if (taginvMakeKey(key, propGetName(cond), L"") != EXIT_SUCCESS)
+				return -1.0;
+			res = (double)taginvCountPrefix(inv, (const char *)key->data, key->length) / itemCount;
+		}
+		if (res > 1.0)
+			res = 1.0;
+		if (step->kind == PlanCondAbsent)
+			res = 1.0 - res;
+	}
+	return (res > 1.0) ? 1.0 : res;
+}
+
+static int printCondition(struct PropertyStruct *prop, enum TagPlanCondKind kind, FILE *fd)
+{
+	if (utf8Fputs(propGetName(prop), fd) == EOF)
+		return EXIT_FAILURE;
+	if (kind == PlanCondPresent)
+		return EXIT_SUCCESS;
+	if (fputc('=', fd) == EOF)
+		return EXIT_FAILURE;
+	unsigned int i;
+	for (i = 0; kind == PlanCondValues && i < prop->valCount; ++i)
+		if ((i != 0 && fputc(',', fd) == EOF) || utf8Fputs(propGetSubval(prop, i, None), fd) == EOF)
+			return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+static int printEstimate(const struct TagPlan *plan, double selectivity, FILE *fd)
+{
+	// Without the number of the items only the share of them is known
+	int res;
+	if (plan->itemCount != 0)
+		res = fprintf(fd, "%.0f", selectivity * plan->itemCount);
+	else
+		res = fprintf(fd, "%.0f%%", selectivity * 100.0);
+	return (res < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
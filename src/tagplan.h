@@ -0,0 +1,79 @@
+/*
+ * tagplan.h
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef TAGPLAN_H
+#define TAGPLAN_H
+
+#include <stdio.h>
+#include <wchar.h>
+
+#include "where.h"
+#include "taginv.h"
+
+/*
+ * Plan of a search by the where conditions. The conditions are checked in the order of their
+ * selectivity, the most selective first, so an item is rejected as early as possible.
+ * The statistics come from the inverted index, without it the selectivity is guessed
+ * from the kind of a condition.
+ */
+
+enum TagPlanAccess
+{
+	PlanFullScan,
+	PlanInvertedIndex
+};
+
+enum TagPlanCondKind
+{
+	PlanCondValues,
+	PlanCondPresent,
+	PlanCondAbsent
+};
+
+struct TagPlanStep
+{
+	struct PropertyStruct *cond;
+	unsigned int  index;
+	enum TagPlanCondKind kind;
+	double        selectivity;
+	size_t        checked;
+	size_t        passed;
+};
+
+struct TagPlan
+{
+	const struct WhereStruct *whr;
+	enum TagPlanAccess access;
+	int           hasStats;
+	size_t        itemCount;
+	double        selectivity;
+	size_t        read;
+	size_t        rows;
+	unsigned int  stepCount;
+	struct TagPlanStep *steps;
+};
+
+void tagplanInit(struct TagPlan *plan);
+int  tagplanBuild(struct TagPlan *plan, const struct WhereStruct *whr, const struct TagInv *inv, size_t itemCount);
+int  tagplanIsFiltered(struct TagPlan *plan, struct ItemStruct *item);
+int  tagplanPrint(const struct TagPlan *plan, const wchar_t *dirPath, FILE *fd);
+void tagplanFree(struct TagPlan *plan);
+
+#endif // TAGPLAN_H
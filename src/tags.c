@@ -26,13 +26,104 @@
 #include "tags.h"
 #include "tagfile.h"
 #include "file.h"
+#include "hashcache.h"
+#include "digest.h"
 #include "fields.h"
 #include "where.h"
+#include "utils.h"
 
-int tagsCreateIndex(void)
+int tagsCreateIndex(const char *format, const char *hash)
 {
+	enum TagFileFormat fmt = FormatSimple;
+	enum HashAlg alg = HashAlgSha1;
+	if (format != NULL)
+	{
+		if (strcmp(format, "binary") == 0)
+			fmt = FormatBinary;
+		else if (strcmp(format, "compressed") == 0)
+			fmt = FormatCompressed;
+		else if (strcmp(format, "simple") != 0)
+		{
+			fprintf(stderr, "Error: unknown index format %s\n", format);
+			return EXIT_FAILURE;
+		}
+	}
+	if (hash != NULL && hashalgFind(hash, strlen(hash), &alg) != EXIT_SUCCESS)
+	{
+		fprintf(stderr, "Error: unknown hash %s\n", hash);
+		return EXIT_FAILURE;
+	}
 	fprintf(stdout, "Initialization...\n");
-	int res = tagfileCreateIndex();
+	int res = tagfileCreateIndex(fmt, alg);
+	return res;
+}
+
+int tagsBuildOffsetIndex(void)
+{
+	int res = EXIT_FAILURE;
+	struct TagFileStruct *tf = tagfileInit(NULL, NULL, ReadOnly);
+	if (tf != NULL)
+	{
+		if (tf->lastError == ErrorNone && tagfileBuildSidecar(tf) == ErrorNone)
+		{
+			fputs("Offset index is built\n", stdout);
+			res = EXIT_SUCCESS;
+		}
+		tagfileFree(tf);
+	}
+	return res;
+}
+
+int tagsBuildInvertedIndex(void)
+{
+	int res = EXIT_FAILURE;
+	struct TagFileStruct *tf = tagfileInit(NULL, NULL, ReadOnly);
+	if (tf != NULL)
+	{
+		if (tf->lastError == ErrorNone && tagfileBuildInverted(tf) == ErrorNone)
+		{
+			fputs("Inverted index is built\n", stdout);
+			res = EXIT_SUCCESS;
+		}
+		tagfileFree(tf);
+	}
+	return res;
+}
+
+int tagsEnableJournal(void)
+{
+	int res = EXIT_FAILURE;
+	struct TagFileStruct *tf = tagfileInit(NULL, NULL, ReadOnly);
+	if (tf != NULL)
+	{
+		if (tf->lastError == ErrorNone && tagfileEnableJournal(tf) == ErrorNone)
+		{
+			fputs("Journal is enabled\n", stdout);
+			res = EXIT_SUCCESS;
+		}
+		tagfileFree(tf);
+	}
+	return res;
+}
+
+int tagsCompactJournal(void)
+{
+	int res = EXIT_FAILURE;
+	struct TagFileStruct *tf = tagfileInit(NULL, NULL, ReadWrite);
+	if (tf != NULL)
+	{
+		if (tf->lastError == ErrorNone)
+		{
+			if (!tf->journaling)
+				fputs("Error: the journal is not enabled\n", stderr);
+			else if (tagfileCompactJournal(tf) == ErrorNone)
+			{
+				fputs("Journal is compacted\n", stdout);
+				res = EXIT_SUCCESS;
+			}
+		}
+		tagfileFree(tf);
+	}
 	return res;
 }
 
@@ -104,9 +195,11 @@ int tagsStatus(char **filesArray, unsigned int filesCount)
 			{
 				const struct FileItem *fi = pFi[i];
 				if (fi->userData != 0)
-					fprintf(stdout, "[%2i] %S\n", fi->userData - 1, fi->path);
+					fprintf(stdout, "[%2i] ", fi->userData - 1);
 				else
-					fprintf(stdout, "[--] %S\n", fi->path);
+					fputs("[--] ", stdout);
+				utf8Fputs(fi->path, stdout);
+				fputc('\n', stdout);
 			}
 		}
 
@@ -168,7 +261,7 @@ int tagsList(const wchar_t *fieldsStr, const wchar_t *whrPropStr)
 
 int tagsShowProps(void)
 {
-	struct ItemStruct *item = itemInit(0, L"");
+	struct ItemStruct *item = itemInit(0, NULL);
 	if (item == NULL)
 	{
 		fputs("Error: itemInit failed\n", stderr);
@@ -191,7 +284,8 @@ int tagsShowProps(void)
 		{
 			struct PropertyStruct *prop = *itemGetPropArrayAddrByNum(item, i);
 			const wchar_t *propName = propGetName(prop);
-			fprintf(stdout, "%S\t%i\n", propName, prop->userData + 1);
+			utf8Fputs(propName, stdout);
+			fprintf(stdout, "\t%i\n", prop->userData + 1);
 			unsigned int subCount = prop->valCount;
 			struct SubvalHandle **ps = propGetValueIndex(prop, ByUser);
 			unsigned int k;
@@ -200,7 +294,13 @@ int tagsShowProps(void)
 				const struct SubvalHandle *subval = ps[k];
 				const wchar_t *str = subvalString(subval);
 				if (*str != L'\0')
-					fprintf(stdout, "  %S=%S\t%i\n", propName, subvalString(subval), subval->userData + 1);
+				{
+					fputs("  ", stdout);
+					utf8Fputs(propName, stdout);
+					fputc('=', stdout);
+					utf8Fputs(str, stdout);
+					fprintf(stdout, "\t%i\n", subval->userData + 1);
+				}
 			}
 		}
 	}
@@ -350,7 +450,16 @@ int tagsUpdateFileInfo(char **filesArray, int filesCount, wchar_t *addPropStr, w
 						addCnt = 0;
 					else
 					{
-						if ((res = fileitemsCalculateHashes(fil)) == EXIT_SUCCESS)
+						struct HashCache *cache = tagfileOpenHashCache(tf, hashCacheCreate);
+						res = fileitemsCalculateHashes(fil, tf->hashAlg, hashJobs, cache);
+						if (cache != NULL)
+						{
+							// The cache is kept even if the hashing failed, the next run skips the hashed files
+							if (hashcacheSave(cache) != EXIT_SUCCESS)
+								fputs("Error: the hash cache is not saved\n", stderr);
+							hashcacheFree(cache);
+						}
+						if (res == EXIT_SUCCESS)
 						{
 							res = EXIT_FAILURE;
 							fileitemsSort(fil, SortBySizeHash);
@@ -367,7 +476,7 @@ int tagsUpdateFileInfo(char **filesArray, int filesCount, wchar_t *addPropStr, w
 										fi = pFi[i];
 
 									if (i != 0 &&
-										(i == addCnt || fi->size != item->fileSize || wcscmp(fi->hash, item->hash) != 0))
+										(i == addCnt || fi->size != item->fileSize || !digestIsEqual(fi->hash, item->hash)))
 									{
 										if (tagfileInsertItem(tf, item) != ErrorNone)
 										{
@@ -504,7 +613,7 @@ int moveFile(char **filesArray)
 	}
 	wchar_t oldNameW[PATH_MAX];
 	wchar_t newNameW[PATH_MAX];
-	if (mbstowcs(oldNameW, oldName, PATH_MAX) == (size_t) -1 || mbstowcs(newNameW, newName, PATH_MAX) == (size_t) -1)
+	if (utf8ToWcs(oldNameW, oldName, PATH_MAX) >= PATH_MAX || utf8ToWcs(newNameW, newName, PATH_MAX) >= PATH_MAX)
 	{
 		fputs("Error: filename is wrong\n", stderr);
 		return EXIT_FAILURE;
@@ -537,6 +646,14 @@ int moveFile(char **filesArray)
 				tagfileFree(tfDst);
 			return EXIT_FAILURE;
 		}
+		// An item is found by its hash, so both indexes must use the same one
+		if (tfDst->hashAlg != tfSrc->hashAlg)
+		{
+			fprintf(stderr, "Error: the index files use different hashes: %s and %s\n", hashalgName(tfSrc->hashAlg), hashalgName(tfDst->hashAlg));
+			tagfileFree(tfSrc);
+			tagfileFree(tfDst);
+			return EXIT_FAILURE;
+		}
 	}
 
 	enum ErrorId res = ErrorNone;
@@ -568,7 +685,11 @@ int moveFile(char **filesArray)
 								if (itemDst->fileNameCount != 0)
 									fprintf(stderr, " File: %S\n", itemGetFileName(itemDst, 0));
 								else
-									fprintf(stderr, " File size: %zu, file hash: %S\n", itemDst->fileSize, itemDst->hash);
+								{
+									char hex[FILE_HASH_LEN + 1];
+									digestToHex(itemDst->hash, hashalgSize(tfDst->hashAlg), hex);
+									fprintf(stderr, " File size: %zu, file hash: %s\n", itemDst->fileSize, hex);
+								}
 								itemFree(itemDst);
 								itemDst = NULL;
 								res = ErrorOther;
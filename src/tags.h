@@ -23,7 +23,11 @@
 
 #include <wchar.h>
 
-int tagsCreateIndex(void);
+int tagsCreateIndex(const char *format, const char *hash);
+int tagsBuildOffsetIndex(void);
+int tagsBuildInvertedIndex(void);
+int tagsEnableJournal(void);
+int tagsCompactJournal(void);
 int tagsStatus(char **filesArray, unsigned int filesCount);
 int tagsList(const wchar_t *fieldsStr, const wchar_t *whrPropStr);
 int tagsShowProps(void);
@@ -0,0 +1,250 @@
+/*
+ * uring.c
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define URING_AVAILABLE
+#endif
+#endif
+
+#define URING_BUSY_RETRIES  100  // of a busy kernel with nothing to complete
+
+int _uringFailCount = 0;  // the tests make this many submits fail with _uringFailErrno
+int _uringFailErrno = 0;
+
+#ifdef URING_AVAILABLE
+
+int uringInit(struct Uring *ring, unsigned int entries)
+{
+	// The rings are mapped from the descriptor, the kernel rounds entries up to a power of two
+	memset(ring, 0, sizeof(struct Uring));
+	ring->fd = -1;
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (fd == -1)
+		return EXIT_FAILURE;
+	ring->fd = fd;
+	if ((params.features & IORING_FEAT_RW_CUR_POS) == 0)
+	{
+		// Older kernels do not know IORING_OP_READ
+		uringFree(ring);
+		errno = ENOSYS;
+		return EXIT_FAILURE;
+	}
+	ring->entries    = params.sq_entries;
+	ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (ring->cqRingSize > ring->sqRingSize)
+			ring->sqRingSize = ring->cqRingSize;
+		ring->cqRingSize = ring->sqRingSize;
+	}
+	ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ring->sqRing == MAP_FAILED)
+	{
+		ring->sqRing = NULL;
+		uringFree(ring);
+		return EXIT_FAILURE;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		ring->cqRing = ring->sqRing;
+	else
+	{
+		ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (ring->cqRing == MAP_FAILED)
+		{
+			ring->cqRing = NULL;
+			uringFree(ring);
+			return EXIT_FAILURE;
+		}
+	}
+	ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+	{
+		ring->sqes = NULL;
+		uringFree(ring);
+		return EXIT_FAILURE;
+	}
+
+	unsigned char *sq = ring->sqRing;
+	ring->sqHead  = (unsigned int *)(sq + params.sq_off.head);
+	ring->sqTail  = (unsigned int *)(sq + params.sq_off.tail);
+	ring->sqMask  = (unsigned int *)(sq + params.sq_off.ring_mask);
+	ring->sqArray = (unsigned int *)(sq + params.sq_off.array);
+	unsigned char *cq = ring->cqRing;
+	ring->cqHead  = (unsigned int *)(cq + params.cq_off.head);
+	ring->cqTail  = (unsigned int *)(cq + params.cq_off.tail);
+	ring->cqMask  = (unsigned int *)(cq + params.cq_off.ring_mask);
+	ring->cqes    = cq + params.cq_off.cqes;
+	return EXIT_SUCCESS;
+}
+
+void uringFree(struct Uring *ring)
+{
+	if (ring->sqes != NULL)
+		munmap(ring->sqes, ring->sqesSize);
+	if (ring->cqRing != NULL && ring->cqRing != ring->sqRing)
+		munmap(ring->cqRing, ring->cqRingSize);
+	if (ring->sqRing != NULL)
+		munmap(ring->sqRing, ring->sqRingSize);
+	if (ring->fd != -1)
+		close(ring->fd);
+	memset(ring, 0, sizeof(struct Uring));
+	ring->fd = -1;
+}
+
+int uringPrepRead(struct Uring *ring, int fd, void *buf, unsigned int len, uint64_t offset, uint64_t userData)
+{
+	// Only this thread writes the tail, the kernel moves the head as it takes the entries
+	unsigned int tail = *ring->sqTail;
+	if (tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) >= ring->entries)
+		return EXIT_FAILURE;
+	unsigned int idx = tail & *ring->sqMask;
+	struct io_uring_sqe *sqe = (struct io_uring_sqe *)ring->sqes + idx;
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode    = IORING_OP_READ;
+	sqe->fd        = fd;
+	sqe->addr      = (uintptr_t)buf;
+	sqe->len       = len;
+	sqe->off       = offset;
+	sqe->user_data = userData;
+	ring->sqArray[idx] = idx;
+	__atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+	++ring->pending;
+	return EXIT_SUCCESS;
+}
+
+int uringSubmit(struct Uring *ring, unsigned int waitCount)
+{
+	// Sends the prepared entries and waits for waitCount completions
+	unsigned int busy = 0;
+	while (1)
+	{
+		int res;
+		if (_uringFailCount > 0 && __atomic_fetch_sub(&_uringFailCount, 1, __ATOMIC_RELAXED) > 0)
+		{
+			errno = _uringFailErrno;
+			res = -1;
+		}
+		else
+			res = syscall(__NR_io_uring_enter, ring->fd, ring->pending, waitCount,
+				(waitCount != 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if (res >= 0)
+		{
+			ring->pending  -= res;
+			ring->inKernel += res;
+			return EXIT_SUCCESS;
+		}
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN && errno != EBUSY)
+			return EXIT_FAILURE;
+
+		// The kernel is short of resources until completions are taken
+		if (*ring->cqHead != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+			return EXIT_SUCCESS;
+		if (ring->inKernel != 0)
+			return uringWait(ring);
+		if (++busy == URING_BUSY_RETRIES)
+			return EXIT_FAILURE;
+		sched_yield();
+	}
+}
+
+int uringWait(struct Uring *ring)
+{
+	// Waits for a completion without sending the prepared entries
+	while (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0)
+		if (errno != EINTR)
+			return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+int uringNextCompletion(struct Uring *ring, uint64_t *userData, int *res)
+{
+	// Returns 0 if no completion is ready
+	unsigned int head = *ring->cqHead;
+	if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+		return 0;
+	const struct io_uring_cqe *cqe = (const struct io_uring_cqe *)ring->cqes + (head & *ring->cqMask);
+	*userData = cqe->user_data;
+	*res      = cqe->res;
+	__atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+	--ring->inKernel;
+	return 1;
+}
+
+#else
+
+int uringInit(struct Uring *ring, unsigned int entries)
+{
+	(void)entries;
+	memset(ring, 0, sizeof(struct Uring));
+	ring->fd = -1;
+	errno = ENOSYS;
+	return EXIT_FAILURE;
+}
+
+void uringFree(struct Uring *ring)
+{
+	(void)ring;
+}
+
+int uringPrepRead(struct Uring *ring, int fd, void *buf, unsigned int len, uint64_t offset, uint64_t userData)
+{
+	(void)ring; (void)fd; (void)buf; (void)len; (void)offset; (void)userData;
+	return EXIT_FAILURE;
+}
+
+int uringSubmit(struct Uring *ring, unsigned int waitCount)
+{
+	(void)ring; (void)waitCount;
+	errno = ENOSYS;
+	return EXIT_FAILURE;
+}
+
+int uringWait(struct Uring *ring)
+{
+	(void)ring;
+	errno = ENOSYS;
+	return EXIT_FAILURE;
+}
+
+int uringNextCompletion(struct Uring *ring, uint64_t *userData, int *res)
+{
+	(void)ring; (void)userData; (void)res;
+	return 0;
+}
+
+#endif // URING_AVAILABLE
@@ -0,0 +1,65 @@
+/*
+ * uring.h
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A minimal io_uring over the raw system calls: the reads are queued into the submission
+ * ring, sent to the kernel by one call and their results are taken from the completion ring.
+ * uringInit fails with ENOSYS when the kernel or the build has no io_uring, or it lacks
+ * the plain read operation; the callers read the files themselves then.
+ * uringSubmit returns without sending while the kernel is busy (EAGAIN, EBUSY) and a completion
+ * is ready, the caller takes the completions and submits again.
+ */
+
+struct Uring
+{
+	int          fd;
+	unsigned int entries;
+	unsigned int pending;   // the prepared entries not sent to the kernel yet
+	unsigned int inKernel;  // the sent entries whose completions are not taken yet
+	unsigned int *sqHead;
+	unsigned int *sqTail;
+	unsigned int *sqMask;
+	unsigned int *sqArray;
+	void         *sqes;
+	unsigned int *cqHead;
+	unsigned int *cqTail;
+	unsigned int *cqMask;
+	void         *cqes;
+	void         *sqRing;
+	size_t       sqRingSize;
+	void         *cqRing;   // the same mapping as sqRing if the kernel has a single one
+	size_t       cqRingSize;
+	size_t       sqesSize;
+};
+
+int  uringInit(struct Uring *ring, unsigned int entries);
+void uringFree(struct Uring *ring);
+int  uringPrepRead(struct Uring *ring, int fd, void *buf, unsigned int len, uint64_t offset, uint64_t userData);
+int  uringSubmit(struct Uring *ring, unsigned int waitCount);
+int  uringWait(struct Uring *ring);
+int  uringNextCompletion(struct Uring *ring, uint64_t *userData, int *res);
+
+#endif // URING_H
@@ -20,10 +20,16 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <wctype.h>
 
 #include "utils.h"
 
+#define UTF8_INVALID  ((unsigned int) -1)
+
 void reversew(wchar_t *s);
+unsigned int utf8DecodeChar(const unsigned char **pp, const unsigned char *end);
+unsigned int utf8CharLength(wchar_t wc);
+unsigned char *utf8EncodeChar(wchar_t wc, unsigned char *out);
 
 void uitow(unsigned long int n, wchar_t *s)
 {
@@ -52,25 +58,199 @@ wchar_t *makeWideCharString(const char *s, size_t len)
 {
 	if (len == 0)
 		len = strlen(s);
-	size_t sz = len * sizeof(char);
-	int n;
-	wchar_t wc;
-	const char *ptr = s;
-	size_t lenW = 0;
-	while ((n = mbtowc(&wc, ptr, sz)) != 0)
-	{
-		if (n < 0)
-			return NULL;
-		sz -= n;
-		ptr += n / sizeof(char);
-		++lenW;
+	wchar_t *res = malloc((len + 1) * sizeof(wchar_t));
+	if (res != NULL && utf8Decode(s, len, res) == (size_t) -1)
+	{
+		free(res);
+		res = NULL;
 	}
+	return res;
+}
 
-	wchar_t *res = malloc((lenW + 1) * sizeof(wchar_t));
-	if (res != NULL)
+size_t utf8Decode(const char *s, size_t len, wchar_t *buf)
+{
+	const unsigned char *p   = (const unsigned char *)s;
+	const unsigned char *end = p + len;
+	wchar_t *out = buf;
+	while (p != end)
 	{
-		mbstowcs(res, s, lenW);
-		res[lenW] = L'\0';
+		unsigned int ch = utf8DecodeChar(&p, end);
+		if (ch == UTF8_INVALID)
+			return (size_t) -1;
+		*out++ = (wchar_t)ch;
 	}
-	return res;
+	*out = L'\0';
+	return out - buf;
+}
+
+size_t utf8EncodedLength(const wchar_t *s)
+{
+	size_t len = 0;
+	for ( ; *s != L'\0'; ++s)
+		len += utf8CharLength(*s);
+	return len;
+}
+
+size_t utf8Encode(const wchar_t *s, char *buf)
+{
+	unsigned char *out = (unsigned char *)buf;
+	for ( ; *s != L'\0'; ++s)
+		out = utf8EncodeChar(*s, out);
+	*out = '\0';
+	return out - (unsigned char *)buf;
+}
+
+size_t utf8ToWcs(wchar_t *dest, const char *src, size_t n)
+{
+	const unsigned char *p   = (const unsigned char *)src;
+	const unsigned char *end = p + strlen(src);
+	size_t cnt = 0;
+	while (p != end)
+	{
+		if (cnt == n)
+			return n;
+		unsigned int ch = utf8DecodeChar(&p, end);
+		if (ch == UTF8_INVALID)
+			return (size_t) -1;
+		dest[cnt++] = (wchar_t)ch;
+	}
+	if (cnt == n)
+		return n;
+	dest[cnt] = L'\0';
+	return cnt;
+}
+
+size_t wcsToUtf8(char *dest, const wchar_t *src, size_t n)
+{
+	size_t cnt = 0;
+	for ( ; *src != L'\0'; ++src)
+	{
+		unsigned int len = utf8CharLength(*src);
+		if (cnt + len >= n)
+			return n;
+		utf8EncodeChar(*src, (unsigned char *)dest + cnt);
+		cnt += len;
+	}
+	dest[cnt] = '\0';
+	return cnt;
+}
+
+int utf8Fputs(const wchar_t *s, FILE *fd)
+{
+	unsigned char buf[256];
+	unsigned char *out = buf;
+	for ( ; *s != L'\0'; ++s)
+	{
+		if (out - buf > (int)sizeof(buf) - 4)
+		{
+			if (fwrite(buf, 1, out - buf, fd) != (size_t)(out - buf))
+				return EOF;
+			out = buf;
+		}
+		out = utf8EncodeChar(*s, out);
+	}
+	if (out != buf && fwrite(buf, 1, out - buf, fd) != (size_t)(out - buf))
+		return EOF;
+	return 0;
+}
+
+uint32_t wcsFoldHash(const wchar_t *s)
+{
+	// FNV-1a of the lower case characters, the strings equal by wcscasecmp have equal hashes
+	uint32_t hash = 2166136261u;
+	for ( ; *s != L'\0'; ++s)
+	{
+		hash ^= (uint32_t)towlower(*s);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+uint32_t wcsnFoldHash(const wchar_t *s, size_t len)
+{
+	// The same hash as wcsFoldHash for the first len characters
+	uint32_t hash = 2166136261u;
+	for ( ; len != 0; --len, ++s)
+	{
+		hash ^= (uint32_t)towlower(*s);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// ************* Private ***************
+
+unsigned int utf8DecodeChar(const unsigned char **pp, const unsigned char *end)
+{
+	const unsigned char *p = *pp;
+	unsigned int ch = *p++;
+	unsigned int extra;
+	if (ch < 0x80)
+		extra = 0;
+	else if ((ch & 0xe0) == 0xc0)
+	{
+		ch &= 0x1f;
+		extra = 1;
+	}
+	else if ((ch & 0xf0) == 0xe0)
+	{
+		ch &= 0x0f;
+		extra = 2;
+	}
+	else if ((ch & 0xf8) == 0xf0)
+	{
+		ch &= 0x07;
+		extra = 3;
+	}
+	else
+		return UTF8_INVALID;
+	if ((size_t)(end - p) < extra)
+		return UTF8_INVALID;
+	for ( ; extra != 0; --extra)
+	{
+		unsigned int c = *p++;
+		if ((c & 0xc0) != 0x80)
+			return UTF8_INVALID;
+		ch = (ch << 6) | (c & 0x3f);
+	}
+	*pp = p;
+	return ch;
+}
+
+unsigned int utf8CharLength(wchar_t wc)
+{
+	unsigned int ch = wc;
+	if (ch < 0x80)
+		return 1;
+	if (ch < 0x800)
+		return 2;
+	if (ch < 0x10000)
+		return 3;
+	return 4;
+}
+
+unsigned char *utf8EncodeChar(wchar_t wc, unsigned char *out)
+{
+	unsigned int ch = wc;
+	if (ch < 0x80)
+		*out++ = ch;
+	else if (ch < 0x800)
+	{
+		*out++ = 0xc0 | (ch >> 6);
+		*out++ = 0x80 | (ch & 0x3f);
+	}
+	else if (ch < 0x10000)
+	{
+		*out++ = 0xe0 | (ch >> 12);
+		*out++ = 0x80 | ((ch >> 6) & 0x3f);
+		*out++ = 0x80 | (ch & 0x3f);
+	}
+	else
+	{
+		*out++ = 0xf0 | (ch >> 18);
+		*out++ = 0x80 | ((ch >> 12) & 0x3f);
+		*out++ = 0x80 | ((ch >> 6) & 0x3f);
+		*out++ = 0x80 | (ch & 0x3f);
+	}
+	return out;
 }
@@ -21,9 +21,19 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <stdio.h>
 #include <wchar.h>
+#include <stdint.h>
 
 void uitow(unsigned long int n, wchar_t *s);
 wchar_t *makeWideCharString(const char *s, size_t len);
+size_t utf8Decode(const char *s, size_t len, wchar_t *buf);
+size_t utf8EncodedLength(const wchar_t *s);
+size_t utf8Encode(const wchar_t *s, char *buf);
+size_t utf8ToWcs(wchar_t *dest, const char *src, size_t n);
+size_t wcsToUtf8(char *dest, const wchar_t *src, size_t n);
+int utf8Fputs(const wchar_t *s, FILE *fd);
+uint32_t wcsFoldHash(const wchar_t *s);
+uint32_t wcsnFoldHash(const wchar_t *s, size_t len);
 
 #endif // UTIL_H
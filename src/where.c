@@ -22,6 +22,7 @@
 #include <string.h>
 
 #include "where.h"
+#include "utils.h"
 
 #define CONDITION_INCREASE   10
 #define CONDITIONS_SEPARATOR L'@'
@@ -29,6 +30,8 @@
 int whereSetConditionsRaw(struct WhereStruct *whr, const wchar_t *whereStr);
 int whereSetConditions(struct WhereStruct *whr, const wchar_t *name, const wchar_t *value, unsigned int data);
 int whereInsertConditions(struct WhereStruct *whr, struct PropertyStruct *prop);
+int whereCompile(struct WhereStruct *whr);
+int whereSetContains(const struct WhereInstr *instr, const wchar_t *value);
 
 struct WhereStruct *whereInit(const wchar_t *whereStr)
 {
@@ -36,7 +39,7 @@ struct WhereStruct *whereInit(const wchar_t *whereStr)
 	if (whr != NULL)
 	{
 		bzero(whr, sizeof(struct WhereStruct));
-		if (whereSetConditionsRaw(whr, whereStr) != EXIT_SUCCESS)
+		if (whereSetConditionsRaw(whr, whereStr) != EXIT_SUCCESS || whereCompile(whr) != EXIT_SUCCESS)
 		{
 			whereFree(whr);
 			whr = NULL;
@@ -47,6 +50,13 @@ struct WhereStruct *whereInit(const wchar_t *whereStr)
 
 void whereFree(struct WhereStruct *whr)
 {
+	if (whr->program != NULL)
+	{
+		unsigned int i;
+		for (i = 0; i < whr->condCount; ++i)
+			free(whr->program[i].values);
+		free(whr->program);
+	}
 	struct PropertyStruct **pCond = whr->conditions;
 	if (pCond != NULL)
 	{
@@ -60,40 +70,82 @@ void whereFree(struct WhereStruct *whr)
 
 int whereIsFiltered(const struct WhereStruct *whr, struct ItemStruct *item)
 {
-	unsigned int whrIdx = 0;
 	unsigned int whrCnt = whr->condCount;
+	struct PropertyStruct *bound[whrCnt];
+	whereBind(whr, item, bound);
+	unsigned int whrIdx = 0;
 	for ( ; whrIdx < whrCnt; ++whrIdx)
 	{
-		struct PropertyStruct *cond = whr->conditions[whrIdx];
-		struct PropertyStruct **pItemProp = itemGetPropertyPosByName(item, propGetName(cond));
-		if (pItemProp == NULL)
+		if (whereIsCondFiltered(whr, whrIdx, bound[whrIdx]))
+			return 1;
+	}
+	return 0;
+}
+
+void whereBind(const struct WhereStruct *whr, const struct ItemStruct *item, struct PropertyStruct **bound)
+{
+	// Finds the property of the item for every condition, the first one wins as by name lookup
+	unsigned int whrCnt = whr->condCount;
+	unsigned int i;
+	if (item->propsIndex != NULL)
+	{
+		for (i = 0; i < whrCnt; ++i)
 		{
-			if (!propIsEmpty(cond) || cond->userData)
-				return 1;
+			const struct WhereInstr *instr = &whr->program[i];
+			struct PropertyStruct **pp = itemGetPropertyPosByHash(item, instr->name, instr->nameHash);
+			bound[i] = (pp != NULL) ? *pp : NULL;
 		}
-		else
+		return;
+	}
+	for (i = 0; i < whrCnt; ++i)
+		bound[i] = NULL;
+	unsigned int cnt = item->propsCount;
+	struct PropertyStruct **ptr = item->props;
+	for ( ; cnt != 0; ++ptr)
+	{
+		struct PropertyStruct *prop = *ptr;
+		if (prop == NULL)
+			continue;
+		--cnt;
+		const wchar_t *name = propGetName(prop);
+		uint32_t hash = wcsFoldHash(name);
+		for (i = 0; i < whrCnt; ++i)
 		{
-			struct PropertyStruct *itemProp = *pItemProp;
-			if (propIsEmpty(cond))
-			{
-				if (propIsEmpty(itemProp) || cond->userData)
-					continue;
-				return 1;
-			}
-			struct SubvalHandle **condArray = propGetValueIndex(cond, None);
-			unsigned int cnt = cond->valCount;
-			unsigned int i;
-			for (i = 0; ; ++i)
-			{
-				if (i == cnt)
-					return 1;
-				struct SubvalHandle *sub = *condArray++;
-				if (propIsSubval(itemProp, subvalString(sub)))
-					break;
-			}
+			const struct WhereInstr *instr = &whr->program[i];
+			if (bound[i] == NULL && instr->nameHash == hash && wcscasecmp(instr->name, name) == 0)
+				bound[i] = prop;
 		}
 	}
-	return 0;
+}
+
+int whereIsCondFiltered(const struct WhereStruct *whr, unsigned int idx, struct PropertyStruct *prop)
+{
+	// The prop is the property of the item bound to the condition or NULL
+	const struct WhereInstr *instr = &whr->program[idx];
+	switch (instr->op)
+	{
+		case WhereOpPresent:
+			return (prop == NULL);
+		case WhereOpAbsent:
+			return (prop != NULL && !propIsEmpty(prop));
+		case WhereOpIn:
+			break;
+	}
+	if (prop == NULL)
+		return 1;
+	unsigned int cnt = prop->valCount;
+	struct SubvalHandle *pSubval = (void *)prop + prop->valuesOffset;
+	while (cnt != 0)
+	{
+		if (pSubval->subvalStatus == Used)
+		{
+			if (whereSetContains(instr, subvalString(pSubval)))
+				return 0;
+			--cnt;
+		}
+		pSubval = (void *)pSubval + pSubval->subvalSize;
+	}
+	return 1;
 }
 
 // ********************* Private ***************************
@@ -138,14 +190,17 @@ int whereSetConditionsRaw(struct WhereStruct *whr, const wchar_t *whereStr)
 		else
 		{
 			++startVal;
-			wchar_t val[2048];
+			// A list of values can be long, so it is not limited by a buffer on the stack
 			unsigned int valLen = endVal - startVal;
-			if (valLen >= sizeof(val) / sizeof(wchar_t))
+			wchar_t *val = malloc((valLen + 1) * sizeof(wchar_t));
+			if (val == NULL)
 				return EXIT_FAILURE;
 			if (valLen != 0)
 				wcsncpy(val, startVal, valLen);
 			val[valLen] = L'\0';
-			if (whereSetConditions(whr, name, val, 0) != EXIT_SUCCESS)
+			int res = whereSetConditions(whr, name, val, 0);
+			free(val);
+			if (res != EXIT_SUCCESS)
 				return EXIT_FAILURE;
 		}
 		if (endVal == NULL)
@@ -191,3 +246,64 @@ int whereInsertConditions(struct WhereStruct *whr, struct PropertyStruct *prop)
 	++whr->condCount;
 	return EXIT_SUCCESS;
 }
+
+int whereCompile(struct WhereStruct *whr)
+{
+	unsigned int cnt = whr->condCount;
+	whr->program = calloc(cnt != 0 ? cnt : 1, sizeof(struct WhereInstr));
+	if (whr->program == NULL)
+		return EXIT_FAILURE;
+	unsigned int i;
+	for (i = 0; i < cnt; ++i)
+	{
+		struct PropertyStruct *cond = whr->conditions[i];
+		struct WhereInstr *instr = &whr->program[i];
+		instr->name     = propGetName(cond);
+		instr->nameHash = wcsFoldHash(instr->name);
+		if (propIsEmpty(cond))
+		{
+			instr->op = cond->userData ? WhereOpPresent : WhereOpAbsent;
+			continue;
+		}
+		instr->op = WhereOpIn;
+
+		// The set is kept at most half full
+		size_t size = 4;
+		while (size < (size_t)cond->valCount * 2)
+			size *= 2;
+		instr->values = calloc(size, sizeof(struct WhereValueSlot));
+		if (instr->values == NULL)
+			return EXIT_FAILURE;
+		instr->mask = size - 1;
+		unsigned int j;
+		for (j = 0; j < cond->valCount; ++j)
+		{
+			const wchar_t *value = propGetSubval(cond, j, None);
+			if (value == NULL)
+				return EXIT_FAILURE;
+			if (whereSetContains(instr, value))
+				continue;
+			uint32_t hash = wcsFoldHash(value);
+			size_t pos = hash & instr->mask;
+			while (instr->values[pos].value != NULL)
+				pos = (pos + 1) & instr->mask;
+			instr->values[pos].hash  = hash;
+			instr->values[pos].value = value;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+int whereSetContains(const struct WhereInstr *instr, const wchar_t *value)
+{
+	uint32_t hash = wcsFoldHash(value);
+	size_t pos = hash & instr->mask;
+	const struct WhereValueSlot *slot;
+	while ((slot = &instr->values[pos])->value != NULL)
+	{
+		if (slot->hash == hash && wcscasecmp(slot->value, value) == 0)
+			return 1;
+		pos = (pos + 1) & instr->mask;
+	}
+	return 0;
+}
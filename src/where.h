@@ -22,19 +22,51 @@
 #define WHERE_H
 
 #include <wchar.h>
+#include <stdint.h>
 
 #include "property.h"
 #include "item.h"
 
+/*
+ * The conditions are compiled once into one instruction per condition. The names are
+ * matched by a case-folded hash, the values of a condition are put into a hash set,
+ * so an item is checked in the time linear in its properties and values.
+ */
+
+enum WhereOpcode
+{
+	WhereOpIn,
+	WhereOpPresent,
+	WhereOpAbsent
+};
+
+struct WhereValueSlot
+{
+	uint32_t      hash;
+	const wchar_t *value;
+};
+
+struct WhereInstr
+{
+	enum WhereOpcode op;
+	uint32_t      nameHash;
+	const wchar_t *name;
+	size_t        mask;
+	struct WhereValueSlot *values;
+};
+
 struct WhereStruct
 {
 	unsigned int condMax;
 	unsigned int condCount;
 	struct PropertyStruct **conditions;
+	struct WhereInstr *program;
 };
 
 struct WhereStruct *whereInit(const wchar_t *whereStr);
 void whereFree(struct WhereStruct *whr);
 int whereIsFiltered(const struct WhereStruct *whr, struct ItemStruct *item);
+void whereBind(const struct WhereStruct *whr, const struct ItemStruct *item, struct PropertyStruct **bound);
+int whereIsCondFiltered(const struct WhereStruct *whr, unsigned int idx, struct PropertyStruct *prop);
 
 #endif // WHERE_H
@@ -0,0 +1,376 @@
+/*
+ * xxh128.c
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#include "xxh128.h"
+
+#define XXH_PRIME32_1  0x9E3779B1U
+#define XXH_PRIME32_2  0x85EBCA77U
+#define XXH_PRIME32_3  0xC2B2AE3DU
+#define XXH_PRIME64_1  0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2  0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3  0x165667B19E3779F9ULL
+#define XXH_PRIME64_4  0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5  0x27D4EB2F165667C5ULL
+#define XXH_PRIME_MX1  0x165667919E3779F9ULL
+#define XXH_PRIME_MX2  0x9FB21C651E98DF25ULL
+
+#define XXH_SECRET_SIZE     192
+#define XXH_STRIPE_LEN      64
+#define XXH_BLOCK_STRIPES   ((XXH_SECRET_SIZE - XXH_STRIPE_LEN) / 8)
+#define XXH_MIDSIZE_MAX     240
+#define XXH_MIDSIZE_START   3
+#define XXH_MIDSIZE_LAST    17
+#define XXH_SECRET_SIZE_MIN 136
+#define XXH_LASTACC_START   7
+#define XXH_MERGEACCS_START 11
+
+struct Xxh128Hash
+{
+	uint64_t low;
+	uint64_t high;
+};
+
+static uint64_t readLE64(const unsigned char *p);
+static uint32_t readLE32(const unsigned char *p);
+static uint64_t mulFold64(uint64_t a, uint64_t b);
+static uint64_t avalanche64(uint64_t h);
+static uint64_t avalanche3(uint64_t h);
+static uint64_t mix16(const unsigned char *input, const unsigned char *secret);
+static void mix32(struct Xxh128Hash *acc, const unsigned char *input1, const unsigned char *input2, const unsigned char *secret);
+static struct Xxh128Hash xxh128Short(const unsigned char *input, size_t len);
+static void xxh128Accumulate(uint64_t acc[8], const unsigned char *input, const unsigned char *secret);
+static void xxh128Scramble(uint64_t acc[8], const unsigned char *secret);
+static void xxh128Stripes(struct Xxh128State *state, const unsigned char *data, size_t count);
+static uint64_t xxh128MergeAccs(const uint64_t acc[8], const unsigned char *secret, uint64_t start);
+
+// The default secret of xxHash
+static const unsigned char xxhSecret[XXH_SECRET_SIZE] = {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e
+};
+
+void xxh128Init(struct Xxh128State *state)
+{
+	static const uint64_t init[8] = {
+		XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+		XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1
+	};
+	memcpy(state->acc, init, sizeof(init));
+	state->length   = 0;
+	state->stripes  = 0;
+	state->buffered = 0;
+}
+
+void xxh128Update(struct Xxh128State *state, const unsigned char *data, size_t len)
+{
+	// A short input stays in the buffer whole, it is hashed apart from the long ones.
+	// Otherwise the stripes are taken from the data itself, the buffer keeps at most the last 64 bytes
+	state->length += len;
+	if (len <= XXH128_BUFFER - state->buffered)
+	{
+		memcpy(state->buffer + state->buffered, data, len);
+		state->buffered += len;
+		return;
+	}
+	if (state->buffered != 0)
+	{
+		size_t part = XXH128_BUFFER - state->buffered;
+		memcpy(state->buffer + state->buffered, data, part);
+		xxh128Stripes(state, state->buffer, XXH128_BUFFER / XXH_STRIPE_LEN);
+		memcpy(state->last, state->buffer + XXH128_BUFFER - XXH_STRIPE_LEN, XXH_STRIPE_LEN);
+		state->buffered = 0;
+		data += part;
+		len  -= part;
+	}
+	size_t count = (len - 1) / XXH_STRIPE_LEN;
+	if (count != 0)
+	{
+		xxh128Stripes(state, data, count);
+		memcpy(state->last, data + (count - 1) * XXH_STRIPE_LEN, XXH_STRIPE_LEN);
+		data += count * XXH_STRIPE_LEN;
+		len  -= count * XXH_STRIPE_LEN;
+	}
+	memcpy(state->buffer, data, len);
+	state->buffered = len;
+}
+
+void xxh128Final(struct Xxh128State *state, unsigned char digest[XXH128_SIZE])
+{
+	struct Xxh128Hash h;
+	if (state->length <= XXH_MIDSIZE_MAX)
+		h = xxh128Short(state->buffer, state->length);
+	else
+	{
+		// The rest of the stripes and the last one, it may begin in the stripe taken before
+		size_t count = (state->buffered - 1) / XXH_STRIPE_LEN;
+		if (count != 0)
+			xxh128Stripes(state, state->buffer, count);
+		unsigned char lastStripe[XXH_STRIPE_LEN];
+		const unsigned char *p = state->buffer + state->buffered - XXH_STRIPE_LEN;
+		if (state->buffered < XXH_STRIPE_LEN)
+		{
+			size_t before = XXH_STRIPE_LEN - state->buffered;
+			memcpy(lastStripe, state->last + XXH_STRIPE_LEN - before, before);
+			memcpy(lastStripe + before, state->buffer, state->buffered);
+			p = lastStripe;
+		}
+		xxh128Accumulate(state->acc, p, xxhSecret + XXH_SECRET_SIZE - XXH_STRIPE_LEN - XXH_LASTACC_START);
+		h.low  = xxh128MergeAccs(state->acc, xxhSecret + XXH_MERGEACCS_START, state->length * XXH_PRIME64_1);
+		h.high = xxh128MergeAccs(state->acc, xxhSecret + XXH_SECRET_SIZE - 64 - XXH_MERGEACCS_START,
+			~(state->length * XXH_PRIME64_2));
+	}
+	int i;
+	for (i = 0; i < 8; ++i)
+	{
+		digest[i]     = h.high >> (56 - i * 8);
+		digest[i + 8] = h.low >> (56 - i * 8);
+	}
+}
+
+/**************************** Private ********************************/
+
+static uint64_t readLE64(const unsigned char *p)
+{
+	uint64_t w;
+	memcpy(&w, p, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	w = __builtin_bswap64(w);
+#endif
+	return w;
+}
+
+static uint32_t readLE32(const unsigned char *p)
+{
+	uint32_t w;
+	memcpy(&w, p, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	w = __builtin_bswap32(w);
+#endif
+	return w;
+}
+
+static uint64_t mulFold64(uint64_t a, uint64_t b)
+{
+	unsigned __int128 p = (unsigned __int128)a * b;
+	return (uint64_t)p ^ (uint64_t)(p >> 64);
+}
+
+static uint64_t avalanche64(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	return h ^ (h >> 32);
+}
+
+static uint64_t avalanche3(uint64_t h)
+{
+	h ^= h >> 37;
+	h *= XXH_PRIME_MX1;
+	return h ^ (h >> 32);
+}
+
+static uint64_t mix16(const unsigned char *input, const unsigned char *secret)
+{
+	return mulFold64(readLE64(input) ^ readLE64(secret), readLE64(input + 8) ^ readLE64(secret + 8));
+}
+
+static void mix32(struct Xxh128Hash *acc, const unsigned char *input1, const unsigned char *input2, const unsigned char *secret)
+{
+	acc->low  += mix16(input1, secret);
+	acc->low  ^= readLE64(input2) + readLE64(input2 + 8);
+	acc->high += mix16(input2, secret + 16);
+	acc->high ^= readLE64(input1) + readLE64(input1 + 8);
+}
+
+static struct Xxh128Hash xxh128Short(const unsigned char *input, size_t len)
+{
+	// The inputs up to XXH_MIDSIZE_MAX bytes, each range of lengths has its own mixing
+	const unsigned char *secret = xxhSecret;
+	struct Xxh128Hash h;
+	if (len == 0)
+	{
+		h.low  = avalanche64(readLE64(secret + 64) ^ readLE64(secret + 72));
+		h.high = avalanche64(readLE64(secret + 80) ^ readLE64(secret + 88));
+	}
+	else if (len <= 3)
+	{
+		uint32_t lo = ((uint32_t)input[0] << 16) | ((uint32_t)input[len >> 1] << 24) | input[len - 1] | ((uint32_t)len << 8);
+		uint32_t hi = __builtin_bswap32(lo);
+		hi = (hi << 13) | (hi >> 19);
+		h.low  = avalanche64(lo ^ (uint64_t)(readLE32(secret) ^ readLE32(secret + 4)));
+		h.high = avalanche64(hi ^ (uint64_t)(readLE32(secret + 8) ^ readLE32(secret + 12)));
+	}
+	else if (len <= 8)
+	{
+		uint64_t in = readLE32(input) + ((uint64_t)readLE32(input + len - 4) << 32);
+		uint64_t keyed = in ^ (readLE64(secret + 16) ^ readLE64(secret + 24));
+		unsigned __int128 m = (unsigned __int128)keyed * (XXH_PRIME64_1 + (len << 2));
+		uint64_t low  = (uint64_t)m;
+		uint64_t high = (uint64_t)(m >> 64);
+		high += low << 1;
+		low  ^= high >> 3;
+		low  ^= low >> 35;
+		low  *= XXH_PRIME_MX2;
+		h.low  = low ^ (low >> 28);
+		h.high = avalanche3(high);
+	}
+	else if (len <= 16)
+	{
+		uint64_t inLo = readLE64(input);
+		uint64_t inHi = readLE64(input + len - 8) ^ (readLE64(secret + 48) ^ readLE64(secret + 56));
+		unsigned __int128 m = (unsigned __int128)(inLo ^ readLE64(input + len - 8) ^ (readLE64(secret + 32) ^ readLE64(secret + 40))) * XXH_PRIME64_1;
+		uint64_t low  = (uint64_t)m + ((uint64_t)(len - 1) << 54);
+		uint64_t high = (uint64_t)(m >> 64) + inHi + (uint64_t)(uint32_t)inHi * (XXH_PRIME32_2 - 1);
+		low ^= __builtin_bswap64(high);
+		m = (unsigned __int128)low * XXH_PRIME64_2;
+		h.low  = avalanche3((uint64_t)m);
+		h.high = avalanche3((uint64_t)(m >> 64) + high * XXH_PRIME64_2);
+	}
+	else
+	{
+		struct Xxh128Hash acc;
+		acc.low  = len * XXH_PRIME64_1;
+		acc.high = 0;
+		if (len <= 128)
+		{
+			unsigned int i = (len - 1) / 32;
+			do
+				mix32(&acc, input + 16 * i, input + len - 16 * (i + 1), secret + 32 * i);
+			while (i-- != 0);
+		}
+		else
+		{
+			size_t i;
+			for (i = 32; i < 160; i += 32)
+				mix32(&acc, input + i - 32, input + i - 16, secret + i - 32);
+			acc.low  = avalanche3(acc.low);
+			acc.high = avalanche3(acc.high);
+			for (i = 160; i <= len; i += 32)
+				mix32(&acc, input + i - 32, input + i - 16, secret + XXH_MIDSIZE_START + i - 160);
+			mix32(&acc, input + len - 16, input + len - 32, secret + XXH_SECRET_SIZE_MIN - XXH_MIDSIZE_LAST - 16);
+		}
+		h.low  = avalanche3(acc.low + acc.high);
+		h.high = 0 - avalanche3(acc.low * XXH_PRIME64_1 + acc.high * XXH_PRIME64_4 + len * XXH_PRIME64_2);
+	}
+	return h;
+}
+
+#ifdef __SSE2__
+
+static void xxh128Accumulate(uint64_t acc[8], const unsigned char *input, const unsigned char *secret)
+{
+	// Every 64-bit lane adds the product of the halves of its keyed data and the data of its neighbour
+	int i;
+	for (i = 0; i < 4; ++i)
+	{
+		__m128i data  = _mm_loadu_si128((const __m128i *)input + i);
+		__m128i key   = _mm_xor_si128(data, _mm_loadu_si128((const __m128i *)secret + i));
+		__m128i prod  = _mm_mul_epu32(key, _mm_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1)));
+		__m128i swap  = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+		__m128i *pAcc = (__m128i *)acc + i;
+		_mm_storeu_si128(pAcc, _mm_add_epi64(_mm_loadu_si128(pAcc), _mm_add_epi64(prod, swap)));
+	}
+}
+
+static void xxh128Scramble(uint64_t acc[8], const unsigned char *secret)
+{
+	__m128i prime = _mm_set1_epi32(XXH_PRIME32_1);
+	int i;
+	for (i = 0; i < 4; ++i)
+	{
+		__m128i *pAcc = (__m128i *)acc + i;
+		__m128i a = _mm_loadu_si128(pAcc);
+		a = _mm_xor_si128(_mm_xor_si128(a, _mm_srli_epi64(a, 47)), _mm_loadu_si128((const __m128i *)secret + i));
+		__m128i lo = _mm_mul_epu32(a, prime);
+		__m128i hi = _mm_mul_epu32(_mm_shuffle_epi32(a, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+		_mm_storeu_si128(pAcc, _mm_add_epi64(lo, _mm_slli_epi64(hi, 32)));
+	}
+}
+
+#else
+
+static void xxh128Accumulate(uint64_t acc[8], const unsigned char *input, const unsigned char *secret)
+{
+	int i;
+	for (i = 0; i < 8; ++i)
+	{
+		uint64_t data = readLE64(input + i * 8);
+		uint64_t key  = data ^ readLE64(secret + i * 8);
+		acc[i ^ 1] += data;
+		acc[i] += (uint64_t)(uint32_t)key * (key >> 32);
+	}
+}
+
+static void xxh128Scramble(uint64_t acc[8], const unsigned char *secret)
+{
+	int i;
+	for (i = 0; i < 8; ++i)
+	{
+		uint64_t a = acc[i];
+		a ^= a >> 47;
+		a ^= readLE64(secret + i * 8);
+		acc[i] = a * XXH_PRIME32_1;
+	}
+}
+
+#endif // __SSE2__
+
+static void xxh128Stripes(struct Xxh128State *state, const unsigned char *data, size_t count)
+{
+	// A block is XXH_BLOCK_STRIPES stripes, each keyed by the secret shifted by 8 bytes, the accumulators are scrambled after it
+	unsigned int stripes = state->stripes;
+	while (count-- != 0)
+	{
+		xxh128Accumulate(state->acc, data, xxhSecret + stripes * 8);
+		data += XXH_STRIPE_LEN;
+		if (++stripes == XXH_BLOCK_STRIPES)
+		{
+			xxh128Scramble(state->acc, xxhSecret + XXH_SECRET_SIZE - XXH_STRIPE_LEN);
+			stripes = 0;
+		}
+	}
+	state->stripes = stripes;
+}
+
+static uint64_t xxh128MergeAccs(const uint64_t acc[8], const unsigned char *secret, uint64_t start)
+{
+	int i;
+	for (i = 0; i < 4; ++i)
+		start += mulFold64(acc[2 * i] ^ readLE64(secret + 16 * i), acc[2 * i + 1] ^ readLE64(secret + 16 * i + 8));
+	return avalanche3(start);
+}
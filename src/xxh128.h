@@ -0,0 +1,52 @@
+/*
+ * xxh128.h
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef XXH128_H
+#define XXH128_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * XXH3-128 of xxHash 0.8 with the default secret and seed 0, a fast hash for finding the same
+ * content, not a cryptographic one. The digest is the canonical form: the high 64 bits and
+ * then the low ones, big-endian, as xxhsum -H2 prints it.
+ * The input is hashed by 64-byte stripes, a stripe is taken only when some input follows it,
+ * since the last stripe of a long input is hashed with its own part of the secret.
+ */
+
+#define XXH128_SIZE    16
+#define XXH128_BUFFER  256
+
+struct Xxh128State
+{
+	uint64_t      acc[8];
+	uint64_t      length;
+	unsigned int  stripes;   // taken in the current block
+	unsigned int  buffered;
+	unsigned char buffer[XXH128_BUFFER];
+	unsigned char last[64];  // the last stripe taken, the last stripe of the input may start in it
+};
+
+void xxh128Init(struct Xxh128State *state);
+void xxh128Update(struct Xxh128State *state, const unsigned char *data, size_t len);
+void xxh128Final(struct Xxh128State *state, unsigned char digest[XXH128_SIZE]);
+
+#endif // XXH128_H
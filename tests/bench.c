@@ -0,0 +1,176 @@
+/*
+ * bench.c
+ * Copyright (C) 2013  Aleksey Andreev
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../src/file.h"
+
+/*
+ * Compares the ways fileitemsCalculateHashes reads the files: one blocking thread, the pool
+ * of blocking threads and the io_uring workers. The files are created in a temporary
+ * directory under the given one (/tmp by default), put it on the disk to measure.
+ * The second argument names the hash, sha1 by default.
+ * Hashing drops the pages of the files from the page cache, so every run reads the disk.
+ */
+
+#define BENCH_SMALL_COUNT  2000
+#define BENCH_SMALL_SIZE   (16 * 1024)
+#define BENCH_LARGE_COUNT  8
+#define BENCH_LARGE_SIZE   (32 * 1024 * 1024)
+
+struct BenchRun
+{
+	const char   *name;
+	enum HashIo  io;
+	unsigned int jobs;
+	enum HashAlg alg;
+};
+
+int benchCreateFiles(char **names, unsigned int count);
+double benchRun(struct FileItemList *fil, const struct BenchRun *run);
+
+int main(int argc, char *argv[])
+{
+	enum HashAlg alg = HashAlgSha1;
+	if (argc > 2 && hashalgFind(argv[2], strlen(argv[2]), &alg) != EXIT_SUCCESS)
+	{
+		fprintf(stderr, "Error: unknown hash %s\n", argv[2]);
+		return EXIT_FAILURE;
+	}
+	char dir[PATH_MAX];
+	snprintf(dir, sizeof(dir), "%s/tags_bench_XXXXXX", (argc > 1) ? argv[1] : "/tmp");
+	if (mkdtemp(dir) == NULL || chdir(dir) != 0)
+	{
+		perror(dir);
+		return EXIT_FAILURE;
+	}
+	unsigned int count = BENCH_SMALL_COUNT + BENCH_LARGE_COUNT;
+	char **names = calloc(count, sizeof(char *));
+	int res = EXIT_FAILURE;
+	struct FileItemList *fil = NULL;
+	if (names == NULL || benchCreateFiles(names, count) != EXIT_SUCCESS)
+		perror("create");
+	else if ((fil = fileitemsInitFromList(names, count, 0, MaskFile)) == NULL)
+		fputs("Error: fileitemsInitFromList failed\n", stderr);
+	else
+	{
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		unsigned int pool = (cpus < 4) ? 4 : (cpus > HASH_JOBS_MAX) ? HASH_JOBS_MAX : cpus;
+		struct BenchRun runs[] = {
+			{ "serial",       HashIoRead,  1,    alg },
+			{ "thread pool",  HashIoRead,  pool, alg },
+			{ "io_uring",     HashIoUring, 1,    alg },
+			{ "io_uring pool", HashIoUring, pool, alg }
+		};
+		double bytes = (double)BENCH_SMALL_COUNT * BENCH_SMALL_SIZE + (double)BENCH_LARGE_COUNT * BENCH_LARGE_SIZE;
+		printf("%u files of %u bytes, %u files of %u bytes, %u threads in the pools, %s\n",
+			BENCH_SMALL_COUNT, BENCH_SMALL_SIZE, BENCH_LARGE_COUNT, BENCH_LARGE_SIZE, pool, hashalgName(alg));
+		unsigned char *first = malloc(count * FILE_HASH_SIZE);
+		res = (first != NULL) ? EXIT_SUCCESS : EXIT_FAILURE;
+		unsigned int r;
+		for (r = 0; res == EXIT_SUCCESS && r < sizeof(runs) / sizeof(runs[0]); ++r)
+		{
+			double sec = benchRun(fil, &runs[r]);
+			if (sec < 0)
+			{
+				res = EXIT_FAILURE;
+				break;
+			}
+			printf("%-14s %8.3f s %10.1f MB/s\n", runs[r].name, sec, bytes / sec / 1e6);
+			unsigned int i;
+			for (i = 0; i < count; ++i)
+			{
+				unsigned char *hash = first + i * FILE_HASH_SIZE;
+				if (r == 0)
+					memcpy(hash, fil->fileItems[i]->hash, FILE_HASH_SIZE);
+				else if (memcmp(hash, fil->fileItems[i]->hash, FILE_HASH_SIZE) != 0)
+				{
+					fprintf(stderr, "Error: %s gives another hash\n", runs[r].name);
+					res = EXIT_FAILURE;
+					break;
+				}
+			}
+		}
+		free(first);
+	}
+	if (fil != NULL)
+		fileitemsFree(fil);
+	unsigned int i;
+	for (i = 0; names != NULL && i < count && names[i] != NULL; ++i)
+	{
+		unlink(names[i]);
+		free(names[i]);
+	}
+	free(names);
+	if (chdir("/") != 0 || rmdir(dir) != 0)
+		perror(dir);
+	return res;
+}
+
+int benchCreateFiles(char **names, unsigned int count)
+{
+	// The files are synced, so their pages can be dropped from the page cache
+	unsigned char *buff = malloc(BENCH_LARGE_SIZE);
+	if (buff == NULL)
+		return EXIT_FAILURE;
+	unsigned int i;
+	for (i = 0; i < BENCH_LARGE_SIZE; ++i)
+		buff[i] = (i * 2654435761u) >> 24;
+	int res = EXIT_SUCCESS;
+	for (i = 0; res == EXIT_SUCCESS && i < count; ++i)
+	{
+		names[i] = malloc(16);
+		if (names[i] == NULL)
+		{
+			res = EXIT_FAILURE;
+			break;
+		}
+		snprintf(names[i], 16, "f%05u", i);
+		size_t size = (i < BENCH_SMALL_COUNT) ? BENCH_SMALL_SIZE : BENCH_LARGE_SIZE;
+		buff[0] = i;
+		buff[1] = i >> 8;
+		int fd = open(names[i], O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		if (fd == -1 || write(fd, buff, size) != (ssize_t)size || fsync(fd) != 0)
+			res = EXIT_FAILURE;
+		if (fd != -1)
+			close(fd);
+	}
+	free(buff);
+	return res;
+}
+
+double benchRun(struct FileItemList *fil, const struct BenchRun *run)
+{
+	// Returns the seconds the hashing took, a negative value if it failed
+	struct timespec start, end;
+	hashIo = run->io;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int res = fileitemsCalculateHashes(fil, run->alg, run->jobs, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	hashIo = HashIoRead;
+	if (res != EXIT_SUCCESS)
+		return -1.0;
+	return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
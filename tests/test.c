@@ -18,16 +18,36 @@
  *
  */
 
+#define _LARGEFILE64_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <wchar.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "../src/property.h"
 #include "../src/item.h"
 #include "../src/fields.h"
 #include "../src/file.h"
 #include "../src/where.h"
+#include "../src/tagbin.h"
+#include "../src/utils.h"
+#include "../src/tagidx.h"
+#include "../src/tagjournal.h"
+#include "../src/tagfile.h"
+#include "../src/taglz.h"
+#include "../src/taginv.h"
+#include "../src/tagbitmap.h"
+#include "../src/tagplan.h"
+#include "../src/tagarena.h"
+#include "../src/digest.h"
+#include "../src/sha1.h"
+#include "../src/sha1mb.h"
+#include "../src/hashcache.h"
+#include "../src/hashalg.h"
 
 const char *testNm = NULL;
 
@@ -38,7 +58,33 @@ void testProp();
 void testItem();
 void testFields();
 void testWhere();
+void testTagbin();
+void testUtf8();
+void testTagidx();
+void testTagjournal();
+void testTagfileHash();
+void testTagfileRewrite();
+void testTaglz();
+void testTaginv();
+void testTagbitmap();
+void testTagplan();
+void testTagarena();
+void testFileitems();
+void testDigest();
+void testSha1();
+void testSha1mb();
+void testHashcache();
+void testHashalg();
+const unsigned char *testHash(const char *hex);
+unsigned char *testReadFile(const char *path, size_t *size);
+void testTreeHash(enum HashAlg base, const unsigned char *data, size_t len, unsigned char *digest);
 unsigned int propCommon(struct PropertyStruct *prop);
+uint32_t invFindId(const struct TagInv *inv, uint64_t offset);
+extern unsigned int _hashThreads;
+extern int _uringFailCount;
+extern int _uringFailErrno;
+extern int _digestAvx2;
+struct ItemStruct *tagfileGetNextItem(struct TagFileStruct *tf);
 void printFailed(const char *descr);
 
 int main()
@@ -47,6 +93,23 @@ int main()
 	testItem();
 	testFields();
 	testWhere();
+	testTagbin();
+	testUtf8();
+	testTagidx();
+	testTagjournal();
+	testTagfileHash();
+	testTagfileRewrite();
+	testTaglz();
+	testTaginv();
+	testTagbitmap();
+	testTagplan();
+	testTagarena();
+	testFileitems();
+	testDigest();
+	testSha1();
+	testSha1mb();
+	testHashcache();
+	testHashalg();
 
 	fprintf(stdout, "Tests: %i, errors: %i\n", tests_cnt, errors_cnt);
 	if (errors_cnt != 0)
@@ -342,6 +405,58 @@ void testProp()
 		propFree(prop2);
 	}
 
+	{
+		++tests_cnt;
+		testNm = "propLookup";
+		struct PropertyStruct *prop = propInit(L"testName_30", L"v_0");
+		wchar_t val[32];
+		unsigned int i;
+		for (i = 1; prop != NULL && i < 2000; ++i)
+		{
+			if (i == 1000 && propGetValueIndex(prop, ByValue) == NULL)
+			{
+				++errors_cnt;
+				printFailed("by value");
+			}
+			swprintf(val, 32, L"v_%u", (i * 7919) % 2000);
+			if (propIsSubval(prop, val) == NULL)
+				prop = propAddSubval(prop, val);
+		}
+		if (prop == NULL || prop->valCount != 2000 || prop->hashSet == NULL)
+		{
+			++errors_cnt;
+			printFailed("add");
+			return;
+		}
+		for (i = 0; i < 2000; i += 3)
+		{
+			swprintf(val, 32, L"v_%u", i);
+			propDelSubvalues(&prop, val);
+		}
+		prop = propAddSubval(prop, L"V_3");
+		for (i = 0; i < 2000; ++i)
+		{
+			swprintf(val, 32, L"V_%u", i);
+			if ((propIsSubval(prop, val) != NULL) != (i % 3 != 0 || i == 3))
+			{
+				++errors_cnt;
+				printFailed("lookup");
+				break;
+			}
+		}
+		struct SubvalHandle **subvals = propGetValueIndex(prop, ByValue);
+		for (i = 1; i < prop->valCount; ++i)
+		{
+			if (wcscmp(subvalString(subvals[i - 1]), subvalString(subvals[i])) >= 0)
+			{
+				++errors_cnt;
+				printFailed("order");
+				break;
+			}
+		}
+		propFree(prop);
+	}
+
 	propFree(propEnum);
 }
 
@@ -349,7 +464,7 @@ void testItem()
 {
 	++tests_cnt;
 	testNm = "itemInit";
-	struct ItemStruct *item = itemInit(4, L"a94a8fe5ccb19ba61c4c0873d391e987982fbbd3");
+	struct ItemStruct *item = itemInit(4, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"));
 	if (item == NULL)
 	{
 		++errors_cnt;
@@ -361,7 +476,7 @@ void testItem()
 		++errors_cnt;
 		printFailed("fileSize");
 	}
-	if (wcscmp(item->hash, L"a94a8fe5ccb19ba61c4c0873d391e987982fbbd3") != 0)
+	if (memcmp(item->hash, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"), FILE_HASH_SIZE) != 0)
 	{
 		++errors_cnt;
 		printFailed("fileHash");
@@ -400,7 +515,7 @@ void testItem()
 
 	++tests_cnt;
 	testNm = "itemInitFromRawData";
-	item = itemInitFromRawData(4, L"a94a8fe5ccb19ba61c4c0873d391e987982fbbd3", L"testfile1", L"testName_10=testVal_10,testVal_11,@testName_30=", L"testName_1=testVal_1,testVal_3,, ,  ,testVal_2@testName_40=@testName_20=testVal_20,testVal_21,");
+	item = itemInitFromRawData(4, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"), L"testfile1", L"testName_10=testVal_10,testVal_11,@testName_30=", L"testName_1=testVal_1,testVal_3,, ,  ,testVal_2@testName_40=@testName_20=testVal_20,testVal_21,");
 	if (item == NULL)
 	{
 		++errors_cnt;
@@ -942,8 +1057,8 @@ void testItem()
 	{
 		++tests_cnt;
 		testNm = "itemMerge";
-		struct ItemStruct *item1 = itemInitFromRawData(4, L"a94a8fe5ccb19ba61c4c0873d391e987982fbbd3", L"testfile1", NULL, L"testName_10=testVal_10,testVal_11@testName_20=");
-		struct ItemStruct *item2 = itemInitFromRawData(4, L"a94a8fe5ccb19ba61c4c0873d391e987982fbbd3", L"testfile2", NULL, L"testName_10=testVal_10,testVal_12@testName_20=testVal_20,testVal_21@testName_30=@testName_40=testVal_40");
+		struct ItemStruct *item1 = itemInitFromRawData(4, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"), L"testfile1", NULL, L"testName_10=testVal_10,testVal_11@testName_20=");
+		struct ItemStruct *item2 = itemInitFromRawData(4, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"), L"testfile2", NULL, L"testName_10=testVal_10,testVal_12@testName_20=testVal_20,testVal_21@testName_30=@testName_40=testVal_40");
 		if (itemMerge(item1, item2) != EXIT_SUCCESS)
 		{
 			itemFree(item2);
@@ -1033,64 +1148,64 @@ void testItem()
 	{
 		++tests_cnt;
 		testNm = "itemIsEqual";
-		struct ItemStruct *item1 = itemInitFromRawData(4, L"a94a8fe5ccb19ba61c4c0873d391e987982fbbd3", L"testfile1", NULL, L"testName_10=testVal_10,testVal_11@testName_20=testVal_20,testVal_21@testName_30=");
-		struct ItemStruct *item2 = itemInit(4, L"a94a8fe5ccb19ba61c4c0873d391e987982fbbd3");
+		struct ItemStruct *item1 = itemInitFromRawData(4, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"), L"testfile1", NULL, L"testName_10=testVal_10,testVal_11@testName_20=testVal_20,testVal_21@testName_30=");
+		struct ItemStruct *item2 = itemInit(4, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"));
 		if (itemIsEqual(item1, item2))
 		{
 			++errors_cnt;
 			printFailed("check empty");
 		}
 		itemFree(item2);
-		item2 = itemInitFromRawData(5, L"a94a8fe5ccb19ba61c4c0873d391e987982fbbd3", L"testfile1", NULL, L"testName_10=testVal_10,testVal_11@testName_20=testVal_20,testVal_21@testName_30=");
+		item2 = itemInitFromRawData(5, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"), L"testfile1", NULL, L"testName_10=testVal_10,testVal_11@testName_20=testVal_20,testVal_21@testName_30=");
 		if (itemIsEqual(item1, item2))
 		{
 			++errors_cnt;
 			printFailed("check size");
 		}
 		itemFree(item2);
-		item2 = itemInitFromRawData(4, L"badhashbadhashbadhashbadhashbadhashbadha", L"testfile1", NULL, L"testName_10=testVal_10,testVal_11@testName_20=testVal_20,testVal_21@testName_30=");
+		item2 = itemInitFromRawData(4, testHash("da39a3ee5e6b4b0d3255bfef95601890afd80709"), L"testfile1", NULL, L"testName_10=testVal_10,testVal_11@testName_20=testVal_20,testVal_21@testName_30=");
 		if (itemIsEqual(item1, item2))
 		{
 			++errors_cnt;
 			printFailed("check hash");
 		}
 		itemFree(item2);
-		item2 = itemInitFromRawData(4, L"a94a8fe5ccb19ba61c4c0873d391e987982fbbd3", L"testfile1", NULL, L"testName_10=@testName_20=testVal_20,testVal_21@testName_30=");
+		item2 = itemInitFromRawData(4, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"), L"testfile1", NULL, L"testName_10=@testName_20=testVal_20,testVal_21@testName_30=");
 		if (itemIsEqual(item1, item2))
 		{
 			++errors_cnt;
 			printFailed("check 10");
 		}
 		itemFree(item2);
-		item2 = itemInitFromRawData(4, L"a94a8fe5ccb19ba61c4c0873d391e987982fbbd3", L"testfile1", NULL, L"testName_10=testVal_11@testName_20=testVal_20,testVal_21@testName_30=");
+		item2 = itemInitFromRawData(4, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"), L"testfile1", NULL, L"testName_10=testVal_11@testName_20=testVal_20,testVal_21@testName_30=");
 		if (itemIsEqual(item1, item2))
 		{
 			++errors_cnt;
 			printFailed("check 11");
 		}
 		itemFree(item2);
-		item2 = itemInitFromRawData(4, L"a94a8fe5ccb19ba61c4c0873d391e987982fbbd3", L"testfile1", NULL, L"testName_10=testVal_10,testVal_11@testName_20=testVal_20@testName_30=");
+		item2 = itemInitFromRawData(4, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"), L"testfile1", NULL, L"testName_10=testVal_10,testVal_11@testName_20=testVal_20@testName_30=");
 		if (itemIsEqual(item1, item2))
 		{
 			++errors_cnt;
 			printFailed("check 20");
 		}
 		itemFree(item2);
-		item2 = itemInitFromRawData(4, L"a94a8fe5ccb19ba61c4c0873d391e987982fbbd3", L"testfile1", NULL, L"testName_10=testVal_10,testVal_11@testName_20=testVal_20,testVal_21");
+		item2 = itemInitFromRawData(4, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"), L"testfile1", NULL, L"testName_10=testVal_10,testVal_11@testName_20=testVal_20,testVal_21");
 		if (itemIsEqual(item1, item2))
 		{
 			++errors_cnt;
 			printFailed("check 30");
 		}
 		itemFree(item2);
-		item2 = itemInitFromRawData(4, L"a94a8fe5ccb19ba61c4c0873d391e987982fbbd3", L"testfile1", NULL, L"testName_20=testVal_20,testVal_21@testName_30=@testName_10=testVal_10,testVal_11");
+		item2 = itemInitFromRawData(4, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"), L"testfile1", NULL, L"testName_20=testVal_20,testVal_21@testName_30=@testName_10=testVal_10,testVal_11");
 		if (!itemIsEqual(item1, item2))
 		{
 			++errors_cnt;
 			printFailed("check full");
 		}
 		itemFree(item2);
-		item2 = itemInitFromRawData(4, L"a94a8fe5ccb19ba61c4c0873d391e987982fbbd3", L"testfile2", NULL, L"testName_20=testVal_20,testVal_21@testName_30=@testName_10=testVal_10,testVal_11");
+		item2 = itemInitFromRawData(4, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"), L"testfile2", NULL, L"testName_20=testVal_20,testVal_21@testName_30=@testName_10=testVal_10,testVal_11");
 		if (!itemIsEqual(item1, item2))
 		{
 			++errors_cnt;
@@ -1224,6 +1339,76 @@ void testItem()
 	}
 
 	itemFree(item);
+
+	++tests_cnt;
+	testNm = "itemPropsIndex";
+	item = itemInit(4, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"));
+	if (item == NULL)
+	{
+		++errors_cnt;
+		printFailed("null item");
+		return;
+	}
+	wchar_t nm[32];
+	unsigned int i;
+	for (i = 0; i < 100; ++i)
+	{
+		swprintf(nm, 32, L"Name_%u", i);
+		if (itemSetProperty(item, nm, L"val") != EXIT_SUCCESS)
+		{
+			++errors_cnt;
+			printFailed("set");
+			break;
+		}
+	}
+	if (item->propsIndex == NULL)
+	{
+		++errors_cnt;
+		printFailed("no index");
+	}
+	for (i = 0; i < 100; i += 2)
+	{
+		swprintf(nm, 32, L"name_%u", i);
+		if (itemDelPropertiesRaw(item, nm) != EXIT_SUCCESS)
+		{
+			++errors_cnt;
+			printFailed("delete");
+			break;
+		}
+	}
+	if (item->propsCount != 50)
+	{
+		++errors_cnt;
+		printFailed("count after delete");
+	}
+	for (i = 0; i < 10; ++i)
+	{
+		swprintf(nm, 32, L"NAME_%u", i * 10);
+		if (itemSetProperty(item, nm, L"again") != EXIT_SUCCESS)
+		{
+			++errors_cnt;
+			printFailed("reinsert");
+			break;
+		}
+	}
+	for (i = 0; i < 100; ++i)
+	{
+		swprintf(nm, 32, L"nAmE_%u", i);
+		struct PropertyStruct **pp = itemGetPropertyPosByName(item, nm);
+		int present = (i % 2 != 0 || i % 10 == 0);
+		if ((pp != NULL) != present || (pp != NULL && wcscasecmp(propGetName(*pp), nm) != 0))
+		{
+			++errors_cnt;
+			printFailed("lookup");
+			break;
+		}
+	}
+	if (item->propsCount != 60)
+	{
+		++errors_cnt;
+		printFailed("count after reinsert");
+	}
+	itemFree(item);
 }
 
 void testWhere()
@@ -1263,7 +1448,7 @@ void testWhere()
 	}
 	++tests_cnt;
 	testNm = "whereTest1";
-	struct ItemStruct *item = itemInitFromRawData(4, L"a94a8fe5ccb19ba61c4c0873d391e987982fbbd3", L"testfile1", NULL, L"prop10=value11,value12,value13@prop20=value21,value22,value23@prop30=value31,value32,value33@prop40=");
+	struct ItemStruct *item = itemInitFromRawData(4, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"), L"testfile1", NULL, L"prop10=value11,value12,value13@prop20=value21,value22,value23@prop30=value31,value32,value33@prop40=");
 	if (item == NULL)
 	{
 		++errors_cnt;
@@ -1588,6 +1773,49 @@ void testWhere()
 		}
 	}
 
+	{
+		// A long list of values is looked up in a hash set, the names and the values ignore case
+		++tests_cnt;
+		testNm = "whereTest17";
+		size_t len = 16 + 5000 * 8;
+		wchar_t *str = malloc(len * sizeof(wchar_t));
+		if (str == NULL)
+		{
+			++errors_cnt;
+			printFailed("malloc");
+		}
+		else
+		{
+			wcscpy(str, L"PROP20=");
+			unsigned int i;
+			for (i = 0; i < 5000; ++i)
+				swprintf(str + wcslen(str), len - wcslen(str), (i == 0) ? L"v%u" : L",v%u", i);
+			struct WhereStruct *whr = whereInit(str);
+			if (whr == NULL || whr->program[0].op != WhereOpIn)
+			{
+				++errors_cnt;
+				printFailed("whereInit");
+			}
+			else if (!whereIsFiltered(whr, item))
+			{
+				++errors_cnt;
+				printFailed("not filtered");
+			}
+			if (whr != NULL)
+				whereFree(whr);
+			wcscat(str, L",VALUE22@prop10");
+			whr = whereInit(str);
+			if (whr == NULL || whereIsFiltered(whr, item))
+			{
+				++errors_cnt;
+				printFailed("filtered");
+			}
+			if (whr != NULL)
+				whereFree(whr);
+			free(str);
+		}
+	}
+
 	itemFree(item);
 }
 
@@ -1625,7 +1853,7 @@ void testFields()
 	{
 		++tests_cnt;
 		testNm = "fieldsPrintRow";
-		struct ItemStruct *item = itemInitFromRawData(4, L"a94a8fe5ccb19ba61c4c0873d391e987982fbbd3", L"testfile1", NULL, L"testName_10=testVal_10,,testVal_11,@testName_20=@testName_30=testVal_30");
+		struct ItemStruct *item = itemInitFromRawData(4, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"), L"testfile1", NULL, L"testName_10=testVal_10,,testVal_11,@testName_20=@testName_30=testVal_30");
 		FILE *fd1 = tmpfile();
 		if (fieldsPrintRow(fields, item, L"", fd1) != EXIT_SUCCESS)
 		{
@@ -1639,16 +1867,18 @@ void testFields()
 			printFailed("print 2");
 		}
 		fseek(fd1, 0L, SEEK_SET);
-		char hash1[41]; hash1[0] = '\0';
-		char hash2[41]; hash2[0] = '\0';
-		sha1file(fd1, &hash1[0]);
+		unsigned char hash1[FILE_HASH_SIZE];
+		unsigned char hash2[FILE_HASH_SIZE];
+		memset(hash1, 0, FILE_HASH_SIZE);
+		memset(hash2, 0xff, FILE_HASH_SIZE);
+		fileHash(fileno(fd1), HashAlgSha1, hash1);
 		FILE *fd2 = tmpfile();
 		char *testRes = "testfile1\t4\t4\ttestVal_10,testVal_11\t-\t-\t-\t-\n"
 			"testfile1\t4\t4\ttestVal_10,testVal_11\t-\t-\ttestVal_20\t-\n";
 		fwrite(testRes, 1, strlen(testRes), fd2);
 		fseek(fd2, 0L, SEEK_SET);
-		sha1file(fd2, &hash2[0]);
-		if (strcmp(hash1, hash2) != 0)
+		fileHash(fileno(fd2), HashAlgSha1, hash2);
+		if (memcmp(hash1, hash2, FILE_HASH_SIZE) != 0)
 		{
 			++errors_cnt;
 			printFailed("res");
@@ -1661,60 +1891,2071 @@ void testFields()
 	fieldsFree(fields);
 }
 
-unsigned int propCommon(struct PropertyStruct *prop)
+void testTagbin()
 {
-	unsigned int err = 0;
-	if (prop->maxSize == 0)
+	++tests_cnt;
+	testNm = "tagbinItemWrite";
+	struct ItemStruct *item = itemInitFromRawData(4, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"), L"\x0444\x0430\x0439\x043b", NULL, L"testName_10=testVal_10,testVal_11@testName_20=");
+	itemAddFileName(item, L"testfile2");
+	struct TagBinDict dict;
+	tagbinDictInit(&dict);
+	struct TagBinBuffer buf = { 0, 0, NULL };
+	FILE *fd = tmpfile();
+	if (item == NULL || tagbinItemWrite(fd, &dict, &buf, item, 20) != EXIT_SUCCESS || dict.count != 2)
 	{
-		++err;
-		printFailed("maxSize == 0");
+		++errors_cnt;
+		printFailed("write");
 	}
-	if (prop->curSize == 0)
+	else
 	{
-		++err;
-		printFailed("curSize == 0");
+		++tests_cnt;
+		testNm = "tagbinItemLoad";
+		struct TagBinItemHeader hdr;
+		struct ItemStruct *item2 = itemInit(4, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"));
+		if (tagbinReadItemHeader(buf.data, buf.length, 20, &hdr) != EXIT_SUCCESS || hdr.fileSize != 4 || hdr.hash[0] != 0xa9 ||
+			tagbinItemLoad(item2, &dict, buf.data + TAGBIN_ITEM_HEADER_SIZE(20), hdr.recLength) != EXIT_SUCCESS)
+		{
+			++errors_cnt;
+			printFailed("load");
+		}
+		else if (!itemIsEqual(item, item2) || item2->fileNameCount != 2 || !itemIsFileName(item2, L"\x0444\x0430\x0439\x043b"))
+		{
+			++errors_cnt;
+			printFailed("compare");
+		}
+		if (tagbinReadItemHeader(buf.data, buf.length - 1, 20, &hdr) == EXIT_SUCCESS)
+		{
+			++errors_cnt;
+			printFailed("truncated");
+		}
+		itemFree(item2);
 	}
-	if (prop->valuesOffset == 0)
+	fclose(fd);
+	if (item != NULL)
+		itemFree(item);
+
+	// A value longer than the buffer on the stack is written whole
+	++tests_cnt;
+	testNm = "tagbinItemWrite long value";
+	static wchar_t longVal[6000];
+	unsigned int i;
+	for (i = 0; i < 5000; ++i)
+		longVal[i] = L'a' + i % 26;
+	wcscpy(longVal + 5000, L",second");
+	item = itemInit(4, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"));
+	struct ItemStruct *item2 = itemInit(4, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"));
+	struct TagBinItemHeader hdr;
+	wchar_t valStr[6000];
+	fd = tmpfile();
+	if (item == NULL || item2 == NULL || itemAddFileName(item, L"f") != EXIT_SUCCESS ||
+		itemSetProperty(item, L"long", longVal) != EXIT_SUCCESS ||
+		tagbinItemWrite(fd, &dict, &buf, item, 20) != EXIT_SUCCESS ||
+		tagbinReadItemHeader(buf.data, buf.length, 20, &hdr) != EXIT_SUCCESS ||
+		tagbinItemLoad(item2, &dict, buf.data + TAGBIN_ITEM_HEADER_SIZE(20), hdr.recLength) != EXIT_SUCCESS ||
+		!itemIsEqual(item, item2) || itemPropertyValueLength(item2, 0) != 5007 ||
+		itemPropertyValueToString(item2, 0, valStr, 6000) != EXIT_SUCCESS || wcslen(valStr) != 5007)
 	{
-		++err;
-		printFailed("valuesOffset == 0");
+		++errors_cnt;
+		printFailed("long");
 	}
-	if (prop->arrayDirect != NULL)
+	if (fd != NULL)
+		fclose(fd);
+	if (item != NULL)
+		itemFree(item);
+	if (item2 != NULL)
+		itemFree(item2);
+	tagbinBufferFree(&buf);
+	tagbinDictFree(&dict);
+}
+
+void testUtf8()
+{
+	++tests_cnt;
+	testNm = "utf8ToWcs";
+	wchar_t wBuf[8];
+	if (utf8ToWcs(wBuf, "a\xd1\x84\xe2\x82\xac\xf0\x9f\x98\x80", 8) != 4 || wcscmp(wBuf, L"a\x0444\x20ac\x1f600") != 0)
 	{
-		++err;
-		printFailed("arrayDirect != NULL");
+		++errors_cnt;
+		printFailed("decode");
 	}
-	if (prop->arrayByValue != NULL)
+	if (utf8ToWcs(wBuf, "abc\xd1", 8) != (size_t) -1)
 	{
-		++err;
-		printFailed("arrayByValue != NULL");
+		++errors_cnt;
+		printFailed("invalid sequence");
 	}
-	if (prop->arrayByUser != NULL)
+	if (utf8ToWcs(wBuf, "abcd", 4) != 4)
 	{
-		++err;
-		printFailed("arrayByUser != NULL");
+		++errors_cnt;
+		printFailed("overflow");
 	}
-	if (prop->userData != 0)
+
+	++tests_cnt;
+	testNm = "wcsToUtf8";
+	char cBuf[16];
+	if (wcsToUtf8(cBuf, L"a\x0444\x20ac\x1f600", 16) != 10 || strcmp(cBuf, "a\xd1\x84\xe2\x82\xac\xf0\x9f\x98\x80") != 0)
 	{
-		++err;
-		printFailed("userData != 0");
+		++errors_cnt;
+		printFailed("encode");
 	}
-	if (wcscmp(propGetName(prop), L"testName_123") != 0)
+	if (wcsToUtf8(cBuf, L"a\x0444\x20ac\x1f600", 10) != 10)
 	{
-		++err;
-		printFailed("propGetName");
+		++errors_cnt;
+		printFailed("overflow");
 	}
-	return err;
 }
 
-void printFailed(const char *descr)
+void testTagidx()
 {
-	fprintf(stderr, "Test \"%s\"", testNm);
-	if (descr != NULL)
+	++tests_cnt;
+	testNm = "tagidxListWrite";
+	char path[] = "/tmp/tags_test_idx_XXXXXX";
+	int fdIndex = mkstemp(path);
+	char idxPath[sizeof(path) + sizeof(TAGIDX_SUFFIX)];
+	strcpy(idxPath, path);
+	strcat(idxPath, TAGIDX_SUFFIX);
+	struct TagIdxList list;
+	tagidxListInit(&list, 20);
+	unsigned char hash[FILE_HASH_SIZE];
+	unsigned int i;
+	for (i = 0; i < 1000; ++i)
+	{
+		memset(hash, 0, sizeof(hash));
+		hash[0] = i & 3;
+		tagidxListAppend(&list, 10 + i / 4, hash, i * 100);
+	}
+	if (fdIndex == -1 || tagidxListWrite(&list, idxPath, fdIndex) != EXIT_SUCCESS)
 	{
-		fprintf(stderr, ", \t\"");
-		fprintf(stderr, descr);
-		fprintf(stderr, "\"");
+		++errors_cnt;
+		printFailed("write");
 	}
-	fprintf(stderr, " \t\tFAILED\n");
+	else
+	{
+		++tests_cnt;
+		testNm = "tagidxLowerBound";
+		struct TagIdx idx;
+		tagidxInit(&idx);
+		if (tagidxOpen(&idx, idxPath, fdIndex, 20) != EXIT_SUCCESS || idx.count != 1000)
+		{
+			++errors_cnt;
+			printFailed("open");
+		}
+		else
+		{
+			const struct TagIdxEntry *entry;
+			hash[0] = 2;
+			if ((entry = tagidxLowerBound(&idx, 20, hash)) == NULL || entry->offset != 4200)
+			{
+				++errors_cnt;
+				printFailed("exact");
+			}
+			hash[0] = 5;
+			if ((entry = tagidxLowerBound(&idx, 20, hash)) == NULL || entry->offset != 4400)
+			{
+				++errors_cnt;
+				printFailed("between");
+			}
+			if (tagidxLowerBound(&idx, 1000, hash) != NULL)
+			{
+				++errors_cnt;
+				printFailed("after last");
+			}
+		}
+		tagidxClose(&idx);
+
+		// The entries of a copied range follow the range to its new offset
+		++tests_cnt;
+		testNm = "tagidxListAppendRange";
+		struct TagIdxList moved;
+		tagidxListInit(&moved, 20);
+		if (tagidxListAppendRange(&moved, list.entries, list.count, 250, 550, 1000) != EXIT_SUCCESS || moved.count != 3 ||
+			tagidxEntry(moved.entries, 20, 0)->offset != 1050 || tagidxEntry(moved.entries, 20, 2)->offset != 1250 ||
+			tagidxEntry(moved.entries, 20, 0)->fileSize != tagidxEntry(list.entries, 20, 3)->fileSize)
+		{
+			++errors_cnt;
+			printFailed("range");
+		}
+		tagidxListFree(&moved);
+
+		// Modification of the index file makes the sidecar stale
+		if (tagidxOpen(&idx, idxPath, fdIndex, 32) == EXIT_SUCCESS)
+		{
+			++errors_cnt;
+			printFailed("hash size");
+		}
+		tagidxClose(&idx);
+		if (write(fdIndex, "x", 1) != 1 || tagidxOpen(&idx, idxPath, fdIndex, 20) == EXIT_SUCCESS)
+		{
+			++errors_cnt;
+			printFailed("stale");
+		}
+		tagidxClose(&idx);
+	}
+	tagidxListFree(&list);
+	if (fdIndex != -1)
+	{
+		close(fdIndex);
+		unlink(path);
+		unlink(idxPath);
+	}
+}
+
+void testTagjournal()
+{
+	++tests_cnt;
+	testNm = "tagjournalCommit";
+	char path[] = "/tmp/tags_test_jrn_XXXXXX";
+	int fdIndex = mkstemp(path);
+	char jrnPath[sizeof(path) + sizeof(TAGJOURNAL_SUFFIX)];
+	strcpy(jrnPath, path);
+	strcat(jrnPath, TAGJOURNAL_SUFFIX);
+	struct TagJournal j;
+	tagjournalInit(&j);
+	j.hashSize = 20;
+	struct ItemStruct *item1 = itemInitFromRawData(10, testHash("0000000000000000000000000000000000000002"), L"b.txt", L"tag=x,y", NULL);
+	struct ItemStruct *item2 = itemInitFromRawData(10, testHash("0000000000000000000000000000000000000001"), L"a.txt", NULL, L"year=2013");
+	if (fdIndex == -1 || item1 == NULL || item2 == NULL
+		|| tagjournalInsertItem(&j, item1) != EXIT_SUCCESS || tagjournalInsertItem(&j, item2) != EXIT_SUCCESS
+		|| tagjournalCommit(&j, jrnPath, path, 1) != EXIT_SUCCESS)
+	{
+		++errors_cnt;
+		printFailed("commit");
+	}
+	else
+	{
+		++tests_cnt;
+		testNm = "tagjournalLoad";
+		struct TagJournal j2;
+		tagjournalInit(&j2);
+		if (tagjournalLoad(&j2, jrnPath, fdIndex, 20) != EXIT_SUCCESS || !j2.enabled || j2.count != 2)
+		{
+			++errors_cnt;
+			printFailed("load");
+		}
+		else
+		{
+			// The entries are sorted by the size and the hash
+			struct ItemStruct *item = tagjournalItemLoad(&j2.entries[0], NULL);
+			if (item == NULL || item->fileNameCount != 1 || wcscmp(itemGetFileName(item, 0), L"a.txt") != 0
+				|| itemGetPropertyPosByName(item, L"year") == NULL)
+			{
+				++errors_cnt;
+				printFailed("item");
+			}
+			if (item != NULL)
+				itemFree(item);
+		}
+		tagjournalFree(&j2);
+
+		// A transaction without its commit record is ignored
+		++tests_cnt;
+		testNm = "tagjournalLoad torn";
+		struct ItemStruct *item3 = itemInitFromRawData(20, testHash("0000000000000000000000000000000000000003"), L"c.txt", L"tag=z", NULL);
+		struct stat st;
+		if (item3 == NULL || tagjournalInsertItem(&j, item3) != EXIT_SUCCESS || tagjournalCommit(&j, jrnPath, path, 1) != EXIT_SUCCESS
+			|| stat(jrnPath, &st) != 0 || truncate(jrnPath, st.st_size - 1) != 0)
+		{
+			++errors_cnt;
+			printFailed("prepare");
+		}
+		else
+		{
+			tagjournalInit(&j2);
+			if (tagjournalLoad(&j2, jrnPath, fdIndex, 20) != EXIT_SUCCESS || j2.count != 2)
+			{
+				++errors_cnt;
+				printFailed("torn tail");
+			}
+			tagjournalFree(&j2);
+		}
+		if (item3 != NULL)
+			itemFree(item3);
+	}
+	tagjournalFree(&j);
+	if (item1 != NULL)
+		itemFree(item1);
+	if (item2 != NULL)
+		itemFree(item2);
+	if (fdIndex != -1)
+	{
+		close(fdIndex);
+		unlink(path);
+		unlink(jrnPath);
+	}
+
+	// A value longer than the buffers of the item strings is journaled whole
+	++tests_cnt;
+	testNm = "tagjournal long value";
+	static wchar_t longVal[3000];
+	unsigned int i;
+	for (i = 0; i < 2999; ++i)
+		longVal[i] = L'a' + i % 26;
+	strcpy(path, "/tmp/tags_test_jrn_XXXXXX");
+	fdIndex = mkstemp(path);
+	strcpy(jrnPath, path);
+	strcat(jrnPath, TAGJOURNAL_SUFFIX);
+	tagjournalInit(&j);
+	j.hashSize = 20;
+	struct TagJournal j2;
+	tagjournalInit(&j2);
+	struct ItemStruct *item = itemInitFromRawData(30, testHash("0000000000000000000000000000000000000004"), L"d.txt", NULL, NULL);
+	struct ItemStruct *loaded = NULL;
+	if (fdIndex == -1 || item == NULL || itemSetProperty(item, L"note", longVal) != EXIT_SUCCESS
+		|| tagjournalInsertItem(&j, item) != EXIT_SUCCESS || tagjournalCommit(&j, jrnPath, path, 1) != EXIT_SUCCESS
+		|| tagjournalLoad(&j2, jrnPath, fdIndex, 20) != EXIT_SUCCESS || j2.count != 1
+		|| (loaded = tagjournalItemLoad(&j2.entries[0], NULL)) == NULL
+		|| !itemIsEqual(item, loaded) || itemPropertyValueLength(loaded, 0) != 2999)
+	{
+		++errors_cnt;
+		printFailed("long");
+	}
+	if (loaded != NULL)
+		itemFree(loaded);
+	if (item != NULL)
+		itemFree(item);
+	tagjournalFree(&j2);
+	tagjournalFree(&j);
+	if (fdIndex != -1)
+	{
+		close(fdIndex);
+		unlink(path);
+		unlink(jrnPath);
+	}
+
+	// A journal is never written without the size of the hashes
+	++tests_cnt;
+	testNm = "tagjournalCreate hash size";
+	strcpy(path, "/tmp/tags_test_jrn_XXXXXX");
+	fdIndex = mkstemp(path);
+	strcpy(jrnPath, path);
+	strcat(jrnPath, TAGJOURNAL_SUFFIX);
+	if (fdIndex == -1 || tagjournalCreate(jrnPath, path, 0) == EXIT_SUCCESS || tagjournalCreate(jrnPath, path, FILE_HASH_SIZE + 1) == EXIT_SUCCESS
+		|| access(jrnPath, F_OK) == 0)
+	{
+		++errors_cnt;
+		printFailed("size");
+	}
+	if (fdIndex != -1)
+	{
+		close(fdIndex);
+		unlink(path);
+		unlink(jrnPath);
+	}
+}
+
+void testTagfileHash()
+{
+	// The index keeps the whole SHA-256 digest in every format, in the offset index and in the journal
+	static const enum TagFileFormat formats[] = { FormatSimple, FormatBinary, FormatCompressed };
+	static const char *names[] = { "tagfile sha256 simple", "tagfile sha256 binary", "tagfile sha256 compressed" };
+	static const size_t sizes[] = { 10, 10, 20 };
+	unsigned char hashes[3][FILE_HASH_SIZE];
+	unsigned int i;
+	for (i = 0; i < 3; ++i)
+	{
+		memset(hashes[i], 0x11 * (i + 1), FILE_HASH_SIZE);
+		hashes[i][FILE_HASH_SIZE - 1] = 0xf0 + i;
+	}
+	char dir[] = "/tmp/tags_test_tf_XXXXXX";
+	char cwd[PATH_MAX];
+	if (mkdtemp(dir) == NULL || getcwd(cwd, sizeof(cwd)) == NULL || chdir(dir) != 0)
+	{
+		++tests_cnt;
+		testNm = "tagfile sha256";
+		++errors_cnt;
+		printFailed("prepare");
+		return;
+	}
+
+	unsigned int f;
+	for (f = 0; f < 3; ++f)
+	{
+		++tests_cnt;
+		testNm = names[f];
+		unlink("tags.info");
+		unlink("tags.info.idx");
+		unlink("tags.info.journal");
+		int res = tagfileCreateIndex(formats[f], HashAlgSha256);
+		struct TagFileStruct *tf = NULL;
+		if (res == EXIT_SUCCESS && (tf = tagfileInit(NULL, NULL, ReadWrite)) != NULL && tagfileSetAppendMode(tf) == ErrorNone)
+		{
+			for (i = 0; i < 3 && res == EXIT_SUCCESS; ++i)
+			{
+				struct ItemStruct *item = itemInitFromRawData(sizes[i], hashes[i], L"f", L"n=1", NULL);
+				if (item == NULL || tagfileFindNextItemPosition(tf, sizes[i], hashes[i]) || tagfileInsertItem(tf, item) != ErrorNone)
+					res = EXIT_FAILURE;
+				if (item != NULL)
+					itemFree(item);
+			}
+			if (res == EXIT_SUCCESS && tagfileApplyModifications(tf) != ErrorNone)
+				res = EXIT_FAILURE;
+		}
+		else
+			res = EXIT_FAILURE;
+		if (tf != NULL)
+			tagfileFree(tf);
+		if (res != EXIT_SUCCESS)
+		{
+			++errors_cnt;
+			printFailed("write");
+			continue;
+		}
+
+		// The offset index and the journal are created, the second item is changed through the journal
+		struct ItemStruct *item = NULL;
+		if ((tf = tagfileInit(NULL, NULL, ReadOnly)) == NULL || tagfileBuildSidecar(tf) != ErrorNone || tagfileEnableJournal(tf) != ErrorNone)
+			res = EXIT_FAILURE;
+		if (tf != NULL)
+			tagfileFree(tf);
+		if (res != EXIT_SUCCESS || (tf = tagfileInit(NULL, NULL, ReadWrite)) == NULL || !tf->journaling ||
+			!tagfileFindNextItemPosition(tf, sizes[1], hashes[1]) || (item = tagfileItemLoad(tf)) == NULL ||
+			itemSetProperty(item, L"j", L"2") != EXIT_SUCCESS || tagfileInsertItem(tf, item) != ErrorNone ||
+			tagfileApplyModifications(tf) != ErrorNone)
+			res = EXIT_FAILURE;
+		if (item != NULL)
+			itemFree(item);
+		if (tf != NULL)
+			tagfileFree(tf);
+		if (res != EXIT_SUCCESS)
+		{
+			++errors_cnt;
+			printFailed("journal");
+			continue;
+		}
+
+		if ((tf = tagfileInit(NULL, NULL, ReadOnly)) == NULL || tf->hashSize != 32 || tf->sidecar.base == NULL || tf->journal.count != 1)
+			res = EXIT_FAILURE;
+		for (i = 0; i < 3 && res == EXIT_SUCCESS; ++i)
+		{
+			if ((item = tagfileGetNextItem(tf)) == NULL || item->fileSize != sizes[i] || memcmp(item->hash, hashes[i], FILE_HASH_SIZE) != 0 ||
+				(itemGetPropertyPosByName(item, L"j") != NULL) != (i == 1))
+				res = EXIT_FAILURE;
+			if (item != NULL)
+				itemFree(item);
+		}
+		if (tf != NULL)
+			tagfileFree(tf);
+		if (res == EXIT_SUCCESS && ((tf = tagfileInit(NULL, NULL, ReadOnly)) == NULL || !tagfileFindNextItemPosition(tf, sizes[2], hashes[2]) ||
+			memcmp(tf->curItemHash, hashes[2], FILE_HASH_SIZE) != 0))
+			res = EXIT_FAILURE;
+		if (tf != NULL)
+			tagfileFree(tf);
+		if (res != EXIT_SUCCESS)
+		{
+			++errors_cnt;
+			printFailed("read");
+		}
+	}
+	unlink("tags.info");
+	unlink("tags.info.idx");
+	unlink("tags.info.journal");
+	if (chdir(cwd) != 0 || rmdir(dir) != 0)
+	{
+		++errors_cnt;
+		printFailed("cleanup");
+	}
+}
+
+void testTagfileRewrite()
+{
+	// An item in the middle is changed, the untouched items around it are passed to the new index as raw bytes,
+	// the ranges are long enough for copy_file_range
+	static const enum TagFileFormat formats[] = { FormatSimple, FormatBinary };
+	static const char *names[] = { "tagfile rewrite simple", "tagfile rewrite binary" };
+	static wchar_t note[1001];
+	unsigned char hash[FILE_HASH_SIZE];
+	unsigned int i;
+	for (i = 0; i < 1000; ++i)
+		note[i] = L'a' + i % 26;
+	memset(hash, 0, FILE_HASH_SIZE);
+	char dir[] = "/tmp/tags_test_rw_XXXXXX";
+	char cwd[PATH_MAX];
+	if (mkdtemp(dir) == NULL || getcwd(cwd, sizeof(cwd)) == NULL || chdir(dir) != 0)
+	{
+		++tests_cnt;
+		testNm = "tagfile rewrite";
+		++errors_cnt;
+		printFailed("prepare");
+		return;
+	}
+
+	unsigned int f;
+	for (f = 0; f < 2; ++f)
+	{
+		++tests_cnt;
+		testNm = names[f];
+		unlink("tags.info");
+		unlink("tags.info.idx");
+		int res = tagfileCreateIndex(formats[f], HashAlgSha1);
+		struct TagFileStruct *tf = NULL;
+		if (res == EXIT_SUCCESS && (tf = tagfileInit(NULL, NULL, ReadWrite)) != NULL && tagfileSetAppendMode(tf) == ErrorNone)
+		{
+			for (i = 0; i < 200 && res == EXIT_SUCCESS; ++i)
+			{
+				memset(hash, i, 20);
+				struct ItemStruct *item = itemInitFromRawData((i + 1) * 10, hash, L"f", NULL, NULL);
+				if (item == NULL || itemSetProperty(item, L"note", note) != EXIT_SUCCESS ||
+					tagfileFindNextItemPosition(tf, (i + 1) * 10, hash) || tagfileInsertItem(tf, item) != ErrorNone)
+					res = EXIT_FAILURE;
+				if (item != NULL)
+					itemFree(item);
+			}
+			if (res == EXIT_SUCCESS && tagfileApplyModifications(tf) != ErrorNone)
+				res = EXIT_FAILURE;
+		}
+		else
+			res = EXIT_FAILURE;
+		if (tf != NULL)
+			tagfileFree(tf);
+
+		// The offsets of the first item, the changed one and the next one and the end of the items,
+		// before and after the change
+		uint64_t offsets[2][3];
+		unsigned char *data[2] = { NULL, NULL };
+		size_t size[2];
+		unsigned int pass;
+		for (pass = 0; pass < 2 && res == EXIT_SUCCESS; ++pass)
+		{
+			// The offset index is built by a scan first, then it is collected while the item is changed
+			struct ItemStruct *item = NULL;
+			memset(hash, 100, 20);
+			if ((tf = tagfileInit(NULL, NULL, (pass == 0) ? ReadOnly : ReadWrite)) == NULL)
+				res = EXIT_FAILURE;
+			else if (pass == 0 && tagfileBuildSidecar(tf) != ErrorNone)
+				res = EXIT_FAILURE;
+			else if (pass == 1 && (!tagfileFindNextItemPosition(tf, 1010, hash) ||
+				(item = tagfileItemLoad(tf)) == NULL || itemSetProperty(item, L"j", L"2") != EXIT_SUCCESS ||
+				tagfileInsertItem(tf, item) != ErrorNone || tagfileApplyModifications(tf) != ErrorNone))
+				res = EXIT_FAILURE;
+			if (item != NULL)
+				itemFree(item);
+			if (tf != NULL)
+				tagfileFree(tf);
+			tf = NULL;
+			if (res == EXIT_SUCCESS && ((tf = tagfileInit(NULL, NULL, ReadOnly)) == NULL || tf->sidecar.base == NULL || tf->sidecar.count != 200))
+				res = EXIT_FAILURE;
+			for (i = 0; i < 3 && res == EXIT_SUCCESS; ++i)
+				offsets[pass][i] = tagidxEntry(tf->sidecar.entries, tf->sidecar.hashSize, (i == 0) ? 0 : 99 + i)->offset;
+			if (tf != NULL)
+				tagfileFree(tf);
+			if (res == EXIT_SUCCESS && (data[pass] = testReadFile("tags.info", &size[pass])) == NULL)
+				res = EXIT_FAILURE;
+			else if (res == EXIT_SUCCESS && formats[f] == FormatBinary)
+			{
+				// The items of the binary index end at the dictionary
+				struct TagBinPreamble pre;
+				memcpy(&pre, data[pass] + offsets[pass][0] - sizeof(pre), sizeof(pre));
+				size[pass] = pre.dictOffset;
+			}
+		}
+		if (res != EXIT_SUCCESS)
+		{
+			++errors_cnt;
+			printFailed("write");
+		}
+		else if (offsets[0][1] - offsets[0][0] < 65536 || size[0] - offsets[0][2] < 65536 ||
+			offsets[1][1] - offsets[1][0] != offsets[0][1] - offsets[0][0] || size[1] - offsets[1][2] != size[0] - offsets[0][2] ||
+			memcmp(data[0] + offsets[0][0], data[1] + offsets[1][0], offsets[0][1] - offsets[0][0]) != 0 ||
+			memcmp(data[0] + offsets[0][2], data[1] + offsets[1][2], size[0] - offsets[0][2]) != 0)
+		{
+			++errors_cnt;
+			printFailed("items");
+		}
+		else
+		{
+			// The collected offset index is the one the scan builds and it finds the items
+			size_t idxSize[2];
+			unsigned char *idx[2] = { testReadFile("tags.info.idx", &idxSize[0]), NULL };
+			if ((tf = tagfileInit(NULL, NULL, ReadOnly)) == NULL || tagfileBuildSidecar(tf) != ErrorNone)
+				res = EXIT_FAILURE;
+			if (tf != NULL)
+				tagfileFree(tf);
+			idx[1] = testReadFile("tags.info.idx", &idxSize[1]);
+			if (res != EXIT_SUCCESS || idx[0] == NULL || idx[1] == NULL || idxSize[0] != idxSize[1] || memcmp(idx[0], idx[1], idxSize[0]) != 0)
+				res = EXIT_FAILURE;
+			free(idx[0]);
+			free(idx[1]);
+			static const unsigned int found[] = { 0, 99, 100, 101, 199 };
+			for (i = 0; i < 5 && res == EXIT_SUCCESS; ++i)
+			{
+				struct ItemStruct *item = NULL;
+				memset(hash, found[i], 20);
+				if ((tf = tagfileInit(NULL, NULL, ReadOnly)) == NULL || !tagfileFindNextItemPosition(tf, (found[i] + 1) * 10, hash) ||
+					(item = tagfileItemLoad(tf)) == NULL || item->fileSize != (found[i] + 1) * 10 ||
+					(itemGetPropertyPosByName(item, L"j") != NULL) != (found[i] == 100))
+					res = EXIT_FAILURE;
+				if (item != NULL)
+					itemFree(item);
+				if (tf != NULL)
+					tagfileFree(tf);
+			}
+			if (res != EXIT_SUCCESS)
+			{
+				++errors_cnt;
+				printFailed("offset index");
+			}
+		}
+		free(data[0]);
+		free(data[1]);
+	}
+
+	// The lines of the simple format are not limited by a buffer, a scan keeps the sequential read-ahead
+	// and a lookup through the offset index turns it off
+	++tests_cnt;
+	testNm = "tagfile long line";
+	static wchar_t longVal[5001];
+	for (i = 0; i < 5000; ++i)
+		longVal[i] = L'a' + i % 26;
+	unlink("tags.info");
+	unlink("tags.info.idx");
+	int res = tagfileCreateIndex(FormatSimple, HashAlgSha1);
+	struct TagFileStruct *tf = NULL;
+	struct ItemStruct *first = itemInitFromRawData(10, hash, L"e", NULL, NULL);
+	struct ItemStruct *item = NULL;
+	struct ItemStruct *loaded = NULL;
+	memset(hash, 7, 20);
+	if (res != EXIT_SUCCESS || first == NULL || (tf = tagfileInit(NULL, NULL, ReadWrite)) == NULL || tagfileSetAppendMode(tf) != ErrorNone ||
+		(item = itemInitFromRawData(70, hash, L"f", NULL, NULL)) == NULL || itemSetProperty(item, L"long", longVal) != EXIT_SUCCESS ||
+		tagfileInsertItem(tf, first) != ErrorNone || tagfileInsertItem(tf, item) != ErrorNone || tagfileApplyModifications(tf) != ErrorNone)
+		res = EXIT_FAILURE;
+	if (tf != NULL)
+		tagfileFree(tf);
+	tf = NULL;
+	for (i = 0; i < 2 && res == EXIT_SUCCESS; ++i)
+	{
+		if ((i == 0 && (tf = tagfileInit(NULL, NULL, ReadOnly)) == NULL) || (loaded = tagfileGetNextItem(tf)) == NULL ||
+			!itemIsEqual((i == 0) ? first : item, loaded) || (i == 1 && itemPropertyValueLength(loaded, 0) != 5000) || tf->map.random)
+			res = EXIT_FAILURE;
+		if (loaded != NULL)
+			itemFree(loaded);
+		loaded = NULL;
+	}
+	if (tf != NULL)
+		tagfileFree(tf);
+	tf = NULL;
+	if (res == EXIT_SUCCESS && ((tf = tagfileInit(NULL, NULL, ReadOnly)) == NULL || tagfileBuildSidecar(tf) != ErrorNone))
+		res = EXIT_FAILURE;
+	if (tf != NULL)
+		tagfileFree(tf);
+	tf = NULL;
+	if (res == EXIT_SUCCESS && ((tf = tagfileInit(NULL, NULL, ReadOnly)) == NULL || !tagfileFindNextItemPosition(tf, 70, hash) ||
+		!tf->map.random || (loaded = tagfileItemLoad(tf)) == NULL || !itemIsEqual(item, loaded)))
+		res = EXIT_FAILURE;
+	if (loaded != NULL)
+		itemFree(loaded);
+	if (item != NULL)
+		itemFree(item);
+	if (first != NULL)
+		itemFree(first);
+	if (tf != NULL)
+		tagfileFree(tf);
+	if (res != EXIT_SUCCESS)
+	{
+		++errors_cnt;
+		printFailed("long");
+	}
+
+	unlink("tags.info");
+	unlink("tags.info.idx");
+	if (chdir(cwd) != 0 || rmdir(dir) != 0)
+	{
+		++errors_cnt;
+		printFailed("cleanup");
+	}
+}
+
+void testTaglz()
+{
+	++tests_cnt;
+	testNm = "taglzCompress";
+	size_t len = 100000;
+	unsigned char *src = malloc(len);
+	size_t bound = taglzCompressBound(len);
+	unsigned char *comp = malloc(bound);
+	unsigned char *dst = malloc(len);
+	if (src == NULL || comp == NULL || dst == NULL)
+	{
+		++errors_cnt;
+		printFailed("malloc");
+	}
+	else
+	{
+		// Repeated text with noise, the tail is not compressible
+		size_t i;
+		unsigned int rnd = 12345;
+		for (i = 0; i < len; ++i)
+		{
+			rnd = rnd * 1103515245 + 12345;
+			src[i] = (i < len / 2 && (rnd >> 16) % 8 != 0) ? (unsigned char)"tag=animals,cat,pets\n"[i % 21] : (unsigned char)(rnd >> 16);
+		}
+		size_t compLen = taglzCompress(src, len, comp, bound);
+		if (compLen == 0 || compLen >= len)
+		{
+			++errors_cnt;
+			printFailed("compress");
+		}
+		else
+		{
+			++tests_cnt;
+			testNm = "taglzDecompress";
+			if (taglzDecompress(comp, compLen, dst, len) != EXIT_SUCCESS || memcmp(src, dst, len) != 0)
+			{
+				++errors_cnt;
+				printFailed("round trip");
+			}
+			if (taglzDecompress(comp, compLen - 1, dst, len) == EXIT_SUCCESS || taglzDecompress(comp, compLen, dst, len - 1) == EXIT_SUCCESS)
+			{
+				++errors_cnt;
+				printFailed("truncated");
+			}
+		}
+
+		++tests_cnt;
+		testNm = "taglzCompress short";
+		compLen = taglzCompress(src, 3, comp, bound);
+		if (compLen == 0 || taglzDecompress(comp, compLen, dst, 3) != EXIT_SUCCESS || memcmp(src, dst, 3) != 0)
+		{
+			++errors_cnt;
+			printFailed("3 bytes");
+		}
+	}
+	free(src);
+	free(comp);
+	free(dst);
+}
+
+void testTaginv()
+{
+	++tests_cnt;
+	testNm = "taginvListWrite";
+	char path[] = "/tmp/tags_test_inv_XXXXXX";
+	int fdIndex = mkstemp(path);
+	char invPath[sizeof(path) + sizeof(TAGINV_SUFFIX)];
+	strcpy(invPath, path);
+	strcat(invPath, TAGINV_SUFFIX);
+	struct TagInvList list;
+	memset(&list, 0, sizeof(list));
+	// Keys: "tag\0a" for the even offsets, "tag\0b" for the multiples of three, appended twice
+	unsigned int i;
+	for (i = 0; i < 2 * 300; ++i)
+	{
+		uint64_t offset = (299 - i % 300) * 10;
+		if ((offset / 10) % 2 == 0)
+			taginvListAppend(&list, "tag\0a", 5, offset);
+		if ((offset / 10) % 3 == 0)
+			taginvListAppend(&list, "tag\0b", 5, offset);
+	}
+	if (fdIndex == -1 || taginvListWrite(&list, invPath, fdIndex) != EXIT_SUCCESS)
+	{
+		++errors_cnt;
+		printFailed("write");
+	}
+	else
+	{
+		++tests_cnt;
+		testNm = "taginvLookup";
+		struct TagInv inv;
+		taginvInit(&inv);
+		struct TagBitmap bmA, bmB, bmC;
+		tagbitmapInit(&bmA);
+		tagbitmapInit(&bmB);
+		tagbitmapInit(&bmC);
+		if (taginvOpen(&inv, invPath, fdIndex) != EXIT_SUCCESS || inv.keyCount != 2 || inv.itemCount != 200)
+		{
+			++errors_cnt;
+			printFailed("open");
+		}
+		else if (taginvLookup(&inv, "tag\0a", 5, &bmA) != EXIT_SUCCESS || tagbitmapCardinality(&bmA) != 150 ||
+			taginvLookup(&inv, "tag\0b", 5, &bmB) != EXIT_SUCCESS || tagbitmapCardinality(&bmB) != 100 ||
+			taginvLookup(&inv, "tag\0c", 5, &bmC) != EXIT_SUCCESS || tagbitmapCardinality(&bmC) != 0)
+		{
+			++errors_cnt;
+			printFailed("count");
+		}
+		else
+		{
+			// The ids of a key map to the ascending offsets of its items
+			struct TagBitmapIter it;
+			tagbitmapIterInit(&it);
+			uint32_t id;
+			uint64_t prev = 0;
+			for (i = 0; tagbitmapNext(&bmA, &it, &id); ++i)
+			{
+				uint64_t offset = inv.items[id];
+				if ((offset / 10) % 2 != 0 || (i != 0 && offset <= prev))
+				{
+					++errors_cnt;
+					printFailed("items");
+					break;
+				}
+				prev = offset;
+			}
+			tagbitmapAnd(&bmA, &bmB);
+			if (tagbitmapCardinality(&bmA) != 50 || !tagbitmapContains(&bmA, invFindId(&inv, 60)) || tagbitmapContains(&bmA, invFindId(&inv, 30)))
+			{
+				++errors_cnt;
+				printFailed("and");
+			}
+		}
+		tagbitmapFree(&bmA);
+		tagbitmapFree(&bmB);
+		tagbitmapFree(&bmC);
+		taginvClose(&inv);
+
+		// Modification of the index file makes the inverted index stale
+		++tests_cnt;
+		testNm = "taginvOpen";
+		if (write(fdIndex, "x", 1) != 1 || taginvOpen(&inv, invPath, fdIndex) == EXIT_SUCCESS)
+		{
+			++errors_cnt;
+			printFailed("stale");
+		}
+		taginvClose(&inv);
+	}
+	taginvListFree(&list);
+	if (fdIndex != -1)
+	{
+		close(fdIndex);
+		unlink(path);
+		unlink(invPath);
+	}
+}
+
+void testTagbitmap()
+{
+	++tests_cnt;
+	testNm = "tagbitmapAdd";
+	struct TagBitmap odd, three, res;
+	tagbitmapInit(&odd);
+	tagbitmapInit(&three);
+	tagbitmapInit(&res);
+	// The odd numbers fill bitmap containers, the multiples of three in the second range stay arrays
+	uint32_t i;
+	for (i = 1; i < 200000; i += 2)
+		tagbitmapAdd(&odd, i);
+	for (i = 0; i < 30000; i += 3)
+		tagbitmapAdd(&three, 70000 + (29997 - i));
+	tagbitmapAdd(&three, 5);
+	tagbitmapAdd(&three, 5);
+	uint32_t max;
+	if (tagbitmapCardinality(&odd) != 100000 || odd.count != 4 || odd.containers[0].type != TagBitmapBits ||
+		tagbitmapCardinality(&three) != 10001 || three.count != 2 || three.containers[1].type != TagBitmapBits ||
+		!tagbitmapContains(&three, 70000 + 29997) || tagbitmapContains(&three, 70001) ||
+		!tagbitmapMaximum(&odd, &max) || max != 199999)
+	{
+		++errors_cnt;
+		printFailed("count");
+	}
+
+	++tests_cnt;
+	testNm = "tagbitmapAnd";
+	tagbitmapOr(&res, &three);
+	tagbitmapAnd(&res, &odd);
+	// The odd multiples of three between 70000 and 99997 and the 5
+	size_t expected = 1;
+	for (i = 70000; i < 100000; ++i)
+		if (i % 2 == 1 && (i - 70000) % 3 == 0)
+			++expected;
+	if (tagbitmapCardinality(&res) != expected || res.containers[res.count - 1].type != TagBitmapBits ||
+		!tagbitmapContains(&res, 5) || !tagbitmapContains(&res, 70003) || tagbitmapContains(&res, 70006))
+	{
+		++errors_cnt;
+		printFailed("and");
+	}
+
+	++tests_cnt;
+	testNm = "tagbitmapOr";
+	tagbitmapOr(&res, &odd);
+	struct TagBitmapIter it;
+	tagbitmapIterInit(&it);
+	uint32_t val;
+	uint32_t prev = 0;
+	size_t cnt = 0;
+	while (tagbitmapNext(&res, &it, &val))
+	{
+		if (val % 2 != 1 || (cnt != 0 && val <= prev))
+			break;
+		prev = val;
+		++cnt;
+	}
+	if (cnt != 100000 || tagbitmapCardinality(&res) != 100000)
+	{
+		++errors_cnt;
+		printFailed("or");
+	}
+
+	++tests_cnt;
+	testNm = "tagbitmapSerialize";
+	size_t len = tagbitmapSerializedSize(&three);
+	unsigned char *buf = malloc(len);
+	struct TagBitmap copy;
+	tagbitmapInit(&copy);
+	if (buf == NULL)
+	{
+		++errors_cnt;
+		printFailed("malloc");
+	}
+	else
+	{
+		tagbitmapSerialize(&three, buf);
+		if (tagbitmapDeserialize(&copy, buf, len) != EXIT_SUCCESS || tagbitmapCardinality(&copy) != 10001 ||
+			!tagbitmapContains(&copy, 5) || !tagbitmapContains(&copy, 70000))
+		{
+			++errors_cnt;
+			printFailed("round trip");
+		}
+		if (tagbitmapDeserialize(&copy, buf, len - 1) == EXIT_SUCCESS || copy.count != 0)
+		{
+			++errors_cnt;
+			printFailed("truncated");
+		}
+		free(buf);
+	}
+	tagbitmapFree(&copy);
+	tagbitmapFree(&odd);
+	tagbitmapFree(&three);
+	tagbitmapFree(&res);
+}
+
+void testTagplan()
+{
+	++tests_cnt;
+	testNm = "tagplanBuild";
+	struct WhereStruct *whr = whereInit(L"year@tag=common@tag=rare,none");
+	struct TagPlan plan;
+	tagplanInit(&plan);
+	// Without statistics the conditions with values go first
+	if (whr == NULL || tagplanBuild(&plan, whr, NULL, 0) != EXIT_SUCCESS || plan.stepCount != 3 ||
+		plan.access != PlanFullScan || plan.steps[0].cond != whr->conditions[1] ||
+		plan.steps[1].cond != whr->conditions[2] || plan.steps[2].kind != PlanCondPresent)
+	{
+		++errors_cnt;
+		printFailed("guess");
+	}
+
+	char path[] = "/tmp/tags_test_plan_XXXXXX";
+	int fdIndex = mkstemp(path);
+	char invPath[sizeof(path) + sizeof(TAGINV_SUFFIX)];
+	strcpy(invPath, path);
+	strcat(invPath, TAGINV_SUFFIX);
+	struct TagInvList list;
+	memset(&list, 0, sizeof(list));
+	struct TagBinBuffer key = { 0, 0, NULL };
+	unsigned int i;
+	for (i = 0; i < 1000; ++i)
+	{
+		taginvMakeKey(&key, L"Tag", L"Common");
+		taginvListAppend(&list, (const char *)key.data, key.length, i * 10);
+		if (i % 100 == 0)
+		{
+			taginvMakeKey(&key, L"tag", L"rare");
+			taginvListAppend(&list, (const char *)key.data, key.length, i * 10);
+		}
+		if (i % 2 == 0)
+		{
+			taginvMakeKey(&key, L"year", L"2013");
+			taginvListAppend(&list, (const char *)key.data, key.length, i * 10);
+		}
+	}
+	struct TagInv inv;
+	taginvInit(&inv);
+	if (fdIndex == -1 || taginvListWrite(&list, invPath, fdIndex) != EXIT_SUCCESS || taginvOpen(&inv, invPath, fdIndex) != EXIT_SUCCESS)
+	{
+		++errors_cnt;
+		printFailed("inverted index");
+	}
+	else
+	{
+		// The statistics put the rare value first and make the inverted index worth using
+		++tests_cnt;
+		testNm = "tagplanBuild stats";
+		if (whr == NULL || tagplanBuild(&plan, whr, &inv, inv.itemCount) != EXIT_SUCCESS || !plan.hasStats ||
+			plan.access != PlanInvertedIndex || plan.steps[0].cond != whr->conditions[2] ||
+			plan.steps[1].cond != whr->conditions[0] || plan.steps[2].cond != whr->conditions[1] ||
+			plan.steps[0].selectivity != 0.01 || plan.steps[1].selectivity != 0.5)
+		{
+			++errors_cnt;
+			printFailed("order");
+		}
+		struct WhereStruct *whr2 = whereInit(L"tag=common@year=2013");
+		if (whr2 == NULL || tagplanBuild(&plan, whr2, &inv, inv.itemCount) != EXIT_SUCCESS || plan.access != PlanFullScan)
+		{
+			++errors_cnt;
+			printFailed("full scan");
+		}
+		if (whr2 != NULL)
+			whereFree(whr2);
+	}
+	tagplanFree(&plan);
+	taginvClose(&inv);
+	taginvListFree(&list);
+	tagbinBufferFree(&key);
+	if (whr != NULL)
+		whereFree(whr);
+	if (fdIndex != -1)
+	{
+		close(fdIndex);
+		unlink(path);
+		unlink(invPath);
+	}
+}
+
+void testTagarena()
+{
+	++tests_cnt;
+	testNm = "tagarenaAlloc";
+	struct TagArena arena;
+	tagarenaInit(&arena);
+	char *p1 = tagarenaAlloc(&arena, 100);
+	char *p2 = tagarenaAlloc(&arena, 10);
+	if (p1 == NULL || p2 == NULL || p2 < p1 + 100 || ((size_t)p2 & 15) != 0)
+	{
+		++errors_cnt;
+		printFailed("alloc");
+		tagarenaFree(&arena);
+		return;
+	}
+	memset(p2, 'x', 10);
+	if (tagarenaRealloc(&arena, p2, 10, 1000) != p2)
+	{
+		++errors_cnt;
+		printFailed("realloc last");
+	}
+	char *p3 = tagarenaRealloc(&arena, p1, 100, 200);
+	if (p3 == NULL || p3 == p1)
+	{
+		++errors_cnt;
+		printFailed("realloc copy");
+	}
+	char *big = tagarenaAlloc(&arena, TAGARENA_BLOCK_MIN * 3);
+	if (big == NULL || arena.head->next == NULL)
+	{
+		++errors_cnt;
+		printFailed("large");
+	}
+	tagarenaReset(&arena);
+	if (arena.head == NULL || arena.head->next != NULL || arena.head->used != 0 || arena.head->size < TAGARENA_BLOCK_MIN * 3)
+	{
+		++errors_cnt;
+		printFailed("reset");
+	}
+
+	++tests_cnt;
+	testNm = "itemInitArena";
+	struct ItemStruct *heapItem = itemInit(0, NULL);
+	unsigned int i;
+	for (i = 0; heapItem != NULL && i < 3; ++i)
+	{
+		struct ItemStruct *item = itemInitArena(&arena, 4, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"));
+		if (item == NULL || itemAddFileName(item, L"name") != EXIT_SUCCESS ||
+			itemSetProperty(item, L"tag", (i == 1) ? L"cat,dog" : L"cat") != EXIT_SUCCESS ||
+			itemSetProperty(item, L"year", L"2013") != EXIT_SUCCESS)
+		{
+			++errors_cnt;
+			printFailed("load");
+			break;
+		}
+		if (propGetSubval(*itemGetPropertyPosByName(item, L"tag"), 0, ByValue) == NULL || itemMerge(heapItem, item) != EXIT_SUCCESS)
+		{
+			++errors_cnt;
+			printFailed("merge");
+			break;
+		}
+		tagarenaReset(&arena);
+	}
+	tagarenaFree(&arena);
+	// The merged item keeps its copies after the arena is gone
+	struct PropertyStruct **pp;
+	if (heapItem == NULL || heapItem->propsCount != 2 || heapItem->fileNameCount != 1 ||
+		(pp = itemGetPropertyPosByName(heapItem, L"tag")) == NULL || (*pp)->arena != NULL ||
+		(*pp)->valCount != 2 || (*pp)->userData != 2 || propIsSubval(*pp, L"dog") == NULL)
+	{
+		++errors_cnt;
+		printFailed("heap copy");
+	}
+	if (heapItem != NULL)
+		itemFree(heapItem);
+}
+
+void testFileitems()
+{
+	++tests_cnt;
+	testNm = "fileHash";
+	char path1[] = "/tmp/tags_test_fi_XXXXXX";
+	char path2[] = "/tmp/tags_test_fi_XXXXXX";
+	int fd1 = mkstemp(path1);
+	int fd2 = mkstemp(path2);
+	if (fd1 == -1 || fd2 == -1 || write(fd1, "abc", 3) != 3 || write(fd2, "abcdef", 6) != 6)
+	{
+		++errors_cnt;
+		printFailed("create");
+	}
+	else
+	{
+		unsigned char hash[FILE_HASH_SIZE];
+		char hex[FILE_HASH_LEN + 1];
+		FILE *fd = fopen(path1, "r");
+		if (fd == NULL || fileHash(fileno(fd), HashAlgSha1, hash) != EXIT_SUCCESS)
+		{
+			++errors_cnt;
+			printFailed("hash");
+		}
+		else
+		{
+			digestToHex(hash, hashalgSize(HashAlgSha1), hex);
+			if (strcmp(hex, "a9993e364706816aba3e25717850c26c9cd0d89d") != 0 || hash[FILE_HASH_SIZE - 1] != 0)
+			{
+				++errors_cnt;
+				printFailed("hex");
+			}
+		}
+		if (fd != NULL && (lseek(fileno(fd), 0, SEEK_SET) == -1 || fileHash(fileno(fd), HashAlgSha256, hash) != EXIT_SUCCESS))
+		{
+			++errors_cnt;
+			printFailed("sha256");
+		}
+		else if (fd != NULL)
+		{
+			digestToHex(hash, hashalgSize(HashAlgSha256), hex);
+			if (strcmp(hex, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad") != 0)
+			{
+				++errors_cnt;
+				printFailed("sha256 hex");
+			}
+		}
+		if (fd != NULL)
+			fclose(fd);
+
+		++tests_cnt;
+		testNm = "fileHash read modes";
+		// The read and the mapped file with the default and the smallest buffer, from the start and an offset
+		char path3[] = "/tmp/tags_test_fi_XXXXXX";
+		static unsigned char data[300000];
+		unsigned int i;
+		for (i = 0; i < sizeof(data); ++i)
+			data[i] = (i * 13 + i / 4099) & 0xff;
+		int fd3 = mkstemp(path3);
+		if (fd3 == -1 || write(fd3, data, sizeof(data)) != sizeof(data))
+		{
+			++errors_cnt;
+			printFailed("create");
+		}
+		else
+		{
+			unsigned char expected[2][FILE_HASH_SIZE];
+			unsigned int offsets[2] = { 0, 5000 };
+			SHA1_CTX ctx;
+			memset(expected, 0, sizeof(expected));
+			for (i = 0; i < 2; ++i)
+			{
+				SHA1Init(&ctx);
+				SHA1Update(&ctx, data + offsets[i], sizeof(data) - offsets[i]);
+				SHA1Final(expected[i], &ctx);
+			}
+			for (i = 0; i < 8; ++i)
+			{
+				hashRead       = (i & 1) ? HashReadMmap : HashReadStream;
+				hashBufferSize = (i & 2) ? HASH_BUFFER_MIN : 0;
+				if (lseek(fd3, offsets[i >> 2], SEEK_SET) == -1 || fileHash(fd3, HashAlgSha1, hash) != EXIT_SUCCESS ||
+					memcmp(hash, expected[i >> 2], FILE_HASH_SIZE) != 0 || lseek(fd3, 0, SEEK_CUR) != sizeof(data))
+				{
+					++errors_cnt;
+					printFailed("compare");
+					break;
+				}
+			}
+			hashRead       = HashReadStream;
+			hashBufferSize = 0;
+		}
+		if (fd3 != -1)
+		{
+			close(fd3);
+			unlink(path3);
+		}
+
+		++tests_cnt;
+		testNm = "fileitemsInitFromList";
+		char *files[] = { path2, path1, path2, path1 };
+		struct FileItemList *fil = fileitemsInitFromList(files, 4, 5, MaskFile);
+		if (fil == NULL || fil->filesCount != 2)
+		{
+			++errors_cnt;
+			printFailed("duplicates");
+		}
+		else
+		{
+			fileitemsSort(fil, SortBySize);
+			struct FileItem **pFi = fil->fileItems;
+			if (pFi[0]->size != 3 || pFi[1]->size != 6 || wcsncmp(pFi[0]->name, L"tags_test_fi_", 13) != 0 ||
+				pFi[0]->path + 5 != pFi[0]->name || wcslen(pFi[0]->path) != strlen(path1))
+			{
+				++errors_cnt;
+				printFailed("items");
+			}
+		}
+		if (fil != NULL)
+			fileitemsFree(fil);
+	}
+	if (fd1 != -1)
+	{
+		close(fd1);
+		unlink(path1);
+	}
+	if (fd2 != -1)
+	{
+		close(fd2);
+		unlink(path2);
+	}
+
+	++tests_cnt;
+	testNm = "fileitemsCalculateHashes";
+	char paths[7][32];
+	char *files[7];
+	unsigned int i;
+	for (i = 0; i < 7; ++i)
+	{
+		strcpy(paths[i], "/tmp/tags_test_hs_XXXXXX");
+		files[i] = paths[i];
+		int fd = mkstemp(paths[i]);
+		if (fd != -1)
+		{
+			unsigned int j;
+			for (j = 0; j <= i; ++j)
+				if (write(fd, "0123456789", i + 1) != i + 1)
+					break;
+			// The last one takes several reads of the io_uring worker
+			for (j = 0; i == 6 && j < 30000; ++j)
+				if (write(fd, "0123456789", 10) != 10)
+					break;
+			close(fd);
+		}
+	}
+	// The files are opened by their names, relative to the current directory.
+	// They are hashed by the blocking reads, then by one and by three io_uring workers,
+	// then by the other hashes
+	static const enum HashAlg modeAlgs[5] = { HashAlgSha1, HashAlgSha1, HashAlgSha1, HashAlgXxh128, HashAlgSha256 };
+	char cwd[PATH_MAX];
+	struct FileItemList *fil = fileitemsInitFromList(files, 7, 5, MaskFile);
+	unsigned int mode;
+	for (mode = 0; mode < 5; ++mode)
+	{
+		int hashRes = EXIT_FAILURE;
+		hashIo = (mode == 0 || mode == 3) ? HashIoRead : HashIoUring;
+		if (fil != NULL && getcwd(cwd, sizeof(cwd)) != NULL && chdir("/tmp") == 0)
+		{
+			for (i = 0; i < fil->filesCount; ++i)
+				memset(fil->fileItems[i]->hash, 0, FILE_HASH_SIZE);
+			hashRes = fileitemsCalculateHashes(fil, modeAlgs[mode], (mode == 1) ? 1 : 3, NULL);
+			if (chdir(cwd) != 0)
+				hashRes = EXIT_FAILURE;
+		}
+		hashIo = HashIoRead;
+		if (fil == NULL || fil->filesCount != 7 || hashRes != EXIT_SUCCESS)
+		{
+			++errors_cnt;
+			printFailed("hash");
+			break;
+		}
+		else
+		{
+			for (i = 0; i < fil->filesCount; ++i)
+			{
+				struct FileItem *fi = fil->fileItems[i];
+				unsigned char hash[FILE_HASH_SIZE];
+				char sPath[32];
+				wcsToUtf8(sPath, fi->path, sizeof(sPath));
+				FILE *fd = fopen(sPath, "r");
+				if (fd == NULL || fileHash(fileno(fd), modeAlgs[mode], hash) != EXIT_SUCCESS || memcmp(hash, fi->hash, FILE_HASH_SIZE) != 0)
+				{
+					++errors_cnt;
+					printFailed("compare");
+					i = fil->filesCount;
+				}
+				if (fd != NULL)
+					fclose(fd);
+			}
+		}
+	}
+
+	// A busy kernel delays the reads of the io_uring workers, a failed submit leaves the files to the blocking reads
+	static const int failErrnos[2] = { EAGAIN, EIO };
+	static const int failCounts[2] = { 3, 1000 };
+	static const char *failNames[2] = { "fileitemsCalculateHashes uring busy", "fileitemsCalculateHashes uring failed" };
+	for (mode = 0; mode < 2 && fil != NULL; ++mode)
+	{
+		++tests_cnt;
+		testNm = failNames[mode];
+		int hashRes = EXIT_FAILURE;
+		hashIo = HashIoUring;
+		_uringFailErrno = failErrnos[mode];
+		_uringFailCount = failCounts[mode];
+		if (getcwd(cwd, sizeof(cwd)) != NULL && chdir("/tmp") == 0)
+		{
+			for (i = 0; i < fil->filesCount; ++i)
+				memset(fil->fileItems[i]->hash, 0, FILE_HASH_SIZE);
+			hashRes = fileitemsCalculateHashes(fil, HashAlgSha1, (mode == 0) ? 1 : 3, NULL);
+			if (chdir(cwd) != 0)
+				hashRes = EXIT_FAILURE;
+		}
+		hashIo = HashIoRead;
+		_uringFailCount = 0;
+		for (i = 0; hashRes == EXIT_SUCCESS && i < fil->filesCount; ++i)
+		{
+			struct FileItem *fi = fil->fileItems[i];
+			unsigned char hash[FILE_HASH_SIZE];
+			char sPath[32];
+			wcsToUtf8(sPath, fi->path, sizeof(sPath));
+			FILE *fd = fopen(sPath, "r");
+			if (fd == NULL || fileHash(fileno(fd), HashAlgSha1, hash) != EXIT_SUCCESS || memcmp(hash, fi->hash, FILE_HASH_SIZE) != 0)
+				hashRes = EXIT_FAILURE;
+			if (fd != NULL)
+				fclose(fd);
+		}
+		if (hashRes != EXIT_SUCCESS || _hashThreads != 0)
+		{
+			++errors_cnt;
+			printFailed("hash");
+		}
+	}
+
+	if (fil != NULL)
+		fileitemsFree(fil);
+	for (i = 0; i < 7; ++i)
+		unlink(paths[i]);
+}
+
+unsigned int propCommon(struct PropertyStruct *prop)
+{
+	unsigned int err = 0;
+	if (prop->maxSize == 0)
+	{
+		++err;
+		printFailed("maxSize == 0");
+	}
+	if (prop->curSize == 0)
+	{
+		++err;
+		printFailed("curSize == 0");
+	}
+	if (prop->valuesOffset == 0)
+	{
+		++err;
+		printFailed("valuesOffset == 0");
+	}
+	if (prop->arrayDirect != NULL)
+	{
+		++err;
+		printFailed("arrayDirect != NULL");
+	}
+	if (prop->arrayByValue != NULL)
+	{
+		++err;
+		printFailed("arrayByValue != NULL");
+	}
+	if (prop->arrayByUser != NULL)
+	{
+		++err;
+		printFailed("arrayByUser != NULL");
+	}
+	if (prop->userData != 0)
+	{
+		++err;
+		printFailed("userData != 0");
+	}
+	if (wcscmp(propGetName(prop), L"testName_123") != 0)
+	{
+		++err;
+		printFailed("propGetName");
+	}
+	return err;
+}
+
+void testDigest()
+{
+	unsigned char digest[FILE_HASH_SIZE];
+	unsigned char digest2[FILE_HASH_SIZE];
+	char hex[FILE_HASH_LEN + 1];
+	char expect[FILE_HASH_LEN + 1];
+	unsigned int i, j;
+
+	// The hex kernels of AVX2 are checked when the processor has them, then the SSE2 ones
+	memset(digest, 0, FILE_HASH_SIZE);
+	_digestAvx2 = -1;
+	digestToHex(digest, FILE_HASH_SIZE, hex);
+	int hasAvx2 = _digestAvx2;
+	int vec;
+	for (vec = hasAvx2; vec >= 0; --vec)
+	{
+		_digestAvx2 = vec;
+		++tests_cnt;
+		testNm = (vec == 1) ? "digestToHex avx2" : "digestToHex";
+		for (i = 0; i < 256; i += FILE_HASH_SIZE)
+		{
+			for (j = 0; j < FILE_HASH_SIZE; ++j)
+			{
+				digest[j] = (i + j) & 0xff;
+				sprintf(expect + j * 2, "%02x", digest[j]);
+			}
+			digestToHex(digest, FILE_HASH_SIZE, hex);
+			if (strcmp(hex, expect) != 0)
+			{
+				++errors_cnt;
+				printFailed("encode");
+				break;
+			}
+			if (digestFromHex(hex, FILE_HASH_SIZE, digest2) != EXIT_SUCCESS || memcmp(digest, digest2, FILE_HASH_SIZE) != 0)
+			{
+				++errors_cnt;
+				printFailed("round trip");
+				break;
+			}
+			// A shorter hash is padded by zeros
+			hex[40] = '\0';
+			memset(digest + 20, 0, FILE_HASH_SIZE - 20);
+			if (digestFromHex(hex, 20, digest2) != EXIT_SUCCESS || memcmp(digest, digest2, FILE_HASH_SIZE) != 0)
+			{
+				++errors_cnt;
+				printFailed("short");
+				break;
+			}
+		}
+
+		++tests_cnt;
+		testNm = (vec == 1) ? "digestFromHex avx2" : "digestFromHex";
+		if (digestFromHex("A94A8FE5CCB19BA61C4C0873D391E987982FBBD3", 20, digest) != EXIT_SUCCESS ||
+			memcmp(digest, testHash("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"), FILE_HASH_SIZE) != 0)
+		{
+			++errors_cnt;
+			printFailed("upper case");
+		}
+		static const char badChars[] = "g/:@G`\x80 ";
+		for (i = 0; i < 40; ++i)
+		{
+			for (j = 0; badChars[j] != '\0'; ++j)
+			{
+				strcpy(hex, "a94a8fe5ccb19ba61c4c0873d391e987982fbbd3");
+				hex[i] = badChars[j];
+				if (digestFromHex(hex, 20, digest) != EXIT_FAILURE)
+					break;
+			}
+			if (badChars[j] != '\0')
+			{
+				++errors_cnt;
+				printFailed("invalid char");
+				break;
+			}
+		}
+	}
+	_digestAvx2 = hasAvx2;
+
+	++tests_cnt;
+	testNm = "digestCompare";
+	srand(17);
+	for (i = 0; i < 1000; ++i)
+	{
+		for (j = 0; j < FILE_HASH_SIZE; ++j)
+		{
+			digest[j] = rand() & 0xff;
+			digest2[j] = (rand() % 4 == 0) ? digest[j] ^ (rand() & 0xff) : digest[j];
+		}
+		int cmp = memcmp(digest, digest2, FILE_HASH_SIZE);
+		int res = digestCompare(digest, digest2);
+		if ((cmp < 0) != (res < 0) || (cmp > 0) != (res > 0) || (cmp == 0) != digestIsEqual(digest, digest2))
+		{
+			++errors_cnt;
+			printFailed("order");
+			break;
+		}
+	}
+}
+
+void testSha1()
+{
+	// The FIPS PUB 180-1 vectors for every backend the CPU has, the data of other lengths is
+	// compared with the portable code
+	static const char *backendNames[] = { "generic", "ssse3", "avx2", "sha-ni" };
+	enum SHA1Backend saved = SHA1GetBackend();
+	unsigned char data[1000];
+	unsigned char refs[65][20];
+	unsigned char hash[20];
+	char hex[FILE_HASH_LEN + 1];
+	SHA1_CTX ctx;
+	unsigned int i, b;
+	for (i = 0; i < sizeof(data); ++i)
+		data[i] = (i * 131 + 7) & 0xff;
+	for (b = SHA1BackendGeneric; b <= SHA1BackendShaNi; ++b)
+	{
+		if (!SHA1SetBackend(b))
+			continue;
+		++tests_cnt;
+		testNm = backendNames[b];
+		SHA1Init(&ctx);
+		SHA1Update(&ctx, (const unsigned char *)"abc", 3);
+		SHA1Final(hash, &ctx);
+		digestToHex(hash, 20, hex);
+		if (strcmp(hex, "a9993e364706816aba3e25717850c26c9cd0d89d") != 0)
+		{
+			++errors_cnt;
+			printFailed("abc");
+		}
+		const char *msg = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+		SHA1Init(&ctx);
+		SHA1Update(&ctx, (const unsigned char *)msg, strlen(msg));
+		SHA1Final(hash, &ctx);
+		digestToHex(hash, 20, hex);
+		if (strcmp(hex, "84983e441c3bd26ebaae4aa1f95129e5e54670f1") != 0)
+		{
+			++errors_cnt;
+			printFailed("abcdbcde...");
+		}
+		unsigned char as[1000];
+		memset(as, 'a', sizeof(as));
+		SHA1Init(&ctx);
+		for (i = 0; i <= 1000; ++i)
+			SHA1Update(&ctx, as, (i == 0) ? 1 : (i == 1) ? 999 : 1000); // a piece across the blocks
+		SHA1Final(hash, &ctx);
+		digestToHex(hash, 20, hex);
+		if (strcmp(hex, "34aa973cd4c4daa4f61eeb2bdbad27316534016f") != 0)
+		{
+			++errors_cnt;
+			printFailed("a million of a");
+		}
+		for (i = 0; i <= 64; ++i)
+		{
+			// Lengths around the block borders, the first backend gives the reference
+			unsigned int len = (i < 32) ? i * 3 : 1000 - (64 - i) * 5;
+			SHA1Init(&ctx);
+			SHA1Update(&ctx, data, len / 3);
+			SHA1Update(&ctx, data + len / 3, len - len / 3);
+			SHA1Final(hash, &ctx);
+			if (b == SHA1BackendGeneric)
+				memcpy(refs[i], hash, 20);
+			else if (memcmp(refs[i], hash, 20) != 0)
+			{
+				++errors_cnt;
+				printFailed("lengths");
+				break;
+			}
+		}
+	}
+	SHA1SetBackend(saved);
+}
+
+void testSha1mb()
+{
+	// The lanes are used when the single messages are hashed by the portable code
+	++tests_cnt;
+	testNm = "sha1mbHash";
+	enum SHA1Backend saved = SHA1GetBackend();
+	SHA1SetBackend(SHA1BackendGeneric);
+	enum { jobsCnt = 150 };
+	unsigned char *data = malloc(20000);
+	struct Sha1mbJob *jobs = malloc(sizeof(struct Sha1mbJob) * jobsCnt * 2);
+	unsigned char *digests = malloc(20 * jobsCnt * 2);
+	if (data == NULL || jobs == NULL || digests == NULL)
+	{
+		++errors_cnt;
+		printFailed("malloc");
+	}
+	else
+	{
+		unsigned int i;
+		for (i = 0; i < 20000; ++i)
+			data[i] = (i * 7 + i / 251) & 0xff;
+		for (i = 0; i < jobsCnt; ++i)
+		{
+			// Every length of the padding cases, then the messages of several blocks
+			jobs[i].data   = data + i;
+			jobs[i].len    = (i < 130) ? i : (i * 97) % 19000;
+			jobs[i].digest = digests + i * 20;
+			jobs[jobsCnt + i] = jobs[i];
+			jobs[jobsCnt + i].digest = digests + (jobsCnt + i) * 20;
+		}
+		sha1mbHash(jobs, jobsCnt);
+		sha1mbHashScalar(jobs + jobsCnt, jobsCnt);
+		if (memcmp(digests, digests + jobsCnt * 20, jobsCnt * 20) != 0)
+		{
+			++errors_cnt;
+			printFailed("lanes");
+		}
+		jobs[0].data = (const unsigned char *)"abc";
+		jobs[0].len  = 3;
+		sha1mbHash(jobs, 1);
+		if (memcmp(jobs[0].digest, testHash("a9993e364706816aba3e25717850c26c9cd0d89d"), 20) != 0)
+		{
+			++errors_cnt;
+			printFailed("abc");
+		}
+	}
+	free(data);
+	free(jobs);
+	free(digests);
+	SHA1SetBackend(saved);
+}
+
+void testHashcache()
+{
+	++tests_cnt;
+	testNm = "hashcache";
+	char path[] = "/tmp/tags_test_hc_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd == -1)
+	{
+		++errors_cnt;
+		printFailed("create");
+		return;
+	}
+	close(fd);
+	unlink(path);
+	struct HashCache *cache = hashcacheOpen(path, HashAlgSha1, 0);
+	if (cache != NULL)
+	{
+		++errors_cnt;
+		printFailed("absent");
+		hashcacheFree(cache);
+	}
+	cache = hashcacheOpen(path, HashAlgSha1, 1);
+	if (cache == NULL)
+	{
+		++errors_cnt;
+		printFailed("open");
+		return;
+	}
+	struct HashCacheKey key;
+	memset(&key, 0, sizeof(key));
+	key.dev       = 2049;
+	key.size      = 1000;
+	key.mtimeSec  = 1000000;
+	key.ctimeSec  = 1000000;
+	key.ctimeNsec = 5;
+	unsigned char hash[FILE_HASH_SIZE];
+	unsigned int i;
+	for (i = 1; i <= 3000; ++i)
+	{
+		key.ino = i;
+		memset(hash, i & 0xff, FILE_HASH_SIZE);
+		hashcacheStore(cache, &key, hash);
+	}
+	// A file changed just now is not stored, it could change again within the same timestamp
+	key.ino      = 5000;
+	key.ctimeSec = time(NULL);
+	hashcacheStore(cache, &key, hash);
+	if (hashcacheLookup(cache, &key, hash) || cache->count != 3000)
+	{
+		++errors_cnt;
+		printFailed("racy");
+	}
+	key.ctimeSec = 1000000;
+	// A new hash of the inode replaces the old one
+	key.ino       = 7;
+	key.ctimeNsec = 6;
+	memset(hash, 0xee, FILE_HASH_SIZE);
+	hashcacheStore(cache, &key, hash);
+	if (hashcacheSave(cache) != EXIT_SUCCESS)
+	{
+		++errors_cnt;
+		printFailed("save");
+	}
+	hashcacheFree(cache);
+
+	cache = hashcacheOpen(path, HashAlgSha1, 0);
+	if (cache == NULL || cache->count != 3000)
+	{
+		++errors_cnt;
+		printFailed("reopen");
+	}
+	else
+	{
+		for (i = 1; i <= 3000; ++i)
+		{
+			key.ino       = i;
+			key.ctimeNsec = (i == 7) ? 6 : 5;
+			memset(hash, 0, FILE_HASH_SIZE);
+			if (!hashcacheLookup(cache, &key, hash) || hash[0] != ((i == 7) ? 0xee : (i & 0xff)))
+			{
+				++errors_cnt;
+				printFailed("lookup");
+				break;
+			}
+		}
+		// Any difference of the identity misses
+		key.ino       = 7;
+		key.ctimeNsec = 5;
+		if (hashcacheLookup(cache, &key, hash))
+		{
+			++errors_cnt;
+			printFailed("changed");
+		}
+	}
+	if (cache != NULL)
+		hashcacheFree(cache);
+	// The hashes of another algorithm are not used
+	cache = hashcacheOpen(path, HashAlgXxh128, 0);
+	if (cache == NULL || cache->count != 0)
+	{
+		++errors_cnt;
+		printFailed("other hash");
+	}
+	if (cache != NULL)
+		hashcacheFree(cache);
+
+	// The hashes come from the cache without reading the files
+	++tests_cnt;
+	testNm = "fileitemsCalculateHashes cache";
+	char fpath[] = "/tmp/tags_test_hc_XXXXXX";
+	fd = mkstemp(fpath);
+	struct stat64 st;
+	struct FileItemList *fil = NULL;
+	char *files[] = { fpath };
+	char cwd[PATH_MAX];
+	int res = EXIT_FAILURE;
+	cache = hashcacheOpen(path, HashAlgSha1, 0);
+	if (fd != -1 && write(fd, "abc", 3) == 3 && fstat64(fd, &st) == 0 && cache != NULL &&
+		(fil = fileitemsInitFromList(files, 1, 5, MaskFile)) != NULL &&
+		getcwd(cwd, sizeof(cwd)) != NULL && chdir("/tmp") == 0)
+	{
+		hashcacheMakeKey(&key, &st);
+		memset(hash, 0x5a, FILE_HASH_SIZE);
+		cache->racyTime = key.ctimeSec + 1;
+		hashcacheStore(cache, &key, hash);
+		res = fileitemsCalculateHashes(fil, HashAlgSha1, 2, cache);
+		if (res == EXIT_SUCCESS && memcmp(fil->fileItems[0]->hash, hash, FILE_HASH_SIZE) != 0)
+			res = EXIT_FAILURE;
+		if (chdir(cwd) != 0)
+			res = EXIT_FAILURE;
+	}
+	if (res != EXIT_SUCCESS)
+	{
+		++errors_cnt;
+		printFailed("cached");
+	}
+	if (fil != NULL)
+		fileitemsFree(fil);
+	if (cache != NULL)
+		hashcacheFree(cache);
+	if (fd != -1)
+	{
+		close(fd);
+		unlink(fpath);
+	}
+	unlink(path);
+}
+
+void testHashalg()
+{
+	++tests_cnt;
+	testNm = "hashalgFind";
+	static const char *names[HashAlgCount] = { "sha1", "xxh128", "sha256", "sha1-tree", "xxh128-tree", "sha256-tree" };
+	static const unsigned int sizes[HashAlgCount] = { 20, 16, 32, 20, 16, 32 };
+	enum HashAlg alg;
+	unsigned int i;
+	for (i = 0; i < HashAlgCount; ++i)
+	{
+		if (hashalgFind(names[i], strlen(names[i]), &alg) != EXIT_SUCCESS || alg != i ||
+			strcmp(hashalgName(alg), names[i]) != 0 || hashalgSize(alg) != sizes[i] || hashalgIsTree(alg) != (i >= 3))
+		{
+			++errors_cnt;
+			printFailed(names[i]);
+		}
+	}
+	if (hashalgFind("sha", 3, &alg) != EXIT_FAILURE || hashalgFind("sha1x", 5, &alg) != EXIT_FAILURE ||
+		hashalgFind("sha1x", 4, &alg) != EXIT_SUCCESS || alg != HashAlgSha1)
+	{
+		++errors_cnt;
+		printFailed("length");
+	}
+
+	// The FIPS 180-4 vectors
+	++tests_cnt;
+	testNm = "sha256";
+	struct HashAlgCtx ctx;
+	unsigned char hash[FILE_HASH_SIZE];
+	char hex[FILE_HASH_LEN + 1];
+	static const struct
+	{
+		const char *msg;
+		const char *hex;
+	} shaVectors[] = {
+		{ "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+		{ "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+		{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+			"248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" }
+	};
+	for (i = 0; i < sizeof(shaVectors) / sizeof(shaVectors[0]); ++i)
+	{
+		hashalgInit(&ctx, HashAlgSha256);
+		hashalgUpdate(&ctx, (const unsigned char *)shaVectors[i].msg, strlen(shaVectors[i].msg));
+		hashalgFinal(&ctx, hash);
+		digestToHex(hash, FILE_HASH_SIZE, hex);
+		if (strcmp(hex, shaVectors[i].hex) != 0)
+		{
+			++errors_cnt;
+			printFailed(shaVectors[i].msg);
+		}
+	}
+	unsigned char as[1000];
+	memset(as, 'a', sizeof(as));
+	hashalgInit(&ctx, HashAlgSha256);
+	for (i = 0; i <= 1000; ++i)
+		hashalgUpdate(&ctx, as, (i == 0) ? 1 : (i == 1) ? 999 : 1000);
+	hashalgFinal(&ctx, hash);
+	digestToHex(hash, FILE_HASH_SIZE, hex);
+	if (strcmp(hex, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0") != 0)
+	{
+		++errors_cnt;
+		printFailed("a million of a");
+	}
+
+	// The digests of the reference implementation, the lengths cover every branch of XXH3
+	++tests_cnt;
+	testNm = "xxh128";
+	static const struct
+	{
+		unsigned int len;
+		const char *hex;
+	} xxhVectors[] = {
+		{ 0, "99aa06d3014798d86001c324468d497f" },
+		{ 3, "390cdc5b4a895dd76e3e2670e61106ac" },
+		{ 8, "6a86a3bda6af4e3d61ddbe7f31a6100d" },
+		{ 16, "7f9a218b0425449ae2ce54a7c19c730d" },
+		{ 100, "76b536586de98b82580b061a98a5a9b4" },
+		{ 200, "26d28d07860728f6a4773493fbbe3543" },
+		{ 240, "5293e17bf553903d3f2c53e72293711f" },
+		{ 241, "b53840fe3fedf161956cae592c67279e" },
+		{ 1024, "f69630613f24324d70bd377d9574f4bb" },
+		{ 5000, "61bedb627e4a5fdfe4007929540f095c" }
+	};
+	unsigned char data[5000];
+	for (i = 0; i < sizeof(data); ++i)
+		data[i] = (i * 131 + 7) & 0xff;
+	for (i = 0; i < sizeof(xxhVectors) / sizeof(xxhVectors[0]); ++i)
+	{
+		unsigned int len = xxhVectors[i].len;
+		hashalgInit(&ctx, HashAlgXxh128);
+		hashalgUpdate(&ctx, data, len);
+		hashalgFinal(&ctx, hash);
+		digestToHex(hash, 16, hex);
+		if (strcmp(hex, xxhVectors[i].hex) != 0)
+		{
+			++errors_cnt;
+			printFailed("vectors");
+			break;
+		}
+		// The pieces across the stripes and the blocks give the same digest
+		unsigned char hash2[FILE_HASH_SIZE];
+		unsigned int step = 1 + len / 7, pos;
+		hashalgInit(&ctx, HashAlgXxh128);
+		for (pos = 0; pos < len; pos += step)
+			hashalgUpdate(&ctx, data + pos, (len - pos < step) ? len - pos : step);
+		hashalgFinal(&ctx, hash2);
+		if (memcmp(hash, hash2, FILE_HASH_SIZE) != 0)
+		{
+			++errors_cnt;
+			printFailed("stream");
+			break;
+		}
+	}
+
+	// The shorter digests are padded by zeros
+	++tests_cnt;
+	testNm = "hashalgFinal";
+	for (alg = HashAlgSha1; alg < HashAlgCount; ++alg)
+	{
+		memset(hash, 0xff, FILE_HASH_SIZE);
+		hashalgInit(&ctx, alg);
+		hashalgUpdate(&ctx, data, 100);
+		hashalgFinal(&ctx, hash);
+		for (i = hashalgSize(alg); i < FILE_HASH_SIZE && hash[i] == 0; ++i)
+			;
+		if (i != FILE_HASH_SIZE)
+		{
+			++errors_cnt;
+			printFailed(hashalgName(alg));
+		}
+	}
+
+	// The tree hashes streamed by pieces across the chunks give the digests of the reference tree
+	++tests_cnt;
+	testNm = "hashalg tree";
+	static const size_t treeLens[] = { 0, 1, HASHALG_CHUNK_SIZE - 1, HASHALG_CHUNK_SIZE, HASHALG_CHUNK_SIZE + 1,
+		2 * HASHALG_CHUNK_SIZE, 3 * HASHALG_CHUNK_SIZE + 5, 4 * HASHALG_CHUNK_SIZE, 7 * HASHALG_CHUNK_SIZE - 1 };
+	size_t bigSize = 7 * HASHALG_CHUNK_SIZE;
+	unsigned char *big = malloc(bigSize);
+	if (big == NULL)
+	{
+		++errors_cnt;
+		printFailed("malloc");
+		return;
+	}
+	for (i = 0; i < bigSize; ++i)
+		big[i] = (i * 7 + i / 4099) & 0xff;
+	unsigned char ref[FILE_HASH_SIZE];
+	for (alg = HashAlgSha1Tree; alg <= HashAlgSha256Tree; ++alg)
+	{
+		enum HashAlg base = alg - HashAlgSha1Tree;
+		unsigned int j;
+		for (j = 0; j < sizeof(treeLens) / sizeof(treeLens[0]); ++j)
+		{
+			size_t len = treeLens[j], pos, step = 100003;
+			testTreeHash(base, big, len, ref);
+			hashalgInit(&ctx, alg);
+			for (pos = 0; pos < len; pos += step)
+				hashalgUpdate(&ctx, big + pos, (len - pos < step) ? len - pos : step);
+			hashalgFinal(&ctx, hash);
+			if (memcmp(hash, ref, FILE_HASH_SIZE) != 0)
+			{
+				++errors_cnt;
+				printFailed(hashalgName(alg));
+				break;
+			}
+		}
+	}
+
+	// The chunks read by several threads give the same digest, from the start and from an offset
+	++tests_cnt;
+	testNm = "fileHash tree";
+	char path[] = "/tmp/tags_test_tree_XXXXXX";
+	int fd = mkstemp(path);
+	size_t fileLen = 5 * HASHALG_CHUNK_SIZE + 123;
+	unsigned int savedJobs = hashJobs;
+	if (fd == -1 || write(fd, big, fileLen) != (ssize_t)fileLen)
+	{
+		++errors_cnt;
+		printFailed("create");
+	}
+	else
+	{
+		static const unsigned int jobsList[] = { 1, 2, 4, 16 };
+		for (i = 0; i < sizeof(jobsList) / sizeof(jobsList[0]); ++i)
+		{
+			unsigned int offset = (i % 2 == 0) ? 0 : 1000;
+			hashJobs = jobsList[i];
+			testTreeHash(HashAlgSha1, big + offset, fileLen - offset, ref);
+			if (lseek(fd, offset, SEEK_SET) != offset || fileHash(fd, HashAlgSha1Tree, hash) != EXIT_SUCCESS ||
+				memcmp(hash, ref, FILE_HASH_SIZE) != 0)
+			{
+				++errors_cnt;
+				printFailed("jobs");
+				break;
+			}
+		}
+
+		// The file workers and the helpers share hashJobs, and all of them leave the count
+		++tests_cnt;
+		testNm = "fileitemsCalculateHashes tree";
+		char *files[] = { path };
+		char cwd[PATH_MAX];
+		struct FileItemList *fil = fileitemsInitFromList(files, 1, 5, MaskFile);
+		testTreeHash(HashAlgSha1, big, fileLen, ref);
+		if (fil == NULL || getcwd(cwd, sizeof(cwd)) == NULL || chdir("/tmp") != 0)
+		{
+			++errors_cnt;
+			printFailed("prepare");
+		}
+		else
+		{
+			for (i = 0; i < 3; ++i)
+			{
+				hashJobs = (i == 2) ? 2 : 4;
+				memset(fil->fileItems[0]->hash, 0, FILE_HASH_SIZE);
+				if (fileitemsCalculateHashes(fil, HashAlgSha1Tree, (i == 0) ? 1 : 3, NULL) != EXIT_SUCCESS ||
+					memcmp(fil->fileItems[0]->hash, ref, FILE_HASH_SIZE) != 0 || _hashThreads != 0)
+				{
+					++errors_cnt;
+					printFailed("hash");
+					break;
+				}
+			}
+			if (chdir(cwd) != 0)
+			{
+				++errors_cnt;
+				printFailed("chdir");
+			}
+		}
+		if (fil != NULL)
+			fileitemsFree(fil);
+	}
+	hashJobs = savedJobs;
+	if (fd != -1)
+	{
+		close(fd);
+		unlink(path);
+	}
+	free(big);
+}
+
+unsigned char *testReadFile(const char *path, size_t *size)
+{
+	// The whole file, NULL if it cannot be read
+	FILE *fd = fopen(path, "r");
+	if (fd == NULL)
+		return NULL;
+	unsigned char *data = NULL;
+	struct stat st;
+	if (fstat(fileno(fd), &st) == 0 && (data = malloc(st.st_size + 1)) != NULL && fread(data, 1, st.st_size, fd) != (size_t)st.st_size)
+	{
+		free(data);
+		data = NULL;
+	}
+	if (data != NULL)
+		*size = st.st_size;
+	fclose(fd);
+	return data;
+}
+
+const unsigned char *testHash(const char *hex)
+{
+	// The hashes of the tests are written in hex, the result is valid until the next call
+	static unsigned char hash[FILE_HASH_SIZE];
+	if (digestFromHex(hex, strlen(hex) / 2, hash) != EXIT_SUCCESS)
+		memset(hash, 0, FILE_HASH_SIZE);
+	return hash;
+}
+
+void testTreeHash(enum HashAlg base, const unsigned char *data, size_t len, unsigned char *digest)
+{
+	// The reference tree of the chunks, the left subtree takes the largest power of two of the chunks
+	static const unsigned char leafTag = 0x00;
+	static const unsigned char nodeTag = 0x01;
+	struct HashAlgCtx ctx;
+	hashalgInit(&ctx, base);
+	if (len <= HASHALG_CHUNK_SIZE)
+	{
+		hashalgUpdate(&ctx, &leafTag, 1);
+		hashalgUpdate(&ctx, data, len);
+	}
+	else
+	{
+		unsigned char left[FILE_HASH_SIZE];
+		unsigned char right[FILE_HASH_SIZE];
+		size_t split = HASHALG_CHUNK_SIZE;
+		while (split * 2 < len)
+			split *= 2;
+		testTreeHash(base, data, split, left);
+		testTreeHash(base, data + split, len - split, right);
+		hashalgUpdate(&ctx, &nodeTag, 1);
+		hashalgUpdate(&ctx, left, hashalgSize(base));
+		hashalgUpdate(&ctx, right, hashalgSize(base));
+	}
+	hashalgFinal(&ctx, digest);
+}
+
+void printFailed(const char *descr)
+{
+	fprintf(stderr, "Test \"%s\"", testNm);
+	if (descr != NULL)
+	{
+		fprintf(stderr, ", \t\"");
+		fprintf(stderr, descr);
+		fprintf(stderr, "\"");
+	}
+	fprintf(stderr, " \t\tFAILED\n");
+}
+
+uint32_t invFindId(const struct TagInv *inv, uint64_t offset)
+{
+	uint32_t id;
+	for (id = 0; id < inv->itemCount; ++id)
+		if (inv->items[id] == offset)
+			break;
+	return id;
 }